@@ -122,6 +122,9 @@ extern off_t restart_point;
 
 /* Exported from server_mode.c.  */
 extern int usefamily;
+extern int backlog;
+extern int max_clients;
+extern int max_per_ip;
 extern int server_mode (const char *pidfile, struct sockaddr *phis_addr,
 			socklen_t *phis_addrlen, char *argv[]);
 
@@ -58,6 +58,7 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 
 #include <netinet/in.h>
@@ -93,6 +94,10 @@
 #ifdef HAVE_MMAP
 # include <sys/mman.h>
 #endif
+#if defined HAVE_SENDFILE && defined HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+# define IU_SENDFILE 1
+#endif
 /* Include glob.h last, because it may define "const" which breaks
    system headers on some platforms. */
 #include <glob.h>
@@ -263,6 +268,9 @@ const char doc[] =
 
 enum {
   OPT_NONRFC2577 = CHAR_MAX + 1,
+  OPT_BACKLOG,
+  OPT_MAX_CLIENTS,
+  OPT_MAX_PER_IP,
 };
 
 static struct argp_option options[] = {
@@ -273,6 +281,15 @@ static struct argp_option options[] = {
   { "daemon", 'D', NULL, 0,
     "start the ftpd standalone",
     GRID+1 },
+  { "backlog", OPT_BACKLOG, "N", 0,
+    "queue at most N connections in daemon mode (default 32)",
+    GRID+1 },
+  { "max-clients", OPT_MAX_CLIENTS, "N", 0,
+    "serve at most N sessions at a time in daemon mode",
+    GRID+1 },
+  { "max-per-ip", OPT_MAX_PER_IP, "N", 0,
+    "serve at most N sessions for one client address in daemon mode",
+    GRID+1 },
   { "debug", 'd', NULL, 0,
     "debug mode",
     GRID+1 },
@@ -428,6 +445,26 @@ parse_opt (int key, char *arg, struct argp_state *state)
       rfc2577 = 0;
       break;
 
+    case OPT_BACKLOG:
+    case OPT_MAX_CLIENTS:
+    case OPT_MAX_PER_IP:
+      /* Active in daemon mode only.  */
+      {
+	char *end;
+	long val = strtol (arg, &end, 10);
+
+	if (*arg == '\0' || *end != '\0' || val < 0 || val > INT_MAX
+	    || (key == OPT_BACKLOG && val == 0))
+	  argp_error (state, "invalid number: %s", arg);
+	else if (key == OPT_BACKLOG)
+	  backlog = val;
+	else if (key == OPT_MAX_CLIENTS)
+	  max_clients = val;
+	else
+	  max_per_ip = val;
+	break;
+      }
+
     default:
       return ARGP_ERR_UNKNOWN;
     }
@@ -1309,6 +1346,229 @@ dataconn (const char *name, off_t size, const char *mode)
 }
 
 #define IU_MMAP_SIZE 0x800000	/* 8 MByte */
+#define IU_SEND_CHUNK 0x1000000	/* 16 MByte per sendfile() or splice() */
+
+/* Number of buffers given to writev() at once in ASCII mode.  */
+#if defined IOV_MAX && IOV_MAX < 1024
+# define IU_ASCII_IOV IOV_MAX
+#else
+# define IU_ASCII_IOV 1024
+#endif
+
+/* Write the COUNT buffers of IOV to FD, all of them.  */
+static int
+writev_all (int fd, struct iovec *iov, int count)
+{
+  ssize_t cnt;
+
+  while (count > 0)
+    {
+      cnt = writev (fd, iov, count);
+      if (cnt < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      for (; count > 0 && (size_t) cnt >= iov->iov_len; iov++, count--)
+	cnt -= iov->iov_len;
+      if (count > 0)
+	{
+	  iov->iov_base = (char *) iov->iov_base + cnt;
+	  iov->iov_len -= cnt;
+	}
+    }
+  return 0;
+}
+
+/* Send the LEN bytes at P to FD as ASCII text, with CR LF for each
+   LF.  The lines are found with memchr(), and written straight from
+   P in large writev() batches.  */
+static int
+send_ascii (int fd, const char *p, size_t len)
+{
+  static char crlf[] = "\r\n";
+  struct iovec iov[IU_ASCII_IOV];
+  const char *end = p + len, *nl;
+  int n = 0;
+
+  while (p < end)
+    {
+      nl = memchr (p, '\n', end - p);
+      if (nl == NULL)
+	nl = end;
+      if (nl > p)
+	{
+	  iov[n].iov_base = (char *) p;
+	  iov[n++].iov_len = nl - p;
+	}
+      if (nl < end)
+	{
+	  iov[n].iov_base = crlf;
+	  iov[n++].iov_len = 2;
+	  nl++;
+	}
+      p = nl;
+      if (n > IU_ASCII_IOV - 2)
+	{
+	  if (writev_all (fd, iov, n) < 0)
+	    return -1;
+	  n = 0;
+	}
+    }
+  return writev_all (fd, iov, n);
+}
+
+/* Translate the LEN bytes of ASCII text at P to local lines in OUT,
+   which has room for LEN + 1 bytes.  A CR LF becomes LF and a CR NUL
+   becomes CR.  *CR tells whether the previous block ended in a CR.
+   Returns the length of the result.  */
+static size_t
+receive_ascii (const char *p, size_t len, char *out, int *cr, int *bare_lfs)
+{
+  const char *end = p + len, *q, *nl;
+  char *o = out;
+
+  while (p < end)
+    {
+      if (*cr)
+	{
+	  /* The bytes following a CR are not counted.  */
+	  switch (*p)
+	    {
+	    case '\n':
+	      *o++ = '\n';
+	      *cr = 0;
+	      break;
+
+	    case '\r':
+	      *o++ = '\r';
+	      break;
+
+	    case '\0':
+	      *o++ = '\r';
+	      *cr = 0;
+	      break;
+
+	    default:
+	      *o++ = '\r';
+	      *o++ = *p;
+	      *cr = 0;
+	    }
+	  p++;
+	  continue;
+	}
+
+      /* Copy up to the next CR; any LF on the way is a bare one.  */
+      q = memchr (p, '\r', end - p);
+      if (q == NULL)
+	q = end;
+      for (nl = p; (nl = memchr (nl, '\n', q - nl)); nl++)
+	(*bare_lfs)++;
+      memcpy (o, p, q - p);
+      o += q - p;
+      byte_count += q - p;
+      p = q;
+      if (p < end)
+	{
+	  byte_count++;
+	  *cr = 1;
+	  p++;
+	}
+    }
+  return o - out;
+}
+
+#ifdef IU_SENDFILE
+/* Send the rest of FILEFD to NETFD with sendfile(), which copies
+   within the kernel.  Returns 1 if sendfile() does not support the
+   descriptors, 0 when done, and -1 on error.  */
+static int
+send_data_sendfile (int filefd, int netfd)
+{
+  ssize_t cnt;
+  int sent = 0;
+
+  for (;;)
+    {
+      cnt = sendfile (netfd, filefd, NULL, IU_SEND_CHUNK);
+      if (cnt > 0)
+	{
+	  byte_count += cnt;
+	  sent = 1;
+	}
+      else if (cnt == 0)
+	return 0;
+      else if (errno != EINTR)
+	break;
+    }
+  if (!sent && (errno == EINVAL || errno == ENOSYS))
+    return 1;
+  return -1;
+}
+#endif
+
+#ifdef HAVE_SPLICE
+/* Likewise with splice(), through a pipe.  */
+static int
+send_data_splice (int filefd, int netfd)
+{
+  /* Kept over calls, so that a transfer aborted by longjmp() does not
+     leak the pipe.  */
+  static int pfd[2] = { -1, -1 };
+  ssize_t cnt, out;
+  int sent = 0, ret = 0, err;
+
+  if (pfd[0] >= 0)
+    {
+      close (pfd[0]);
+      close (pfd[1]);
+    }
+  if (pipe (pfd) < 0)
+    {
+      pfd[0] = pfd[1] = -1;
+      return 1;
+    }
+
+  for (;;)
+    {
+      cnt = splice (filefd, NULL, pfd[1], NULL, IU_SEND_CHUNK,
+		    SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (cnt == 0)
+	break;
+      if (cnt < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  ret = (!sent && (errno == EINVAL || errno == ENOSYS)) ? 1 : -1;
+	  break;
+	}
+      sent = 1;
+      while (cnt > 0)
+	{
+	  out = splice (pfd[0], NULL, netfd, NULL, cnt,
+			SPLICE_F_MOVE | SPLICE_F_MORE);
+	  if (out < 0 && errno == EINTR)
+	    continue;
+	  if (out <= 0)
+	    {
+	      ret = -1;
+	      goto done;
+	    }
+	  cnt -= out;
+	  byte_count += out;
+	}
+    }
+
+done:
+  err = errno;
+  close (pfd[0]);
+  close (pfd[1]);
+  pfd[0] = pfd[1] = -1;
+  errno = err;
+  return ret;
+}
+#endif
 
 /* Tranfer the contents of "instr" to "outstr" peer using the appropriate
    encapsulation of the data subject * to Mode, Structure, and Type.
@@ -1317,7 +1577,7 @@ dataconn (const char *name, off_t size, const char *mode)
 static void
 send_data (FILE * instr, FILE * outstr, off_t blksize)
 {
-  int c, cnt, filefd, netfd;
+  int cnt, filefd, netfd;
   char *buf = MAP_FAILED, *bp;
   off_t curpos;
   off_t len, filesize;
@@ -1336,7 +1596,12 @@ send_data (FILE * instr, FILE * outstr, off_t blksize)
    * at least for Solaris and Linux, so use mmap()
    * only with null offset retrievals.
    */
-  if (file_size > 0 && file_size < IU_MMAP_SIZE && restart_point == 0)
+  if (file_size > 0 && file_size < IU_MMAP_SIZE && restart_point == 0
+#if defined IU_SENDFILE || defined HAVE_SPLICE
+      /* Images of regular files are sent from the kernel below.  */
+      && type == TYPE_A
+#endif
+      )
     {
       curpos = lseek (filefd, 0, SEEK_CUR);
       if (debug)
@@ -1359,52 +1624,81 @@ send_data (FILE * instr, FILE * outstr, off_t blksize)
 	{
 	  if (debug)
 	    syslog (LOG_DEBUG, "Reading file as ascii in mmap mode.");
-	  len = 0;
-	  while (len < filesize)
-	    {
-	      byte_count++;
-	      if (buf[len] == '\n')
-		{
-		  if (ferror (outstr))
-		    break;
-		  putc ('\r', outstr);
-		}
-	      putc (buf[len], outstr);
-	      len++;
-	    }
-	  fflush (outstr);
+	  cnt = send_ascii (netfd, buf, filesize);
+	  if (cnt == 0)
+	    byte_count += filesize;
 	  transflag = 0;
 	  munmap (buf, filesize);
-	  if (ferror (outstr))
+	  if (cnt < 0)
 	    goto data_err;
 	  reply (226, "Transfer complete.");
 	  return;
 	}
 #endif
       if (debug)
-	syslog (LOG_DEBUG, "Reading file as ascii in byte mode.");
-      while ((c = getc (instr)) != EOF)
+	syslog (LOG_DEBUG, "Reading file as ascii in block mode.");
+      buf = malloc ((u_int) blksize);
+      if (buf == NULL)
 	{
-	  byte_count++;
-	  if (c == '\n')
+	  transflag = 0;
+	  perror_reply (451, "Local resource failure: malloc");
+	  return;
+	}
+      /* The input is read through INSTR, which may hold data already,
+	 having skipped to a restart point.  */
+      while ((len = fread (buf, 1, blksize, instr)) > 0)
+	{
+	  if (send_ascii (netfd, buf, len) < 0)
 	    {
-	      if (ferror (outstr))
-		goto data_err;
-	      putc ('\r', outstr);
+	      transflag = 0;
+	      free (buf);
+	      goto data_err;
 	    }
-	  putc (c, outstr);
+	  byte_count += len;
 	}
-      fflush (outstr);
       transflag = 0;
+      free (buf);
       if (ferror (instr))
 	goto file_err;
-      if (ferror (outstr))
-	goto data_err;
       reply (226, "Transfer complete.");
       return;
 
     case TYPE_I:
     case TYPE_L:
+#if defined IU_SENDFILE || defined HAVE_SPLICE
+      /* Regular files, from any restart point, are copied to the data
+	 connection by the kernel, when it can.  */
+      if (file_size > 0)
+	{
+	  int ret = 1;
+
+# ifdef IU_SENDFILE
+	  if (debug)
+	    syslog (LOG_DEBUG, "Sending file as image with sendfile.");
+	  ret = send_data_sendfile (filefd, netfd);
+# endif
+# ifdef HAVE_SPLICE
+	  if (ret > 0)
+	    {
+	      if (debug)
+		syslog (LOG_DEBUG, "Sending file as image with splice.");
+	      ret = send_data_splice (filefd, netfd);
+	    }
+# endif
+	  if (ret == 0)
+	    {
+	      transflag = 0;
+	      reply (226, "Transfer complete.");
+	      return;
+	    }
+	  if (ret < 0)
+	    {
+	      if (errno == EIO)
+		goto file_err;
+	      goto data_err;
+	    }
+	}
+#endif
 #ifdef HAVE_MMAP
       if (file_size > 0 && curpos >= 0 && buf != MAP_FAILED)
 	{
@@ -1483,8 +1777,7 @@ file_err:
 static int
 receive_data (FILE * instr, FILE * outstr, off_t blksize)
 {
-  int c;
-  int cnt, bare_lfs = 0;
+  int cnt, bare_lfs = 0, cr = 0;
   char *buf;
 
   transflag++;
@@ -1526,28 +1819,27 @@ receive_data (FILE * instr, FILE * outstr, off_t blksize)
       return -1;
 
     case TYPE_A:
-      while ((c = getc (instr)) != EOF)
+      buf = malloc (2 * (u_int) blksize + 1);
+      if (buf == NULL)
 	{
-	  byte_count++;
-	  if (c == '\n')
-	    bare_lfs++;
-	  while (c == '\r')
-	    {
-	      if (ferror (outstr))
-		goto data_err;
-	      c = getc (instr);
-	      if (c != '\n')
-		{
-		  putc ('\r', outstr);
-		  if (c == '\0' || c == EOF)
-		    goto contin2;
-		}
-	    }
-	  putc (c, outstr);
-	contin2:;
+	  transflag = 0;
+	  perror_reply (451, "Local resource failure: malloc");
+	  return -1;
+	}
+
+      while ((cnt = read (fileno (instr), buf, blksize)) > 0)
+	{
+	  size_t len = receive_ascii (buf, cnt, buf + blksize, &cr, &bare_lfs);
+
+	  if (fwrite (buf + blksize, 1, len, outstr) != len)
+	    break;
 	}
+      /* A CR at the very end stands for itself.  */
+      if (cr)
+	putc ('\r', outstr);
+      free (buf);
       fflush (outstr);
-      if (ferror (instr))
+      if (cnt < 0)
 	goto data_err;
       if (ferror (outstr))
 	goto file_err;
@@ -2215,7 +2507,12 @@ send_file_list (const char *whichf)
 
       while ((dir = readdir (dirp)) != NULL)
 	{
-	  char *nbuf;
+	  /* Kept from one call to the next, which may be left with
+	     a longjmp().  */
+	  static char *nbuf;
+	  static size_t nbufsize;
+	  size_t len;
+	  int regular = 1;
 
 	  if (dir->d_name[0] == '.' && dir->d_name[1] == '\0')
 	    continue;
@@ -2223,12 +2520,32 @@ send_file_list (const char *whichf)
 	      dir->d_name[2] == '\0')
 	    continue;
 
-	  nbuf = alloca (strlen (dirname) + 1 + strlen (dir->d_name) + 1);
+	  len = strlen (dirname) + 1 + strlen (dir->d_name) + 1;
+	  if (len > nbufsize)
+	    {
+	      char *n = realloc (nbuf, len);
+
+	      if (n == NULL)
+		continue;
+	      nbuf = n;
+	      nbufsize = len;
+	    }
 	  sprintf (nbuf, "%s/%s", dirname, dir->d_name);
 
-	  /* We have to do a stat to insure it's
-	     not a directory or special file.  */
-	  if (simple || (stat (nbuf, &st) == 0 && S_ISREG (st.st_mode)))
+	  /* We have to insure it's not a directory or special file.
+	     The directory entry tells, unless it is a symbolic link
+	     or the file system does not know.  */
+	  if (!simple)
+	    {
+#ifdef HAVE_STRUCT_DIRENT_D_TYPE
+	      if (dir->d_type != DT_UNKNOWN && dir->d_type != DT_LNK)
+		regular = dir->d_type == DT_REG;
+	      else
+#endif
+		regular = stat (nbuf, &st) == 0 && S_ISREG (st.st_mode);
+	    }
+
+	  if (regular)
 	    {
 	      if (dout == NULL)
 		{
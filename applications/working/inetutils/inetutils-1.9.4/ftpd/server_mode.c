@@ -32,6 +32,9 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
 
 #ifdef HAVE_TCPD_H
 # include <tcpd.h>
@@ -41,6 +44,24 @@
 #include "unused-parameter.h"
 
 int usefamily = AF_UNSPEC;	/* Address family for daemon.  */
+int backlog = 32;		/* Length of the queue of connections.  */
+int max_clients;		/* Sessions at a time, if not 0.  */
+int max_per_ip;			/* Sessions from one address, if not 0.  */
+
+/* A running session, and the client address it serves, in a form
+   comparable for IPv4 and IPv6 alike.  */
+struct session
+{
+  pid_t pid;
+  unsigned char addr[16];
+};
+
+static struct session *sessions;
+static int nsessions;
+static int sesalloc;
+
+/* The signal handler announces a dead child on this pipe.  */
+static int sigpipe[2] = { -1, -1 };
 
 static void reapchild (int);
 
@@ -100,11 +121,98 @@ reapchild (int signo _GL_UNUSED_PARAMETER)
 {
   int save_errno = errno;
 
-  while (waitpid (-1, NULL, WNOHANG) > 0)
-    ;
+  write (sigpipe[1], "", 1);
   errno = save_errno;
 }
 
+/* Store the address of SA in ADDR, with an IPv4 address mapped to
+   IPv6 alike to a plain one.  */
+static void
+session_addr (struct sockaddr *sa, unsigned char *addr)
+{
+  memset (addr, 0, 16);
+  if (sa->sa_family == AF_INET)
+    memcpy (addr + 12, &((struct sockaddr_in *) sa)->sin_addr, 4);
+  else if (sa->sa_family == AF_INET6)
+    {
+      struct in6_addr *in6 = &((struct sockaddr_in6 *) sa)->sin6_addr;
+
+      if (IN6_IS_ADDR_V4MAPPED (in6))
+	memcpy (addr + 12, in6->s6_addr + 12, 4);
+      else
+	memcpy (addr, in6->s6_addr, 16);
+    }
+}
+
+/* Forget the sessions whose processes have exited.  */
+static void
+session_reap (void)
+{
+  char buf[64];
+  pid_t pid;
+  int i;
+
+  while (read (sigpipe[0], buf, sizeof (buf)) > 0)
+    ;
+  while ((pid = waitpid (-1, NULL, WNOHANG)) > 0)
+    for (i = 0; i < nsessions; i++)
+      if (sessions[i].pid == pid)
+	{
+	  sessions[i] = sessions[--nsessions];
+	  break;
+	}
+}
+
+/* Tell whether a new session from ADDR would exceed a limit, and
+   refuse it with a reply.  */
+static int
+session_refuse (int fd, const unsigned char *addr)
+{
+  static const char full[] =
+    "421 Service not available, too many users.\r\n";
+  static const char busy[] =
+    "421 Too many connections from your address.\r\n";
+  const char *msg = NULL;
+  int i, n = 0;
+
+  if (max_clients && nsessions >= max_clients)
+    msg = full;
+  else if (max_per_ip)
+    {
+      for (i = 0; i < nsessions; i++)
+	if (memcmp (sessions[i].addr, addr, 16) == 0)
+	  n++;
+      if (n >= max_per_ip)
+	msg = busy;
+    }
+  if (msg == NULL)
+    return 0;
+
+  /* The reply fits in any socket buffer, so never wait for it.  */
+  send (fd, msg, strlen (msg), MSG_DONTWAIT);
+  return 1;
+}
+
+/* Record the session of process PID, serving ADDR.  */
+static void
+session_add (pid_t pid, const unsigned char *addr)
+{
+  if (nsessions == sesalloc)
+    {
+      struct session *p;
+      int n = sesalloc ? 2 * sesalloc : 64;
+
+      p = realloc (sessions, n * sizeof (*p));
+      if (p == NULL)
+	return;			/* Only the limits suffer.  */
+      sessions = p;
+      sesalloc = n;
+    }
+  sessions[nsessions].pid = pid;
+  memcpy (sessions[nsessions].addr, addr, 16);
+  nsessions++;
+}
+
 /* The parameter '*phis_addrlen' must be initiated
    with the space available at calling time.
    The size of used space will then be returned.
@@ -113,12 +221,15 @@ int
 server_mode (const char *pidfile, struct sockaddr *phis_addr,
 	     socklen_t *phis_addrlen, char *argv[])
 {
-  int ctl_sock, fd;
+  int ctl_sock, fd = -1;
   struct servent *sv;
   int port, err;
   char portstr[8];
   socklen_t saved_addrlen = *phis_addrlen;
   struct addrinfo hints, *res, *ai;
+  struct pollfd pfd[2];
+  unsigned char addr[16];
+  pid_t pid;
 
   /* Become a daemon.  */
   if (daemon (1, 1) < 0)
@@ -126,6 +237,14 @@ server_mode (const char *pidfile, struct sockaddr *phis_addr,
       syslog (LOG_ERR, "failed to become a daemon");
       return -1;
     }
+
+  if (pipe (sigpipe) < 0)
+    {
+      syslog (LOG_ERR, "pipe: %m");
+      return -1;
+    }
+  fcntl (sigpipe[0], F_SETFL, O_NONBLOCK);
+  fcntl (sigpipe[1], F_SETFL, O_NONBLOCK);
   signal (SIGCHLD, reapchild);
 
   /* Get port for ftp/tcp.  */
@@ -181,7 +300,7 @@ server_mode (const char *pidfile, struct sockaddr *phis_addr,
 	  continue;
 	}
 
-      if (listen (ctl_sock, 32) < 0)
+      if (listen (ctl_sock, backlog) < 0)
 	{
 	  close (ctl_sock);
 	  ctl_sock = -1;
@@ -215,19 +334,70 @@ server_mode (const char *pidfile, struct sockaddr *phis_addr,
   }
 
   /* Loop forever accepting connection requests and forking off
-     children to handle them.  */
-  while (1)
+     children to handle them.  The listener is drained on every
+     wakeup, so that a burst of clients is taken in at once, and
+     clients beyond the limits are turned away without a fork.  */
+  fcntl (ctl_sock, F_SETFL, O_NONBLOCK);
+  pfd[0].fd = ctl_sock;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = sigpipe[0];
+  pfd[1].events = POLLIN;
+
+  while (fd < 0)
     {
-      *phis_addrlen = saved_addrlen;
-      fd = accept (ctl_sock, phis_addr, phis_addrlen);
-      if (fork () == 0)		/* child */
+      if (poll (pfd, 2, -1) < 0)
 	{
-	  dup2 (fd, 0);
-	  dup2 (fd, 1);
-	  close (ctl_sock);
-	  break;
+	  if (errno != EINTR)
+	    syslog (LOG_ERR, "poll: %m");
+	  continue;
+	}
+      if (pfd[1].revents)
+	session_reap ();
+      if (!pfd[0].revents)
+	continue;
+
+      for (;;)
+	{
+	  *phis_addrlen = saved_addrlen;
+	  fd = accept (ctl_sock, phis_addr, phis_addrlen);
+	  if (fd < 0)
+	    {
+	      if (errno != EAGAIN && errno != EWOULDBLOCK
+		  && errno != EINTR && errno != ECONNABORTED)
+		syslog (LOG_ERR, "accept: %m");
+	      break;
+	    }
+
+	  session_addr (phis_addr, addr);
+	  if (session_refuse (fd, addr))
+	    {
+	      char host[INET6_ADDRSTRLEN];
+
+	      getnameinfo (phis_addr, *phis_addrlen, host, sizeof (host),
+			   NULL, 0, NI_NUMERICHOST);
+	      syslog (LOG_NOTICE, "refused connection from %s", host);
+	      close (fd);
+	      continue;
+	    }
+
+	  pid = fork ();
+	  if (pid == 0)		/* child */
+	    {
+	      signal (SIGCHLD, SIG_DFL);
+	      close (sigpipe[0]);
+	      close (sigpipe[1]);
+	      fcntl (fd, F_SETFL, 0);
+	      dup2 (fd, 0);
+	      dup2 (fd, 1);
+	      close (ctl_sock);
+	      break;
+	    }
+	  if (pid < 0)
+	    syslog (LOG_ERR, "fork: %m");
+	  else
+	    session_add (pid, addr);
+	  close (fd);
 	}
-      close (fd);
     }
 
 #ifdef WITH_WRAP
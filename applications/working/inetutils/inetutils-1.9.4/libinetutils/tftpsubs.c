@@ -70,32 +70,37 @@
 #include <arpa/tftp.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include "tftpsubs.h"
+#include "xalloc.h"
 
 /* Some systems define PKTSIZE in <arpa/tftp.h>.  */
 #ifndef PKTSIZE
 #define PKTSIZE SEGSIZE+4	/* should be moved to tftp.h */
 #endif
 
+/* Size of the data in a full packet, as negotiated with the
+   option `blksize'.  */
+int segsize = SEGSIZE;
+
 struct bf
 {
   int counter;			/* size of data in buffer, or flag */
-  char buf[PKTSIZE];		/* room for data packet */
+  char *buf;			/* room for data packet */
+  int size;			/* data that fits in BUF */
 } bfs[2];
 
 				/* Values for bf.counter  */
 #define BF_ALLOC -3		/* alloc'd but not yet filled */
 #define BF_FREE  -2		/* free */
-/* [-1 .. SEGSIZE] = size of data in the data buffer */
+/* [-1 .. segsize] = size of data in the data buffer */
 
 static int nextone;		/* index of next buffer to use */
 static int current;		/* index of buffer in use */
 
-				/* control flags for crlf conversions */
-int newline = 0;		/* fillbuf: in middle of newline expansion */
-int prevchar = -1;		/* putbuf: previous char (cr check) */
+static struct tftpconv conv;	/* control flags for crlf conversions */
 
 static struct tftphdr *rw_init (int);
 
@@ -115,8 +120,19 @@ r_init (void)
 static struct tftphdr *
 rw_init (int x)
 {
-  newline = 0;			/* init crlf flag */
-  prevchar = -1;
+  int i;
+
+  /* Make room for packets of the current size.  */
+  for (i = 0; i < 2; i++)
+    if (bfs[i].size < segsize)
+      {
+	free (bfs[i].buf);
+	bfs[i].buf = xmalloc (segsize + 4);
+	bfs[i].size = segsize;
+      }
+
+  conv.newline = 0;		/* init crlf flag */
+  conv.prevchar = -1;
   bfs[0].counter = BF_ALLOC;	/* pass out the first buffer */
   current = 0;
   bfs[1].counter = BF_FREE;
@@ -155,9 +171,6 @@ readit (FILE * file, struct tftphdr **dpp, int convert)
 void
 read_ahead (FILE * file, int convert)
 {
-  register int i;
-  register char *p;
-  register int c;
   struct bf *b;
   struct tftphdr *dp;
 
@@ -167,23 +180,33 @@ read_ahead (FILE * file, int convert)
   nextone = !nextone;		/* "incr" next buffer ptr */
 
   dp = (struct tftphdr *) b->buf;
+  b->counter = readblock (file, dp->th_data, segsize, convert, &conv);
+}
+
+/* Read up to SIZE bytes of FILE into BUF, converted to netascii if
+   CONVERT, with the conversion state of the transfer in CV.  Returns
+   the number of bytes read, or -1 on a read error.  */
+int
+readblock (FILE * file, char *buf, int size, int convert,
+	   struct tftpconv *cv)
+{
+  register int i;
+  register char *p;
+  register int c;
 
   if (convert == 0)
-    {
-      b->counter = read (fileno (file), dp->th_data, SEGSIZE);
-      return;
-    }
+    return read (fileno (file), buf, size);
 
-  p = dp->th_data;
-  for (i = 0; i < SEGSIZE; i++)
+  p = buf;
+  for (i = 0; i < size; i++)
     {
-      if (newline)
+      if (cv->newline)
 	{
-	  if (prevchar == '\n')
+	  if (cv->prevchar == '\n')
 	    c = '\n';		/* lf to cr,lf */
 	  else
 	    c = '\0';		/* cr to cr,nul */
-	  newline = 0;
+	  cv->newline = 0;
 	}
       else
 	{
@@ -192,14 +215,14 @@ read_ahead (FILE * file, int convert)
 	    break;
 	  if (c == '\n' || c == '\r')
 	    {
-	      prevchar = c;
+	      cv->prevchar = c;
 	      c = '\r';
-	      newline = 1;
+	      cv->newline = 1;
 	    }
 	}
       *p++ = c;
     }
-  b->counter = (int) (p - dp->th_data);
+  return (int) (p - buf);
 }
 
 /* Update count associated with the buffer, get new buffer
@@ -229,9 +252,6 @@ write_behind (FILE * file, int convert)
 {
   char *buf;
   int count;
-  register int ct;
-  register char *p;
-  register int c;		/* current character */
   struct bf *b;
   struct tftphdr *dp;
 
@@ -248,6 +268,19 @@ write_behind (FILE * file, int convert)
   if (count <= 0)
     return -1;			/* nak logic? */
 
+  return writeblock (file, buf, count, convert, &conv);
+}
+
+/* Write the COUNT bytes at BUF to FILE, converted from netascii if
+   CONVERT, with the conversion state of the transfer in CV.  */
+int
+writeblock (FILE * file, const char *buf, int count, int convert,
+	    struct tftpconv *cv)
+{
+  register int ct;
+  register const char *p;
+  register int c;		/* current character */
+
   if (convert == 0)
     return write (fileno (file), buf, count);
 
@@ -256,7 +289,7 @@ write_behind (FILE * file, int convert)
   while (ct--)
     {				/* loop over the buffer */
       c = *p++;			/* pick up a character */
-      if (prevchar == '\r')
+      if (cv->prevchar == '\r')
 	{			/* if prev char was cr */
 	  if (c == '\n')	/* if have cr,lf then just */
 	    fseeko (file, -1, 1);	/* smash lf on top of the cr */
@@ -266,7 +299,7 @@ write_behind (FILE * file, int convert)
 	}
       putc (c, file);
     skipit:
-      prevchar = c;
+      cv->prevchar = c;
     }
   return count;
 }
@@ -47,6 +47,29 @@
  * SUCH DAMAGE.
  */
 
+/* Option acknowledgement and its error code, from RFC 2347, which
+   older versions of <arpa/tftp.h> lack.  */
+#ifndef OACK
+# define OACK	06
+#endif
+#ifndef EOPTNEG
+# define EOPTNEG	8
+#endif
+
+/* Limits of the options `blksize' and `windowsize'.  */
+#define MINBLKSIZE	8
+#define MAXBLKSIZE	65464
+#define MAXWINDOWSIZE	65535
+
+extern int segsize;
+
+/* State of the netascii conversion of a transfer.  */
+struct tftpconv
+{
+  int newline;			/* in middle of newline expansion */
+  int prevchar;			/* previous char (cr check) */
+};
+
 /*
  * Prototypes for read-ahead/write-behind subroutines for tftp user and
  * server.
@@ -60,3 +83,7 @@ int synchnet (int);
 struct tftphdr *w_init (void);
 int write_behind (FILE *, int);
 int writeit (FILE *, struct tftphdr **, int, int);
+
+/* Block transfers with the netascii state kept in a struct tftpconv.  */
+int readblock (FILE *, char *, int, int, struct tftpconv *);
+int writeblock (FILE *, const char *, int, int, struct tftpconv *);
@@ -114,6 +114,54 @@ int f_whiteout;			/* show whiteout entries */
 
 int rval;
 
+/* Names of owners and groups met last.  Looking up a name may well
+   read the whole password or group file, and the entries of a
+   directory mostly share a few owners.  */
+#define NAMECACHE 64
+
+struct namecache
+{
+  int valid;
+  unsigned long id;
+  char *name;			/* NULL if the id has no name.  */
+};
+
+static struct namecache users[NAMECACHE], groups[NAMECACHE];
+
+static char *
+user_name (uid_t uid)
+{
+  struct namecache *c = &users[uid % NAMECACHE];
+
+  if (!c->valid || c->id != uid)
+    {
+      struct passwd *pwd = getpwuid (uid);
+
+      free (c->name);
+      c->name = pwd ? strdup (pwd->pw_name) : NULL;
+      c->id = uid;
+      c->valid = 1;
+    }
+  return c->name;
+}
+
+static char *
+group_name (gid_t gid)
+{
+  struct namecache *c = &groups[gid % NAMECACHE];
+
+  if (!c->valid || c->id != gid)
+    {
+      struct group *grp = getgrgid (gid);
+
+      free (c->name);
+      c->name = grp ? strdup (grp->gr_name) : NULL;
+      c->id = gid;
+      c->valid = 1;
+    }
+  return c->name;
+}
+
 int
 ls_main (int argc, char **argv)
 {
@@ -518,19 +566,12 @@ display (FTSENT *p, FTSENT *list)
 	  btotal += sp->st_blocks;
 	  if (f_longform)
 	    {
-	      struct passwd *pwd;
-	      struct group *grp;
-
 	      user = group = NULL;
 
 	      if (!f_numericonly)
 		{
-		  pwd = getpwuid (sp->st_uid);
-		  if (pwd)
-		    user = pwd->pw_name;
-		  grp = getgrgid (sp->st_gid);
-		  if (grp)
-		    group = grp->gr_name;
+		  user = user_name (sp->st_uid);
+		  group = group_name (sp->st_gid);
 		}
 	      if (!user)
 		user = umaxtostr (sp->st_uid, nuser);
@@ -265,30 +265,41 @@ printaname (FTSENT *p, unsigned long inodefield, unsigned long sizefield)
   return (chcnt);
 }
 
+/* Print FTIME in the manner of ctime(), without the week day.  The
+   fields are formatted here, since ctime() may look at the time zone
+   files again for every call.  */
 static void
 printtime (time_t ftime)
 {
-  int i;
-  char *longstring;
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  static time_t now;
+  struct tm *tm;
+#ifdef HAVE_LOCALTIME_R
+  struct tm tmbuf;
+
+  tm = localtime_r (&ftime, &tmbuf);
+#else
+  tm = localtime (&ftime);
+#endif
+  if (tm == NULL)
+    {
+      printf ("%-12ld ", (long) ftime);
+      return;
+    }
 
-  longstring = ctime (&ftime);
-  for (i = 4; i < 11; ++i)
-    putchar (longstring[i]);
+  printf ("%.3s %2d ", months + 3 * tm->tm_mon, tm->tm_mday);
+
+  if (now == 0)
+    now = time (NULL);
 
 #define SIXMONTHS	((DAYSPERNYEAR / 2) * SECSPERDAY)
   if (f_sectime)
-    for (i = 11; i < 24; i++)
-      putchar (longstring[i]);
-  else if (ftime + SIXMONTHS > time (NULL))
-    for (i = 11; i < 16; ++i)
-      putchar (longstring[i]);
+    printf ("%02d:%02d:%02d %d ", tm->tm_hour, tm->tm_min, tm->tm_sec,
+	    tm->tm_year + 1900);
+  else if (ftime + SIXMONTHS > now)
+    printf ("%02d:%02d ", tm->tm_hour, tm->tm_min);
   else
-    {
-      putchar (' ');
-      for (i = 20; i < 24; ++i)
-	putchar (longstring[i]);
-    }
-  putchar (' ');
+    printf (" %d ", tm->tm_year + 1900);
 }
 
 void
@@ -76,6 +76,8 @@ ping_init (int type, int ident)
       return NULL;
     }
 
+  ping_set_timestamps (fd);
+
   /* Allocate PING structure and initialize it to default values */
   p = malloc (sizeof (*p));
   if (!p)
@@ -93,7 +95,6 @@ ping_init (int type, int ident)
   p->ping_datalen = sizeof (icmphdr_t);
   /* Make sure we use only 16 bits in this field, id for icmp is a unsigned short.  */
   p->ping_ident = ident & 0xFFFF;
-  p->ping_cktab_size = PING_CKTABSIZE;
   gettimeofday (&p->ping_start_time, NULL);
   return p;
 }
@@ -112,42 +113,46 @@ ping_set_type (PING * p, int type)
   p->ping_type = type;
 }
 
-int
-ping_xmit (PING * p)
+/* Encode in BUF, of BUFLEN bytes, the ICMP header of the request
+   with sequence number SEQ.  */
+static void
+_ping_encode (PING * p, unsigned char *buf, int buflen, size_t seq)
 {
-  int i, buflen;
-
-  if (_ping_setbuf (p, USE_IPV6))
-    return -1;
-
-  buflen = _ping_packetsize (p);
-
   /* Mark sequence number as sent */
-  _PING_CLR (p, p->ping_num_xmit);
+  _PING_CLR (p, seq);
 
-  /* Encode ICMP header */
   switch (p->ping_type)
     {
     case ICMP_ECHO:
-      icmp_echo_encode (p->ping_buffer, buflen, p->ping_ident,
-			p->ping_num_xmit);
+      icmp_echo_encode (buf, buflen, p->ping_ident, seq);
       break;
 
     case ICMP_TIMESTAMP:
-      icmp_timestamp_encode (p->ping_buffer, buflen, p->ping_ident,
-			     p->ping_num_xmit);
+      icmp_timestamp_encode (buf, buflen, p->ping_ident, seq);
       break;
 
     case ICMP_ADDRESS:
-      icmp_address_encode (p->ping_buffer, buflen, p->ping_ident,
-			   p->ping_num_xmit);
+      icmp_address_encode (buf, buflen, p->ping_ident, seq);
       break;
 
     default:
-      icmp_generic_encode (p->ping_buffer, buflen, p->ping_type,
-			   p->ping_ident, p->ping_num_xmit);
+      icmp_generic_encode (buf, buflen, p->ping_type, p->ping_ident, seq);
       break;
     }
+}
+
+int
+ping_xmit (PING * p)
+{
+  int i, buflen;
+
+  if (_ping_setbuf (p, USE_IPV6))
+    return -1;
+
+  buflen = _ping_packetsize (p);
+
+  /* Encode ICMP header */
+  _ping_encode (p, p->ping_buffer, buflen, p->ping_num_xmit);
 
   i = sendto (p->ping_fd, (char *) p->ping_buffer, buflen, 0,
 	      (struct sockaddr *) &p->ping_dest.ping_sockaddr, sizeof (struct sockaddr_in));
@@ -163,13 +168,77 @@ ping_xmit (PING * p)
   return 0;
 }
 
+/* Send N requests, with the data now in the buffer and sequence
+   numbers following each other, in one system call where sendmmsg
+   is available.  Returns the number sent, at most PING_BATCH, or -1
+   if none could be.  */
+int
+ping_xmit_batch (PING * p, size_t n)
+{
+#ifdef HAVE_SENDMMSG
+  struct mmsghdr msgs[PING_BATCH];
+  struct iovec iov[PING_BATCH];
+  int buflen, rc;
+  size_t i;
+
+  if (n > PING_BATCH)
+    n = PING_BATCH;
+  if (n < 2)
+    return ping_xmit (p) < 0 ? -1 : 1;
+
+  buflen = _ping_packetsize (p);
+  if (!p->ping_batch)
+    {
+      p->ping_batch = malloc (PING_BATCH * buflen);
+      if (!p->ping_batch)
+	return -1;
+    }
+
+  memset (msgs, 0, sizeof (msgs));
+  for (i = 0; i < n; i++)
+    {
+      unsigned char *buf = p->ping_batch + i * buflen;
+
+      memcpy (buf, p->ping_buffer, buflen);
+      _ping_encode (p, buf, buflen, p->ping_num_xmit + i);
+      iov[i].iov_base = buf;
+      iov[i].iov_len = buflen;
+      msgs[i].msg_hdr.msg_name = &p->ping_dest.ping_sockaddr;
+      msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+  rc = sendmmsg (p->ping_fd, msgs, n, 0);
+  if (rc <= 0)
+    return -1;
+  p->ping_num_xmit += rc;
+  for (i = 0; i < (size_t) rc; i++)
+    if (msgs[i].msg_len != (unsigned) buflen)
+      printf ("ping: wrote %s %d chars, ret=%u\n",
+	      p->ping_hostname, buflen, msgs[i].msg_len);
+  return rc;
+#else
+  size_t i;
+
+  if (n > PING_BATCH)
+    n = PING_BATCH;
+  for (i = 0; i < n; i++)
+    if (ping_xmit (p) < 0)
+      break;
+  return i ? (int) i : -1;
+#endif
+}
+
 static int
 my_echo_reply (PING * p, icmphdr_t * icmp)
 {
   struct ip *orig_ip = &icmp->icmp_ip;
   icmphdr_t *orig_icmp = (icmphdr_t *) (orig_ip + 1);
 
-  return (orig_ip->ip_dst.s_addr == p->ping_dest.ping_sockaddr.sin_addr.s_addr
+  return ((p->ping_anydest
+	   || (orig_ip->ip_dst.s_addr
+	       == p->ping_dest.ping_sockaddr.sin_addr.s_addr))
 	  && orig_ip->ip_p == IPPROTO_ICMP
 	  && orig_icmp->icmp_type == ICMP_ECHO
 	  && ntohs (orig_icmp->icmp_id) == p->ping_ident);
@@ -178,17 +247,28 @@ my_echo_reply (PING * p, icmphdr_t * icmp)
 int
 ping_recv (PING * p)
 {
-  socklen_t fromlen = sizeof (p->ping_from.ping_sockaddr);
   int n, rc;
   icmphdr_t *icmp;
   struct ip *ip;
   int dupflag;
-
-  n = recvfrom (p->ping_fd,
-		(char *) p->ping_buffer, _PING_BUFLEN (p, USE_IPV6), 0,
-		(struct sockaddr *) &p->ping_from.ping_sockaddr, &fromlen);
+  struct msghdr msg;
+  struct iovec iov;
+  char cmsg_data[256];
+
+  iov.iov_base = p->ping_buffer;
+  iov.iov_len = _PING_BUFLEN (p, USE_IPV6);
+  msg.msg_name = &p->ping_from.ping_sockaddr;
+  msg.msg_namelen = sizeof (p->ping_from.ping_sockaddr);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsg_data;
+  msg.msg_controllen = sizeof (cmsg_data);
+  msg.msg_flags = 0;
+
+  n = recvmsg (p->ping_fd, &msg, MSG_DONTWAIT);
   if (n < 0)
     return -1;
+  ping_recv_time (&msg, &p->ping_recv_time);
 
   rc = icmp_generic_decode (p->ping_buffer, n, &ip, &icmp);
   if (rc < 0)
@@ -213,17 +293,20 @@ ping_recv (PING * p)
 	fprintf (stderr, "checksum mismatch from %s\n",
 		 inet_ntoa (p->ping_from.ping_sockaddr.sin_addr));
 
-      p->ping_num_recv++;
-      if (_PING_TST (p, ntohs (icmp->icmp_seq)))
+      switch (ping_window_mark (p, ntohs (icmp->icmp_seq)))
 	{
+	case PEV_RESPONSE:
+	  p->ping_num_recv++;
+	  dupflag = 0;
+	  break;
+
+	case PEV_DUPLICATE:
 	  p->ping_num_rept++;
-	  p->ping_num_recv--;
 	  dupflag = 1;
-	}
-      else
-	{
-	  _PING_SET (p, ntohs (icmp->icmp_seq));
-	  dupflag = 0;
+	  break;
+
+	default:
+	  return -1;		/* Too late, the request is lost.  */
 	}
 
       if (p->ping_event.handler)
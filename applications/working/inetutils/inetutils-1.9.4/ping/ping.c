@@ -57,6 +57,7 @@ extern int ping_echo (char *hostname);
 extern int ping_timestamp (char *hostname);
 extern int ping_address (char *hostname);
 extern int ping_router (char *hostname);
+extern int ping_multi (char **hosts, int nhosts, const char *file);
 
 PING *ping;
 bool is_root = false;
@@ -75,12 +76,12 @@ int ttl = 0;
 int timeout = -1;
 int linger = MAXWAIT;
 int (*ping_type) (char *hostname) = ping_echo;
+bool multi = false;		/* Probe all hosts at once.  */
+char *hosts_file;		/* Read more hosts to probe from it.  */
 
 int (*decode_type (const char *arg)) (char *hostname);
 static int decode_ip_timestamp (char *arg);
-static int send_echo (PING * ping);
-
-#define MIN_USER_INTERVAL (200000/PING_PRECISION)
+static size_t send_echo (PING * ping, size_t n);
 
 const char args_doc[] = "HOST ...";
 const char doc[] = "Send ICMP ECHO_REQUEST packets to network hosts."
@@ -99,6 +100,8 @@ enum {
   ARG_ROUTERDISCOVERY,
   ARG_TTL,
   ARG_IPTIMESTAMP,
+  ARG_MULTI,
+  ARG_HOSTS_FILE,
 };
 
 static struct argp_option argp_options[] = {
@@ -141,6 +144,11 @@ static struct argp_option argp_options[] = {
   {"ip-timestamp", ARG_IPTIMESTAMP, "FLAG", 0, "IP timestamp of type FLAG, "
    "which is one of \"tsonly\" and \"tsaddr\"", GRP+1},
   {"size", 's', "NUMBER", 0, "send NUMBER data octets", GRP+1},
+  {"multi", ARG_MULTI, NULL, 0, "ping all HOSTs at once, and print "
+   "their statistics one line each", GRP+1},
+  {"hosts-file", ARG_HOSTS_FILE, "FILE", 0, "ping the hosts listed in "
+   "FILE as well, or in standard input if FILE is -; implies --multi",
+   GRP+1},
 #undef GRP
   {NULL, 0, NULL, 0, NULL, 0}
 };
@@ -252,8 +260,19 @@ parse_opt (int key, char *arg, struct argp_state *state)
       suboptions |= decode_ip_timestamp (arg);
       break;
 
+    case ARG_MULTI:
+      multi = true;
+      break;
+
+    case ARG_HOSTS_FILE:
+      multi = true;
+      hosts_file = arg;
+      break;
+
     case ARGP_KEY_NO_ARGS:
-      argp_error (state, "missing host operand");
+      if (!hosts_file)
+	argp_error (state, "missing host operand");
+      break;
 
     default:
       return ARGP_ERR_UNKNOWN;
@@ -322,11 +341,18 @@ main (int argc, char **argv)
 
   init_data_buffer (patptr, pattern_len);
 
-  while (argc--)
+  if (multi)
     {
-      status |= (*(ping_type)) (*argv++);
-      ping_reset (ping);
+      if (ping_type != ping_echo)
+	error (EXIT_FAILURE, 0, "--multi is only available with --echo");
+      status = ping_multi (argv, argc, hosts_file);
     }
+  else
+    while (argc--)
+      {
+	status |= (*(ping_type)) (*argv++);
+	ping_reset (ping);
+      }
 
   free (ping);
   free (data_buffer);
@@ -385,80 +411,90 @@ sig_int (int signal _GL_UNUSED_PARAMETER)
 int
 ping_run (PING * ping, int (*finish) ())
 {
-  fd_set fdset;
-  int fdmax;
-  struct timeval resp_time;
-  struct timeval last, intvl, now;
-  struct timeval *t = NULL;
+  struct ping_timer timer;
+  long long intvl, now, until, deadline = 0;
   int finishing = 0;
   size_t nresp = 0;
-  size_t i;
+  size_t i, n;
 
   signal (SIGINT, sig_int);
 
-  fdmax = ping->ping_fd + 1;
+  for (i = 0; i < preload; i += send_echo (ping, preload - i))
+    ;
 
-  /* Some systems use `struct timeval' of size 16.  As these are
-   * not initialising `timeval' properly by assignment alone, let
-   * us play safely here.  gettimeofday() is always sufficient.
-   */
-  memset (&resp_time, 0, sizeof (resp_time));
-  memset (&intvl, 0, sizeof (intvl));
-  memset (&now, 0, sizeof (now));
-
-  for (i = 0; i < preload; i++)
-    send_echo (ping);
+  if (options & OPT_FLOOD && !(options & OPT_INTERVAL))
+    intvl = 10000000;		/* 10 ms */
+  else
+    intvl = ping->ping_interval * (1000000000LL / PING_PRECISION);
 
-  if (options & OPT_FLOOD)
+  /* Room for the replies that come in bursts at high rates.  */
+  if (intvl < 1000000)
     {
-      intvl.tv_sec = 0;
-      intvl.tv_usec = 10000;
+      int size = PING_RCVBUF;
+
+      setsockopt (ping->ping_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
     }
-  else
-    PING_SET_INTERVAL (intvl, ping->ping_interval);
 
-  gettimeofday (&last, NULL);
-  send_echo (ping);
+  ping_timer_start (&timer, intvl, is_root ? PING_BATCH : 1);
 
   while (!stop)
     {
-      int n;
-
-      FD_ZERO (&fdset);
-      FD_SET (ping->ping_fd, &fdset);
-      gettimeofday (&now, NULL);
-      resp_time.tv_sec = last.tv_sec + intvl.tv_sec - now.tv_sec;
-      resp_time.tv_usec = last.tv_usec + intvl.tv_usec - now.tv_usec;
+      int rc;
 
-      while (resp_time.tv_usec < 0)
+      now = ping_clock ();
+      if (finishing)
 	{
-	  resp_time.tv_usec += 1000000;
-	  resp_time.tv_sec--;
+	  if (now >= deadline)
+	    break;
+	  until = deadline;
 	}
-      while (resp_time.tv_usec >= 1000000)
+      else if ((n = ping_timer_due (&timer, now)) > 0)
 	{
-	  resp_time.tv_usec -= 1000000;
-	  resp_time.tv_sec++;
-	}
+	  /* Send the requests that are due, all at once if late.  */
+	  if (ping->ping_count)
+	    n = MIN (n, ping->ping_count - ping->ping_num_xmit);
+	  if (n == 0)
+	    {
+	      /* Wait for the replies still to come.  */
+	      finishing = 1;
+	      deadline = now + linger * 1000000000LL;
+	      ping_timer_stop (&timer);
+	      continue;
+	    }
 
-      if (resp_time.tv_sec < 0)
-	resp_time.tv_sec = resp_time.tv_usec = 0;
+	  n = send_echo (ping, n);
+	  timer.pt_sent += n;
+	  if (!(options & OPT_QUIET) && options & OPT_FLOOD)
+	    for (i = 0; i < n; i++)
+	      putchar ('.');
 
-      n = select (fdmax, &fdset, NULL, NULL, &resp_time);
-      if (n < 0)
+	  if (ping_timeout_p (&ping->ping_start_time, timeout))
+	    break;
+	  continue;
+	}
+      else
+	until = ping_timer_next (&timer);
+
+      rc = ping_timer_wait (&timer, ping->ping_fd, until);
+      if (rc < 0)
 	{
 	  if (errno != EINTR)
 	    error (EXIT_FAILURE, errno, "select failed");
 	  continue;
 	}
-      else if (n == 1)
+      else if (rc == 1)
 	{
-	  if (ping_recv (ping) == 0)
-	    nresp++;
-	  if (t == 0)
+	  /* Take all the packets waiting, so that none are dropped
+	     when sending fast.  */
+	  for (i = 0; i < PING_BATCH; i++)
 	    {
-	      gettimeofday (&now, NULL);
-	      t = &now;
+	      errno = 0;
+	      if (ping_recv (ping) == 0)
+		nresp++;
+	      else if (errno == EAGAIN || errno == EWOULDBLOCK)
+		break;
+	      if (ping->ping_count && nresp >= ping->ping_count)
+		break;
 	    }
 
 	  if (ping_timeout_p (&ping->ping_start_time, timeout))
@@ -467,29 +503,9 @@ ping_run (PING * ping, int (*finish) ())
 	  if (ping->ping_count && nresp >= ping->ping_count)
 	    break;
 	}
-      else
-	{
-	  if (!ping->ping_count || ping->ping_num_xmit < ping->ping_count)
-	    {
-	      send_echo (ping);
-	      if (!(options & OPT_QUIET) && options & OPT_FLOOD)
-		putchar ('.');
-
-	      if (ping_timeout_p (&ping->ping_start_time, timeout))
-		break;
-	    }
-	  else if (finishing)
-	    break;
-	  else
-	    {
-	      finishing = 1;
-
-	      intvl.tv_sec = linger;
-	    }
-	  gettimeofday (&last, NULL);
-	}
     }
 
+  ping_timer_stop (&timer);
   ping_unset_data (ping);
 
   if (finish)
@@ -497,25 +513,27 @@ ping_run (PING * ping, int (*finish) ())
   return 0;
 }
 
-int
-send_echo (PING * ping)
+/* Send N requests, or as many of them as can be sent at once.
+   Returns the number sent.  */
+size_t
+send_echo (PING * ping, size_t n)
 {
   size_t off = 0;
   int rc;
 
   if (PING_TIMING (data_length))
     {
-      struct timeval tv;
-      gettimeofday (&tv, NULL);
-      ping_set_data (ping, &tv, 0, sizeof (tv), USE_IPV6);
-      off += sizeof (tv);
+      struct timespec ts;
+      ping_now (&ts);
+      ping_set_data (ping, &ts, 0, sizeof (ts), USE_IPV6);
+      off += sizeof (ts);
     }
   if (data_buffer)
     ping_set_data (ping, data_buffer, off,
 		   data_length > off ? data_length - off : data_length,
 		   USE_IPV6);
 
-  rc = ping_xmit (ping);
+  rc = ping_xmit_batch (ping, n);
   if (rc < 0)
     error (EXIT_FAILURE, errno, "sending packet");
 
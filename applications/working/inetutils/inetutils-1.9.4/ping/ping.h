@@ -30,3 +30,4 @@ int ping_set_pattern (PING * p, int len, unsigned char * pat);
 void ping_set_event_handler (PING * ping, ping_efp fp, void *closure);
 int ping_recv (PING * p);
 int ping_xmit (PING * p);
+int ping_xmit_batch (PING * p, size_t n);
@@ -77,7 +77,7 @@ int flowinfo;
 
 static int ping_echo (char *hostname);
 static void ping_reset (PING * p);
-static int send_echo (PING * ping);
+static size_t send_echo (PING * ping, size_t n);
 
 const char args_doc[] = "HOST ...";
 const char doc[] = "Send ICMP ECHO_REQUEST packets to network hosts."
@@ -131,6 +131,7 @@ parse_opt (int key, char *arg, struct argp_state *state)
 {
   char *endptr;
   static unsigned char pattern[MAXPATTERN];
+  double v;
 
   switch (key)
     {
@@ -158,8 +159,13 @@ parse_opt (int key, char *arg, struct argp_state *state)
 #endif
 
     case 'i':
+      v = strtod (arg, &endptr);
+      if (*endptr)
+        argp_error (state, "invalid value (`%s' near `%s')", arg, endptr);
       options |= OPT_INTERVAL;
-      interval = ping_cvt_number (arg, 0, 0);
+      interval = v * PING_PRECISION;
+      if (!is_root && interval < MIN_USER_INTERVAL)
+        error (EXIT_FAILURE, 0, "option value too small: %s", arg);
       break;
 
     case 'l':
@@ -310,81 +316,91 @@ sig_int (int signal _GL_UNUSED_PARAMETER)
 static int
 ping_run (PING * ping, int (*finish) ())
 {
-  fd_set fdset;
-  int fdmax;
-  struct timeval resp_time;
-  struct timeval last, intvl, now;
-  struct timeval *t = NULL;
+  struct ping_timer timer;
+  long long intvl, now, until, deadline = 0;
   int finishing = 0;
   size_t nresp = 0;
   unsigned long i;
+  size_t n;
 
   signal (SIGINT, sig_int);
 
-  fdmax = ping->ping_fd + 1;
+  for (i = 0; i < preload; i += send_echo (ping, preload - i))
+    ;
 
-  /* Some systems use `struct timeval' of size 16.  As these are
-   * not initialising `timeval' properly by assignment alone, let
-   * us play safely here.  gettimeofday() is always sufficient.
-   */
-  memset (&resp_time, 0, sizeof (resp_time));
-  memset (&intvl, 0, sizeof (intvl));
-  memset (&now, 0, sizeof (now));
-
-  for (i = 0; i < preload; i++)
-    send_echo (ping);
+  if (options & OPT_FLOOD && !(options & OPT_INTERVAL))
+    intvl = 10000000;		/* 10 ms */
+  else
+    intvl = ping->ping_interval * (1000000000LL / PING_PRECISION);
 
-  if (options & OPT_FLOOD)
+  /* Room for the replies that come in bursts at high rates.  */
+  if (intvl < 1000000)
     {
-      intvl.tv_sec = 0;
-      intvl.tv_usec = 10000;
+      int size = PING_RCVBUF;
+
+      setsockopt (ping->ping_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
     }
-  else
-    PING_SET_INTERVAL (intvl, ping->ping_interval);
 
-  gettimeofday (&last, NULL);
-  send_echo (ping);
+  ping_timer_start (&timer, intvl, is_root ? PING_BATCH : 1);
 
   while (!stop)
     {
-      int n;
-
-      FD_ZERO (&fdset);
-      FD_SET (ping->ping_fd, &fdset);
+      int rc;
 
-      gettimeofday (&now, NULL);
-      resp_time.tv_sec = last.tv_sec + intvl.tv_sec - now.tv_sec;
-      resp_time.tv_usec = last.tv_usec + intvl.tv_usec - now.tv_usec;
-
-      while (resp_time.tv_usec < 0)
+      now = ping_clock ();
+      if (finishing)
 	{
-	  resp_time.tv_usec += 1000000;
-	  resp_time.tv_sec--;
+	  if (now >= deadline)
+	    break;
+	  until = deadline;
 	}
-      while (resp_time.tv_usec >= 1000000)
+      else if ((n = ping_timer_due (&timer, now)) > 0)
 	{
-	  resp_time.tv_usec -= 1000000;
-	  resp_time.tv_sec++;
-	}
+	  /* Send the requests that are due, all at once if late.  */
+	  if (ping->ping_count && n > ping->ping_count - ping->ping_num_xmit)
+	    n = ping->ping_count - ping->ping_num_xmit;
+	  if (n == 0)
+	    {
+	      /* Wait for the replies still to come.  */
+	      finishing = 1;
+	      deadline = now + MAXWAIT * 1000000000LL;
+	      ping_timer_stop (&timer);
+	      continue;
+	    }
 
-      if (resp_time.tv_sec < 0)
-	resp_time.tv_sec = resp_time.tv_usec = 0;
+	  n = send_echo (ping, n);
+	  timer.pt_sent += n;
+	  if (!(options & OPT_QUIET) && options & OPT_FLOOD)
+	    for (i = 0; i < n; i++)
+	      putchar ('.');
 
-      n = select (fdmax, &fdset, NULL, NULL, &resp_time);
-      if (n < 0)
+	  if (ping_timeout_p (&ping->ping_start_time, timeout))
+	    break;
+	  continue;
+	}
+      else
+	until = ping_timer_next (&timer);
+
+      rc = ping_timer_wait (&timer, ping->ping_fd, until);
+      if (rc < 0)
 	{
 	  if (errno != EINTR)
 	    error (EXIT_FAILURE, errno, "select failed");
 	  continue;
 	}
-      else if (n == 1)
+      else if (rc == 1)
 	{
-	  if (ping_recv (ping) == 0)
-	    nresp++;
-	  if (t == 0)
+	  /* Take all the packets waiting, so that none are dropped
+	     when sending fast.  */
+	  for (i = 0; i < PING_BATCH; i++)
 	    {
-	      gettimeofday (&now, NULL);
-	      t = &now;
+	      errno = 0;
+	      if (ping_recv (ping) == 0)
+		nresp++;
+	      else if (errno == EAGAIN || errno == EWOULDBLOCK)
+		break;
+	      if (ping->ping_count && nresp >= ping->ping_count)
+		break;
 	    }
 
 	  if (ping_timeout_p (&ping->ping_start_time, timeout))
@@ -393,31 +409,9 @@ ping_run (PING * ping, int (*finish) ())
 	  if (ping->ping_count && nresp >= ping->ping_count)
 	    break;
 	}
-      else
-	{
-	  if (!ping->ping_count || ping->ping_num_xmit < ping->ping_count)
-	    {
-	      send_echo (ping);
-	      if (!(options & OPT_QUIET) && options & OPT_FLOOD)
-		{
-		  putchar ('.');
-		}
-
-	      if (ping_timeout_p (&ping->ping_start_time, timeout))
-		break;
-	    }
-	  else if (finishing)
-	    break;
-	  else
-	    {
-	      finishing = 1;
-
-	      intvl.tv_sec = MAXWAIT;
-	    }
-	  gettimeofday (&last, NULL);
-	}
     }
 
+  ping_timer_stop (&timer);
   ping_unset_data (ping);
 
   if (finish)
@@ -425,25 +419,27 @@ ping_run (PING * ping, int (*finish) ())
   return 0;
 }
 
-static int
-send_echo (PING * ping)
+/* Send N requests, or as many of them as can be sent at once.
+   Returns the number sent.  */
+static size_t
+send_echo (PING * ping, size_t n)
 {
   size_t off = 0;
   int rc;
 
   if (PING_TIMING (data_length))
     {
-      struct timeval tv;
-      gettimeofday (&tv, NULL);
-      ping_set_data (ping, &tv, 0, sizeof (tv), USE_IPV6);
-      off += sizeof (tv);
+      struct timespec ts;
+      ping_now (&ts);
+      ping_set_data (ping, &ts, 0, sizeof (ts), USE_IPV6);
+      off += sizeof (ts);
     }
   if (data_buffer)
     ping_set_data (ping, data_buffer, off,
 		   data_length > off ? data_length - off : data_length,
 		   USE_IPV6);
 
-  rc = ping_xmit (ping);
+  rc = ping_xmit_batch (ping, n);
   if (rc < 0)
     error (EXIT_FAILURE, errno, "sending packet");
 
@@ -489,9 +485,6 @@ ping_echo (char *hostname)
   struct ping_stat ping_stat;
   int status;
 
-  if (options & OPT_FLOOD && options & OPT_INTERVAL)
-    error (EXIT_FAILURE, 0, "-f and -i incompatible options");
-
   memset (&ping_stat, 0, sizeof (ping_stat));
   ping_stat.tmin = 999999999.0;
 
@@ -525,6 +518,7 @@ ping_echo (char *hostname)
 
   status = ping_run (ping, echo_finish);
   free (ping->ping_hostname);
+  free (ping_stat.thist);
   return status;
 }
 
@@ -544,32 +538,19 @@ print_echo (int dupflag, int hops, struct ping_stat *ping_stat,
 {
   int err;
   char buf[256];
-  struct timeval tv;
   int timing = 0;
   double triptime = 0.0;
 
-  gettimeofday (&tv, NULL);
-
   /* Do timing */
   if (PING_TIMING (datalen - sizeof (struct icmp6_hdr)))
     {
-      struct timeval tv1, *tp;
+      struct timespec ts;
 
       timing++;
-      tp = (struct timeval *) (icmp6 + 1);
 
       /* Avoid unaligned data: */
-      memcpy (&tv1, tp, sizeof (tv1));
-      tvsub (&tv, &tv1);
-
-      triptime = ((double) tv.tv_sec) * 1000.0 +
-	((double) tv.tv_usec) / 1000.0;
-      ping_stat->tsum += triptime;
-      ping_stat->tsumsq += triptime * triptime;
-      if (triptime < ping_stat->tmin)
-	ping_stat->tmin = triptime;
-      if (triptime > ping_stat->tmax)
-	ping_stat->tmax = triptime;
+      memcpy (&ts, icmp6 + 1, sizeof (ts));
+      triptime = ping_stat_add (ping_stat, &ts, &ping->ping_recv_time);
     }
 
   if (options & OPT_QUIET)
@@ -810,6 +791,11 @@ echo_finish (void)
 
       printf ("round-trip min/avg/max/stddev = %.3f/%.3f/%.3f/%.3f ms\n",
 	      ping_stat->tmin, avg, ping_stat->tmax, nsqrt (vari, 0.0005));
+      printf ("round-trip p50/p90/p99/p99.9 = %.3f/%.3f/%.3f/%.3f ms\n",
+	      ping_stat_percentile (ping_stat, 0.5),
+	      ping_stat_percentile (ping_stat, 0.9),
+	      ping_stat_percentile (ping_stat, 0.99),
+	      ping_stat_percentile (ping_stat, 0.999));
     }
   return (ping->ping_num_recv == 0);
 }
@@ -855,6 +841,8 @@ ping_init (int type _GL_UNUSED_PARAMETER, int ident)
       return NULL;
     }
 
+  ping_set_timestamps (fd);
+
   /* Allocate PING structure and initialize it to default values */
   p = malloc (sizeof (*p));
   if (!p)
@@ -868,35 +856,43 @@ ping_init (int type _GL_UNUSED_PARAMETER, int ident)
   p->ping_fd = fd;
   p->ping_count = DEFAULT_PING_COUNT;
   p->ping_interval = PING_DEFAULT_INTERVAL;
-  p->ping_datalen = sizeof (struct timeval);
+  p->ping_datalen = sizeof (struct timespec);
   /* Make sure we use only 16 bits in this field, id for icmp is a unsigned short.  */
   p->ping_ident = ident & 0xFFFF;
-  p->ping_cktab_size = PING_CKTABSIZE;
   gettimeofday (&p->ping_start_time, NULL);
   return p;
 }
 
-static int
-ping_xmit (PING * p)
+/* Encode in BUF the ICMPv6 header of the request with sequence
+   number SEQ.  */
+static void
+ping_encode (PING * p, unsigned char *buf, size_t seq)
 {
-  int i, buflen;
   struct icmp6_hdr *icmp6;
 
-  if (_ping_setbuf (p, USE_IPV6))
-    return -1;
-
-  buflen = p->ping_datalen + sizeof (struct icmp6_hdr);
-
   /* Mark sequence number as sent */
-  _PING_CLR (p, p->ping_num_xmit);
+  _PING_CLR (p, seq);
 
-  icmp6 = (struct icmp6_hdr *) p->ping_buffer;
+  icmp6 = (struct icmp6_hdr *) buf;
   icmp6->icmp6_type = ICMP6_ECHO_REQUEST;
   icmp6->icmp6_code = 0;
   /* The checksum will be calculated by the TCP/IP stack.  */
   icmp6->icmp6_cksum = 0;
   icmp6->icmp6_id = htons (p->ping_ident);
-  icmp6->icmp6_seq = htons (p->ping_num_xmit);
+  icmp6->icmp6_seq = htons (seq);
+}
+
+static int
+ping_xmit (PING * p)
+{
+  int i, buflen;
+
+  if (_ping_setbuf (p, USE_IPV6))
+    return -1;
+
+  buflen = p->ping_datalen + sizeof (struct icmp6_hdr);
+
+  ping_encode (p, p->ping_buffer, p->ping_num_xmit);
 
   i = sendto (p->ping_fd, (char *) p->ping_buffer, buflen, 0,
 	      (struct sockaddr *) &p->ping_dest.ping_sockaddr6,
@@ -914,6 +910,68 @@ ping_xmit (PING * p)
   return 0;
 }
 
+/* Send N requests, with the data now in the buffer and sequence
+   numbers following each other, in one system call where sendmmsg
+   is available.  Returns the number sent, at most PING_BATCH, or -1
+   if none could be.  */
+static int
+ping_xmit_batch (PING * p, size_t n)
+{
+#ifdef HAVE_SENDMMSG
+  struct mmsghdr msgs[PING_BATCH];
+  struct iovec iov[PING_BATCH];
+  int buflen, rc;
+  size_t i;
+
+  if (n > PING_BATCH)
+    n = PING_BATCH;
+  if (n < 2)
+    return ping_xmit (p) < 0 ? -1 : 1;
+
+  buflen = p->ping_datalen + sizeof (struct icmp6_hdr);
+  if (!p->ping_batch)
+    {
+      p->ping_batch = malloc (PING_BATCH * buflen);
+      if (!p->ping_batch)
+	return -1;
+    }
+
+  memset (msgs, 0, sizeof (msgs));
+  for (i = 0; i < n; i++)
+    {
+      unsigned char *buf = p->ping_batch + i * buflen;
+
+      memcpy (buf, p->ping_buffer, buflen);
+      ping_encode (p, buf, p->ping_num_xmit + i);
+      iov[i].iov_base = buf;
+      iov[i].iov_len = buflen;
+      msgs[i].msg_hdr.msg_name = &p->ping_dest.ping_sockaddr6;
+      msgs[i].msg_hdr.msg_namelen = sizeof (p->ping_dest.ping_sockaddr6);
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+  rc = sendmmsg (p->ping_fd, msgs, n, 0);
+  if (rc <= 0)
+    return -1;
+  p->ping_num_xmit += rc;
+  for (i = 0; i < (size_t) rc; i++)
+    if (msgs[i].msg_len != (unsigned) buflen)
+      printf ("ping: wrote %s %d chars, ret=%u\n",
+	      p->ping_hostname, buflen, msgs[i].msg_len);
+  return rc;
+#else
+  size_t i;
+
+  if (n > PING_BATCH)
+    n = PING_BATCH;
+  for (i = 0; i < n; i++)
+    if (ping_xmit (p) < 0)
+      break;
+  return i ? (int) i : -1;
+#endif
+}
+
 static int
 my_echo_reply (PING * p, struct icmp6_hdr *icmp6)
 {
@@ -947,9 +1005,10 @@ ping_recv (PING * p)
   msg.msg_controllen = sizeof (cmsg_data);
   msg.msg_flags = 0;
 
-  n = recvmsg (p->ping_fd, &msg, 0);
+  n = recvmsg (p->ping_fd, &msg, MSG_DONTWAIT);
   if (n < 0)
     return -1;
+  ping_recv_time (&msg, &p->ping_recv_time);
 
   for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg))
     {
@@ -968,17 +1027,21 @@ ping_recv (PING * p)
       if (ntohs (icmp6->icmp6_id) != p->ping_ident)
 	return -1;		/* It's not a response to us.  */
 
-      if (_PING_TST (p, ntohs (icmp6->icmp6_seq)))
+      switch (ping_window_mark (p, ntohs (icmp6->icmp6_seq)))
 	{
+	case PEV_RESPONSE:
+	  p->ping_num_recv++;
+	  dupflag = 0;
+	  break;
+
+	case PEV_DUPLICATE:
 	  /* We already got the reply for this echo request.  */
 	  p->ping_num_rept++;
 	  dupflag = 1;
-	}
-      else
-	{
-	  _PING_SET (p, ntohs (icmp6->icmp6_seq));
-	  p->ping_num_recv++;
-	  dupflag = 0;
+	  break;
+
+	default:
+	  return -1;		/* Too late, the request is lost.  */
 	}
 
       print_echo (dupflag, hops, p->ping_closure, &p->ping_dest.ping_sockaddr6,
@@ -27,6 +27,7 @@ static PING *ping_init (int type, int ident);
 static int ping_set_dest (PING * ping, char *host);
 static int ping_recv (PING * p);
 static int ping_xmit (PING * p);
+static int ping_xmit_batch (PING * p, size_t n);
 
 static int ping_run (PING * ping, int (*finish) ());
 static int ping_finish (void);
@@ -22,9 +22,13 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#ifdef HAVE_TIMERFD_CREATE
+# include <sys/timerfd.h>
+#endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -120,6 +124,275 @@ tvsub (struct timeval *out, struct timeval *in)
   out->tv_sec -= in->tv_sec;
 }
 
+/* The current time in TS, with the precision of the system.  */
+void
+ping_now (struct timespec *ts)
+{
+#ifdef HAVE_CLOCK_GETTIME
+  clock_gettime (CLOCK_REALTIME, ts);
+#else
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  ts->tv_sec = tv.tv_sec;
+  ts->tv_nsec = tv.tv_usec * 1000;
+#endif
+}
+
+/* Ask the kernel to tell when each packet received on FD arrived, to
+   nanoseconds if it can.  */
+void
+ping_set_timestamps (int fd)
+{
+  int on = 1;
+
+#ifdef SO_TIMESTAMPNS
+  if (setsockopt (fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof (on)) == 0)
+    return;
+#endif
+#ifdef SO_TIMESTAMP
+  setsockopt (fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof (on));
+#endif
+}
+
+/* The time in TS at which the packet received with MSG arrived, as
+   told by the kernel, or else the current time.  */
+void
+ping_recv_time (struct msghdr *msg, struct timespec *ts)
+{
+  struct cmsghdr *cmsg;
+
+  for (cmsg = CMSG_FIRSTHDR (msg); cmsg; cmsg = CMSG_NXTHDR (msg, cmsg))
+    {
+      if (cmsg->cmsg_level != SOL_SOCKET)
+	continue;
+#ifdef SCM_TIMESTAMPNS
+      if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+	{
+	  memcpy (ts, CMSG_DATA (cmsg), sizeof (*ts));
+	  return;
+	}
+#endif
+#ifdef SCM_TIMESTAMP
+      if (cmsg->cmsg_type == SCM_TIMESTAMP)
+	{
+	  struct timeval tv;
+
+	  memcpy (&tv, CMSG_DATA (cmsg), sizeof (tv));
+	  ts->tv_sec = tv.tv_sec;
+	  ts->tv_nsec = tv.tv_usec * 1000;
+	  return;
+	}
+#endif
+    }
+  ping_now (ts);
+}
+
+/* Nanoseconds on a clock that is never set back.  */
+long long
+ping_clock (void)
+{
+#if defined HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#else
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000000000LL + tv.tv_usec * 1000LL;
+#endif
+}
+
+/* Start the schedule PT of a request every INTERVAL nanoseconds, the
+   first of which is due now.  The times are counted from the start,
+   so that a late request does not put off the following ones, but
+   no more than BURST late requests are sent at once.  Where there
+   are timer descriptors, one expires at each request, which is more
+   accurate than a timeout of select.  */
+void
+ping_timer_start (struct ping_timer *pt, long long interval, size_t burst)
+{
+  pt->pt_start = ping_clock ();
+  pt->pt_interval = interval > 0 ? interval : 1;
+  pt->pt_sent = 0;
+  pt->pt_burst = burst > 0 ? burst : 1;
+  pt->pt_fd = -1;
+
+#if defined HAVE_TIMERFD_CREATE && defined HAVE_CLOCK_GETTIME
+  pt->pt_fd = timerfd_create (CLOCK_MONOTONIC, 0);
+  if (pt->pt_fd >= 0)
+    {
+      struct itimerspec its;
+      long long first = pt->pt_start + pt->pt_interval;
+
+      its.it_value.tv_sec = first / 1000000000LL;
+      its.it_value.tv_nsec = first % 1000000000LL;
+      its.it_interval.tv_sec = pt->pt_interval / 1000000000LL;
+      its.it_interval.tv_nsec = pt->pt_interval % 1000000000LL;
+      if (timerfd_settime (pt->pt_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+	ping_timer_stop (pt);
+    }
+#endif
+}
+
+/* The number of requests of PT due at NOW and not yet sent.  */
+size_t
+ping_timer_due (struct ping_timer *pt, long long now)
+{
+  unsigned long long due;
+
+  if (now < pt->pt_start)
+    return 0;
+  due = (now - pt->pt_start) / pt->pt_interval + 1;
+  /* After a stall, such as a stop by the user, skip the requests
+     missed instead of sending them all in a burst.  */
+  if (due > pt->pt_sent + pt->pt_burst)
+    pt->pt_sent = due - 1;
+  return due > pt->pt_sent ? due - pt->pt_sent : 0;
+}
+
+/* The time at which the next request of PT is due.  */
+long long
+ping_timer_next (struct ping_timer *pt)
+{
+  return pt->pt_start + (long long) pt->pt_sent * pt->pt_interval;
+}
+
+/* Wait until FD can be read, or the time UNTIL comes, on the clock of
+   ping_clock, or the timer of PT expires if it has one.  Returns 1
+   if FD can be read, 0 if not, and -1 on error.  */
+int
+ping_timer_wait (struct ping_timer *pt, int fd, long long until)
+{
+  fd_set fdset;
+  struct timeval tv, *tvp = NULL;
+  int fdmax = fd, rc;
+
+  FD_ZERO (&fdset);
+  FD_SET (fd, &fdset);
+  if (pt->pt_fd >= 0)
+    {
+      FD_SET (pt->pt_fd, &fdset);
+      if (pt->pt_fd > fdmax)
+	fdmax = pt->pt_fd;
+    }
+  else
+    {
+      long long left = until - ping_clock ();
+
+      if (left < 0)
+	left = 0;
+      /* Round up, not to wake up before the time.  */
+      left = (left + 999) / 1000;
+      tv.tv_sec = left / 1000000;
+      tv.tv_usec = left % 1000000;
+      tvp = &tv;
+    }
+
+  rc = select (fdmax + 1, &fdset, NULL, NULL, tvp);
+  if (rc < 0)
+    return -1;
+
+  if (pt->pt_fd >= 0 && FD_ISSET (pt->pt_fd, &fdset))
+    {
+      unsigned long long expired;
+
+      /* Only to clear the descriptor: the requests due are counted
+         from the clock.  */
+      if (read (pt->pt_fd, &expired, sizeof (expired)) < 0)
+	return -1;
+    }
+  return FD_ISSET (fd, &fdset) ? 1 : 0;
+}
+
+/* Stop the timer of PT, whose requests have all been sent.  */
+void
+ping_timer_stop (struct ping_timer *pt)
+{
+  if (pt->pt_fd >= 0)
+    {
+      close (pt->pt_fd);
+      pt->pt_fd = -1;
+    }
+}
+
+/* Account in STAT for the round trip of a packet sent at SENT that
+   came back at RECV.  Returns the time in milliseconds.  */
+double
+ping_stat_add (struct ping_stat *stat, struct timespec *sent,
+	       struct timespec *recv)
+{
+  long long ns;
+  double triptime;
+  int shift = 0;
+
+  ns = (recv->tv_sec - sent->tv_sec) * 1000000000LL
+    + recv->tv_nsec - sent->tv_nsec;
+  if (ns < 0)
+    ns = 0;			/* the clock was set back */
+  triptime = ns / 1000000.0;
+
+  stat->tsum += triptime;
+  stat->tsumsq += triptime * triptime;
+  if (triptime < stat->tmin)
+    stat->tmin = triptime;
+  if (triptime > stat->tmax)
+    stat->tmax = triptime;
+  stat->tcount++;
+
+  if (!stat->thist)
+    stat->thist = xcalloc (PING_HIST_SIZE, sizeof (*stat->thist));
+  if (ns >= 1LL << PING_HIST_MAXBITS)
+    ns = (1LL << PING_HIST_MAXBITS) - 1;
+  while (ns >> shift >= 2 * PING_HIST_SUB)
+    shift++;
+  stat->thist[shift * PING_HIST_SUB + (ns >> shift)]++;
+
+  return triptime;
+}
+
+/* The round trip time in milliseconds within which a fraction Q of
+   those counted in STAT came back.  */
+double
+ping_stat_percentile (struct ping_stat *stat, double q)
+{
+  size_t i, rank, seen = 0;
+  double ms;
+
+  if (!stat->thist || !stat->tcount)
+    return 0.0;
+
+  rank = q * stat->tcount;
+  if (rank < q * stat->tcount || rank == 0)
+    rank++;
+
+  for (i = 0; i < PING_HIST_SIZE; i++)
+    {
+      seen += stat->thist[i];
+      if (seen >= rank)
+	break;
+    }
+
+  /* The middle of the bucket.  */
+  if (i < 2 * PING_HIST_SUB)
+    ms = i / 1000000.0;
+  else
+    {
+      int shift = i / PING_HIST_SUB - 1;
+      long long low = (long long) (i - shift * PING_HIST_SUB) << shift;
+
+      ms = (low + ((1LL << shift) - 1) / 2.0) / 1000000.0;
+    }
+
+  if (ms < stat->tmin)
+    ms = stat->tmin;
+  if (ms > stat->tmax)
+    ms = stat->tmax;
+  return ms;
+}
+
 double
 nabs (double a)
 {
@@ -177,16 +450,41 @@ _ping_setbuf (PING * p, bool use_ipv6)
       if (!p->ping_buffer)
 	return -1;
     }
-  if (!p->ping_cktab)
+  if (!p->ping_window)
     {
-      p->ping_cktab = malloc (p->ping_cktab_size);
-      if (!p->ping_cktab)
+      p->ping_window = calloc (PING_WINDOW / 8, 1);
+      if (!p->ping_window)
 	return -1;
-      memset (p->ping_cktab, 0, p->ping_cktab_size);
     }
   return 0;
 }
 
+/* Note the reply to the request with sequence number SEQ.  Returns
+   PEV_RESPONSE for the first reply to one of the last PING_WINDOW
+   requests, PEV_DUPLICATE for another, and -1 for a reply to a
+   request older than these, or not sent at all.  */
+int
+ping_window_mark (PING * p, unsigned short seq)
+{
+  size_t back, n;
+  unsigned char bit;
+
+  if (!p->ping_window || p->ping_num_xmit == 0)
+    return -1;
+
+  /* Requests sent since the one with SEQ.  */
+  back = (unsigned short) (p->ping_num_xmit - 1 - seq);
+  if (back >= PING_WINDOW || back >= p->ping_num_xmit)
+    return -1;
+
+  n = (p->ping_num_xmit - 1 - back) % PING_WINDOW;
+  bit = 1 << (n & 0x07);
+  if (p->ping_window[n >> 3] & bit)
+    return PEV_DUPLICATE;
+  p->ping_window[n >> 3] |= bit;
+  return PEV_RESPONSE;
+}
+
 int
 ping_set_data (PING * p, void *data, size_t off, size_t len, bool use_ipv6)
 {
@@ -229,10 +527,12 @@ _ping_freebuf (PING * p)
       free (p->ping_buffer);
       p->ping_buffer = NULL;
     }
-  if (p->ping_cktab)
+  free (p->ping_batch);
+  p->ping_batch = NULL;
+  if (p->ping_window)
     {
-      free (p->ping_cktab);
-      p->ping_cktab = NULL;
+      free (p->ping_window);
+      p->ping_window = NULL;
     }
 }
 
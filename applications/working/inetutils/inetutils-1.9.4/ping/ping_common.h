@@ -26,6 +26,7 @@
 #include <progname.h>
 
 #include <stdbool.h>
+#include <time.h>
 
 #define MAXWAIT         10	/* Max seconds to wait for response.  */
 #define MAXPATTERN      16	/* Maximal length of pattern.  */
@@ -44,35 +45,54 @@
 #define SOPT_TSADDR     0x002
 #define SOPT_TSPRESPEC  0x004
 
+/* Round trip times are also counted in a histogram whose buckets
+   grow with the time, as in an HDR histogram: below 2 * PING_HIST_SUB
+   nanoseconds each has a bucket, and every doubling above is split in
+   PING_HIST_SUB buckets.  A percentile is then off by 1/PING_HIST_SUB
+   at most.  Times from 2^PING_HIST_MAXBITS nanoseconds, over a minute,
+   count as the largest.  */
+#define PING_HIST_BITS    5
+#define PING_HIST_SUB     (1 << PING_HIST_BITS)
+#define PING_HIST_MAXBITS 36
+#define PING_HIST_SIZE    ((PING_HIST_MAXBITS - PING_HIST_BITS + 1) \
+			   * PING_HIST_SUB)
+
 struct ping_stat
 {
   double tmin;                  /* minimum round trip time */
   double tmax;                  /* maximum round trip time */
   double tsum;                  /* sum of all times, for doing average */
   double tsumsq;                /* sum of all times squared, for std. dev. */
+  size_t tcount;                /* number of times */
+  unsigned *thist;              /* histogram of times, or NULL */
 };
 
 #define PEV_RESPONSE 0
 #define PEV_DUPLICATE 1
 #define PEV_NOECHO  2
 
-#define PING_CKTABSIZE 128
+/* Replies are told from duplicates for the last PING_WINDOW requests
+   sent; a reply to an older request is counted as lost.  */
+#define PING_WINDOW 32768
+
+/* Requests sent at once when late.  */
+#define PING_BATCH 64
+
+/* Size of the receive buffer when sending faster than every
+   millisecond.  */
+#define PING_RCVBUF (4 * 1024 * 1024)
 
 /* The rationale for not exiting after a sending N packets is that we
    want to follow the traditional behaviour of ping.  */
 #define DEFAULT_PING_COUNT 0
 
 #define PING_HEADER_LEN (USE_IPV6 ? sizeof (struct icmp6_hdr) : ICMP_MINLEN)
-#define PING_TIMING(s)  ((s) >= sizeof (struct timeval))
+#define PING_TIMING(s)  ((s) >= sizeof (struct timespec))
 #define PING_DATALEN    (64 - PING_HEADER_LEN)  /* default data length */
 
-#define PING_DEFAULT_INTERVAL 1000      /* Milliseconds */
-#define PING_PRECISION 1000     /* Millisecond precision */
-
-#define PING_SET_INTERVAL(t,i) do {\
-  (t).tv_sec = (i)/PING_PRECISION;\
-  (t).tv_usec = ((i)%PING_PRECISION)*(1000000/PING_PRECISION) ;\
-} while (0)
+#define PING_DEFAULT_INTERVAL 1000000   /* Microseconds */
+#define PING_PRECISION 1000000  /* Microsecond precision */
+#define MIN_USER_INTERVAL (PING_PRECISION / 5)  /* 200 ms, unless root */
 
 /* FIXME: Adjust IPv6 case for options and their consumption.  */
 #define _PING_BUFLEN(p, u) ((u)? ((p)->ping_datalen + sizeof (struct icmp6_hdr)) : \
@@ -111,45 +131,52 @@ struct ping_data
   char *ping_hostname;         /* Printable hostname */
   size_t ping_datalen;         /* Length of data */
   int ping_ident;              /* Our identifier */
+  int ping_anydest;            /* Requests go to other hosts than ping_dest */
   union event ping_event;      /* User-defined handler */
   void *ping_closure;          /* User-defined data */
 
   /* Runtime info */
-  int ping_cktab_size;
-  char *ping_cktab;
+  unsigned char *ping_window;  /* A bit for each of the last requests */
 
   unsigned char *ping_buffer;         /* I/O buffer */
+  unsigned char *ping_batch;   /* Requests sent at once */
   union ping_address ping_from;
+  struct timespec ping_recv_time; /* Arrival of the last packet */
   size_t ping_num_xmit;        /* Number of packets transmitted */
   size_t ping_num_recv;        /* Number of packets received */
   size_t ping_num_rept;        /* Number of duplicates received */
 };
 
-#define _C_BIT(p,bit)   (p)->ping_cktab[(bit)>>3]	/* byte in ck array */
-#define _C_MASK(bit)    (1 << ((bit) & 0x07))
-#define _C_IND(p,bit)   ((bit) % (8 * (p)->ping_cktab_size))
+#define _PING_CLR(p,n)						\
+  ((p)->ping_window[((n) % PING_WINDOW) >> 3] &= ~(1 << ((n) & 0x07)))
 
-#define _PING_SET(p,bit)						\
-  do									\
-    {									\
-      int n = _C_IND (p,bit);						\
-      _C_BIT (p,n) |= _C_MASK (n);					\
-    }									\
-  while (0)
-
-#define _PING_CLR(p,bit)						\
-  do									\
-    {									\
-      int n = _C_IND (p,bit);						\
-      _C_BIT (p,n) &= ~_C_MASK (n);					\
-    }									\
-  while (0)
-
-#define _PING_TST(p,bit)					\
-  (_C_BIT (p, _C_IND (p,bit)) & _C_MASK  (_C_IND (p,bit)))
+/* The schedule of requests: one every PT_INTERVAL nanoseconds from
+   PT_START, on the monotonic clock.  */
+struct ping_timer
+{
+  long long pt_start;
+  long long pt_interval;
+  unsigned long long pt_sent;   /* requests sent so far */
+  size_t pt_burst;              /* late requests sent at once at most */
+  int pt_fd;                    /* timer descriptor, or -1 */
+};
 
 
 void tvsub (struct timeval *out, struct timeval *in);
+void ping_now (struct timespec *ts);
+void ping_set_timestamps (int fd);
+void ping_recv_time (struct msghdr *msg, struct timespec *ts);
+double ping_stat_add (struct ping_stat *stat, struct timespec *sent,
+		      struct timespec *recv);
+double ping_stat_percentile (struct ping_stat *stat, double q);
+int ping_window_mark (PING * p, unsigned short seq);
+long long ping_clock (void);
+void ping_timer_start (struct ping_timer *pt, long long interval,
+		       size_t burst);
+size_t ping_timer_due (struct ping_timer *pt, long long now);
+long long ping_timer_next (struct ping_timer *pt);
+int ping_timer_wait (struct ping_timer *pt, int fd, long long until);
+void ping_timer_stop (struct ping_timer *pt);
 double nabs (double a);
 double nsqrt (double a, double prec);
 
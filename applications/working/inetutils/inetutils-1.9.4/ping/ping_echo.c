@@ -73,9 +73,6 @@ ping_echo (char *hostname)
   struct ping_stat ping_stat;
   int status;
 
-  if (options & OPT_FLOOD && options & OPT_INTERVAL)
-    error (EXIT_FAILURE, 0, "-f and -i incompatible options");
-
   memset (&ping_stat, 0, sizeof (ping_stat));
   ping_stat.tmin = 999999999.0;
 
@@ -149,6 +146,7 @@ ping_echo (char *hostname)
 
   status = ping_run (ping, echo_finish);
   free (ping->ping_hostname);
+  free (ping_stat.thist);
   return status;
 }
 
@@ -178,12 +176,9 @@ print_echo (int dupflag, struct ping_stat *ping_stat,
 	    struct ip *ip, icmphdr_t * icmp, int datalen)
 {
   int hlen;
-  struct timeval tv;
   int timing = 0;
   double triptime = 0.0;
 
-  gettimeofday (&tv, NULL);
-
   /* Length of IP header */
   hlen = ip->ip_hl << 2;
 
@@ -193,23 +188,13 @@ print_echo (int dupflag, struct ping_stat *ping_stat,
   /* Do timing */
   if (PING_TIMING (datalen - PING_HEADER_LEN))
     {
-      struct timeval tv1, *tp;
+      struct timespec ts;
 
       timing++;
-      tp = (struct timeval *) icmp->icmp_data;
 
       /* Avoid unaligned data: */
-      memcpy (&tv1, tp, sizeof (tv1));
-      tvsub (&tv, &tv1);
-
-      triptime = ((double) tv.tv_sec) * 1000.0 +
-	((double) tv.tv_usec) / 1000.0;
-      ping_stat->tsum += triptime;
-      ping_stat->tsumsq += triptime * triptime;
-      if (triptime < ping_stat->tmin)
-	ping_stat->tmin = triptime;
-      if (triptime > ping_stat->tmax)
-	ping_stat->tmax = triptime;
+      memcpy (&ts, icmp->icmp_data, sizeof (ts));
+      triptime = ping_stat_add (ping_stat, &ts, &ping->ping_recv_time);
     }
 
   if (options & OPT_QUIET)
@@ -637,6 +622,11 @@ echo_finish (void)
 
       printf ("round-trip min/avg/max/stddev = %.3f/%.3f/%.3f/%.3f ms\n",
 	      ping_stat->tmin, avg, ping_stat->tmax, nsqrt (vari, 0.0005));
+      printf ("round-trip p50/p90/p99/p99.9 = %.3f/%.3f/%.3f/%.3f ms\n",
+	      ping_stat_percentile (ping_stat, 0.5),
+	      ping_stat_percentile (ping_stat, 0.9),
+	      ping_stat_percentile (ping_stat, 0.99),
+	      ping_stat_percentile (ping_stat, 0.999));
     }
   return (ping->ping_num_recv == 0);
 }
@@ -26,6 +26,13 @@ extern unsigned int suboptions;
 extern PING *ping;
 extern unsigned char *data_buffer;
 extern size_t data_length;
+extern size_t count;
+extern unsigned long preload;
+extern int timeout;
+extern int linger;
+extern int volatile stop;
+
+extern void sig_int (int signal);
 
 extern int ping_run (PING * ping, int (*finish) ());
 extern int ping_finish (void);
@@ -0,0 +1,392 @@
+/*
+  Copyright (C) 2016 Free Software Foundation, Inc.
+
+  This file is part of GNU Inetutils.
+
+  GNU Inetutils is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or (at
+  your option) any later version.
+
+  GNU Inetutils is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see `http://www.gnu.org/licenses/'. */
+
+/*
+ * Multiple host mode (--multi).  Every host is probed with ICMP ECHO
+ * requests from the one raw socket of this process.  A round sends one
+ * request to each host, spread evenly over the interval, and rounds
+ * follow each other every interval.  All requests carry the identifier
+ * of this process, and each a sequence number of its own, which tells
+ * to which host, and to which of its requests, a reply belongs.
+ */
+
+#include <config.h>
+
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/file.h>
+#include <sys/time.h>
+#include <signal.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*#include <netinet/ip_icmp.h>  -- deliberately not including this */
+#ifdef HAVE_NETINET_IP_VAR_H
+# include <netinet/ip_var.h>
+#endif
+
+#include <netdb.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unused-parameter.h>
+#include <xalloc.h>
+
+#include <ping.h>
+#include "ping_impl.h"
+
+#define SEQ_SPACE	65536	/* sequence numbers of ICMP */
+
+struct target
+{
+  char *t_name;			/* as given */
+  struct sockaddr_in t_addr;
+  size_t t_xmit;		/* requests sent */
+  size_t t_recv;		/* replies received */
+  size_t t_rept;		/* duplicates received */
+  struct ping_stat t_stat;
+};
+
+/* The request sent with a sequence number.  */
+struct probe
+{
+  size_t p_target;		/* index in TARGETS plus one, or 0 */
+  unsigned short p_seq;		/* sequence number for the target */
+};
+
+static struct target *targets;
+static size_t ntargets;
+static struct probe *probes;
+static size_t nanswered;	/* requests answered */
+
+extern int print_echo (int dup, struct ping_stat *stat,
+		       struct sockaddr_in *dest, struct sockaddr_in *from,
+		       struct ip *ip, icmphdr_t * icmp, int datalen);
+
+static void
+add_target (const char *name)
+{
+  struct target *t;
+
+  if (ntargets % 64 == 0)
+    targets = xrealloc (targets, (ntargets + 64) * sizeof (*targets));
+  t = &targets[ntargets++];
+  memset (t, 0, sizeof (*t));
+  t->t_name = xstrdup (name);
+  t->t_stat.tmin = 999999999.0;
+}
+
+/* Add the hosts named in FILE, or on the standard input if FILE is
+   "-".  A line may name several hosts, and a `#' starts a comment.  */
+static void
+read_targets (const char *file)
+{
+  FILE *fp = stdin;
+  char *line = NULL, *name;
+  size_t size = 0;
+
+  if (strcmp (file, "-") != 0)
+    {
+      fp = fopen (file, "r");
+      if (fp == NULL)
+	error (EXIT_FAILURE, errno, "%s", file);
+    }
+
+  while (getline (&line, &size, fp) > 0)
+    for (name = strtok (line, " \t\r\n"); name && *name != '#';
+	 name = strtok (NULL, " \t\r\n"))
+      add_target (name);
+
+  free (line);
+  if (fp != stdin)
+    fclose (fp);
+}
+
+static int
+handler (int code, void *closure _GL_UNUSED_PARAMETER,
+	 struct sockaddr_in *dest, struct sockaddr_in *from,
+	 struct ip *ip, icmphdr_t * icmp, int datalen)
+{
+  struct probe *pr;
+  struct target *t;
+
+  if (code == PEV_NOECHO)
+    {
+      /* An error quotes the header of the request it is about, with
+         the sequence number, and the host it was sent to.  */
+      struct ip *orig_ip = &icmp->icmp_ip;
+      icmphdr_t *orig_icmp =
+	(icmphdr_t *) ((char *) orig_ip + (orig_ip->ip_hl << 2));
+
+      pr = &probes[ntohs (orig_icmp->icmp_seq)];
+      if (pr->p_target == 0
+	  || (targets[pr->p_target - 1].t_addr.sin_addr.s_addr
+	      != orig_ip->ip_dst.s_addr))
+	return 0;
+      print_icmp_header (from, ip, icmp, datalen);
+      return 0;
+    }
+
+  pr = &probes[ntohs (icmp->icmp_seq)];
+
+  /* A reply to a request whose sequence number has since been used
+     again comes from another host.  */
+  if (pr->p_target == 0)
+    return 0;
+  t = &targets[pr->p_target - 1];
+  if (from->sin_addr.s_addr != t->t_addr.sin_addr.s_addr)
+    return 0;
+
+  if (code == PEV_DUPLICATE)
+    t->t_rept++;
+  else
+    {
+      t->t_recv++;
+      nanswered++;
+    }
+
+  /* Report the sequence number of the host.  */
+  icmp->icmp_seq = htons (pr->p_seq);
+  return print_echo (code == PEV_DUPLICATE, &t->t_stat, dest, from,
+		     ip, icmp, datalen);
+}
+
+/* Send a request to the target at index I.  */
+static void
+send_probe (size_t i)
+{
+  struct target *t = &targets[i];
+  struct probe *pr = &probes[ping->ping_num_xmit % SEQ_SPACE];
+  size_t off = 0;
+
+  if (PING_TIMING (data_length))
+    {
+      struct timespec ts;
+      ping_now (&ts);
+      ping_set_data (ping, &ts, 0, sizeof (ts), USE_IPV6);
+      off += sizeof (ts);
+    }
+  if (data_buffer)
+    ping_set_data (ping, data_buffer, off,
+		   data_length > off ? data_length - off : data_length,
+		   USE_IPV6);
+
+  ping->ping_dest.ping_sockaddr = t->t_addr;
+  pr->p_target = i + 1;
+  pr->p_seq = t->t_xmit++;
+  if (ping_xmit (ping) < 0)
+    {
+      /* The request is lost, and the host need not be given up.  */
+      pr->p_target = 0;
+      if (!(options & OPT_QUIET))
+	error (0, errno, "sending packet to %s", t->t_name);
+    }
+}
+
+/* The time at which request K is due, in nanoseconds from the start,
+   with ROUND between rounds and GAP between requests of a round.  */
+static long long
+probe_time (size_t k, long long round, long long gap)
+{
+  return (long long) (k / ntargets) * round + (long long) (k % ntargets) * gap;
+}
+
+/* Print a line of statistics for every host, with fields separated
+   by blanks.  Returns 1 if any host did not reply.  */
+static int
+multi_finish (void)
+{
+  size_t i;
+  int status = 0;
+
+  fflush (stdout);
+  printf ("# host address transmitted received duplicates loss"
+	  " min avg max stddev p50 p90 p99 p99.9\n");
+  for (i = 0; i < ntargets; i++)
+    {
+      struct target *t = &targets[i];
+
+      printf ("%s %s %zu %zu %zu %d", t->t_name,
+	      inet_ntoa (t->t_addr.sin_addr), t->t_xmit, t->t_recv,
+	      t->t_rept,
+	      t->t_xmit ? (int) ((t->t_xmit - t->t_recv) * 100 / t->t_xmit)
+	      : 0);
+      if (t->t_recv && PING_TIMING (data_length))
+	{
+	  double total = t->t_recv + t->t_rept;
+	  double avg = t->t_stat.tsum / total;
+	  double vari = t->t_stat.tsumsq / total - avg * avg;
+
+	  printf (" %.3f %.3f %.3f %.3f", t->t_stat.tmin, avg,
+		  t->t_stat.tmax, nsqrt (vari, 0.0005));
+	  printf (" %.3f %.3f %.3f %.3f",
+		  ping_stat_percentile (&t->t_stat, 0.5),
+		  ping_stat_percentile (&t->t_stat, 0.9),
+		  ping_stat_percentile (&t->t_stat, 0.99),
+		  ping_stat_percentile (&t->t_stat, 0.999));
+	}
+      else
+	printf (" - - - - - - - -");
+      printf ("\n");
+
+      if (t->t_recv == 0)
+	status = 1;
+    }
+  return status;
+}
+
+/*
+ * Probe the NHOSTS hosts in HOSTS, and those named in FILE unless it
+ * is NULL, all at once.  Each is sent COUNT requests, or requests
+ * until interrupted.
+ */
+int
+ping_multi (char **hosts, int nhosts, const char *file)
+{
+  struct timeval tv;
+  long long start, round, gap, elapsed, due, left, deadline = -1;
+  size_t next = 0, total, i, n;
+  fd_set fdset;
+  int status = 0;
+
+  if (options & OPT_FLOOD || preload)
+    error (EXIT_FAILURE, 0, "--multi and -f or -l incompatible options");
+  if (options & (OPT_RROUTE | OPT_IPTIMESTAMP))
+    error (EXIT_FAILURE, 0, "IP options not available with --multi");
+
+  while (nhosts--)
+    add_target (*hosts++);
+  if (file)
+    read_targets (file);
+
+  /* Hosts that cannot be found are left out.  */
+  for (i = n = 0; i < ntargets; i++)
+    {
+      if (ping_set_dest (ping, targets[i].t_name))
+	{
+	  error (0, 0, "unknown host %s", targets[i].t_name);
+	  free (targets[i].t_name);
+	  status = 1;
+	  continue;
+	}
+      free (ping->ping_hostname);
+      ping->ping_hostname = NULL;
+      targets[i].t_addr = ping->ping_dest.ping_sockaddr;
+      targets[n++] = targets[i];
+    }
+  ntargets = n;
+  if (ntargets == 0)
+    error (EXIT_FAILURE, 0, "no host to ping");
+
+  ping_set_type (ping, ICMP_ECHO);
+  ping_set_packetsize (ping, data_length);
+  ping_set_event_handler (ping, handler, NULL);
+  /* Errors are about requests to any of the hosts.  */
+  ping->ping_anydest = 1;
+
+  probes = xcalloc (SEQ_SPACE, sizeof (*probes));
+
+  printf ("PING %zu hosts: %zu data bytes", ntargets, data_length);
+  if (options & OPT_VERBOSE)
+    printf (", id 0x%04x = %u", ping->ping_ident, ping->ping_ident);
+  printf ("\n");
+
+  /* Nanoseconds between rounds, and between requests of a round.  */
+  round = ping->ping_interval * (1000000000LL / PING_PRECISION);
+  gap = round / ntargets;
+  total = count * ntargets;
+
+  signal (SIGINT, sig_int);
+  start = ping_clock ();
+
+  while (!stop)
+    {
+      int rc;
+
+      elapsed = ping_clock () - start;
+
+      /* Send the requests that are due, a batch at most.  Further
+         behind, after a stall, the schedule is moved on instead.  */
+      for (n = 0; (!count || next < total)
+	     && probe_time (next, round, gap) <= elapsed; n++)
+	{
+	  if (n == PING_BATCH)
+	    {
+	      start += elapsed - probe_time (next, round, gap);
+	      elapsed = probe_time (next, round, gap);
+	      break;
+	    }
+	  send_probe (next++ % ntargets);
+	}
+
+      if (count && next == total)
+	{
+	  /* Wait for the replies still to come.  */
+	  if (deadline < 0)
+	    deadline = elapsed + linger * 1000000000LL;
+	  if (nanswered >= total || elapsed >= deadline)
+	    break;
+	  due = deadline;
+	}
+      else
+	due = probe_time (next, round, gap);
+
+      if (ping_timeout_p (&ping->ping_start_time, timeout))
+	break;
+
+      /* Round up, not to wake up before the time.  */
+      left = due > elapsed ? (due - elapsed + 999) / 1000 : 0;
+      tv.tv_sec = left / 1000000;
+      tv.tv_usec = left % 1000000;
+      FD_ZERO (&fdset);
+      FD_SET (ping->ping_fd, &fdset);
+      rc = select (ping->ping_fd + 1, &fdset, NULL, NULL, &tv);
+      if (rc < 0)
+	{
+	  if (errno != EINTR)
+	    error (EXIT_FAILURE, errno, "select failed");
+	  continue;
+	}
+
+      /* Take all the packets waiting, for their times of arrival to
+         stay true at thousands of hosts.  */
+      if (rc == 1)
+	for (;;)
+	  {
+	    errno = 0;
+	    if (ping_recv (ping) < 0
+		&& (errno == EAGAIN || errno == EWOULDBLOCK))
+	      break;
+	  }
+    }
+
+  ping_unset_data (ping);
+
+  status |= multi_finish ();
+  for (i = 0; i < ntargets; i++)
+    {
+      free (targets[i].t_name);
+      free (targets[i].t_stat.thist);
+    }
+  free (targets);
+  free (probes);
+  return status;
+}
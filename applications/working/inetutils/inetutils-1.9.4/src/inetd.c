@@ -76,6 +76,8 @@
  *	protocol			must be in /etc/protocols
  *	wait/nowait[.max]		single-threaded/multi-threaded
  *                                      [with an optional fork limit]
+ *                                      [and ,prefork=N,minspare=M,
+ *                                      maxspare=X for a worker pool]
  *	user[:group] or user[.group]	user (and group) to run daemon as
  *	server program			full path name
  *	server program arguments	arguments starting with argv[0]
@@ -131,6 +133,15 @@
 #include <argp-version-etc.h>
 #include <progname.h>
 #include <sys/select.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
+#ifdef HAVE_SCHED_SETAFFINITY
+# include <sched.h>
+#endif
+#ifdef HAVE_EPOLL_CREATE1
+# include <sys/epoll.h>
+#endif
 #include <grp.h>
 
 #include "libinetutils.h"
@@ -145,6 +156,10 @@
 #define TOOMANY		1000	/* don't start more than TOOMANY */
 #define CNT_INTVL	60	/* servers in CNT_INTVL sec. */
 #define RETRYTIME	(60*10)	/* retry after bind or server fail */
+#define ACCEPT_BATCH	16	/* connections accepted per wakeup */
+#define EVENT_MAX	64	/* ready sockets handled per wakeup */
+#define POOL_MAX	64	/* workers of a prefork service */
+#define RATE_SLOTS	256	/* services with counts shared by shards */
 
 #ifndef SIGCHLD
 # define SIGCHLD	SIGCLD
@@ -154,6 +169,19 @@
 bool debug = false;
 int nsock, maxsock;
 fd_set allsock;
+int epfd = -1;			/* epoll instance, or -1 to use select */
+int sesfd = -1;			/* epoll instance of inline sessions */
+const char *exec_failure;	/* what a vforked child failed to do */
+int exec_errno;			/* and why */
+unsigned nsessions;		/* number of inline sessions */
+unsigned session_max;		/* and how many there may be */
+unsigned shards = 1;		/* number of processes accepting connections */
+unsigned shard;			/* which of them this is */
+pid_t *shard_pids;		/* the others, in the first shard */
+#ifdef HAVE_SCHED_SETAFFINITY
+cpu_set_t shard_cpus;		/* processors available before binding */
+#endif
+volatile sig_atomic_t config_serial;	/* bumped on each reconfiguration */
 int options;
 int timingout;
 unsigned toomany = TOOMANY;
@@ -164,6 +192,7 @@ char **config_files;
 
 static bool env_option = false;	       /* Set environment variables */
 static bool resolve_option = false;    /* Resolve IP addresses */
+static bool inline_option = false;     /* Serve stream builtins in-process */
 static bool pidfile_option = true;     /* Record the PID in a file */
 static const char *pid_file = PATH_INETDPID;
 
@@ -173,7 +202,9 @@ const char doc[] = "Internet super-server.";
 /* Define keys for long options that do not have short counterparts. */
 enum {
   OPT_ENVIRON = 256,
-  OPT_RESOLVE
+  OPT_INLINE,
+  OPT_RESOLVE,
+  OPT_SHARDS
 };
 
 const char *program_authors[] = {
@@ -188,6 +219,9 @@ static struct argp_option argp_options[] = {
    "turn on debugging, run in foreground mode", GRP+1},
   {"environment", OPT_ENVIRON, NULL, 0,
    "pass local and remote socket information in environment variables", GRP+1},
+  {"inline-builtins", OPT_INLINE, NULL, 0,
+   "serve the echo, discard and chargen stream services without forking",
+   GRP+1},
   { "pidfile", 'p', "PIDFILE", OPTION_ARG_OPTIONAL,
     "override pidfile (default: \"" PATH_INETDPID "\")",
     GRP+1 },
@@ -196,13 +230,15 @@ static struct argp_option argp_options[] = {
   {"resolve", OPT_RESOLVE, NULL, 0,
    "resolve IP addresses when setting environment variables "
    "(see --environment)", GRP+1},
+  {"shards", OPT_SHARDS, "NUMBER", 0,
+   "accept connections to `nowait' stream services in NUMBER processes",
+   GRP+1},
 #undef GRP
   {NULL, 0, NULL, 0, NULL, 0}
 };
 
 static error_t
-parse_opt (int key, char *arg,
-	   struct argp_state *state _GL_UNUSED_PARAMETER)
+parse_opt (int key, char *arg, struct argp_state *state)
 {
   char *p;
   int number;
@@ -218,6 +254,10 @@ parse_opt (int key, char *arg,
       env_option = true;
       break;
 
+    case OPT_INLINE:
+      inline_option = true;
+      break;
+
     case 'p':
       if (arg && strlen (arg))
 	pid_file = arg;
@@ -237,6 +277,13 @@ parse_opt (int key, char *arg,
       resolve_option = true;
       break;
 
+    case OPT_SHARDS:
+      number = strtol (arg, &p, 0);
+      if (number < 1 || number > 1024 || *p)
+	argp_error (state, "invalid number of shards: %s", arg);
+      shards = number;
+      break;
+
     default:
       return ARGP_ERR_UNKNOWN;
     }
@@ -274,9 +321,46 @@ struct servtab
   unsigned se_refcnt;
   unsigned se_count;			/* number started since se_time */
   struct timeval se_time;	/* start of se_count */
+  struct rate *se_rate;		/* counts shared by shards, if any */
+  uid_t se_uid;			/* user to run the server as */
+  gid_t se_gid;			/* its group */
+  gid_t *se_groups;		/* its supplementary groups */
+  int se_ngroups;		/* number of them */
+  unsigned se_prefork;		/* workers started in advance */
+  unsigned se_minspare;		/* idle workers to keep at least */
+  unsigned se_maxspare;		/* idle workers to keep at most */
+  struct worker *se_pool;	/* workers, if any */
+  unsigned se_nworkers;		/* number of workers */
   struct servtab *se_next;
 } *servtab;
 
+/* Counts of servers started for a service, shared by all shards.  */
+struct rate
+{
+  unsigned long r_key;		/* hash of the service, 0 if free */
+  unsigned r_count;		/* number started since r_time */
+  struct timeval r_time;	/* start of r_count */
+} *rates;
+
+#if defined __GNUC__
+# define rate_add(p)		__sync_add_and_fetch (p, 1)
+# define rate_claim(p, key)	__sync_bool_compare_and_swap (p, 0, key)
+#else
+# define rate_add(p)		(++*(p))
+# define rate_claim(p, key)	(*(p) = (key))
+#endif
+
+/* A pre-forked process serving connections of one service.  It is
+   handed each connection over W_FD, and answers with one byte when
+   done.  Workers of external servers execute the server for the
+   first connection they get, and are replaced.  */
+struct worker
+{
+  pid_t w_pid;
+  int w_fd;			/* our end of the socket pair */
+  int w_busy;			/* serving a connection */
+};
+
 #define NORM_TYPE	0
 #define MUX_TYPE	1
 #define MUXPLUS_TYPE	2
@@ -298,6 +382,15 @@ void machtime_dg (int, struct servtab *);
 void machtime_stream (int, struct servtab *);
 void tcpmux (int s, struct servtab *sep);
 
+void watch_sep (struct servtab *sep);
+void unwatch_sep (struct servtab *sep);
+void pool_stop (struct servtab *sep);
+int pool_reap (pid_t pid);
+int shard_reap (pid_t pid);
+void shard_signal (int signo);
+void shard_unbind (void);
+void prepenv (int ctrl, struct sockaddr *sa_client, socklen_t sa_len);
+
 struct biltin
 {
   const char *bi_service;	/* internally provided service name */
@@ -412,11 +505,71 @@ signal_unblock (SIGSTATUS * status)
 #endif
 }
 
+/*
+ * Take on the user and group identity of SEP, as resolved when the
+ * configuration was read.  Only system calls are made, so that this
+ * can run in a child made by vfork.  Returns -1 and sets errno on
+ * failure.
+ */
+int
+set_credentials (struct servtab *sep)
+{
+  if (sep->se_uid == 0)
+    return 0;
+#ifdef HAVE_GETGROUPLIST
+  if (setgroups (sep->se_ngroups, sep->se_groups) < 0)
+    return -1;
+#elif defined HAVE_INITGROUPS
+  initgroups (sep->se_user, sep->se_gid);
+#endif
+  if (setgid (sep->se_gid) < 0 || setuid (sep->se_uid) < 0)
+    return -1;
+  return 0;
+}
+
+/* Look up the supplementary groups of USER for SEP.  */
 void
-run_service (int ctrl, struct servtab *sep)
+resolve_groups (struct servtab *sep, const char *user)
+{
+#ifdef HAVE_GETGROUPLIST
+  gid_t *groups = NULL, *p;
+  int n = 16, want;
+
+  free (sep->se_groups);
+  sep->se_groups = NULL;
+  sep->se_ngroups = 0;
+  if (sep->se_uid == 0)
+    return;
+
+  for (;;)
+    {
+      p = realloc (groups, n * sizeof (*groups));
+      if (p == NULL)
+	{
+	  /* The server then runs with no supplementary groups.  */
+	  syslog (LOG_ERR, "Out of memory.");
+	  free (groups);
+	  return;
+	}
+      groups = p;
+      want = n;
+      if (getgrouplist (user, sep->se_gid, groups, &want) >= 0)
+	break;
+      n = want > n ? want : 2 * n;
+    }
+  sep->se_groups = groups;
+  sep->se_ngroups = want;
+#endif
+}
+
+/*
+ * Execute the server of SEP on CTRL.  Built-in servers return when
+ * done, external ones never return.  CREDS tells whether the user
+ * and group identity still have to be set.
+ */
+void
+run_service (int ctrl, struct servtab *sep, int creds)
 {
-  struct passwd *pwd;
-  struct group *grp = NULL;
   char buf[50];
 
   if (sep->se_bi)
@@ -431,55 +584,15 @@ run_service (int ctrl, struct servtab *sep)
       close (ctrl);
       dup2 (0, 1);
       dup2 (0, 2);
-      pwd = getpwnam (sep->se_user);
-      if (pwd == NULL)
+      shard_unbind ();
+      if (creds && set_credentials (sep) < 0)
 	{
-	  syslog (LOG_ERR, "%s/%s: %s: No such user",
+	  syslog (LOG_ERR, "%s/%s: can't set user %s: %m",
 		  sep->se_service, sep->se_proto, sep->se_user);
 	  if (sep->se_socktype != SOCK_STREAM)
 	    recv (0, buf, sizeof buf, 0);
 	  _exit (EXIT_FAILURE);
 	}
-      if (sep->se_group && *sep->se_group)
-	{
-	  grp = getgrnam (sep->se_group);
-	  if (grp == NULL)
-	    {
-	      syslog (LOG_ERR, "%s/%s: %s: No such group",
-		      sep->se_service, sep->se_proto, sep->se_group);
-	      if (sep->se_socktype != SOCK_STREAM)
-		recv (0, buf, sizeof buf, 0);
-	      _exit (EXIT_FAILURE);
-	    }
-	}
-      if (pwd->pw_uid)
-	{
-	  if (grp && grp->gr_gid)
-	    {
-	      if (setgid (grp->gr_gid) < 0)
-		{
-		  syslog (LOG_ERR, "%s: can't set gid %d: %m",
-			  sep->se_service, grp->gr_gid);
-		  _exit (EXIT_FAILURE);
-		}
-	    }
-	  else if (setgid (pwd->pw_gid) < 0)
-	    {
-	      syslog (LOG_ERR, "%s: can't set gid %d: %m",
-		      sep->se_service, pwd->pw_gid);
-	      _exit (EXIT_FAILURE);
-	    }
-#ifdef HAVE_INITGROUPS
-	  initgroups (pwd->pw_name,
-		      (grp && grp->gr_gid) ? grp->gr_gid : pwd->pw_gid);
-#endif
-	  if (setuid (pwd->pw_uid) < 0)
-	    {
-	      syslog (LOG_ERR, "%s: can't set uid %d: %m",
-		      sep->se_service, pwd->pw_uid);
-	      _exit (EXIT_FAILURE);
-	    }
-	}
       execv (sep->se_server, sep->se_argv);
       if (sep->se_socktype != SOCK_STREAM)
 	recv (0, buf, sizeof buf, 0);
@@ -488,6 +601,44 @@ run_service (int ctrl, struct servtab *sep)
     }
 }
 
+/*
+ * Execute the external server of SEP on CTRL in a child made by vfork.
+ * The child shares the memory of inetd, so only system calls are made
+ * here, and a failure is left in exec_errno for the parent to log.
+ */
+void
+exec_server (int ctrl, struct servtab *sep)
+{
+  char buf[50];
+
+  signal_set_handler (SIGHUP, SIG_DFL);
+  signal_set_handler (SIGCHLD, SIG_DFL);
+  signal_set_handler (SIGALRM, SIG_DFL);
+  signal_set_handler (SIGTERM, SIG_DFL);
+  signal_set_handler (SIGINT, SIG_DFL);
+  signal_unblock (NULL);
+  if (debug)
+    setsid ();
+
+  /* Our other descriptors are all close-on-exec.  */
+  dup2 (ctrl, 0);
+  close (ctrl);
+  dup2 (0, 1);
+  dup2 (0, 2);
+  shard_unbind ();
+  if (set_credentials (sep) < 0)
+    exec_failure = "set user for";
+  else
+    {
+      execv (sep->se_server, sep->se_argv);
+      exec_failure = "execute";
+    }
+  exec_errno = errno;
+  if (sep->se_socktype != SOCK_STREAM)
+    recv (0, buf, sizeof buf, 0);
+  _exit (EXIT_FAILURE);
+}
+
 void
 reapchild (int signo _GL_UNUSED_PARAMETER)
 {
@@ -506,6 +657,8 @@ reapchild (int signo _GL_UNUSED_PARAMETER)
 	break;
       if (debug)
 	fprintf (stderr, "%d reaped, status %#x\n", (int) pid, status);
+      if (pool_reap (pid) || shard_reap (pid))
+	continue;
       for (sep = servtab; sep; sep = sep->se_next)
 	if (sep->se_wait == pid)
 	  {
@@ -515,8 +668,7 @@ reapchild (int signo _GL_UNUSED_PARAMETER)
 	    if (debug)
 	      fprintf (stderr, "restored %s, fd %d\n",
 		       sep->se_service, sep->se_fd);
-	    FD_SET (sep->se_fd, &allsock);
-	    nsock++;
+	    watch_sep (sep);
 	    sep->se_wait = 1;
 	  }
     }
@@ -606,6 +758,8 @@ setup (struct servtab *sep)
 	      sep->se_service, sep->se_proto);
       return 1;
     }
+  /* Servers get it as descriptor 0, if at all.  */
+  fcntl (sep->se_fd, F_SETFD, FD_CLOEXEC);
 #ifdef IPV6
   if (sep->se_family == AF_INET6)
     {
@@ -632,6 +786,14 @@ setup (struct servtab *sep)
   if (err < 0)
     syslog (LOG_ERR, "setsockopt (SO_REUSEADDR): %m");
 
+#ifdef SO_REUSEPORT
+  /* Every shard listens on a socket of its own.  */
+  if (shards > 1 && sep->se_socktype == SOCK_STREAM && !sep->se_wait
+      && setsockopt (sep->se_fd, SOL_SOCKET, SO_REUSEPORT,
+		     (char *) &on, sizeof (on)) < 0)
+    syslog (LOG_ERR, "setsockopt (SO_REUSEPORT): %m");
+#endif
+
   err = bind (sep->se_fd, (struct sockaddr *) &sep->se_ctrladdr,
 	      sep->se_addrlen);
   if (err < 0)
@@ -673,6 +835,58 @@ setup (struct servtab *sep)
   return 0;
 }
 
+/*
+ * Start or stop listening for requests on the socket of SEP.
+ */
+void
+watch_sep (struct servtab *sep)
+{
+#ifdef HAVE_EPOLL_CREATE1
+  if (epfd >= 0)
+    {
+      struct epoll_event ev;
+
+      memset (&ev, 0, sizeof (ev));
+      ev.events = EPOLLIN;
+      ev.data.ptr = sep;
+      if (epoll_ctl (epfd, EPOLL_CTL_ADD, sep->se_fd, &ev) < 0)
+	{
+	  syslog (LOG_ERR, "%s/%s: epoll_ctl: %m",
+		  sep->se_service, sep->se_proto);
+	  return;
+	}
+      nsock++;
+      return;
+    }
+#endif
+  if (sep->se_fd >= FD_SETSIZE)
+    {
+      syslog (LOG_ERR, "%s/%s: descriptor %d too large for select",
+	      sep->se_service, sep->se_proto, sep->se_fd);
+      return;
+    }
+  FD_SET (sep->se_fd, &allsock);
+  nsock++;
+}
+
+void
+unwatch_sep (struct servtab *sep)
+{
+#ifdef HAVE_EPOLL_CREATE1
+  if (epfd >= 0)
+    {
+      if (epoll_ctl (epfd, EPOLL_CTL_DEL, sep->se_fd, NULL) == 0)
+	nsock--;
+      return;
+    }
+#endif
+  if (sep->se_fd < FD_SETSIZE && FD_ISSET (sep->se_fd, &allsock))
+    {
+      FD_CLR (sep->se_fd, &allsock);
+      nsock--;
+    }
+}
+
 void
 servent_setup (struct servtab *sep)
 {
@@ -681,13 +895,23 @@ servent_setup (struct servtab *sep)
     {
       if (sep->se_socktype == SOCK_STREAM)
 	listen (sep->se_fd, 10);
-      FD_SET (sep->se_fd, &allsock);
-      nsock++;
+      watch_sep (sep);
       if (sep->se_fd > maxsock)
 	maxsock = sep->se_fd;
       if (debug)
 	fprintf (stderr, "registered %s on %d\n", sep->se_server, sep->se_fd);
     }
+
+  /* Connections to `nowait' services are accepted in batches, but
+     `wait' servers get the listening socket as it was created.  */
+  if (sep->se_fd >= 0 && sep->se_socktype == SOCK_STREAM)
+    {
+      int flags = fcntl (sep->se_fd, F_GETFL);
+
+      if (flags >= 0)
+	fcntl (sep->se_fd, F_SETFL,
+	       sep->se_wait ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+    }
 }
 
 void
@@ -707,20 +931,497 @@ retry (int signo _GL_UNUSED_PARAMETER)
 void
 close_sep (struct servtab *sep)
 {
-  if (sep->se_fd >= 0)
+  if (sep->se_fd >= 0)
+    {
+      unwatch_sep (sep);
+      close (sep->se_fd);
+      sep->se_fd = -1;
+    }
+  sep->se_count = 0;
+  pool_stop (sep);
+  /*
+   * Don't keep the pid of this running deamon: when reapchild()
+   * reaps this pid, it would erroneously increment nsock.
+   */
+  if (sep->se_wait > 1)
+    sep->se_wait = 1;
+}
+
+/*
+ * Worker pools of prefork services.
+ */
+
+/* Pass the descriptor FD over SOCK.  */
+int
+send_fd (int sock, int fd)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char cmd = 'c';
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE (sizeof (int))];
+  } control;
+
+  memset (&msg, 0, sizeof (msg));
+  iov.iov_base = &cmd;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+  cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+  memcpy (CMSG_DATA (cmsg), &fd, sizeof (int));
+
+  return sendmsg (sock, &msg, 0) == 1 ? 0 : -1;
+}
+
+/* Receive a descriptor from SOCK.  Returns -1 on end of file.  */
+int
+recv_fd (int sock)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char cmd;
+  int fd = -1;
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE (sizeof (int))];
+  } control;
+
+  memset (&msg, 0, sizeof (msg));
+  iov.iov_base = &cmd;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+
+  while (recvmsg (sock, &msg, 0) != 1)
+    if (errno != EINTR)
+      return -1;
+
+  cmsg = CMSG_FIRSTHDR (&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+      && cmsg->cmsg_type == SCM_RIGHTS)
+    memcpy (&fd, CMSG_DATA (cmsg), sizeof (int));
+  return fd;
+}
+
+/*
+ * Main loop of a worker of SEP, talking to inetd over SOCK.
+ */
+void
+worker_main (struct servtab *sep, int sock)
+{
+  int ctrl;
+
+  signal_set_handler (SIGHUP, SIG_IGN);
+  signal_set_handler (SIGALRM, SIG_DFL);
+  signal_set_handler (SIGCHLD, SIG_DFL);
+  signal_unblock (NULL);
+
+  /* Keep nothing but SOCK.  A connection of inetd held open here,
+     such as one about to be passed to this or another worker, would
+     not see end of file when its server is done with it.  */
+#ifdef HAVE_CLOSE_RANGE
+  if (sock > 3)
+    close_range (3, sock - 1, 0);
+  close_range (sock + 1, ~0U, 0);
+#else
+  {
+    long n = sysconf (_SC_OPEN_MAX);
+
+    for (ctrl = 3; ctrl < n || ctrl <= maxsock; ctrl++)
+      if (ctrl != sock)
+	close (ctrl);
+  }
+#endif
+
+  if (!sep->se_bi && set_credentials (sep) < 0)
+    {
+      syslog (LOG_ERR, "%s/%s: can't set user %s: %m",
+	      sep->se_service, sep->se_proto, sep->se_user);
+      _exit (EXIT_FAILURE);
+    }
+
+  while ((ctrl = recv_fd (sock)) >= 0)
+    {
+      if (env_option)
+	{
+	  struct sockaddr_storage sa_client;
+	  socklen_t len = sizeof (sa_client);
+
+	  if (getpeername (ctrl, (struct sockaddr *) &sa_client, &len) == 0)
+	    prepenv (ctrl, (struct sockaddr *) &sa_client, len);
+	}
+      run_service (ctrl, sep, 0);
+      close (ctrl);
+      if (write (sock, "d", 1) != 1)
+	break;
+    }
+  _exit (EXIT_SUCCESS);
+}
+
+/* Start one more worker for SEP.  */
+struct worker *
+pool_spawn (struct servtab *sep)
+{
+  struct worker *w;
+  int sv[2];
+  pid_t pid;
+
+  if (sep->se_nworkers >= POOL_MAX)
+    return NULL;
+  if (sep->se_pool == NULL)
+    {
+      sep->se_pool = calloc (POOL_MAX, sizeof (*sep->se_pool));
+      if (sep->se_pool == NULL)
+	{
+	  syslog (LOG_ERR, "Out of memory.");
+	  return NULL;
+	}
+    }
+
+  /* Neither end may be left to a server the worker executes.  */
+#ifdef SOCK_CLOEXEC
+  if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+#else
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+#endif
+    {
+      syslog (LOG_ERR, "%s/%s: socketpair: %m",
+	      sep->se_service, sep->se_proto);
+      return NULL;
+    }
+#ifndef SOCK_CLOEXEC
+  fcntl (sv[0], F_SETFD, FD_CLOEXEC);
+  fcntl (sv[1], F_SETFD, FD_CLOEXEC);
+#endif
+  pid = fork ();
+  if (pid < 0)
+    {
+      syslog (LOG_ERR, "fork: %m");
+      close (sv[0]);
+      close (sv[1]);
+      return NULL;
+    }
+  if (pid == 0)
+    {
+      close (sv[0]);
+      worker_main (sep, sv[1]);
+    }
+  close (sv[1]);
+
+  if (debug)
+    fprintf (stderr, "worker %d started for %s\n", (int) pid,
+	     sep->se_service);
+  w = &sep->se_pool[sep->se_nworkers++];
+  w->w_pid = pid;
+  w->w_fd = sv[0];
+  w->w_busy = 0;
+  return w;
+}
+
+/* Start the workers of SEP, if it wants some.  */
+void
+pool_start (struct servtab *sep)
+{
+  unsigned i;
+
+  if (sep->se_prefork == 0 || sep->se_fd < 0 || sep->se_nworkers)
+    return;
+  for (i = 0; i < sep->se_prefork; i++)
+    if (pool_spawn (sep) == NULL)
+      break;
+}
+
+/* Let all workers of SEP exit once they are done.  */
+void
+pool_stop (struct servtab *sep)
+{
+  unsigned i;
+
+  for (i = 0; i < sep->se_nworkers; i++)
+    if (sep->se_pool[i].w_fd >= 0)
+      close (sep->se_pool[i].w_fd);
+  free (sep->se_pool);
+  sep->se_pool = NULL;
+  sep->se_nworkers = 0;
+}
+
+/* Forget about the worker PID, which has exited.  */
+int
+pool_reap (pid_t pid)
+{
+  struct servtab *sep;
+  unsigned i;
+
+  for (sep = servtab; sep; sep = sep->se_next)
+    for (i = 0; i < sep->se_nworkers; i++)
+      if (sep->se_pool[i].w_pid == pid)
+	{
+	  if (sep->se_pool[i].w_fd >= 0)
+	    close (sep->se_pool[i].w_fd);
+	  sep->se_pool[i] = sep->se_pool[--sep->se_nworkers];
+	  return 1;
+	}
+  return 0;
+}
+
+/*
+ * Hand the connection CTRL to an idle worker of SEP, and adjust the
+ * number of idle workers to the configured range.  Returns -1 if no
+ * worker could take it.  Called with signals blocked.
+ */
+int
+pool_dispatch (struct servtab *sep, int ctrl)
+{
+  struct worker *w = NULL;
+  unsigned i, idle = 0;
+  char buf[16];
+  int ret = -1;
+
+  /* Collect the notes of workers done with their connection.  */
+  for (i = 0; i < sep->se_nworkers; i++)
+    {
+      struct worker *p = &sep->se_pool[i];
+
+      if (p->w_busy && p->w_fd >= 0
+	  && recv (p->w_fd, buf, sizeof buf, MSG_DONTWAIT) > 0)
+	p->w_busy = 0;
+      if (!p->w_busy && w == NULL)
+	w = p;
+      else if (!p->w_busy)
+	idle++;
+    }
+
+  if (w == NULL)
+    w = pool_spawn (sep);
+  if (w && send_fd (w->w_fd, ctrl) == 0)
+    {
+      if (debug)
+	fprintf (stderr, "passed %d to worker %d\n", ctrl, (int) w->w_pid);
+      w->w_busy = 1;
+      close (ctrl);
+      ret = 0;
+    }
+
+  while (idle < sep->se_minspare && pool_spawn (sep))
+    idle++;
+  for (i = 0; idle > sep->se_maxspare && i < sep->se_nworkers; i++)
+    {
+      w = &sep->se_pool[i];
+      if (!w->w_busy)
+	{
+	  /* Retire it; it is forgotten once reaped.  */
+	  close (w->w_fd);
+	  w->w_fd = -1;
+	  w->w_busy = 1;
+	  idle--;
+	}
+    }
+
+  return ret;
+}
+
+/*
+ * Shards: with --shards=N, inetd runs as N processes, each with its own
+ * SO_REUSEPORT copy of every `nowait' stream listener and bound to a
+ * processor of its own.  The first shard, the one started by the user,
+ * also serves all other services, and passes signals on to the rest.
+ */
+
+/* Bind the calling shard to a processor of its own.  */
+void
+shard_bind (void)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+  cpu_set_t set;
+  unsigned i, n;
+
+  if (sched_getaffinity (0, sizeof (shard_cpus), &shard_cpus) < 0)
+    return;
+  n = shard % CPU_COUNT (&shard_cpus);
+  for (i = 0; i < CPU_SETSIZE; i++)
+    if (CPU_ISSET (i, &shard_cpus) && n-- == 0)
+      break;
+  CPU_ZERO (&set);
+  CPU_SET (i, &set);
+  if (sched_setaffinity (0, sizeof (set), &set) < 0)
+    syslog (LOG_WARNING, "sched_setaffinity: %m");
+  else if (debug)
+    fprintf (stderr, "shard %u on processor %u\n", shard, i);
+#endif
+}
+
+/* Let servers started by a shard run on any processor again.  */
+void
+shard_unbind (void)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+  if (shards > 1)
+    sched_setaffinity (0, sizeof (shard_cpus), &shard_cpus);
+#endif
+}
+
+/* Send SIGNO to all other shards.  */
+void
+shard_signal (int signo)
+{
+  unsigned i;
+
+  if (shard_pids)
+    for (i = 1; i < shards; i++)
+      if (shard_pids[i] > 0)
+	kill (shard_pids[i], signo);
+}
+
+void
+shard_exit (int signo)
+{
+  shard_signal (SIGTERM);
+  signal_set_handler (signo, SIG_DFL);
+  raise (signo);
+}
+
+/* Forget about the shard PID, which has exited.  */
+int
+shard_reap (pid_t pid)
+{
+  unsigned i;
+
+  if (shard_pids)
+    for (i = 1; i < shards; i++)
+      if (shard_pids[i] == pid)
+	{
+	  syslog (LOG_ERR, "shard %u exited", i);
+	  shard_pids[i] = 0;
+	  return 1;
+	}
+  return 0;
+}
+
+/* Fork the other shards.  */
+void
+shard_start (void)
+{
+  unsigned i;
+  pid_t pid;
+
+#if defined HAVE_MMAP && defined MAP_ANONYMOUS
+  rates = mmap (NULL, RATE_SLOTS * sizeof (*rates), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (rates == MAP_FAILED)
+    {
+      syslog (LOG_WARNING, "mmap: %m, rate limits are per shard");
+      rates = NULL;
+    }
+#endif
+
+  /* Until they have read the configuration.  */
+  signal_set_handler (SIGHUP, SIG_IGN);
+
+  shard_pids = calloc (shards, sizeof (*shard_pids));
+  if (shard_pids == NULL)
+    {
+      syslog (LOG_ERR, "Out of memory.");
+      shards = 1;
+      return;
+    }
+
+  for (i = 1; i < shards; i++)
+    {
+      pid = fork ();
+      if (pid < 0)
+	{
+	  syslog (LOG_ERR, "fork: %m");
+	  break;
+	}
+      if (pid == 0)
+	{
+	  shard = i;
+	  free (shard_pids);
+	  shard_pids = NULL;
+	  break;
+	}
+      shard_pids[i] = pid;
+    }
+  shard_bind ();
+}
+
+/* Find the counts shared by all shards for SEP, or NULL.  */
+struct rate *
+rate_lookup (struct servtab *sep)
+{
+  unsigned long key = 2166136261UL;
+  const char *p;
+  unsigned i, slot;
+
+  if (rates == NULL)
+    return NULL;
+
+  for (p = sep->se_service; *p; p++)
+    key = (key ^ (unsigned char) *p) * 16777619UL;
+  for (p = sep->se_proto; *p; p++)
+    key = (key ^ (unsigned char) *p) * 16777619UL;
+  for (p = sep->se_node ? sep->se_node : "*"; *p; p++)
+    key = (key ^ (unsigned char) *p) * 16777619UL;
+  if (key == 0)
+    key = 1;
+
+  /* Each shard claims the same free slot for the same service.  */
+  for (i = 0, slot = key % RATE_SLOTS; i < RATE_SLOTS;
+       i++, slot = (slot + 1) % RATE_SLOTS)
+    if (rates[slot].r_key == key
+	|| (rates[slot].r_key == 0
+	    && (rate_claim (&rates[slot].r_key, key)
+		|| rates[slot].r_key == key)))
+      return &rates[slot];
+  return NULL;
+}
+
+/*
+ * Count a server started for SEP.  Returns -1 if SEP has started too
+ * many servers within CNT_INTVL seconds.  If FORKS, the server runs
+ * in a process of its own, and is held to the global limit as well,
+ * which catches a server that fails right away.
+ */
+int
+rate_check (struct servtab *sep, int forks)
+{
+  unsigned *countp = &sep->se_count, count;
+  struct timeval *timep = &sep->se_time, now;
+
+  if (sep->se_rate)
     {
-      nsock--;
-      FD_CLR (sep->se_fd, &allsock);
-      close (sep->se_fd);
-      sep->se_fd = -1;
+      countp = &sep->se_rate->r_count;
+      timep = &sep->se_rate->r_time;
     }
-  sep->se_count = 0;
-  /*
-   * Don't keep the pid of this running deamon: when reapchild()
-   * reaps this pid, it would erroneously increment nsock.
-   */
-  if (sep->se_wait > 1)
-    sep->se_wait = 1;
+
+  count = rate_add (countp);
+  if (count == 1)
+    gettimeofday (timep, NULL);
+  else if ((sep->se_max && count > sep->se_max)
+	   || (forks && count >= toomany))
+    {
+      gettimeofday (&now, NULL);
+      if (now.tv_sec - timep->tv_sec > CNT_INTVL)
+	{
+	  *timep = now;
+	  *countp = 1;
+	}
+      else
+	return -1;
+    }
+  return 0;
 }
 
 struct servtab *
@@ -749,6 +1450,16 @@ enter (struct servtab *cp)
        */
       if (cp->se_bi == 0 && (sep->se_wait == 1 || cp->se_wait == 0))
 	sep->se_wait = cp->se_wait;
+      sep->se_prefork = cp->se_prefork;
+      sep->se_minspare = cp->se_minspare;
+      sep->se_maxspare = cp->se_maxspare;
+      sep->se_uid = cp->se_uid;
+      sep->se_gid = cp->se_gid;
+      free (sep->se_groups);
+      sep->se_groups = cp->se_groups;
+      sep->se_ngroups = cp->se_ngroups;
+      cp->se_groups = NULL;
+      cp->se_ngroups = 0;
 #define SWAP(a, b) { char *c = a; a = b; b = c; }
       if (cp->se_user)
 	SWAP (sep->se_user, cp->se_user);
@@ -787,6 +1498,9 @@ enter (struct servtab *cp)
   dupmem ((void**)&sep->se_argv, sep->se_argc * sizeof (sep->se_argv[0]));
   for (i = 0; i < sep->se_argc; i++)
     dupstr (&sep->se_argv[i]);
+  if (sep->se_groups)
+    dupmem ((void**)&sep->se_groups,
+	    sep->se_ngroups * sizeof (sep->se_groups[0]));
 
   sep->se_fd = -1;
   signal_block (&sigstatus);
@@ -947,6 +1661,7 @@ freeconfig (struct servtab *cp)
   free (cp->se_user);
   free (cp->se_group);
   free (cp->se_server);
+  free (cp->se_groups);
   argcv_free (cp->se_argc, cp->se_argv);
 }
 
@@ -1142,7 +1857,12 @@ getconfigent (FILE *fconfig, const char *file, size_t *line)
       sep->se_family = AF_INET;
 #endif
       {
-	char *p, *q;
+	char *p, *q, *opts;
+
+	/* Worker pool options follow the wait type, separated by commas.  */
+	opts = strchr (argv[INETD_WAIT], ',');
+	if (opts)
+	  *opts++ = 0;
 
 	p = strchr(argv[INETD_WAIT], '.');
 	if (p)
@@ -1163,6 +1883,41 @@ getconfigent (FILE *fconfig, const char *file, size_t *line)
 	      syslog (LOG_WARNING, "%s:%lu: invalid number (%s)",
 		      file, (unsigned long) *line, p);
 	  }
+
+	sep->se_minspare = 1;
+	sep->se_maxspare = 0;
+	for (p = opts ? strtok (opts, ",") : NULL; p; p = strtok (NULL, ","))
+	  {
+	    unsigned *valp;
+	    char *val = strchr (p, '=');
+
+	    if (val)
+	      *val++ = 0;
+	    if (strcmp (p, "prefork") == 0)
+	      valp = &sep->se_prefork;
+	    else if (strcmp (p, "minspare") == 0)
+	      valp = &sep->se_minspare;
+	    else if (strcmp (p, "maxspare") == 0)
+	      valp = &sep->se_maxspare;
+	    else
+	      {
+		syslog (LOG_WARNING, "%s:%lu: unknown option %s",
+			file, (unsigned long) *line, p);
+		continue;
+	      }
+	    if (!val || (*valp = strtoul (val, &q, 10), *q))
+	      {
+		syslog (LOG_WARNING, "%s:%lu: invalid number for %s",
+			file, (unsigned long) *line, p);
+		*valp = 0;
+	      }
+	  }
+	if (sep->se_prefork > POOL_MAX)
+	  sep->se_prefork = POOL_MAX;
+	if (sep->se_maxspare == 0 || sep->se_maxspare > POOL_MAX)
+	  sep->se_maxspare = sep->se_prefork;
+	if (sep->se_minspare > sep->se_maxspare)
+	  sep->se_minspare = sep->se_maxspare;
       }
 
       if (ISMUX (sep))
@@ -1224,6 +1979,16 @@ getconfigent (FILE *fconfig, const char *file, size_t *line)
       else
 	sep->se_bi = NULL;
 
+      /* Only services that fork a server per connection have a pool.  */
+      if (sep->se_prefork
+	  && (sep->se_wait || sep->se_socktype != SOCK_STREAM || ISMUX (sep)
+	      || (sep->se_bi && !sep->se_bi->bi_fork)))
+	{
+	  syslog (LOG_WARNING, "%s:%lu: %s: prefork ignored",
+		  file, (unsigned long) *line, sep->se_service);
+	  sep->se_prefork = 0;
+	}
+
       sep->se_argc = argc - INETD_FIELDS_MIN + 1;
       sep->se_argv = calloc (sep->se_argc + 1, sizeof sep->se_argv[0]);
       if (!sep->se_argv)
@@ -1286,6 +2051,7 @@ nextconfig (const char *file)
 		  sep->se_service, sep->se_proto, sep->se_user);
 	  continue;
 	}
+      grp = NULL;
       if (sep->se_group && *sep->se_group)
 	{
 	  grp = getgrnam (sep->se_group);
@@ -1296,6 +2062,16 @@ nextconfig (const char *file)
 	      continue;
 	    }
 	}
+
+      /* Resolve the identity now, so that starting a server needs no
+         lookups.  A changed user database takes effect on SIGHUP.  */
+      sep->se_uid = pwd->pw_uid;
+      sep->se_gid = (grp && grp->gr_gid) ? grp->gr_gid : pwd->pw_gid;
+      resolve_groups (sep, pwd->pw_name);
+
+      /* The first shard alone serves the other services.  */
+      if (shard > 0 && (sep->se_socktype != SOCK_STREAM || sep->se_wait))
+	continue;
       if (ISMUX (sep))
 	{
 	  sep->se_fd = -1;
@@ -1406,8 +2182,12 @@ config (int signo)
   struct stat stats;
   struct servtab *sep;
 
+  config_serial++;
   for (sep = servtab; sep; sep = sep->se_next)
-    sep->se_checked = 0;
+    {
+      sep->se_checked = 0;
+      pool_stop (sep);
+    }
 
   for (i = 0; config_files[i]; i++)
     {
@@ -1462,6 +2242,15 @@ config (int signo)
   linebufsize = 0;
 
   fix_tcpmux ();
+
+  for (sep = servtab; sep; sep = sep->se_next)
+    {
+      sep->se_rate = shards > 1 ? rate_lookup (sep) : NULL;
+      pool_start (sep);
+    }
+
+  if (signo)
+    shard_signal (SIGHUP);
 }
 
 
@@ -1520,7 +2309,6 @@ echo_stream (int s, struct servtab *sep)
   while ((i = read (s, buffer, sizeof buffer)) > 0
 	 && write (s, buffer, i) > 0)
     ;
-  exit (EXIT_SUCCESS);
 }
 
 /* Echo service -- echo data back */
@@ -1558,7 +2346,6 @@ discard_stream (int s, struct servtab *sep)
       if (ret == 0 || errno != EINTR)
 	break;
     }
-  exit (EXIT_SUCCESS);
 }
 
 void
@@ -1619,7 +2406,6 @@ chargen_stream (int s, struct servtab *sep)
       if (write (s, text, sizeof text) != sizeof text)
 	break;
     }
-  exit (EXIT_SUCCESS);
 }
 
 /* Character generator */
@@ -1661,6 +2447,252 @@ chargen_dg (int s, struct servtab *sep _GL_UNUSED_PARAMETER)
   sendto (s, text, sizeof text, 0, (struct sockaddr *) &sa, sizeof sa);
 }
 
+#ifdef HAVE_EPOLL_CREATE1
+/*
+ * Stream builtins served inside inetd (--inline-builtins).  Each
+ * connection is a small state machine run from the event loop,
+ * instead of a forked process.  The sessions have an epoll instance
+ * of their own, which is watched by the main one.
+ */
+#define SESSION_BUF	1024	/* output buffer of a session */
+#define SESSION_BURST	16	/* reads or writes per wakeup */
+#define SESSION_MAX	4096	/* sessions at most */
+#define SESSION_IDLE	300	/* seconds a session may stay idle */
+
+enum session_kind
+{
+  SESSION_ECHO,
+  SESSION_DISCARD,
+  SESSION_CHARGEN
+};
+
+struct session
+{
+  struct session *s_next, *s_prev;
+  int s_fd;
+  enum session_kind s_kind;
+  time_t s_time;		/* last time data moved */
+  unsigned s_events;		/* events waited for */
+  char *s_rs;			/* chargen: start of the next line */
+  size_t s_off, s_len;		/* pending output in s_buf */
+  char s_buf[SESSION_BUF];
+};
+
+struct session *sessions;	/* all sessions, for the idle timeout */
+time_t session_now;		/* time of the current wakeup */
+
+/* Seconds on a clock that is never set back.  */
+time_t
+session_clock (void)
+{
+#if defined HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+#else
+  return time (NULL);
+#endif
+}
+
+/* Serve the connection CTRL to SEP inside inetd, if SEP is a builtin
+   which can be and there is room for one more session.  Returns -1
+   otherwise.  */
+int
+session_start (struct servtab *sep, int ctrl)
+{
+  struct session *ses;
+  struct epoll_event ev;
+  enum session_kind kind;
+
+  if (nsessions >= session_max)
+    return -1;
+  if (sep->se_bi->bi_fn == echo_stream)
+    kind = SESSION_ECHO;
+  else if (sep->se_bi->bi_fn == discard_stream)
+    kind = SESSION_DISCARD;
+  else if (sep->se_bi->bi_fn == chargen_stream)
+    kind = SESSION_CHARGEN;
+  else
+    return -1;
+
+  ses = malloc (sizeof (*ses));
+  if (ses == NULL)
+    return -1;
+  if (!endring)
+    initring ();
+  ses->s_fd = ctrl;
+  ses->s_kind = kind;
+  ses->s_events = kind == SESSION_CHARGEN ? EPOLLOUT : EPOLLIN;
+  ses->s_rs = ring;
+  ses->s_off = ses->s_len = 0;
+  ses->s_time = session_clock ();
+
+  fcntl (ctrl, F_SETFL, fcntl (ctrl, F_GETFL) | O_NONBLOCK);
+  memset (&ev, 0, sizeof (ev));
+  ev.events = ses->s_events;
+  ev.data.ptr = ses;
+  if (epoll_ctl (sesfd, EPOLL_CTL_ADD, ctrl, &ev) < 0)
+    {
+      syslog (LOG_ERR, "%s/%s: epoll_ctl: %m",
+	      sep->se_service, sep->se_proto);
+      fcntl (ctrl, F_SETFL, fcntl (ctrl, F_GETFL) & ~O_NONBLOCK);
+      free (ses);
+      return -1;
+    }
+
+  /* Have forked servers close it.  */
+  if (ctrl > maxsock)
+    maxsock = ctrl;
+  ses->s_prev = NULL;
+  ses->s_next = sessions;
+  if (sessions)
+    sessions->s_prev = ses;
+  sessions = ses;
+  nsessions++;
+  if (debug)
+    fprintf (stderr, "%s session on %d\n", sep->se_service, ctrl);
+  return 0;
+}
+
+void
+session_end (struct session *ses)
+{
+  if (ses->s_prev)
+    ses->s_prev->s_next = ses->s_next;
+  else
+    sessions = ses->s_next;
+  if (ses->s_next)
+    ses->s_next->s_prev = ses->s_prev;
+  close (ses->s_fd);
+  free (ses);
+  nsessions--;
+}
+
+/* Fill the buffer of a chargen session with whole lines.  */
+void
+session_chargen (struct session *ses)
+{
+  char *text = ses->s_buf;
+  int len;
+
+  for (ses->s_len = 0; ses->s_len + LINESIZ + 2 <= SESSION_BUF;
+       ses->s_len += LINESIZ + 2, text += LINESIZ + 2)
+    {
+      len = endring - ses->s_rs;
+      if (len >= LINESIZ)
+	memmove (text, ses->s_rs, LINESIZ);
+      else
+	{
+	  memmove (text, ses->s_rs, len);
+	  memmove (text + len, ring, LINESIZ - len);
+	}
+      text[LINESIZ] = '\r';
+      text[LINESIZ + 1] = '\n';
+      if (++ses->s_rs == endring)
+	ses->s_rs = ring;
+    }
+  ses->s_off = 0;
+}
+
+/* Make progress on SES, which is ready for EVENTS.  */
+void
+session_run (struct session *ses, unsigned events)
+{
+  struct epoll_event ev;
+  ssize_t n;
+  int i;
+
+  if (events & EPOLLERR)
+    {
+      session_end (ses);
+      return;
+    }
+
+  for (i = 0; i < SESSION_BURST; i++)
+    {
+      if (ses->s_off < ses->s_len)
+	{
+	  n = write (ses->s_fd, ses->s_buf + ses->s_off,
+		     ses->s_len - ses->s_off);
+	  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+	    break;
+	  if (n <= 0)
+	    {
+	      session_end (ses);
+	      return;
+	    }
+	  ses->s_off += n;
+	  ses->s_time = session_now;
+	}
+      else if (ses->s_kind == SESSION_CHARGEN)
+	session_chargen (ses);
+      else
+	{
+	  n = read (ses->s_fd, ses->s_buf, sizeof (ses->s_buf));
+	  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+	    break;
+	  if (n <= 0)
+	    {
+	      session_end (ses);
+	      return;
+	    }
+	  ses->s_off = 0;
+	  ses->s_len = ses->s_kind == SESSION_ECHO ? n : 0;
+	  ses->s_time = session_now;
+	}
+    }
+
+  /* Wait for output room while some is pending, else for input.  */
+  ev.events = (ses->s_off < ses->s_len || ses->s_kind == SESSION_CHARGEN)
+    ? EPOLLOUT : EPOLLIN;
+  if (ev.events != ses->s_events)
+    {
+      ev.data.ptr = ses;
+      ses->s_events = ev.events;
+      if (epoll_ctl (sesfd, EPOLL_CTL_MOD, ses->s_fd, &ev) < 0)
+	session_end (ses);
+    }
+}
+
+/* Make progress on all sessions ready.  */
+void
+run_sessions (void)
+{
+  struct epoll_event events[EVENT_MAX];
+  int i, n;
+
+  session_now = session_clock ();
+  n = epoll_wait (sesfd, events, EVENT_MAX, 0);
+  for (i = 0; i < n; i++)
+    session_run (events[i].data.ptr, events[i].events);
+}
+
+/* Close the sessions idle for SESSION_IDLE seconds.  */
+void
+expire_sessions (void)
+{
+  static time_t last;
+  struct session *ses, *next;
+  time_t now = session_clock ();
+
+  /* Once a second is often enough.  */
+  if (now == last)
+    return;
+  last = now;
+  for (ses = sessions; ses; ses = next)
+    {
+      next = ses->s_next;
+      if (now - ses->s_time >= SESSION_IDLE)
+	{
+	  if (debug)
+	    fprintf (stderr, "session on %d timed out\n", ses->s_fd);
+	  session_end (ses);
+	}
+    }
+}
+#endif /* HAVE_EPOLL_CREATE1 */
+
 /*
  * Return a machine readable date and time, in the form of the
  * number of seconds since midnight, Jan 1, 1900.  Since gettimeofday
@@ -1796,7 +2828,7 @@ tcpmux (int s, struct servtab *sep)
   if (len < 0)
     {
       strwrite (s, "-Error reading service name\r\n");
-      _exit (EXIT_FAILURE);
+      return;
     }
   service[len] = '\0';
 
@@ -1816,7 +2848,7 @@ tcpmux (int s, struct servtab *sep)
 	  write (s, sep->se_service, strlen (sep->se_service));
 	  strwrite (s, "\r\n");
 	}
-      _exit (EXIT_FAILURE);
+      return;
     }
 
   /* Try matching a service in inetd.conf with the request */
@@ -1828,12 +2860,11 @@ tcpmux (int s, struct servtab *sep)
 	    {
 	      strwrite (s, "+Go\r\n");
 	    }
-	  run_service (s, sep);
+	  run_service (s, sep, 1);
 	  return;
 	}
     }
   strwrite (s, "-Service not available\r\n");
-  exit (EXIT_FAILURE);
 }
 
 /* Set TCP environment variables, modelled after djb's ucspi-tcp tools:
@@ -1923,14 +2954,220 @@ prepenv (int ctrl, struct sockaddr *sa_client, socklen_t sa_len)
 
 
 
+/*
+ * Wait for requests and store up to MAX services ready to be served
+ * in READY.  Returns their number, or -1 on error.
+ */
 int
-main (int argc, char *argv[], char *envp[])
+wait_requests (struct servtab **ready, int max)
 {
-  int index;
   struct servtab *sep;
+  fd_set readable;
+  int i, n;
+
+#ifdef HAVE_EPOLL_CREATE1
+  if (epfd >= 0)
+    {
+      struct epoll_event events[EVENT_MAX];
+      int j;
+
+      if (max > EVENT_MAX)
+	max = EVENT_MAX;
+      /* Wake up each second while there are sessions to time out.  */
+      n = epoll_wait (epfd, events, max, nsessions ? 1000 : -1);
+      if (n < 0)
+	return n;
+      /* Sessions are served right away, services by the caller.  */
+      for (i = j = 0; i < n; i++)
+	if (events[i].data.ptr)
+	  ready[j++] = events[i].data.ptr;
+	else
+	  run_sessions ();
+      if (nsessions)
+	expire_sessions ();
+      return j;
+    }
+#endif
+
+  readable = allsock;
+  n = select (maxsock + 1, &readable, NULL, NULL, NULL);
+  if (n <= 0)
+    return n;
+  for (i = 0, sep = servtab; i < n && i < max && sep; sep = sep->se_next)
+    if (sep->se_fd != -1 && sep->se_fd < FD_SETSIZE
+	&& FD_ISSET (sep->se_fd, &readable))
+      ready[i++] = sep;
+  return i;
+}
+
+/*
+ * Start the server of SEP for the connection or datagram on CTRL.
+ * Returns -1 if no further requests should be accepted for now.
+ */
+int
+spawn_server (struct servtab *sep, int ctrl)
+{
   int dofork;
   pid_t pid;
 
+  signal_block (NULL);
+  pid = 0;
+  dofork = (sep->se_bi == 0 || sep->se_bi->bi_fork);
+
+  /* A builtin served by an inline session or by a worker forks no
+     process, so it is held only to the limit of its service.  */
+  if (dofork && sep->se_bi && !sep->se_wait
+      && (sep->se_max == 0 || rate_check (sep, 0) == 0))
+    {
+#ifdef HAVE_EPOLL_CREATE1
+      if (sesfd >= 0 && session_start (sep, ctrl) == 0)
+	{
+	  signal_unblock (NULL);
+	  return 0;
+	}
+#endif
+      if (sep->se_prefork && pool_dispatch (sep, ctrl) == 0)
+	{
+	  signal_unblock (NULL);
+	  return 0;
+	}
+    }
+
+  if (dofork)
+    {
+      if (rate_check (sep, 1) < 0)
+	{
+	  syslog (LOG_ERR,
+		  "%s/%s server failing (looping), service terminated",
+		  sep->se_service, sep->se_proto);
+	  close_sep (sep);
+	  if (! sep->se_wait && sep->se_socktype == SOCK_STREAM)
+	    close (ctrl);
+	  signal_unblock (NULL);
+	  if (!timingout)
+	    {
+	      timingout = 1;
+	      alarm (RETRYTIME);
+	    }
+	  return -1;
+	}
+      /* A worker running an external server serves the connection if
+         one can, counted all the same.  */
+      if (sep->se_prefork && !sep->se_bi && pool_dispatch (sep, ctrl) == 0)
+	{
+	  signal_unblock (NULL);
+	  return 0;
+	}
+      if (debug && !sep->se_bi)
+	fprintf (stderr, "vfork and execute %s\n", sep->se_server);
+      /* External servers are started with vfork, which does not copy
+         the address space of inetd.  */
+      pid = sep->se_bi ? fork () : vfork ();
+      if (pid == 0 && !sep->se_bi)
+	exec_server (ctrl, sep);
+      if (exec_failure)
+	{
+	  errno = exec_errno;
+	  syslog (LOG_ERR, "cannot %s %s: %m", exec_failure, sep->se_server);
+	  exec_failure = NULL;
+	}
+    }
+  if (pid < 0)
+    {
+      syslog (LOG_ERR, "fork: %m");
+      if (!sep->se_wait && sep->se_socktype == SOCK_STREAM)
+	close (ctrl);
+      signal_unblock (NULL);
+      sleep (1);
+      return -1;
+    }
+  if (pid && sep->se_wait)
+    {
+      sep->se_wait = pid;
+      if (sep->se_fd >= 0)
+	unwatch_sep (sep);
+    }
+  signal_unblock (NULL);
+  if (pid == 0)
+    {
+      if (debug && dofork)
+	setsid ();
+      if (dofork)
+	{
+	  int sock;
+	  if (debug)
+	    fprintf (stderr, "+ Closing from %d\n", maxsock);
+	  for (sock = maxsock; sock > 2; sock--)
+	    if (sock != ctrl)
+	      close (sock);
+	}
+      run_service (ctrl, sep, 1);
+      if (dofork)
+	_exit (EXIT_SUCCESS);
+    }
+  if (!sep->se_wait && sep->se_socktype == SOCK_STREAM)
+    close (ctrl);
+  return 0;
+}
+
+/*
+ * Serve the requests waiting on the socket of SEP.  Pending connections
+ * to a `nowait' stream service are accepted in one go.
+ */
+void
+handle_request (struct servtab *sep)
+{
+  int i, ctrl;
+
+  if (debug)
+    fprintf (stderr, "someone wants %s\n", sep->se_service);
+
+  if (sep->se_wait || sep->se_socktype != SOCK_STREAM)
+    {
+      spawn_server (sep, sep->se_fd);
+      return;
+    }
+
+  for (i = 0; i < ACCEPT_BATCH && sep->se_fd != -1 && !sep->se_wait; i++)
+    {
+#ifdef IPV6
+      struct sockaddr_storage sa_client;
+#else
+      struct sockaddr_in sa_client;
+#endif
+      socklen_t len = sizeof (sa_client);
+
+#ifdef HAVE_ACCEPT4
+      ctrl = accept4 (sep->se_fd, (struct sockaddr *) &sa_client, &len,
+		      SOCK_CLOEXEC);
+#else
+      ctrl = accept (sep->se_fd, (struct sockaddr *) &sa_client, &len);
+#endif
+      if (debug)
+	fprintf (stderr, "accept, ctrl %d\n", ctrl);
+      if (ctrl < 0)
+	{
+	  if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+	    syslog (LOG_WARNING, "accept (for %s): %m", sep->se_service);
+	  break;
+	}
+#ifndef HAVE_ACCEPT4
+      /* Some systems let the new socket inherit O_NONBLOCK.  */
+      fcntl (ctrl, F_SETFL, fcntl (ctrl, F_GETFL) & ~O_NONBLOCK);
+      fcntl (ctrl, F_SETFD, FD_CLOEXEC);
+#endif
+      if (env_option)
+	prepenv (ctrl, (struct sockaddr *) &sa_client, len);
+      if (spawn_server (sep, ctrl) < 0)
+	break;
+    }
+}
+
+int
+main (int argc, char *argv[], char *envp[])
+{
+  int index;
+
   set_program_name (argv[0]);
 
   Argv = argv;
@@ -1990,6 +3227,44 @@ main (int argc, char *argv[], char *envp[])
 	      strerror (errno));
   }
 
+  if (shards > 1)
+    {
+      shard_start ();
+      if (shard == 0)
+	{
+	  signal_set_handler (SIGTERM, shard_exit);
+	  signal_set_handler (SIGINT, shard_exit);
+	}
+    }
+
+#ifdef HAVE_EPOLL_CREATE1
+  /* Fall back to select if the kernel lacks epoll.  */
+  epfd = epoll_create1 (EPOLL_CLOEXEC);
+
+  /* Inline sessions need epoll; without it, builtins fork as usual.  */
+  if (inline_option && epfd >= 0)
+    {
+      struct epoll_event ev;
+
+      memset (&ev, 0, sizeof (ev));
+      ev.events = EPOLLIN;
+      ev.data.ptr = NULL;
+      sesfd = epoll_create1 (EPOLL_CLOEXEC);
+      if (sesfd >= 0 && epoll_ctl (epfd, EPOLL_CTL_ADD, sesfd, &ev) < 0)
+	{
+	  syslog (LOG_ERR, "epoll_ctl: %m");
+	  close (sesfd);
+	  sesfd = -1;
+	}
+
+      /* Leave at least half of the descriptors to the rest.  */
+      session_max = SESSION_MAX;
+      if (sysconf (_SC_OPEN_MAX) > 0
+	  && sysconf (_SC_OPEN_MAX) / 2 < session_max)
+	session_max = sysconf (_SC_OPEN_MAX) / 2;
+    }
+#endif
+
   signal_set_handler (SIGALRM, retry);
   config (0);
   signal_set_handler (SIGHUP, config);
@@ -2008,133 +3283,35 @@ main (int argc, char *argv[], char *envp[])
 
   for (;;)
     {
-      int n, ctrl;
-      fd_set readable;
+      struct servtab *ready[EVENT_MAX];
+      int i, n, serial;
 
-      if (nsock == 0)
+      if (nsock == 0 && nsessions == 0)
 	{
 	  SIGSTATUS stat;
 	  sigstatus_empty (stat);
 
 	  signal_block (NULL);
-	  while (nsock == 0)
+	  while (nsock == 0 && nsessions == 0)
 	    inetd_pause (stat);
 	  signal_unblock (NULL);
 	}
-      readable = allsock;
-      n = select (maxsock + 1, &readable, NULL, NULL, NULL);
+      serial = config_serial;
+      n = wait_requests (ready, EVENT_MAX);
       if (n <= 0)
 	{
 	  if (n < 0 && errno != EINTR)
-	    syslog (LOG_WARNING, "select: %m");
-	  sleep (1);
+	    {
+	      syslog (LOG_WARNING, "%s: %m",
+		      epfd >= 0 ? "epoll_wait" : "select");
+	      sleep (1);
+	    }
 	  continue;
 	}
-      for (sep = servtab; n && sep; sep = sep->se_next)
-	if (sep->se_fd != -1 && FD_ISSET (sep->se_fd, &readable))
-	  {
-	    n--;
-	    if (debug)
-	      fprintf (stderr, "someone wants %s\n", sep->se_service);
-	    if (!sep->se_wait && sep->se_socktype == SOCK_STREAM)
-	      {
-#ifdef IPV6
-		struct sockaddr_storage sa_client;
-#else
-		struct sockaddr_in sa_client;
-#endif
-		socklen_t len = sizeof (sa_client);
-
-		ctrl = accept (sep->se_fd, (struct sockaddr *) &sa_client,
-			       &len);
-		if (debug)
-		  fprintf (stderr, "accept, ctrl %d\n", ctrl);
-		if (ctrl < 0)
-		  {
-		    if (errno != EINTR)
-		      syslog (LOG_WARNING, "accept (for %s): %m",
-			      sep->se_service);
-		    continue;
-		  }
-		if (env_option)
-		  prepenv (ctrl, (struct sockaddr *) &sa_client, len);
-	      }
-	    else
-	      ctrl = sep->se_fd;
 
-	    signal_block (NULL);
-	    pid = 0;
-	    dofork = (sep->se_bi == 0 || sep->se_bi->bi_fork);
-	    if (dofork)
-	      {
-		if (sep->se_count++ == 0)
-		  gettimeofday (&sep->se_time, NULL);
-		else if ((sep->se_max && sep->se_count > sep->se_max)
-			 || sep->se_count >= toomany)
-		  {
-		    struct timeval now;
-
-		    gettimeofday (&now, NULL);
-		    if (now.tv_sec - sep->se_time.tv_sec > CNT_INTVL)
-		      {
-			sep->se_time = now;
-			sep->se_count = 1;
-		      }
-		    else
-		      {
-			syslog (LOG_ERR,
-				"%s/%s server failing (looping), service terminated",
-				sep->se_service, sep->se_proto);
-			close_sep (sep);
-			if (! sep->se_wait && sep->se_socktype == SOCK_STREAM)
-			  close (ctrl);
-			signal_unblock (NULL);
-			if (!timingout)
-			  {
-			    timingout = 1;
-			    alarm (RETRYTIME);
-			  }
-			continue;
-		      }
-		  }
-		pid = fork ();
-	      }
-	    if (pid < 0)
-	      {
-		syslog (LOG_ERR, "fork: %m");
-		if (!sep->se_wait && sep->se_socktype == SOCK_STREAM)
-		  close (ctrl);
-		signal_unblock (NULL);
-		sleep (1);
-		continue;
-	      }
-	    if (pid && sep->se_wait)
-	      {
-		sep->se_wait = pid;
-		if (sep->se_fd >= 0)
-		  {
-		    FD_CLR (sep->se_fd, &allsock);
-		    nsock--;
-		  }
-	      }
-	    signal_unblock (NULL);
-	    if (pid == 0)
-	      {
-		if (debug && dofork)
-		  setsid ();
-		if (dofork)
-		  {
-		    int sock;
-		    if (debug)
-		      fprintf (stderr, "+ Closing from %d\n", maxsock);
-		    for (sock = maxsock; sock > 2; sock--)
-		      if (sock != ctrl)
-			close (sock);
-		  }
-		run_service (ctrl, sep);
-	      }
-	    if (!sep->se_wait && sep->se_socktype == SOCK_STREAM)
-	      close (ctrl);
-	  }
+      /* A reconfiguration may have freed the services found ready.  */
+      for (i = 0; i < n && serial == config_serial; i++)
+	if (ready[i]->se_fd != -1)
+	  handle_request (ready[i]);
     }
 }
@@ -78,6 +78,10 @@
 #define DEFSPRI		(LOG_KERN|LOG_CRIT)
 #define TIMERINTVL	30	/* Interval for checking flush, mark.  */
 #define TTYMSGTIME      10	/* Time out passed to ttymsg.  */
+#define RECVBATCH_MAX	1024	/* Maximum datagrams read per wakeup.  */
+#define FWDQUEUE_LEN	64	/* Messages queued for each forwarding.  */
+#define FWDRETRY_MSEC	100	/* Retry delay for a busy TCP stream.  */
+#define QUEUE_DEFAULT	65536	/* Bytes queued for each writer thread.  */
 
 #include <sys/param.h>
 #include <sys/ioctl.h>
@@ -112,6 +116,9 @@
 
 #define SYSLOG_NAMES
 #include <syslog.h>
+#if USE_POSIX_THREADS
+# include <pthread.h>
+#endif
 #ifndef HAVE_SYSLOG_INTERNAL
 # include "logprio.h"
 #endif
@@ -143,7 +150,10 @@ const char *PidFile = PATH_LOGPID;	/* Default path to tuck pid.  */
 char ctty[] = PATH_CONSOLE;	/* Default console to send message info.  */
 
 static int dbg_output;		/* If true, print debug output in debug mode.  */
-static int restart;		/* If 1, indicates SIGHUP was dropped.  */
+static volatile sig_atomic_t restart;	/* If 1, indicates SIGHUP was dropped.  */
+static volatile sig_atomic_t dying;	/* Signal to exit on, or 0.  */
+static volatile sig_atomic_t toggle_wanted;	/* SIGUSR1 was dropped.  */
+static volatile sig_atomic_t mark_wanted;	/* SIGALRM was dropped.  */
 
 /* Unix socket family to listen.  */
 struct funix
@@ -163,6 +173,42 @@ size_t nfunix;			/* Number of unix sockets in the funix array.  */
 #define ADDDATE		0x004	/* Add a date to the message.  */
 #define MARK		0x008	/* This message is a mark.  */
 
+/* Ring of formatted messages waiting to be forwarded.  For a TCP
+   target each message carries its octet count, and Q_OFF tells how
+   much of the first message has been written already.  */
+struct fwdqueue
+{
+  int q_head;			/* Slot of the oldest message.  */
+  int q_count;			/* Number of queued messages.  */
+  size_t q_off;			/* Bytes of q_head already sent.  */
+  unsigned long q_drops;	/* Messages lost to a full queue.  */
+  size_t q_len[FWDQUEUE_LEN];
+  char q_buf[FWDQUEUE_LEN][MAXLINE + 8];
+};
+
+#if USE_POSIX_THREADS
+/* Output thread of an action in pipeline mode.  Lines are appended
+   to a ring of QueueSize bytes by the main loop and written out by
+   the thread, so a slow file never holds up the reception of
+   messages.  W_ERROR hands a failed write back to the main loop.  */
+struct writer
+{
+  pthread_t w_thread;
+  pthread_mutex_t w_lock;
+  pthread_cond_t w_more;	/* Lines or a request were queued.  */
+  pthread_cond_t w_room;	/* Queued lines were written.  */
+  char *w_buf;			/* Ring of queued bytes.  */
+  size_t w_head;		/* Offset of the oldest byte.  */
+  size_t w_len;			/* Number of queued bytes.  */
+  size_t w_hiwat;		/* Largest w_len seen.  */
+  unsigned long w_lines;	/* Lines accepted.  */
+  unsigned long w_drops;	/* Lines lost to a full queue.  */
+  int w_sync;			/* Sync the file once written.  */
+  int w_stop;			/* Exit once the queue is empty.  */
+  int w_error;			/* Errno of a failed write.  */
+};
+#endif
+
 /* This structure represents the files that will have log copies
    printed.  */
 
@@ -185,6 +231,10 @@ struct filed
       char *f_hname;
       struct sockaddr_storage f_addr;
       socklen_t f_addrlen;
+      struct fwdqueue *f_queue;	/* Messages not yet sent.  */
+      int f_fd;			/* Stream socket, if FORW_TCP.  */
+      int f_backoff;		/* Seconds between reconnections.  */
+      time_t f_retry;		/* Time of next connection attempt.  */
     } f_forw;			/* Forwarding address.  */
     char *f_fname;		/* Name use for Files|Pipes|TTYs.  */
   } f_un;
@@ -195,14 +245,37 @@ struct filed
   int f_prognlen;		/* Length of the same.  */
   int f_prevpri;		/* Pri of f_prevline.  */
   int f_prevlen;		/* Length of f_prevline.  */
+  unsigned long long f_prevhash;	/* Hash of f_prevline.  */
   int f_prevcount;		/* Repetition cnt of prevline.  */
   size_t f_repeatcount;		/* Number of "repeated" msgs.  */
   int f_flags;			/* Additional flags see below.  */
+  char *f_obuf;			/* Output buffer for F_FILE, if any.  */
+  size_t f_olen;		/* Bytes waiting in f_obuf.  */
+  long long f_odeadline;	/* Write out f_obuf at this time.  */
+  int f_seq;			/* Position in Files.  */
+  struct writer *f_writer;	/* Output thread, in pipeline mode.  */
 };
 
 struct filed *Files;		/* Linked list of files to log to.  */
 struct filed consfile;		/* Console `file'.  */
 
+/* Dispatch table compiled from Files.  Actions are listed for each
+   facility and priority, in the order of Files.  Actions bound to a
+   program name are instead found by hashing the tag of a message.
+   Each list is terminated by a null pointer.  */
+struct progsel
+{
+  struct progsel *ps_next;	/* Next in hash chain.  */
+  const char *ps_name;		/* Selected program.  */
+  struct filed **ps_files;	/* Actions bound to this program.  */
+};
+
+#define PROGHASH_SIZE	64
+
+struct filed **Dispatch[LOG_NFACILITIES + 1][LOG_PRIMASK + 1];
+struct progsel *ProgHash[PROGHASH_SIZE];
+int DispatchValid;		/* Tables above reflect Files.  */
+
 /* Values for f_type.  */
 #define F_UNUSED	0	/* Unused entry.  */
 #define F_FILE		1	/* Regular file.  */
@@ -230,6 +303,16 @@ const char *TypeNames[] = {
 
 /* Flags in filed.f_flags.  */
 #define OMIT_SYNC	0x001	/* Omit fsync after printing.  */
+#define NEED_SYNC	0x002	/* Written lines await a group commit.  */
+#define FORW_TCP	0x004	/* Forward over TCP, with octet counting.  */
+#define FORW_CONNECTING	0x008	/* TCP connection is in progress.  */
+
+/* Values for Durability.  */
+#define DUR_LINE	0	/* Sync after every line needing it.  */
+#define DUR_GROUP	1	/* One sync covers a whole wakeup.  */
+#define DUR_NONE	2	/* Never sync.  */
+
+#define WRITEBUF_MIN	(4 * MAXLINE)	/* Smallest output buffer.  */
 
 /* Constants for the F_FORW_UNKN retry feature.  */
 #define INET_SUSPEND_TIME 180	/* Number of seconds between attempts.  */
@@ -250,18 +333,81 @@ int repeatinterval[] = { 30, 60 };	/* Number of seconds before flush.  */
 /* Delimiter in arguments to command line options `-s' and `-l'.  */
 #define LIST_DELIMITER	':'
 
+/* Cache of reverse lookups for remote senders.  The table is direct
+   mapped on the sender address, so a colliding address simply replaces
+   the older entry.  Entries are keyed on the address alone, since the
+   source port of a sender changes at will.  */
+struct hostcache
+{
+  int hc_state;			/* Entry state, see below.  */
+  int hc_family;		/* Address family of key.  */
+  unsigned char hc_key[16];	/* IPv4 or IPv6 address.  */
+  time_t hc_expire;		/* Entry is stale after this time.  */
+  char hc_name[NI_MAXHOST];	/* Name, after domain stripping.  */
+};
+
+/* Values for hc_state.  */
+#define HC_EMPTY	0	/* Unused slot.  */
+#define HC_PENDING	1	/* Lookup handed to the resolver.  */
+#define HC_NAME		2	/* Name is known.  */
+#define HC_NONAME	3	/* Address has no name.  */
+
+#define HC_PENDING_TIME	10	/* Seconds to wait for the resolver.  */
+
+/* Messages exchanged with the resolver process.  */
+struct resolve_req
+{
+  struct sockaddr_storage rq_addr;
+  socklen_t rq_addrlen;
+};
+
+struct resolve_rep
+{
+  struct sockaddr_storage rp_addr;
+  socklen_t rp_addrlen;
+  int rp_found;			/* Non-zero if rp_name is valid.  */
+  char rp_name[NI_MAXHOST];
+};
+
 extern int waitdaemon (int nochdir, int noclose, int maxwait);
 
 void cfline (const char *, struct filed *);
 const char *cvthname (struct sockaddr *, socklen_t);
+static char *strip_hostname (char *);
+static struct hostcache *hostcache_slot (struct sockaddr *, int *);
+static void hostcache_stats (void);
+static void start_resolver (void);
+static void resolver_reply (void);
 int decode (const char *, CODE *);
 void die (int);
+void trigger_die (int);
 void doexit (int);
 void domark (int);
+void trigger_mark (int);
 void find_inet_port (const char *);
 void fprintlog (struct filed *, const char *, int, const char *);
+static void buffer_write (struct filed *, struct iovec *, int);
+static int flush_file (struct filed *);
+static int flush_pending (int);
+static long long clock_msec (void);
+static void forw_enqueue (struct filed *, struct iovec *);
+static int forw_flush (struct filed *);
+static void forw_close (struct filed *);
+static int forw_socket (int family);
+static int writer_start (struct filed *);
+static void writer_put (struct filed *, struct iovec *, int, int);
+static void writer_check (struct filed *);
+static void writer_stop (struct filed *);
+static void pipeline_stats (void);
 static int load_conffile (const char *, struct filed **);
 static int load_confdir (const char *, struct filed **);
+static void dispatch_compile (void);
+static void dispatch_free (void);
+static struct filed *dispatch_next (struct filed ***, struct filed ***);
+static int prog_indexable (const char *);
+static const char *timestamp_now (void);
+static unsigned long long msg_hash (const char *, size_t);
+static unsigned int prog_hash (const char *, size_t);
 void init (int);
 void logerror (const char *);
 void logmsg (int, const char *, const char *, int);
@@ -272,11 +418,16 @@ void wallmsg (struct filed *, struct iovec *);
 char **crunch_list (char **oldlist, char *list);
 char *textpri (int pri);
 void dbg_toggle (int);
+void trigger_dbg_toggle (int);
 static void dbg_printf (const char *, ...);
 void trigger_restart (int);
 static void add_funix (const char *path);
 static int create_unix_socket (const char *path);
 static void create_inet_socket (int af, int fd46[2]);
+#ifdef HAVE_RECVMMSG
+static void recv_batch_init (void);
+static int recv_batch (int fd, int inet);
+#endif
 
 char *LocalHostName;		/* Our hostname.  */
 char *LocalDomain;		/* Our local domain name.  */
@@ -293,6 +444,7 @@ int usefamily = AF_INET;	/* Address family for INET services.
 				 * Each of the values `AF_INET' and `AF_INET6'
 				 * produces a single-stacked server.  */
 int finet[2] = {-1, -1};	/* Internet datagram socket fd.  */
+int fforw[2] = {-1, -1};	/* Forwarding sockets, lacking finet.  */
 #define IU_FD_IP4	0	/* Indices for the address families.  */
 #define IU_FD_IP6	1
 int fklog = -1;			/* Kernel log device fd.  */
@@ -316,6 +468,31 @@ time_t now;			/* Time use for mark and forward supending.  */
 int force_sync;			/* GNU/Linux behaviour to sync on every line.
 				   This off by default. Set to 1 to enable.  */
 int set_local_time = 0;		/* Record local time, not message time.  */
+size_t WriteBuffer;		/* Size of output buffers, 0 for none.  */
+int FlushDelay = 1000;		/* Milliseconds data may stay buffered.  */
+int Durability = DUR_LINE;	/* When to sync files to disk.  */
+int Pipeline;			/* Write files from their own threads.  */
+size_t QueueSize = QUEUE_DEFAULT;	/* Ring size of each writer.  */
+int QueueBlock;			/* Wait for room rather than drop.  */
+
+struct hostcache *hostcache;	/* Cache of remote host names.  */
+size_t hostcache_size = 256;	/* Number of slots, zero disables.  */
+int hostcache_ttl = 300;	/* Seconds a known name stays valid.  */
+int hostcache_negttl = 60;	/* Seconds an unknown name stays so.  */
+unsigned long hostcache_hits;	/* Lookups answered by the cache.  */
+unsigned long hostcache_misses;	/* Lookups passed on to the resolver.  */
+int AsyncResolve;		/* Resolve names in a helper process.  */
+int resolver_fd = -1;		/* Socket to the resolver process.  */
+pid_t resolver_pid = -1;	/* Process id of the same.  */
+
+int RecvBatch = 16;		/* Datagrams to read in one system call.  */
+#ifdef HAVE_RECVMMSG
+/* Preallocated ring of receive buffers, used with recvmmsg().  */
+struct mmsghdr *rb_msgs;
+struct iovec *rb_iov;
+struct sockaddr_storage *rb_addr;
+char *rb_buf;
+#endif
 
 const char args_doc[] = "";
 const char doc[] = "Log system messages.";
@@ -325,7 +502,18 @@ enum {
   OPT_NO_FORWARD = 256,
   OPT_NO_KLOG,
   OPT_NO_UNIXAF,
-  OPT_IPANY
+  OPT_IPANY,
+  OPT_ASYNC_RESOLVE,
+  OPT_HOSTNAME_CACHE,
+  OPT_HOSTNAME_TTL,
+  OPT_HOSTNAME_NEGTTL,
+  OPT_RECV_BATCH,
+  OPT_WRITE_BUFFER,
+  OPT_FLUSH_DELAY,
+  OPT_DURABILITY,
+  OPT_PIPELINE,
+  OPT_QUEUE_SIZE,
+  OPT_QUEUE_POLICY
 };
 
 static struct argp_option argp_options[] = {
@@ -367,6 +555,31 @@ static struct argp_option argp_options[] = {
    GRP+1},
   {"sync", 'S', NULL, 0, "force a file sync on every line", GRP+1},
   {"local-time", 'T', NULL, 0, "set local time on received messages", GRP+1},
+  {"async-resolve", OPT_ASYNC_RESOLVE, NULL, 0, "resolve names of remote "
+   "hosts in the background, logging their address meanwhile", GRP+1},
+  {"hostname-cache", OPT_HOSTNAME_CACHE, "SIZE", 0, "cache names of up to "
+   "SIZE remote hosts (default 256, 0 disables caching)", GRP+1},
+  {"hostname-ttl", OPT_HOSTNAME_TTL, "SECS", 0, "keep cached host names "
+   "for SECS seconds (default 300)", GRP+1},
+  {"hostname-negttl", OPT_HOSTNAME_NEGTTL, "SECS", 0, "remember hosts "
+   "without name for SECS seconds (default 60)", GRP+1},
+  {"recv-batch", OPT_RECV_BATCH, "N", 0, "read up to N messages from a "
+   "socket at each wakeup (default 16, 1 disables batching)", GRP+1},
+  {"write-buffer", OPT_WRITE_BUFFER, "SIZE", 0, "buffer up to SIZE bytes "
+   "for each log file (default 0, no buffering)", GRP+1},
+  {"flush-delay", OPT_FLUSH_DELAY, "MSEC", 0, "write out buffered lines "
+   "after at most MSEC milliseconds (default 1000)", GRP+1},
+  {"durability", OPT_DURABILITY, "MODE", 0, "sync files after each `line' "
+   "(default), once per `group' of lines, or `none' at all", GRP+1},
+#if USE_POSIX_THREADS
+  {"pipeline", OPT_PIPELINE, NULL, 0, "write to files, pipes and terminals "
+   "from separate threads", GRP+1},
+  {"queue-size", OPT_QUEUE_SIZE, "SIZE", 0, "queue up to SIZE bytes for "
+   "each output thread (default 65536)", GRP+1},
+  {"queue-policy", OPT_QUEUE_POLICY, "POLICY", 0, "`drop' new lines when "
+   "an output queue is full (default), or `block' until there is room",
+   GRP+1},
+#endif
 #undef GRP
   {NULL, 0, NULL, 0, NULL, 0}
 };
@@ -472,6 +685,87 @@ parse_opt (int key, char *arg, struct argp_state *state)
       set_local_time = 1;
       break;
 
+    case OPT_ASYNC_RESOLVE:
+      AsyncResolve = 1;
+      break;
+
+    case OPT_HOSTNAME_CACHE:
+      v = strtol (arg, &endptr, 10);
+      if (*endptr || v < 0)
+        argp_error (state, "invalid value (`%s' near `%s')", arg, endptr);
+      hostcache_size = v;
+      break;
+
+    case OPT_HOSTNAME_TTL:
+      v = strtol (arg, &endptr, 10);
+      if (*endptr || v < 0)
+        argp_error (state, "invalid value (`%s' near `%s')", arg, endptr);
+      hostcache_ttl = v;
+      break;
+
+    case OPT_HOSTNAME_NEGTTL:
+      v = strtol (arg, &endptr, 10);
+      if (*endptr || v < 0)
+        argp_error (state, "invalid value (`%s' near `%s')", arg, endptr);
+      hostcache_negttl = v;
+      break;
+
+    case OPT_RECV_BATCH:
+      v = strtol (arg, &endptr, 10);
+      if (*endptr || v < 1 || v > RECVBATCH_MAX)
+        argp_error (state, "invalid value (`%s' near `%s')", arg, endptr);
+      RecvBatch = v;
+      break;
+
+    case OPT_WRITE_BUFFER:
+      v = strtol (arg, &endptr, 10);
+      if (*endptr || v < 0)
+        argp_error (state, "invalid value (`%s' near `%s')", arg, endptr);
+      if (v > 0 && v < WRITEBUF_MIN)
+	v = WRITEBUF_MIN;
+      WriteBuffer = v;
+      break;
+
+    case OPT_FLUSH_DELAY:
+      v = strtol (arg, &endptr, 10);
+      if (*endptr || v < 0)
+        argp_error (state, "invalid value (`%s' near `%s')", arg, endptr);
+      FlushDelay = v;
+      break;
+
+    case OPT_DURABILITY:
+      if (strcmp (arg, "line") == 0)
+	Durability = DUR_LINE;
+      else if (strcmp (arg, "group") == 0)
+	Durability = DUR_GROUP;
+      else if (strcmp (arg, "none") == 0)
+	Durability = DUR_NONE;
+      else
+        argp_error (state, "invalid durability mode `%s'", arg);
+      break;
+
+    case OPT_PIPELINE:
+      Pipeline = 1;
+      break;
+
+    case OPT_QUEUE_SIZE:
+      v = strtol (arg, &endptr, 10);
+      if (*endptr || v < 0)
+        argp_error (state, "invalid value (`%s' near `%s')", arg, endptr);
+      if (v < WRITEBUF_MIN)
+	v = WRITEBUF_MIN;
+      QueueSize = v;
+      break;
+
+    case OPT_QUEUE_POLICY:
+      if (strcmp (arg, "drop") == 0)
+	QueueBlock = 0;
+      else if (strcmp (arg, "block") == 0)
+	QueueBlock = 1;
+      else
+        argp_error (state, "invalid queue policy `%s'", arg);
+      break;
+
     default:
       return ARGP_ERR_UNKNOWN;
     }
@@ -576,32 +870,55 @@ main (int argc, char *argv[])
   consfile.f_type = F_CONSOLE;
   consfile.f_un.f_fname = strdup (ctty);
 
-  signal (SIGTERM, die);
-  signal (SIGINT, NoDetach ? die : SIG_IGN);
-  signal (SIGQUIT, NoDetach ? die : SIG_IGN);
+  signal (SIGTERM, trigger_die);
+  signal (SIGINT, NoDetach ? trigger_die : SIG_IGN);
+  signal (SIGQUIT, NoDetach ? trigger_die : SIG_IGN);
 
 #ifdef HAVE_SIGACTION
   /* Register repeatable actions portably!  */
   sa.sa_flags = SA_RESTART;
   sigemptyset (&sa.sa_mask);
 
-  sa.sa_handler = domark;
+  sa.sa_handler = trigger_mark;
   (void) sigaction (SIGALRM, &sa, NULL);
 
-  sa.sa_handler = NoDetach ? dbg_toggle : SIG_IGN;
+  sa.sa_handler = NoDetach ? trigger_dbg_toggle : SIG_IGN;
   (void) sigaction (SIGUSR1, &sa, NULL);
 #else /* !HAVE_SIGACTION */
-  signal (SIGALRM, domark);
-  signal (SIGUSR1, NoDetach ? dbg_toggle : SIG_IGN);
+  signal (SIGALRM, trigger_mark);
+  signal (SIGUSR1, NoDetach ? trigger_dbg_toggle : SIG_IGN);
 #endif
 
   alarm (TIMERINTVL);
 
-  /* We add  3 = 1(klog) + 2(inet,inet6), even if they may stay unused.  */
-  fdarray = (struct pollfd *) malloc ((nfunix + 3) * sizeof (*fdarray));
+  /* We add  4 = 1(klog) + 2(inet,inet6) + 1(resolver),
+     even if they may stay unused.  */
+  fdarray = (struct pollfd *) malloc ((nfunix + 4) * sizeof (*fdarray));
   if (fdarray == NULL)
     error (EXIT_FAILURE, errno, "can't allocate fd table");
 
+  if (hostcache_size)
+    {
+      hostcache = calloc (hostcache_size, sizeof (*hostcache));
+      if (hostcache == NULL)
+	error (EXIT_FAILURE, errno, "can't allocate hostname cache");
+    }
+
+  if (AsyncResolve)
+    {
+      if (hostcache == NULL)
+	error (EXIT_FAILURE, 0, "asynchronous resolving needs a hostname cache");
+
+      /* Fork before any log file or socket is opened.  */
+      start_resolver ();
+      if (resolver_fd >= 0)
+	{
+	  fdarray[nfds].fd = resolver_fd;
+	  fdarray[nfds].events = POLLIN;
+	  nfds++;
+	}
+    }
+
   /* read configuration file */
   init (0);
 
@@ -665,6 +982,11 @@ main (int argc, char *argv[])
 	dbg_printf ("Can't open UDP port: %s\n", strerror (errno));
     }
 
+#ifdef HAVE_RECVMMSG
+  if (RecvBatch > 1)
+    recv_batch_init ();
+#endif
+
   /* Tuck my process id away.  */
   fp = fopen (PidFile, "w");
   if (fp != NULL)
@@ -699,7 +1021,25 @@ main (int argc, char *argv[])
   for (;;)
     {
       int nready;
-      nready = poll (fdarray, nfds, -1);
+
+      /* The handlers of SIGTERM, SIGUSR1 and SIGALRM leave their
+	 work here, where no lock or buffer is held.  */
+      if (dying)
+	die (dying);
+      if (toggle_wanted)
+	{
+	  toggle_wanted = 0;
+	  dbg_toggle (SIGUSR1);
+	}
+      if (mark_wanted)
+	{
+	  mark_wanted = 0;
+	  domark (SIGALRM);
+	}
+
+      /* Lines of the previous wakeup are committed here,
+	 the timeout caters for the oldest buffered line.  */
+      nready = poll (fdarray, nfds, flush_pending (0));
       if (nready == 0)		/* ??  noop */
 	continue;
 
@@ -728,6 +1068,12 @@ main (int argc, char *argv[])
 	    socklen_t len;
 	    if (fdarray[i].fd == -1)
 	      continue;
+	    else if (fdarray[i].fd == resolver_fd)
+	      {
+		resolver_reply ();
+		if (resolver_fd < 0)
+		  fdarray[i].fd = -1;
+	      }
 	    else if (fdarray[i].fd == fklog)
 	      {
 		result = read (fdarray[i].fd, &kline[kline_len],
@@ -806,6 +1152,12 @@ main (int argc, char *argv[])
 		      }
 		  }
 	      }
+#ifdef HAVE_RECVMMSG
+	    else if (rb_msgs != NULL)
+	      recv_batch (fdarray[i].fd,
+			  fdarray[i].fd == finet[IU_FD_IP4]
+			  || fdarray[i].fd == finet[IU_FD_IP6]);
+#endif
 	    else if (fdarray[i].fd == finet[IU_FD_IP4]
 		     || fdarray[i].fd == finet[IU_FD_IP6])
 	      {
@@ -969,6 +1321,68 @@ create_inet_socket (int af, int fd46[2])
   return;
 }
 
+#ifdef HAVE_RECVMMSG
+/* Allocate the receive ring and bind each slot to its buffer.  */
+static void
+recv_batch_init (void)
+{
+  int i;
+
+  rb_msgs = calloc (RecvBatch, sizeof (*rb_msgs));
+  rb_iov = calloc (RecvBatch, sizeof (*rb_iov));
+  rb_addr = calloc (RecvBatch, sizeof (*rb_addr));
+  rb_buf = malloc (RecvBatch * (MAXLINE + 1));
+  if (!rb_msgs || !rb_iov || !rb_addr || !rb_buf)
+    error (EXIT_FAILURE, errno, "can't allocate receive buffers");
+
+  for (i = 0; i < RecvBatch; i++)
+    {
+      rb_iov[i].iov_base = rb_buf + i * (MAXLINE + 1);
+      rb_iov[i].iov_len = MAXLINE;
+      rb_msgs[i].msg_hdr.msg_iov = &rb_iov[i];
+      rb_msgs[i].msg_hdr.msg_iovlen = 1;
+      rb_msgs[i].msg_hdr.msg_name = &rb_addr[i];
+    }
+}
+
+/* Read every pending datagram from FD, up to the size of the ring,
+   with a single system call and dispatch them in order of arrival.
+   INET is non-zero for network sockets, whose senders are looked up.
+   Returns the number of messages read.  */
+static int
+recv_batch (int fd, int inet)
+{
+  int i, n;
+
+  for (i = 0; i < RecvBatch; i++)
+    rb_msgs[i].msg_hdr.msg_namelen = sizeof (rb_addr[i]);
+
+  n = recvmmsg (fd, rb_msgs, RecvBatch, MSG_DONTWAIT, NULL);
+  if (n < 0)
+    {
+      if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+	logerror (inet ? "recvmmsg inet" : "recvmmsg unix");
+      return 0;
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      char *line = rb_iov[i].iov_base;
+
+      if (rb_msgs[i].msg_len == 0)
+	continue;
+      line[rb_msgs[i].msg_len] = '\0';
+
+      if (inet)
+	printline (cvthname ((struct sockaddr *) &rb_addr[i],
+			     rb_msgs[i].msg_hdr.msg_namelen), line);
+      else
+	printline (LocalHostName, line);
+    }
+  return n;
+}
+#endif /* HAVE_RECVMMSG */
+
 char **
 crunch_list (char **oldlist, char *list)
 {
@@ -1154,13 +1568,48 @@ textpri (int pri)
   return res;
 }
 
+/* Return the current time as formatted for log files.  The text
+   is made again only when the second changes.  */
+static const char *
+timestamp_now (void)
+{
+  static time_t stamptime = (time_t) -1;
+  static char stamp[16];
+
+  if (now != stamptime)
+    {
+      memcpy (stamp, ctime (&now) + 4, sizeof (stamp) - 1);
+      stamp[sizeof (stamp) - 1] = '\0';
+      stamptime = now;
+    }
+  return stamp;
+}
+
+/* 64-bit FNV-1a hash of the LEN bytes at MSG.  A line is compared
+   with the last one in full only when the hashes match.  */
+static unsigned long long
+msg_hash (const char *msg, size_t len)
+{
+  unsigned long long h = 14695981039346656037ULL;
+
+  while (len--)
+    {
+      h ^= (unsigned char) *msg++;
+      h *= 1099511628211ULL;
+    }
+  return h;
+}
+
 /* Log a message to the appropriate log files, users, etc. based on
    the priority.  */
 void
 logmsg (int pri, const char *msg, const char *from, int flags)
 {
-  struct filed *f;
+  struct filed *f, **gp, **pp;
+  struct progsel *ps;
   int fac, msglen, prilev;
+  size_t taglen;
+  unsigned long long hash = 0;
 #ifdef HAVE_SIGACTION
   sigset_t sigs, osigs;
 #else
@@ -1189,11 +1638,11 @@ logmsg (int pri, const char *msg, const char *from, int flags)
 
   time (&now);
   if (flags & ADDDATE)
-    timestamp = ctime (&now) + 4;
+    timestamp = timestamp_now ();
   else
     {
       if (set_local_time)
-	timestamp = ctime (&now) + 4;
+	timestamp = timestamp_now ();
       else
 	timestamp = msg;
       msg += 16;
@@ -1229,7 +1678,26 @@ logmsg (int pri, const char *msg, const char *from, int flags)
 #endif
       return;
     }
-  for (f = Files; f; f = f->f_next)
+
+  if (!DispatchValid)
+    dispatch_compile ();
+
+  /* Look up actions selecting the program which sent the message.  */
+  for (taglen = 0; isalnum (msg[taglen])
+	 || msg[taglen] == '-' || msg[taglen] == '_'; taglen++)
+    ;
+  for (ps = ProgHash[prog_hash (msg, taglen)]; ps; ps = ps->ps_next)
+    if (strncmp (ps->ps_name, msg, taglen) == 0 && !ps->ps_name[taglen])
+      break;
+
+  gp = fac <= LOG_NFACILITIES ? Dispatch[fac][prilev] : NULL;
+  pp = ps ? ps->ps_files : NULL;
+
+  /* Lines are compared by their hash first, computed only once.  */
+  if ((flags & MARK) == 0 && msglen < MAXSVLINE)
+    hash = msg_hash (msg, msglen);
+
+  while ((f = dispatch_next (&gp, &pp)) != NULL)
     {
       /* Skip messages that are incorrect priority. */
       if (!(f->f_pmask[fac] & LOG_MASK (prilev)))
@@ -1263,9 +1731,10 @@ logmsg (int pri, const char *msg, const char *from, int flags)
 
       /* Suppress duplicate lines to this file.  */
       if ((flags & MARK) == 0 && msglen == f->f_prevlen && f->f_prevhost
-	  && !strcmp (msg, f->f_prevline) && !strcmp (from, f->f_prevhost))
+	  && hash == f->f_prevhash && !memcmp (msg, f->f_prevline, msglen)
+	  && !strcmp (from, f->f_prevhost))
 	{
-	  strncpy (f->f_lasttime, timestamp, sizeof (f->f_lasttime) - 1);
+	  memcpy (f->f_lasttime, timestamp, sizeof (f->f_lasttime) - 1);
 	  f->f_prevcount++;
 	  dbg_printf ("msg repeated %d times, %ld sec of %d\n",
 		      f->f_prevcount, now - f->f_time,
@@ -1285,22 +1754,25 @@ logmsg (int pri, const char *msg, const char *from, int flags)
 	  if (f->f_prevcount)
 	    fprintlog (f, from, 0, (char *) NULL);
 	  f->f_repeatcount = 0;
-	  strncpy (f->f_lasttime, timestamp, sizeof (f->f_lasttime) - 1);
-	  free (f->f_prevhost);
-	  f->f_prevhost = strdup (from);
+	  memcpy (f->f_lasttime, timestamp, sizeof (f->f_lasttime) - 1);
+	  if (f->f_prevhost == NULL || strcmp (from, f->f_prevhost))
+	    {
+	      free (f->f_prevhost);
+	      f->f_prevhost = strdup (from);
+	    }
+	  f->f_prevpri = pri;
 	  if (msglen < MAXSVLINE)
 	    {
 	      f->f_prevlen = msglen;
-	      f->f_prevpri = pri;
-	      strcpy (f->f_prevline, msg);
-	      fprintlog (f, from, flags, (char *) NULL);
+	      memcpy (f->f_prevline, msg, msglen + 1);
 	    }
 	  else
 	    {
 	      f->f_prevline[0] = 0;
 	      f->f_prevlen = 0;
-	      fprintlog (f, from, flags, msg);
 	    }
+	  f->f_prevhash = hash;
+	  fprintlog (f, from, flags, msg);
 	}
     }
 #ifdef HAVE_SIGACTION
@@ -1315,8 +1787,7 @@ fprintlog (struct filed *f, const char *from, int flags, const char *msg)
 {
   struct iovec iov[IOVCNT];
   struct iovec *v;
-  int l;
-  char line[MAXLINE + 1], repbuf[80], greetings[200];
+  char repbuf[80], greetings[200];
   time_t fwd_suspend;
 
   v = iov;
@@ -1422,6 +1893,8 @@ fprintlog (struct filed *f, const char *from, int flags, const char *msg)
 		  f->f_type = F_UNUSED;
 		  free (f->f_un.f_forw.f_hname);
 		  f->f_un.f_forw.f_hname = NULL;
+		  free (f->f_un.f_forw.f_queue);
+		  f->f_un.f_forw.f_queue = NULL;
 		}
 	    }
 	  else
@@ -1449,73 +1922,8 @@ fprintlog (struct filed *f, const char *from, int flags, const char *msg)
 	dbg_printf ("Not forwarding because forwarding is disabled.\n");
       else
 	{
-	  int temp_finet, *pfinet;	/* PFINET points to active fd.  */
-
-	  if (f->f_un.f_forw.f_addr.ss_family == AF_INET)
-	    pfinet = &finet[IU_FD_IP4];
-	  else	/* AF_INET6 */
-	    pfinet = &finet[IU_FD_IP6];
-
-	  temp_finet = *pfinet;
-
-	  if (temp_finet < 0)
-	    {
-	      int err;
-	      struct addrinfo hints, *rp;
-
-	      /* Forwarding needs a temporary socket.
-	       * The source port is fixed!  */
-	      memset (&hints, 0, sizeof (hints));
-	      hints.ai_family = f->f_un.f_forw.f_addr.ss_family;
-	      hints.ai_socktype = SOCK_DGRAM;
-	      hints.ai_flags = AI_PASSIVE;
-
-	      err = getaddrinfo (NULL, LogForwardPort, &hints, &rp);
-	      if (err)
-		{
-		  dbg_printf ("Not forwarding due to lookup failure: %s.\n",
-			      gai_strerror(err));
-		  break;
-		}
-	      temp_finet = socket (rp->ai_family, rp->ai_socktype,
-				   rp->ai_protocol);
-	      if (temp_finet < 0)
-		{
-		  dbg_printf ("Not forwarding due to socket failure.\n");
-		  freeaddrinfo (rp);
-		  break;
-		}
-
-	      err = bind (temp_finet, rp->ai_addr, rp->ai_addrlen);
-	      freeaddrinfo (rp);
-	      if (err)
-		{
-		  dbg_printf ("Not forwarding due to bind error: %s.\n",
-			      strerror (errno));
-		  break;
-		}
-	    } /* Creation of temporary outgoing socket since "finet < 0" */
-
 	  f->f_time = now;
-	  snprintf (line, sizeof (line), "<%d>%.15s %s",
-		    f->f_prevpri, (char *) iov[0].iov_base,
-		    (char *) iov[4].iov_base);
-	  l = strlen (line);
-	  if (l > MAXLINE)
-	    l = MAXLINE;
-	  if (sendto (temp_finet, line, l, 0,
-		      (struct sockaddr *) &f->f_un.f_forw.f_addr,
-		      f->f_un.f_forw.f_addrlen) != l)
-	    {
-	      int e = errno;
-	      dbg_printf ("INET sendto error: %d = %s.\n", e, strerror (e));
-	      f->f_type = F_FORW_SUSP;
-	      errno = e;
-	      logerror ("sendto");
-	    }
-
-	  if (*pfinet < 0)
-	    close (temp_finet);	/* Only temporary socket may be closed.  */
+	  forw_enqueue (f, iov);
 	}
       break;
 
@@ -1542,6 +1950,27 @@ fprintlog (struct filed *f, const char *from, int flags, const char *msg)
 	  v->iov_base = (char *) "\n";
 	  v->iov_len = 1;
 	}
+      if (f->f_writer)
+	{
+	  writer_put (f, iov, IOVCNT,
+		      f->f_type == F_FILE && (flags & SYNC_FILE)
+		      && !(f->f_flags & OMIT_SYNC) && Durability != DUR_NONE);
+	  break;
+	}
+      if (f->f_obuf)
+	{
+	  buffer_write (f, iov, IOVCNT);
+	  if (f->f_type == F_FILE && (flags & SYNC_FILE)
+	      && !(f->f_flags & OMIT_SYNC) && Durability != DUR_NONE)
+	    {
+	      /* Commit with the present wakeup, or at once.  */
+	      f->f_flags |= NEED_SYNC;
+	      f->f_odeadline = 0;
+	      if (Durability == DUR_LINE)
+		flush_file (f);
+	    }
+	  break;
+	}
     again:
       if (writev (f->f_file, iov, IOVCNT) < 0)
 	{
@@ -1577,7 +2006,12 @@ fprintlog (struct filed *f, const char *from, int flags, const char *msg)
 	    }
 	}
       else if ((flags & SYNC_FILE) && !(f->f_flags & OMIT_SYNC))
-	fsync (f->f_file);
+	{
+	  if (Durability == DUR_LINE)
+	    fsync (f->f_file);
+	  else if (Durability == DUR_GROUP)
+	    f->f_flags |= NEED_SYNC;
+	}
       break;
 
     case F_USERS:
@@ -1594,84 +2028,865 @@ fprintlog (struct filed *f, const char *from, int flags, const char *msg)
     f->f_prevcount = 0;
 }
 
-/* Write the specified message to either the entire world,
- * or to a list of approved users.  */
-void
-wallmsg (struct filed *f, struct iovec *iov)
+/* Append a formatted line to the output buffer of F,
+   making room by writing out older lines if necessary.  */
+static void
+buffer_write (struct filed *f, struct iovec *iov, int iovcnt)
 {
-  static int reenter;		/* Avoid calling ourselves.  */
-  STRUCT_UTMP *utp;
-#if defined UTMP_NAME_FUNCTION || !defined HAVE_GETUTXENT
-  STRUCT_UTMP *utmpbuf;
-  size_t utmp_count;
-#endif /* UTMP_NAME_FUNCTION || !HAVE_GETUTXENT */
   int i;
-  char *p;
-  char line[sizeof (utp->ut_line) + 1];
+  size_t len = 0;
 
-  if (reenter++)
+  for (i = 0; i < iovcnt; i++)
+    len += iov[i].iov_len;
+
+  if (f->f_olen + len > WriteBuffer && flush_file (f) < 0)
     return;
 
-#if !defined UTMP_NAME_FUNCTION && defined HAVE_GETUTXENT
-  setutxent ();
+  if (f->f_olen == 0)
+    f->f_odeadline = clock_msec () + FlushDelay;
 
-  while ((utp = getutxent ()))
-#else /* UTMP_NAME_FUNCTION || !HAVE_GETUTXENT */
-  if (read_utmp (UTMP_FILE, &utmp_count, &utmpbuf,
-		 READ_UTMP_USER_PROCESS | READ_UTMP_CHECK_PIDS) < 0)
+  for (i = 0; i < iovcnt; i++)
     {
-      logerror ("opening utmp file");
-      return;
+      memcpy (f->f_obuf + f->f_olen, iov[i].iov_base, iov[i].iov_len);
+      f->f_olen += iov[i].iov_len;
     }
+}
 
-  for (utp = utmpbuf; utp < utmpbuf + utmp_count; utp++)
-#endif /* UTMP_NAME_FUNCTION || !HAVE_GETUTXENT */
+/* Write out the buffered lines of F, then sync the file if a
+   group commit is due.  Returns -1 if the file had to be given up.  */
+static int
+flush_file (struct filed *f)
+{
+  size_t off = 0;
+  ssize_t n;
+
+  while (off < f->f_olen)
     {
-      strncpy (line, utp->ut_line, sizeof (utp->ut_line));
-      line[sizeof (utp->ut_line)] = '\0';
-      if (f->f_type == F_WALL)
+      n = write (f->f_file, f->f_obuf + off, f->f_olen - off);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n <= 0)
 	{
-	  /* Note we're using our own version of ttymsg
-	     which does a double fork () to not have
-	     zombies.  No need to waitpid().  */
-	  p = ttymsg (iov, IOVCNT, line, TTYMSGTIME);
-	  if (p != NULL)
-	    {
-	      errno = 0;	/* Already in message. */
-	      logerror (p);
-	    }
-	  continue;
+	  int e = errno;
+
+	  close (f->f_file);
+	  f->f_type = F_UNUSED;
+	  f->f_olen = 0;
+	  f->f_flags &= ~NEED_SYNC;
+	  errno = e;
+	  logerror (f->f_un.f_fname);
+	  free (f->f_un.f_fname);
+	  f->f_un.f_fname = NULL;
+	  return -1;
 	}
-      /* Should we send the message to this user? */
-      for (i = 0; i < f->f_un.f_user.f_nusers; i++)
-	if (!strncmp (f->f_un.f_user.f_unames[i], UT_USER (utp),
-		      sizeof (UT_USER (utp))))
-	  {
-	    p = ttymsg (iov, IOVCNT, line, TTYMSGTIME);
-	    if (p != NULL)
-	      {
-		errno = 0;	/* Already in message. */
-		logerror (p);
-	      }
-	    break;
-	  }
+      off += n;
     }
-#if defined UTMP_NAME_FUNCTION || !defined HAVE_GETUTXENT
-  free (utmpbuf);
-#else /* !UTMP_NAME_FUNCTION && HAVE_GETUTXENT */
-  endutxent ();
+  f->f_olen = 0;
+
+  if (f->f_flags & NEED_SYNC)
+    {
+#ifdef HAVE_FDATASYNC
+      fdatasync (f->f_file);
+#else
+      fsync (f->f_file);
 #endif
-  reenter = 0;
+      f->f_flags &= ~NEED_SYNC;
+    }
+  return 0;
 }
 
-/* Return a printable representation of a host address.  */
-const char *
-cvthname (struct sockaddr *f, socklen_t len)
+/* Write out buffers whose deadline has passed, or all of them if
+   FORCE is set, and sync every file with pending commits.  Queued
+   messages are forwarded.  Returns the number of milliseconds until
+   the next deadline, or -1.  */
+static int
+flush_pending (int force)
 {
-  int err;
-  char *p;
+  struct filed *f;
+  long long t, next = -1;
+#ifdef HAVE_SIGACTION
+  sigset_t sigs, osigs;
+#else
+  int omask;
+#endif
 
-  err = getnameinfo (f, len, addrstr, sizeof (addrstr),
+#ifdef HAVE_SIGACTION
+  sigemptyset (&sigs);
+  sigaddset (&sigs, SIGHUP);
+  sigaddset (&sigs, SIGALRM);
+  sigprocmask (SIG_BLOCK, &sigs, &osigs);
+#else
+  omask = sigblock (sigmask (SIGHUP) | sigmask (SIGALRM));
+#endif
+
+  t = clock_msec ();
+  for (f = Files; f; f = f->f_next)
+    {
+      if (f->f_type == F_FORW)
+	{
+	  int wait = forw_flush (f);
+
+	  if (wait >= 0 && (next < 0 || wait < next))
+	    next = wait;
+	  continue;
+	}
+
+      if (f->f_writer)
+	{
+	  writer_check (f);
+	  continue;
+	}
+
+      if (f->f_type != F_FILE)
+	continue;
+
+      if (f->f_olen && (force || f->f_odeadline <= t))
+	flush_file (f);
+      else if (f->f_olen)
+	{
+	  if (next < 0 || f->f_odeadline - t < next)
+	    next = f->f_odeadline - t;
+	}
+      else if (f->f_flags & NEED_SYNC)
+	flush_file (f);
+    }
+
+#ifdef HAVE_SIGACTION
+  sigprocmask (SIG_SETMASK, &osigs, 0);
+#else
+  sigsetmask (omask);
+#endif
+
+  return (int) next;
+}
+
+/* Milliseconds on a clock that is never set back, for the flush
+   deadlines.  */
+static long long
+clock_msec (void)
+{
+#if defined HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+#if USE_POSIX_THREADS
+/* Write LEN bytes at BUF to the file of F, from its writer thread.
+   A terminal that went away is reopened, and a full pipe is waited
+   for.  Returns the number of bytes consumed, or -1.  */
+static ssize_t
+writer_write (struct filed *f, const char *buf, size_t len)
+{
+  struct writer *w = f->f_writer;
+  struct pollfd pfd;
+  ssize_t n;
+  int stop;
+
+  for (;;)
+    {
+      n = write (f->f_file, buf, len);
+      if (n > 0)
+	return n;
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n < 0 && errno == EAGAIN && f->f_type == F_PIPE)
+	{
+	  /* When exiting, drop what the pipe refuses.  */
+	  pthread_mutex_lock (&w->w_lock);
+	  stop = w->w_stop;
+	  pthread_mutex_unlock (&w->w_lock);
+	  if (stop)
+	    return len;
+
+	  pfd.fd = f->f_file;
+	  pfd.events = POLLOUT;
+	  poll (&pfd, 1, 100);
+	  continue;
+	}
+      if (n < 0 && (errno == EIO || errno == EBADF)
+	  && (f->f_type == F_TTY || f->f_type == F_CONSOLE))
+	{
+	  close (f->f_file);
+	  f->f_file = open (f->f_un.f_fname, O_WRONLY | O_APPEND, 0);
+	  if (f->f_file >= 0)
+	    continue;
+	}
+      if (n == 0)
+	errno = EIO;
+      return -1;
+    }
+}
+
+/* Main function of a writer thread.  */
+static void *
+writer_run (void *arg)
+{
+  struct filed *f = arg;
+  struct writer *w = f->f_writer;
+  size_t chunk;
+  ssize_t n;
+
+  pthread_mutex_lock (&w->w_lock);
+  for (;;)
+    {
+      while (w->w_len == 0 && !w->w_sync && !w->w_stop)
+	pthread_cond_wait (&w->w_more, &w->w_lock);
+
+      if (w->w_len == 0)
+	{
+	  if (!w->w_sync)
+	    break;		/* Stopped and drained.  */
+	  w->w_sync = 0;
+	  pthread_mutex_unlock (&w->w_lock);
+#ifdef HAVE_FDATASYNC
+	  fdatasync (f->f_file);
+#else
+	  fsync (f->f_file);
+#endif
+	  pthread_mutex_lock (&w->w_lock);
+	  continue;
+	}
+
+      /* The queued bytes are not touched by the main loop,
+         so they can be written without holding the lock.  */
+      chunk = w->w_len;
+      if (chunk > QueueSize - w->w_head)
+	chunk = QueueSize - w->w_head;
+      pthread_mutex_unlock (&w->w_lock);
+
+      n = writer_write (f, w->w_buf + w->w_head, chunk);
+
+      pthread_mutex_lock (&w->w_lock);
+      if (n < 0)
+	{
+	  w->w_error = errno;
+	  w->w_len = 0;
+	  w->w_sync = 0;
+	  pthread_cond_broadcast (&w->w_room);
+	  break;
+	}
+      w->w_head = (w->w_head + n) % QueueSize;
+      w->w_len -= n;
+      pthread_cond_broadcast (&w->w_room);
+    }
+  pthread_mutex_unlock (&w->w_lock);
+
+  return NULL;
+}
+
+/* Give F an output thread.  Returns -1 if F has to be written
+   directly.  */
+static int
+writer_start (struct filed *f)
+{
+  struct writer *w;
+  sigset_t sigs, osigs;
+  int err;
+
+  w = calloc (1, sizeof (*w));
+  if (w)
+    w->w_buf = malloc (QueueSize);
+  if (w == NULL || w->w_buf == NULL)
+    {
+      free (w);
+      logerror ("Cannot allocate output queue");
+      return -1;
+    }
+  pthread_mutex_init (&w->w_lock, NULL);
+  pthread_cond_init (&w->w_more, NULL);
+  pthread_cond_init (&w->w_room, NULL);
+  f->f_writer = w;
+
+  /* Signals are for the main loop only.  */
+  sigfillset (&sigs);
+  pthread_sigmask (SIG_SETMASK, &sigs, &osigs);
+  err = pthread_create (&w->w_thread, NULL, writer_run, f);
+  pthread_sigmask (SIG_SETMASK, &osigs, NULL);
+
+  if (err)
+    {
+      f->f_writer = NULL;
+      pthread_mutex_destroy (&w->w_lock);
+      pthread_cond_destroy (&w->w_more);
+      pthread_cond_destroy (&w->w_room);
+      free (w->w_buf);
+      free (w);
+      errno = err;
+      logerror ("Cannot start output thread");
+      return -1;
+    }
+  return 0;
+}
+
+/* Queue a formatted line for the thread of F, requesting a sync
+   after it if SYNC is set.  A full queue drops the line, unless
+   QueueBlock has us wait for room.  */
+static void
+writer_put (struct filed *f, struct iovec *iov, int iovcnt, int sync)
+{
+  struct writer *w = f->f_writer;
+  size_t len = 0, tail, part;
+  int i;
+
+  for (i = 0; i < iovcnt; i++)
+    len += iov[i].iov_len;
+
+  pthread_mutex_lock (&w->w_lock);
+
+  /* The thread is draining its queue to exit, and may be gone before
+     it would see this line, so it is written here instead.  */
+  if (w->w_stop)
+    {
+      pthread_mutex_unlock (&w->w_lock);
+      if (writev (f->f_file, iov, iovcnt) < 0)
+	{
+	  pthread_mutex_lock (&w->w_lock);
+	  w->w_drops++;
+	  pthread_mutex_unlock (&w->w_lock);
+	}
+      return;
+    }
+
+  while (QueueBlock && w->w_len + len > QueueSize && !w->w_error)
+    pthread_cond_wait (&w->w_room, &w->w_lock);
+
+  if (w->w_error || w->w_len + len > QueueSize)
+    {
+      w->w_drops++;
+      pthread_mutex_unlock (&w->w_lock);
+      return;
+    }
+
+  tail = (w->w_head + w->w_len) % QueueSize;
+  for (i = 0; i < iovcnt; i++)
+    {
+      const char *p = iov[i].iov_base;
+      size_t n = iov[i].iov_len;
+
+      while (n > 0)
+	{
+	  part = QueueSize - tail;
+	  if (part > n)
+	    part = n;
+	  memcpy (w->w_buf + tail, p, part);
+	  tail = (tail + part) % QueueSize;
+	  p += part;
+	  n -= part;
+	}
+    }
+
+  w->w_len += len;
+  if (w->w_len > w->w_hiwat)
+    w->w_hiwat = w->w_len;
+  w->w_lines++;
+  if (sync)
+    w->w_sync = 1;
+  pthread_cond_signal (&w->w_more);
+  pthread_mutex_unlock (&w->w_lock);
+}
+
+/* Give up F if its thread failed to write.  */
+static void
+writer_check (struct filed *f)
+{
+  struct writer *w = f->f_writer;
+  int err;
+
+  pthread_mutex_lock (&w->w_lock);
+  err = w->w_error;
+  pthread_mutex_unlock (&w->w_lock);
+
+  if (err)
+    writer_stop (f);
+}
+
+/* Let the thread of F write out its queue, and wait for it to exit.
+   If a write failed, F is given up.  */
+static void
+writer_stop (struct filed *f)
+{
+  struct writer *w = f->f_writer;
+  int err;
+
+  pthread_mutex_lock (&w->w_lock);
+  w->w_stop = 1;
+  pthread_cond_signal (&w->w_more);
+  pthread_mutex_unlock (&w->w_lock);
+  pthread_join (w->w_thread, NULL);
+
+  err = w->w_error;
+  f->f_writer = NULL;
+  pthread_mutex_destroy (&w->w_lock);
+  pthread_cond_destroy (&w->w_more);
+  pthread_cond_destroy (&w->w_room);
+  free (w->w_buf);
+  free (w);
+
+  if (err)
+    {
+      if (f->f_file >= 0)
+	close (f->f_file);
+      f->f_type = F_UNUSED;
+      errno = err;
+      logerror (f->f_un.f_fname);
+      free (f->f_un.f_fname);
+      f->f_un.f_fname = NULL;
+    }
+}
+
+/* Print the state of the output queues.  */
+static void
+pipeline_stats (void)
+{
+  struct filed *f;
+  struct writer *w;
+
+  for (f = Files; f; f = f->f_next)
+    {
+      w = f->f_writer;
+      if (w == NULL)
+	continue;
+      pthread_mutex_lock (&w->w_lock);
+      dbg_printf ("Queue %s: %lu bytes, %lu at most, "
+		  "%lu lines, %lu dropped\n", f->f_un.f_fname,
+		  (unsigned long) w->w_len, (unsigned long) w->w_hiwat,
+		  w->w_lines, w->w_drops);
+      pthread_mutex_unlock (&w->w_lock);
+    }
+}
+#else /* !USE_POSIX_THREADS */
+static int
+writer_start (struct filed *f _GL_UNUSED_PARAMETER)
+{
+  return -1;
+}
+
+static void
+writer_put (struct filed *f _GL_UNUSED_PARAMETER,
+	    struct iovec *iov _GL_UNUSED_PARAMETER,
+	    int iovcnt _GL_UNUSED_PARAMETER, int sync _GL_UNUSED_PARAMETER)
+{
+}
+
+static void
+writer_check (struct filed *f _GL_UNUSED_PARAMETER)
+{
+}
+
+static void
+writer_stop (struct filed *f _GL_UNUSED_PARAMETER)
+{
+}
+
+static void
+pipeline_stats (void)
+{
+}
+#endif /* !USE_POSIX_THREADS */
+
+/* Return a socket for forwarding datagrams to FAMILY.  The listening
+   socket is used if there is one.  Otherwise a socket is created once
+   and kept, bound like the listener to the syslog port.  */
+static int
+forw_socket (int family)
+{
+  int err, idx = (family == AF_INET) ? IU_FD_IP4 : IU_FD_IP6;
+  struct addrinfo hints, *rp;
+
+  if (finet[idx] >= 0)
+    return finet[idx];
+  if (fforw[idx] >= 0)
+    return fforw[idx];
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = family;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  err = getaddrinfo (NULL, LogForwardPort, &hints, &rp);
+  if (err)
+    {
+      dbg_printf ("Not forwarding due to lookup failure: %s.\n",
+		  gai_strerror (err));
+      return -1;
+    }
+
+  fforw[idx] = socket (rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+  if (fforw[idx] < 0)
+    dbg_printf ("Not forwarding due to socket failure.\n");
+  else if (bind (fforw[idx], rp->ai_addr, rp->ai_addrlen) < 0)
+    {
+      dbg_printf ("Not forwarding due to bind error: %s.\n",
+		  strerror (errno));
+      close (fforw[idx]);
+      fforw[idx] = -1;
+    }
+  freeaddrinfo (rp);
+
+  return fforw[idx];
+}
+
+/* Format the message described by IOV for forwarding and put it
+   last in the queue of F.  A full queue first tries to send, and
+   then gives up its oldest message.  */
+static void
+forw_enqueue (struct filed *f, struct iovec *iov)
+{
+  struct fwdqueue *q = f->f_un.f_forw.f_queue;
+  char pribuf[16], *bp, *end;
+  size_t len, msglen, n;
+  int pri = f->f_prevpri;
+
+  if (q->q_count == FWDQUEUE_LEN)
+    forw_flush (f);
+  if (q->q_count == FWDQUEUE_LEN)
+    {
+      int next = (q->q_head + 1) % FWDQUEUE_LEN;
+
+      /* Drop the oldest message, unless part of it is in the stream
+	 already: the rest must follow, or the frame would be broken,
+	 so the one after it goes instead.  */
+      if (q->q_off > 0)
+	{
+	  memcpy (q->q_buf[next], q->q_buf[q->q_head],
+		  q->q_len[q->q_head]);
+	  q->q_len[next] = q->q_len[q->q_head];
+	}
+      q->q_head = next;
+      q->q_count--;
+      q->q_drops++;
+    }
+
+  /* The priority is the only number to print, do it by hand.  */
+  bp = pribuf + sizeof (pribuf);
+  *--bp = '>';
+  do
+    *--bp = '0' + pri % 10;
+  while ((pri /= 10) > 0);
+  *--bp = '<';
+  n = pribuf + sizeof (pribuf) - bp;
+
+  /* Compose "<PRI>TIMESTAMP MSG", cut to MAXLINE.  */
+  msglen = iov[4].iov_len;
+  len = n + 15 + 1 + msglen;
+  if (len > MAXLINE)
+    {
+      msglen -= len - MAXLINE;
+      len = MAXLINE;
+    }
+
+  bp = q->q_buf[(q->q_head + q->q_count) % FWDQUEUE_LEN];
+  end = bp;
+  if (f->f_flags & FORW_TCP)
+    end += sprintf (bp, "%lu ", (unsigned long) len);
+
+  memcpy (end, pribuf + sizeof (pribuf) - n, n);
+  end += n;
+  memcpy (end, iov[0].iov_base, 15);
+  end += 15;
+  *end++ = ' ';
+  memcpy (end, iov[4].iov_base, msglen);
+  end += msglen;
+
+  q->q_len[(q->q_head + q->q_count) % FWDQUEUE_LEN] = end - bp;
+  q->q_count++;
+}
+
+/* Give up the stream of F, and schedule the next attempt.  */
+static void
+forw_close (struct filed *f)
+{
+  if (f->f_un.f_forw.f_fd >= 0)
+    close (f->f_un.f_forw.f_fd);
+  f->f_un.f_forw.f_fd = -1;
+  f->f_flags &= ~FORW_CONNECTING;
+  if (f->f_un.f_forw.f_queue)
+    f->f_un.f_forw.f_queue->q_off = 0;	/* Resend the whole message.  */
+
+  if (f->f_un.f_forw.f_backoff == 0)
+    f->f_un.f_forw.f_backoff = 1;
+  else if (f->f_un.f_forw.f_backoff < INET_SUSPEND_TIME)
+    f->f_un.f_forw.f_backoff *= 2;
+  if (f->f_un.f_forw.f_backoff > INET_SUSPEND_TIME)
+    f->f_un.f_forw.f_backoff = INET_SUSPEND_TIME;
+  f->f_un.f_forw.f_retry = time (NULL) + f->f_un.f_forw.f_backoff;
+
+  dbg_printf ("Reconnecting to %s in %d seconds.\n",
+	      f->f_un.f_forw.f_hname, f->f_un.f_forw.f_backoff);
+}
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+/* Send the queued messages of F.  Datagrams leave in one sendmmsg()
+   call, and a stream is written with one gathering send.  Returns
+   the number of milliseconds to wait before the next attempt, or -1
+   if the queue is empty.  */
+static int
+forw_flush (struct filed *f)
+{
+  struct fwdqueue *q = f->f_un.f_forw.f_queue;
+  int i, n, slot;
+
+  if (q == NULL || q->q_count == 0)
+    return -1;
+
+  if (q->q_drops)
+    {
+      dbg_printf ("Dropped %lu messages to %s.\n",
+		  q->q_drops, f->f_un.f_forw.f_hname);
+      q->q_drops = 0;
+    }
+
+  if (!(f->f_flags & FORW_TCP))
+    {
+      int fd = forw_socket (f->f_un.f_forw.f_addr.ss_family);
+#ifdef HAVE_SENDMMSG
+      struct mmsghdr msgs[FWDQUEUE_LEN];
+      struct iovec iov[FWDQUEUE_LEN];
+#endif
+
+      if (fd < 0)
+	{
+	  q->q_count = 0;
+	  return -1;
+	}
+
+      while (q->q_count)
+	{
+#ifdef HAVE_SENDMMSG
+	  memset (msgs, 0, q->q_count * sizeof (msgs[0]));
+	  for (i = 0; i < q->q_count; i++)
+	    {
+	      slot = (q->q_head + i) % FWDQUEUE_LEN;
+	      iov[i].iov_base = q->q_buf[slot];
+	      iov[i].iov_len = q->q_len[slot];
+	      msgs[i].msg_hdr.msg_iov = &iov[i];
+	      msgs[i].msg_hdr.msg_iovlen = 1;
+	      msgs[i].msg_hdr.msg_name = &f->f_un.f_forw.f_addr;
+	      msgs[i].msg_hdr.msg_namelen = f->f_un.f_forw.f_addrlen;
+	    }
+	  n = sendmmsg (fd, msgs, q->q_count, MSG_DONTWAIT);
+#else /* !HAVE_SENDMMSG */
+	  slot = q->q_head;
+	  n = sendto (fd, q->q_buf[slot], q->q_len[slot], MSG_DONTWAIT,
+		      (struct sockaddr *) &f->f_un.f_forw.f_addr,
+		      f->f_un.f_forw.f_addrlen) < 0 ? -1 : 1;
+#endif
+	  if (n < 0)
+	    {
+	      int e = errno;
+
+	      if (e == EAGAIN || e == EWOULDBLOCK || e == ENOBUFS)
+		return FWDRETRY_MSEC;
+	      if (e == EINTR)
+		continue;
+
+	      dbg_printf ("INET sendto error: %d = %s.\n", e, strerror (e));
+	      q->q_count = 0;
+	      f->f_type = F_FORW_SUSP;
+	      f->f_time = now;
+	      errno = e;
+	      logerror ("sendto");
+	      return -1;
+	    }
+	  q->q_head = (q->q_head + n) % FWDQUEUE_LEN;
+	  q->q_count -= n;
+	}
+      return -1;
+    }
+
+  /* Forwarding over TCP.  */
+  if (f->f_un.f_forw.f_fd < 0)
+    {
+      time_t t = time (NULL);
+      int fd;
+
+      if (t < f->f_un.f_forw.f_retry)
+	return (f->f_un.f_forw.f_retry - t) * 1000;
+
+      fd = socket (f->f_un.f_forw.f_addr.ss_family, SOCK_STREAM, 0);
+      if (fd < 0)
+	{
+	  forw_close (f);
+	  return f->f_un.f_forw.f_backoff * 1000;
+	}
+      fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+      f->f_un.f_forw.f_fd = fd;
+
+      if (connect (fd, (struct sockaddr *) &f->f_un.f_forw.f_addr,
+		   f->f_un.f_forw.f_addrlen) < 0)
+	{
+	  if (errno != EINPROGRESS)
+	    {
+	      dbg_printf ("Connection to %s failed: %s.\n",
+			  f->f_un.f_forw.f_hname, strerror (errno));
+	      forw_close (f);
+	      return f->f_un.f_forw.f_backoff * 1000;
+	    }
+	  f->f_flags |= FORW_CONNECTING;
+	}
+    }
+
+  if (f->f_flags & FORW_CONNECTING)
+    {
+      struct pollfd pfd;
+      int err = 0;
+      socklen_t errlen = sizeof (err);
+
+      pfd.fd = f->f_un.f_forw.f_fd;
+      pfd.events = POLLOUT;
+      if (poll (&pfd, 1, 0) <= 0)
+	return FWDRETRY_MSEC;
+
+      if (getsockopt (pfd.fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0
+	  || err)
+	{
+	  dbg_printf ("Connection to %s failed: %s.\n",
+		      f->f_un.f_forw.f_hname, strerror (err ? err : errno));
+	  forw_close (f);
+	  return f->f_un.f_forw.f_backoff * 1000;
+	}
+      f->f_flags &= ~FORW_CONNECTING;
+    }
+  f->f_un.f_forw.f_backoff = 0;
+
+  while (q->q_count)
+    {
+      struct iovec iov[FWDQUEUE_LEN];
+      struct msghdr mh;
+      ssize_t sent;
+
+      for (i = 0; i < q->q_count; i++)
+	{
+	  slot = (q->q_head + i) % FWDQUEUE_LEN;
+	  iov[i].iov_base = q->q_buf[slot];
+	  iov[i].iov_len = q->q_len[slot];
+	}
+      iov[0].iov_base = (char *) iov[0].iov_base + q->q_off;
+      iov[0].iov_len -= q->q_off;
+
+      memset (&mh, 0, sizeof (mh));
+      mh.msg_iov = iov;
+      mh.msg_iovlen = q->q_count;
+
+      sent = sendmsg (f->f_un.f_forw.f_fd, &mh, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (sent < 0)
+	{
+	  if (errno == EAGAIN || errno == EWOULDBLOCK)
+	    return FWDRETRY_MSEC;
+	  if (errno == EINTR)
+	    continue;
+	  dbg_printf ("Lost connection to %s: %s.\n",
+		      f->f_un.f_forw.f_hname, strerror (errno));
+	  forw_close (f);
+	  return f->f_un.f_forw.f_backoff * 1000;
+	}
+
+      /* Retire every completely written message.  */
+      for (i = 0; sent > 0; i++)
+	{
+	  if ((size_t) sent < iov[i].iov_len)
+	    {
+	      q->q_off += sent;
+	      break;
+	    }
+	  sent -= iov[i].iov_len;
+	  q->q_head = (q->q_head + 1) % FWDQUEUE_LEN;
+	  q->q_count--;
+	  q->q_off = 0;
+	}
+    }
+  return -1;
+}
+
+/* Write the specified message to either the entire world,
+ * or to a list of approved users.  */
+void
+wallmsg (struct filed *f, struct iovec *iov)
+{
+  static int reenter;		/* Avoid calling ourselves.  */
+  STRUCT_UTMP *utp;
+#if defined UTMP_NAME_FUNCTION || !defined HAVE_GETUTXENT
+  STRUCT_UTMP *utmpbuf;
+  size_t utmp_count;
+#endif /* UTMP_NAME_FUNCTION || !HAVE_GETUTXENT */
+  int i;
+  char *p;
+  char line[sizeof (utp->ut_line) + 1];
+
+  if (reenter++)
+    return;
+
+#if !defined UTMP_NAME_FUNCTION && defined HAVE_GETUTXENT
+  setutxent ();
+
+  while ((utp = getutxent ()))
+#else /* UTMP_NAME_FUNCTION || !HAVE_GETUTXENT */
+  if (read_utmp (UTMP_FILE, &utmp_count, &utmpbuf,
+		 READ_UTMP_USER_PROCESS | READ_UTMP_CHECK_PIDS) < 0)
+    {
+      logerror ("opening utmp file");
+      return;
+    }
+
+  for (utp = utmpbuf; utp < utmpbuf + utmp_count; utp++)
+#endif /* UTMP_NAME_FUNCTION || !HAVE_GETUTXENT */
+    {
+      strncpy (line, utp->ut_line, sizeof (utp->ut_line));
+      line[sizeof (utp->ut_line)] = '\0';
+      if (f->f_type == F_WALL)
+	{
+	  /* Note we're using our own version of ttymsg
+	     which does a double fork () to not have
+	     zombies.  No need to waitpid().  */
+	  p = ttymsg (iov, IOVCNT, line, TTYMSGTIME);
+	  if (p != NULL)
+	    {
+	      errno = 0;	/* Already in message. */
+	      logerror (p);
+	    }
+	  continue;
+	}
+      /* Should we send the message to this user? */
+      for (i = 0; i < f->f_un.f_user.f_nusers; i++)
+	if (!strncmp (f->f_un.f_user.f_unames[i], UT_USER (utp),
+		      sizeof (UT_USER (utp))))
+	  {
+	    p = ttymsg (iov, IOVCNT, line, TTYMSGTIME);
+	    if (p != NULL)
+	      {
+		errno = 0;	/* Already in message. */
+		logerror (p);
+	      }
+	    break;
+	  }
+    }
+#if defined UTMP_NAME_FUNCTION || !defined HAVE_GETUTXENT
+  free (utmpbuf);
+#else /* !UTMP_NAME_FUNCTION && HAVE_GETUTXENT */
+  endutxent ();
+#endif
+  reenter = 0;
+}
+
+/* Return a printable representation of a host address.  */
+const char *
+cvthname (struct sockaddr *f, socklen_t len)
+{
+  int err, match = 0;
+  struct hostcache *hc = NULL;
+
+  err = getnameinfo (f, len, addrstr, sizeof (addrstr),
 		     NULL, 0, NI_NUMERICHOST);
   if (err)
     {
@@ -1682,15 +2897,81 @@ cvthname (struct sockaddr *f, socklen_t len)
 
   dbg_printf ("cvthname(%s)\n", addrstr);
 
+  if (hostcache)
+    {
+      time_t t = time (NULL);
+
+      hc = hostcache_slot (f, &match);
+      if (hc && match && t < hc->hc_expire)
+	{
+	  switch (hc->hc_state)
+	    {
+	    case HC_NAME:
+	      hostcache_hits++;
+	      strcpy (addrname, hc->hc_name);
+	      return addrname;
+
+	    case HC_NONAME:
+	      hostcache_hits++;
+	      return addrstr;
+
+	    case HC_PENDING:
+	      /* Still waiting for the resolver.  */
+	      return addrstr;
+	    }
+	}
+      hostcache_misses++;
+
+      if (hc && resolver_fd >= 0)
+	{
+	  struct resolve_req req;
+
+	  memset (&req, 0, sizeof (req));
+	  memcpy (&req.rq_addr, f, len);
+	  req.rq_addrlen = len;
+
+	  /* A full queue is not fatal, the entry is retried
+	     once the pending state has expired.  */
+	  if (send (resolver_fd, &req, sizeof (req), MSG_DONTWAIT) < 0)
+	    dbg_printf ("Resolver queue: %s\n", strerror (errno));
+
+	  hc->hc_state = HC_PENDING;
+	  hc->hc_expire = t + HC_PENDING_TIME;
+	  return addrstr;
+	}
+    }
+
   err = getnameinfo (f, len, addrname, sizeof (addrname),
 		     NULL, 0, NI_NAMEREQD);
   if (err)
     {
       dbg_printf ("Host name for your address (%s) unknown.\n", addrstr);
+      if (hc)
+	{
+	  hc->hc_state = HC_NONAME;
+	  hc->hc_expire = time (NULL) + hostcache_negttl;
+	}
       return addrstr;
     }
 
-  p = strchr (addrname, '.');
+  strip_hostname (addrname);
+  if (hc)
+    {
+      hc->hc_state = HC_NAME;
+      hc->hc_expire = time (NULL) + hostcache_ttl;
+      strcpy (hc->hc_name, addrname);
+    }
+  return addrname;
+}
+
+/* Remove the local domain, or any domain listed with `-s', from NAME.
+   Hosts given with `-l' are also reduced to their plain host name.  */
+static char *
+strip_hostname (char *name)
+{
+  char *p;
+
+  p = strchr (name, '.');
   if (p != NULL)
     {
       if (strcasecmp (p + 1, LocalDomain) == 0)
@@ -1707,7 +2988,7 @@ cvthname (struct sockaddr *f, socklen_t len)
 		  if (strcasecmp (p + 1, StripDomains[count]) == 0)
 		    {
 		      *p = '\0';
-		      return addrname;
+		      return name;
 		    }
 		  count++;
 		}
@@ -1717,17 +2998,192 @@ cvthname (struct sockaddr *f, socklen_t len)
 	      count = 0;
 	      while (LocalHosts[count])
 		{
-		  if (strcasecmp (addrname, LocalHosts[count]) == 0)
+		  if (strcasecmp (name, LocalHosts[count]) == 0)
 		    {
 		      *p = '\0';
-		      return addrname;
+		      return name;
 		    }
 		  count++;
 		}
 	    }
 	}
     }
-  return addrname;
+  return name;
+}
+
+/* Locate the cache slot for address SA.  MATCH is set to non-zero
+   when the slot already belongs to this address.  Otherwise the slot
+   is claimed for SA, dropping whatever it held.  Returns NULL for
+   address families that are not cached.  */
+static struct hostcache *
+hostcache_slot (struct sockaddr *sa, int *match)
+{
+  struct hostcache *hc;
+  unsigned char *key;
+  size_t i, keylen;
+  unsigned long h = 5381;
+
+  switch (sa->sa_family)
+    {
+    case AF_INET:
+      key = (unsigned char *) &((struct sockaddr_in *) sa)->sin_addr;
+      keylen = sizeof (struct in_addr);
+      break;
+
+    case AF_INET6:
+      key = (unsigned char *) &((struct sockaddr_in6 *) sa)->sin6_addr;
+      keylen = sizeof (struct in6_addr);
+      break;
+
+    default:
+      return NULL;
+    }
+
+  for (i = 0; i < keylen; i++)
+    h = h * 33 + key[i];
+
+  hc = &hostcache[h % hostcache_size];
+  *match = (hc->hc_state != HC_EMPTY && hc->hc_family == sa->sa_family
+	    && memcmp (hc->hc_key, key, keylen) == 0);
+  if (!*match)
+    {
+      hc->hc_state = HC_EMPTY;
+      hc->hc_family = sa->sa_family;
+      memset (hc->hc_key, 0, sizeof (hc->hc_key));
+      memcpy (hc->hc_key, key, keylen);
+    }
+  return hc;
+}
+
+static void
+hostcache_stats (void)
+{
+  size_t i, used = 0;
+
+  if (hostcache == NULL)
+    return;
+
+  for (i = 0; i < hostcache_size; i++)
+    if (hostcache[i].hc_state != HC_EMPTY)
+      used++;
+
+  dbg_printf ("Hostname cache: %lu hits, %lu misses, %lu of %lu slots used\n",
+	      hostcache_hits, hostcache_misses,
+	      (unsigned long) used, (unsigned long) hostcache_size);
+}
+
+/* Fork a helper process which performs reverse lookups on behalf
+   of the main loop, so that a slow name server never delays the
+   logging of messages.  On failure names are looked up inline.  */
+static void
+start_resolver (void)
+{
+  int sv[2];
+  struct resolve_req req;
+  struct resolve_rep rep;
+  ssize_t n;
+
+  if (socketpair (AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+    {
+      dbg_printf ("Can't create resolver socket: %s\n", strerror (errno));
+      return;
+    }
+
+  resolver_pid = fork ();
+  if (resolver_pid < 0)
+    {
+      dbg_printf ("Can't fork resolver: %s\n", strerror (errno));
+      close (sv[0]);
+      close (sv[1]);
+      return;
+    }
+
+  if (resolver_pid > 0)
+    {
+      close (sv[1]);
+      resolver_fd = sv[0];
+      dbg_printf ("Started resolver process %d.\n", (int) resolver_pid);
+      return;
+    }
+
+  /* The child must never remove the sockets of its parent.  */
+  close (sv[0]);
+  signal (SIGTERM, SIG_DFL);
+  signal (SIGINT, SIG_DFL);
+  signal (SIGQUIT, SIG_DFL);
+  signal (SIGHUP, SIG_IGN);
+  signal (SIGALRM, SIG_IGN);
+
+  while ((n = recv (sv[1], &req, sizeof (req), 0)) != 0)
+    {
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  break;
+	}
+      if (n != sizeof (req) || req.rq_addrlen > sizeof (req.rq_addr))
+	continue;
+
+      memset (&rep, 0, sizeof (rep));
+      memcpy (&rep.rp_addr, &req.rq_addr, req.rq_addrlen);
+      rep.rp_addrlen = req.rq_addrlen;
+      rep.rp_found = getnameinfo ((struct sockaddr *) &req.rq_addr,
+				  req.rq_addrlen, rep.rp_name,
+				  sizeof (rep.rp_name), NULL, 0,
+				  NI_NAMEREQD) == 0;
+
+      if (send (sv[1], &rep, sizeof (rep), 0) < 0)
+	break;
+    }
+  _exit (EXIT_SUCCESS);
+}
+
+/* Collect answers from the resolver process into the cache.  */
+static void
+resolver_reply (void)
+{
+  struct resolve_rep rep;
+  struct hostcache *hc;
+  ssize_t n;
+  int match;
+
+  while ((n = recv (resolver_fd, &rep, sizeof (rep), MSG_DONTWAIT)) > 0)
+    {
+      if (n != sizeof (rep))
+	continue;
+
+      hc = hostcache_slot ((struct sockaddr *) &rep.rp_addr, &match);
+      if (hc == NULL)
+	continue;
+
+      if (rep.rp_found)
+	{
+	  rep.rp_name[sizeof (rep.rp_name) - 1] = '\0';
+	  strip_hostname (rep.rp_name);
+	  strcpy (hc->hc_name, rep.rp_name);
+	  hc->hc_state = HC_NAME;
+	  hc->hc_expire = time (NULL) + hostcache_ttl;
+	}
+      else
+	{
+	  hc->hc_state = HC_NONAME;
+	  hc->hc_expire = time (NULL) + hostcache_negttl;
+	}
+      dbg_printf ("Resolver: %s\n",
+		  rep.rp_found ? hc->hc_name : "(no name)");
+    }
+
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK
+		 && errno != EINTR))
+    {
+      /* Fall back to inline lookups.  */
+      logerror ("resolver process vanished");
+      close (resolver_fd);
+      resolver_fd = -1;
+      waitpid (resolver_pid, NULL, WNOHANG);
+      resolver_pid = -1;
+    }
 }
 
 void
@@ -1757,9 +3213,18 @@ domark (int signo _GL_UNUSED_PARAMETER)
 	  BACKOFF (f);
 	}
     }
+}
 
+/* Handle SIGALRM by asking the main loop to run domark, which logs
+   and so may take the lock of a writer thread.  The timer is set
+   again right here, so that marks go on while the main loop sleeps
+   in poll.  */
+void
+trigger_mark (int signo _GL_UNUSED_PARAMETER)
+{
+  mark_wanted = 1;
 #ifndef HAVE_SIGACTION
-  signal (SIGALRM, domark);
+  signal (SIGALRM, trigger_mark);
 #endif
   alarm (TIMERINTVL);
 }
@@ -1810,6 +3275,16 @@ die (int signo)
       logerror (buf);
     }
 
+  flush_pending (1);
+  pipeline_stats ();
+  for (f = Files; f != NULL; f = f->f_next)
+    if (f->f_writer)
+      writer_stop (f);
+
+  hostcache_stats ();
+  if (resolver_pid > 0)
+    kill (resolver_pid, SIGTERM);
+
   if (fklog >= 0)
     close (fklog);
 
@@ -1825,6 +3300,10 @@ die (int signo)
     close (finet[IU_FD_IP4]);
   if (finet[IU_FD_IP6] >= 0)
     close (finet[IU_FD_IP6]);
+  if (fforw[IU_FD_IP4] >= 0)
+    close (fforw[IU_FD_IP4]);
+  if (fforw[IU_FD_IP6] >= 0)
+    close (fforw[IU_FD_IP6]);
 
   exit (EXIT_SUCCESS);
 }
@@ -1865,6 +3344,7 @@ load_conffile (const char *filename, struct filed **nextp)
 	  cfline ("*.PANIC\t*", f->f_next);	/* Erases *(f->f_next)!  */
 
 	  *nextp = f;	/* Return this minimal table to the caller.  */
+	  DispatchValid = 0;
 	}
 
       Initialized = 1;
@@ -2015,6 +3495,7 @@ load_conffile (const char *filename, struct filed **nextp)
       cfline (cbuf, f);			/* Erases *f!  */
       f->f_next = *nextp;
       *nextp = f;
+      DispatchValid = 0;
     }
 
   /* Close the configuration file.  */
@@ -2075,6 +3556,135 @@ load_confdir (const char *dirname, struct filed **nextp)
   return (found ? rc : 1);
 }
 
+/* A program selector can be hashed if it is made up of the
+   characters ending a message tag.  */
+static int
+prog_indexable (const char *name)
+{
+  if (*name == '\0')
+    return 0;
+  for (; *name; name++)
+    if (!isalnum (*name) && *name != '-' && *name != '_')
+      return 0;
+  return 1;
+}
+
+static unsigned int
+prog_hash (const char *name, size_t len)
+{
+  unsigned int h = 5381;
+
+  while (len--)
+    h = h * 33 + (unsigned char) *name++;
+  return h % PROGHASH_SIZE;
+}
+
+/* Append F to the null terminated list *LIST.  */
+static void
+dispatch_add (struct filed ***list, struct filed *f)
+{
+  size_t n = 0;
+
+  if (*list)
+    while ((*list)[n])
+      n++;
+
+  *list = realloc (*list, (n + 2) * sizeof (**list));
+  if (*list == NULL)
+    error (EXIT_FAILURE, errno, "can't allocate dispatch table");
+  (*list)[n] = f;
+  (*list)[n + 1] = NULL;
+}
+
+/* Build the dispatch table from the list of actions in Files.  */
+static void
+dispatch_compile (void)
+{
+  struct filed *f;
+  struct progsel *ps;
+  int fac, prilev, seq = 0;
+
+  dispatch_free ();
+
+  for (f = Files; f; f = f->f_next)
+    {
+      f->f_seq = seq++;
+
+      if (f->f_progname && prog_indexable (f->f_progname))
+	{
+	  unsigned int h = prog_hash (f->f_progname, f->f_prognlen);
+
+	  for (ps = ProgHash[h]; ps; ps = ps->ps_next)
+	    if (strcmp (ps->ps_name, f->f_progname) == 0)
+	      break;
+	  if (ps == NULL)
+	    {
+	      ps = calloc (1, sizeof (*ps));
+	      if (ps == NULL)
+		error (EXIT_FAILURE, errno, "can't allocate dispatch table");
+	      ps->ps_name = f->f_progname;
+	      ps->ps_next = ProgHash[h];
+	      ProgHash[h] = ps;
+	    }
+	  dispatch_add (&ps->ps_files, f);
+	  continue;
+	}
+
+      for (fac = 0; fac <= LOG_NFACILITIES; fac++)
+	for (prilev = 0; prilev <= LOG_PRIMASK; prilev++)
+	  if (f->f_pmask[fac] & LOG_MASK (prilev))
+	    dispatch_add (&Dispatch[fac][prilev], f);
+    }
+
+  DispatchValid = 1;
+}
+
+static void
+dispatch_free (void)
+{
+  struct progsel *ps, *next;
+  int i, j;
+
+  for (i = 0; i <= LOG_NFACILITIES; i++)
+    for (j = 0; j <= LOG_PRIMASK; j++)
+      {
+	free (Dispatch[i][j]);
+	Dispatch[i][j] = NULL;
+      }
+
+  for (i = 0; i < PROGHASH_SIZE; i++)
+    {
+      for (ps = ProgHash[i]; ps; ps = next)
+	{
+	  next = ps->ps_next;
+	  free (ps->ps_files);
+	  free (ps);
+	}
+      ProgHash[i] = NULL;
+    }
+
+  DispatchValid = 0;
+}
+
+/* Merge two lists of actions, keeping the order of Files.  */
+static struct filed *
+dispatch_next (struct filed ***gp, struct filed ***pp)
+{
+  struct filed **g = *gp, **p = *pp;
+
+  if (g && *g && (!p || !*p || (*g)->f_seq < (*p)->f_seq))
+    {
+      *gp = g + 1;
+      return *g;
+    }
+  if (p && *p)
+    {
+      *pp = p + 1;
+      return *p;
+    }
+  return NULL;
+}
+
 /* INIT -- Initialize syslogd from configuration table.  */
 void
 init (int signo _GL_UNUSED_PARAMETER)
@@ -2083,6 +3693,8 @@ init (int signo _GL_UNUSED_PARAMETER)
   struct filed *f, *next, **nextp;
 
   dbg_printf ("init\n");
+  hostcache_stats ();
+  pipeline_stats ();
 
   /* Close all open log files.  */
   Initialized = 0;
@@ -2094,9 +3706,16 @@ init (int signo _GL_UNUSED_PARAMETER)
       if (f->f_prevcount)
 	fprintlog (f, LocalHostName, 0, (char *) NULL);
 
+      if (f->f_writer)
+	writer_stop (f);
+
       switch (f->f_type)
 	{
 	case F_FILE:
+	  if (f->f_olen || (f->f_flags & NEED_SYNC))
+	    flush_file (f);
+	  if (f->f_type != F_FILE)
+	    break;		/* Given up by flush_file.  */
 	case F_TTY:
 	case F_CONSOLE:
 	case F_PIPE:
@@ -2106,6 +3725,11 @@ init (int signo _GL_UNUSED_PARAMETER)
 	case F_FORW:
 	case F_FORW_SUSP:
 	case F_FORW_UNKN:
+	  if (f->f_type == F_FORW)
+	    forw_flush (f);
+	  if (f->f_un.f_forw.f_fd >= 0)
+	    close (f->f_un.f_forw.f_fd);
+	  free (f->f_un.f_forw.f_queue);
 	  free (f->f_un.f_forw.f_hname);
 	  break;
 	case F_USERS:
@@ -2116,11 +3740,13 @@ init (int signo _GL_UNUSED_PARAMETER)
 	}
       free (f->f_progname);
       free (f->f_prevhost);
+      free (f->f_obuf);
       next = f->f_next;
       free (f);
     }
 
   Files = NULL;		/* Empty the table.  */
+  dispatch_free ();
   nextp = &Files;
   facilities_seen = 0;
 
@@ -2131,6 +3757,13 @@ init (int signo _GL_UNUSED_PARAMETER)
     rc = 0;		/* Some allocation errors were found.  */
 
   Initialized = 1;
+  dispatch_compile ();
+
+  if (Pipeline)
+    for (f = Files; f; f = f->f_next)
+      if (f->f_type == F_FILE || f->f_type == F_PIPE
+	  || f->f_type == F_TTY || f->f_type == F_CONSOLE)
+	writer_start (f);
 
   if (Debug)
     {
@@ -2335,6 +3968,20 @@ cfline (const char *line, struct filed *f)
   switch (*p)
     {
     case '@':
+      /* A doubled `@' asks for TCP.  */
+      if (p[1] == '@')
+	{
+	  f->f_flags |= FORW_TCP;
+	  p++;
+	}
+      f->f_un.f_forw.f_fd = -1;
+      f->f_un.f_forw.f_queue = calloc (1, sizeof (struct fwdqueue));
+      if (f->f_un.f_forw.f_queue == NULL)
+	{
+	  f->f_type = F_UNUSED;
+	  logerror ("cannot allocate forwarding queue");
+	  break;
+	}
       f->f_un.f_forw.f_hname = strdup (++p);
       memset (&hints, 0, sizeof (hints));
       hints.ai_family = usefamily;
@@ -2367,6 +4014,8 @@ cfline (const char *line, struct filed *f)
 #endif
 	      default:		/* Catch system exceptions.  */
 		f->f_type = F_UNUSED;
+		free (f->f_un.f_forw.f_queue);
+		f->f_un.f_forw.f_queue = NULL;
 	    }
 
 	  f->f_time = time ((time_t *) 0);
@@ -2415,7 +4064,11 @@ cfline (const char *line, struct filed *f)
       else if (isatty (f->f_file))
 	f->f_type = F_TTY;
       else
-	f->f_type = F_FILE;
+	{
+	  f->f_type = F_FILE;
+	  if (WriteBuffer && !Pipeline)
+	    f->f_obuf = malloc (WriteBuffer);	/* Unbuffered on failure.  */
+	}
       break;
 
     case '*':
@@ -2482,9 +4135,18 @@ dbg_toggle (int signo _GL_UNUSED_PARAMETER)
   dbg_printf ("Switching dbg_output to %s.\n",
 	      dbg_save == 0 ? "true" : "false");
   dbg_output = (dbg_save == 0) ? 1 : 0;
+  hostcache_stats ();
+  pipeline_stats ();
+}
 
+/* Handle SIGUSR1 by asking the main loop to run dbg_toggle, which
+   takes the locks of the writer threads.  */
+void
+trigger_dbg_toggle (int signo _GL_UNUSED_PARAMETER)
+{
+  toggle_wanted = 1;
 #ifndef HAVE_SIGACTION
-  signal (SIGUSR1, dbg_toggle);
+  signal (SIGUSR1, trigger_dbg_toggle);
 #endif
 }
 
@@ -2518,6 +4180,16 @@ trigger_restart (int signo _GL_UNUSED_PARAMETER)
 #endif
 }
 
+/* Handle SIGTERM, and SIGINT and SIGQUIT when not detached, by asking
+   the main loop to run die.  Flushing the buffers and stopping the
+   writer threads from the handler could deadlock on a lock held by the
+   interrupted main thread, or write a buffer it is changing.  */
+void
+trigger_die (int signo)
+{
+  dying = signo;
+}
+
 /* Override default port with a non-NULL argument.
  * Otherwise identify the default syslog/udp with
  * proper fallback to avoid resolve issues.  */
@@ -54,6 +54,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <time.h>
 
@@ -98,7 +99,9 @@ int timeout;
 jmp_buf timeoutbuf;
 
 static void nak (int);
-static int makerequest (int, const char *, struct tftphdr *, const char *);
+static int makerequest (int, const char *, struct tftphdr *, const char *,
+			off_t);
+static int oack (struct tftphdr *, int, int *);
 static void printstats (const char *, unsigned long);
 static void startclock (void);
 static void stopclock (void);
@@ -109,6 +112,9 @@ static void tpacket (const char *, struct tftphdr *, int);
 
 static int rexmtval = TIMEOUT;
 static int maxtimeout = 5 * TIMEOUT;
+static int blksize;		/* option values asked for, or 0 */
+static int windowsize;
+static int tsize;
 
 static struct sockaddr_storage peeraddr;	/* filled in by main */
 static socklen_t peerlen;
@@ -134,11 +140,14 @@ void put (int, char **);
 void quit (int, char **);
 void setascii (int, char **);
 void setbinary (int, char **);
+void setblksize (int, char **);
 void setpeer (int, char **);
 void setrexmt (int, char **);
 void settimeout (int, char **);
 void settrace (int, char **);
+void settsize (int, char **);
 void setverbose (int, char **);
+void setwindowsize (int, char **);
 void status (int, char **);
 
 static void command (void);
@@ -172,6 +181,9 @@ char xhelp[] = "set per-packet retransmission timeout";
 char ihelp[] = "set total retransmission timeout";
 char ashelp[] = "set mode to netascii";
 char bnhelp[] = "set mode to octet";
+char bshelp[] = "set block size to ask for";
+char wshelp[] = "set window size to ask for";
+char tshelp[] = "toggle asking for transfer size";
 
 struct cmd cmdtab[] = {
   {"connect", chelp, setpeer},
@@ -186,6 +198,9 @@ struct cmd cmdtab[] = {
   {"ascii", ashelp, setascii},
   {"rexmt", xhelp, setrexmt},
   {"timeout", ihelp, settimeout},
+  {"blksize", bshelp, setblksize},
+  {"windowsize", wshelp, setwindowsize},
+  {"tsize", tshelp, settsize},
   {"?", hhelp, help},
   {NULL, NULL, NULL}
 };
@@ -788,6 +803,46 @@ settimeout (int argc, char *argv[])
     maxtimeout = t;
 }
 
+void
+setblksize (int argc, char *argv[])
+{
+  int t;
+
+  if (argc < 2)
+    get_args ("Block-size", "(value) ", &argc, &argv);
+
+  if (argc != 2)
+    {
+      printf ("usage: %s value\n", argv[0]);
+      return;
+    }
+  t = atoi (argv[1]);
+  if (t != 0 && (t < MINBLKSIZE || t > MAXBLKSIZE))
+    printf ("%s: bad value\n", argv[1]);
+  else
+    blksize = t;
+}
+
+void
+setwindowsize (int argc, char *argv[])
+{
+  int t;
+
+  if (argc < 2)
+    get_args ("Window-size", "(value) ", &argc, &argv);
+
+  if (argc != 2)
+    {
+      printf ("usage: %s value\n", argv[0]);
+      return;
+    }
+  t = atoi (argv[1]);
+  if (t < 0 || t > MAXWINDOWSIZE)
+    printf ("%s: bad value\n", argv[1]);
+  else
+    windowsize = t;
+}
+
 void
 status (int argc _GL_UNUSED_PARAMETER, char *argv[] _GL_UNUSED_PARAMETER)
 {
@@ -799,6 +854,9 @@ status (int argc _GL_UNUSED_PARAMETER, char *argv[] _GL_UNUSED_PARAMETER)
 	  verbose ? "on" : "off", trace ? "on" : "off");
   printf ("Rexmt-interval: %d seconds, Max-timeout: %d seconds\n",
 	  rexmtval, maxtimeout);
+  printf ("Block-size: %d Window-size: %d Transfer-size: %s\n",
+	  blksize ? blksize : SEGSIZE, windowsize ? windowsize : 1,
+	  tsize ? "on" : "off");
 }
 
 void
@@ -969,6 +1027,13 @@ settrace (int argc _GL_UNUSED_PARAMETER, char *argv[] _GL_UNUSED_PARAMETER)
   printf ("Packet tracing %s.\n", trace ? "on" : "off");
 }
 
+void
+settsize (int argc _GL_UNUSED_PARAMETER, char *argv[] _GL_UNUSED_PARAMETER)
+{
+  tsize = !tsize;
+  printf ("Transfer size option %s.\n", tsize ? "on" : "off");
+}
+
 void
 setverbose (int argc _GL_UNUSED_PARAMETER, char *argv[] _GL_UNUSED_PARAMETER)
 {
@@ -977,62 +1042,154 @@ setverbose (int argc _GL_UNUSED_PARAMETER, char *argv[] _GL_UNUSED_PARAMETER)
 }
 
 /*
- * Send the requested file.
+ * Send the requested file.  Up to the negotiated window of blocks is
+ * sent before an ACK is awaited.
  */
 void
 send_file (int fd, char *name, char *mode)
 {
   register struct tftphdr *ap;	/* data and ack packets */
   struct tftphdr *r_init (void), *dp;
-  register int n;
-  volatile int block, size, convert;
+  register int n, i;
+  volatile int size, convert;
   volatile unsigned long amount;
+  struct window
+  {
+    char *pkt;
+    int len;
+  } *volatile win = NULL;
+  volatile unsigned short base;	/* first block not acknowledged */
+  volatile int count;		/* blocks sent after it */
+  volatile int first;		/* index of BASE in WIN */
+  volatile int last;		/* the final block has been read */
+  int window = 1, resend;
   struct sockaddr_storage from;
   socklen_t fromlen;
+  struct stat st;
   FILE *file;
 
   startclock ();		/* start stat's clock */
+  segsize = SEGSIZE;
   dp = r_init ();		/* reset fillbuf/read-ahead code */
   ap = (struct tftphdr *) ackbuf;
   file = fdopen (fd, "r");
   convert = !strcmp (mode, "netascii");
-  block = 0;
   amount = 0;
 
   signal (SIGALRM, timer);
+
+  /* The request is answered with an ACK of block 0, or with an OACK
+     if the server takes any option.  */
+  size = makerequest (WRQ, name, dp, mode,
+		      !convert && fstat (fd, &st) == 0 ? st.st_size : -1);
+  timeout = 0;
+  setjmp (timeoutbuf);
+  if (trace)
+    tpacket ("sent", dp, size);
+  if (sendto (f, (const char *) dp, size, 0,
+	      (struct sockaddr *) &peeraddr, peerlen) != size)
+    {
+      perror ("tftp: sendto");
+      goto abort;
+    }
+  for (;;)
+    {
+      alarm (rexmtval);
+      do
+	{
+	  fromlen = sizeof (from);
+	  n = recvfrom (f, ackbuf, sizeof (ackbuf), 0,
+			(struct sockaddr *) &from, &fromlen);
+	}
+      while (n <= 0);
+      alarm (0);
+      set_port (&peeraddr, get_port (&from));
+      if (trace)
+	tpacket ("received", ap, n);
+      ap->th_opcode = ntohs (ap->th_opcode);
+      if (ap->th_opcode == ERROR)
+	{
+	  printf ("Error code %d: %s\n", ntohs (ap->th_code), ap->th_msg);
+	  goto abort;
+	}
+      if (ap->th_opcode == OACK)
+	{
+	  if (!oack (ap, n, &window))
+	    {
+	      nak (EOPTNEG);
+	      goto abort;
+	    }
+	  break;
+	}
+      if (ap->th_opcode == ACK && ntohs (ap->th_block) == 0)
+	break;
+    }
+
+  /* Make room for blocks of the size agreed on.  */
+  r_init ();
+  win = xmalloc (window * sizeof (*win));
+  for (i = 0; i < window; i++)
+    win[i].pkt = xmalloc (segsize + 4);
+
+  base = 1;
+  count = first = last = 0;
   do
     {
-      if (block == 0)
-	size = makerequest (WRQ, name, dp, mode) - 4;
-      else
+      /* Fill the window.  */
+      while (!last && count < window)
 	{
-	  /*      size = read(fd, dp->th_data, SEGSIZE);   */
+	  struct window *w = &win[(first + count) % window];
+
 	  size = readit (file, &dp, convert);
 	  if (size < 0)
 	    {
 	      nak (errno + 100);
-	      break;
+	      goto abort;
 	    }
 	  dp->th_opcode = htons ((unsigned short) DATA);
-	  dp->th_block = htons ((unsigned short) block);
-	}
-      timeout = 0;
-      setjmp (timeoutbuf);
-
-    send_data:
-      if (trace)
-	tpacket ("sent", dp, size + 4);
-      n = sendto (f, (const char *) dp, size + 4, 0,
-		  (struct sockaddr *) &peeraddr, peerlen);
-      if (n != size + 4)
-	{
-	  perror ("tftp: sendto");
-	  goto abort;
+	  dp->th_block = htons ((unsigned short) (base + count));
+	  memcpy (w->pkt, dp, size + 4);
+	  w->len = size + 4;
+	  if (trace)
+	    tpacket ("sent", dp, w->len);
+	  if (sendto (f, w->pkt, w->len, 0,
+		      (struct sockaddr *) &peeraddr, peerlen) != w->len)
+	    {
+	      perror ("tftp: sendto");
+	      goto abort;
+	    }
+	  amount += size;
+	  if (size < segsize)
+	    last = 1;
+	  count++;
+	  read_ahead (file, convert);
 	}
-      read_ahead (file, convert);
 
+      timeout = 0;
+      resend = 0;
+      if (setjmp (timeoutbuf))
+	resend = 1;
       for (;;)
 	{
+	  if (resend)
+	    {
+	      for (i = 0; i < count; i++)
+		{
+		  struct window *w = &win[(first + i) % window];
+
+		  if (trace)
+		    tpacket ("sent", (struct tftphdr *) w->pkt, w->len);
+		  if (sendto (f, w->pkt, w->len, 0,
+			      (struct sockaddr *) &peeraddr,
+			      peerlen) != w->len)
+		    {
+		      perror ("tftp: sendto");
+		      goto abort;
+		    }
+		}
+	      resend = 0;
+	    }
+
 	  alarm (rexmtval);
 	  do
 	    {
@@ -1042,11 +1199,6 @@ send_file (int fd, char *name, char *mode)
 	    }
 	  while (n <= 0);
 	  alarm (0);
-	  if (n < 0)
-	    {
-	      perror ("tftp: recvfrom");
-	      goto abort;
-	    }
 	  set_port (&peeraddr, get_port (&from));
 	  if (trace)
 	    tpacket ("received", ap, n);
@@ -1062,8 +1214,15 @@ send_file (int fd, char *name, char *mode)
 	    {
 	      int j;
 
-	      if (ap->th_block == block)
-		break;
+	      /* Number of blocks acknowledged.  */
+	      n = (unsigned short) (ap->th_block - base + 1);
+	      if (n >= 1 && n <= count)
+		{
+		  base += n;
+		  count -= n;
+		  first = (first + n) % window;
+		  break;
+		}
 
 	      /* On an error, try to synchronize
 	       * both sides.
@@ -1072,17 +1231,20 @@ send_file (int fd, char *name, char *mode)
 	      if (j && trace)
 		printf ("discarded %d packets\n", j);
 
-	      if (ap->th_block == (block - 1))
-		goto send_data;
+	      if (ap->th_block == (unsigned short) (base - 1))
+		resend = 1;
 	    }
 	}
-      if (block > 0)
-	amount += size;
-      block++;
     }
-  while (size == SEGSIZE || block == 1);
+  while (!last || count > 0);
 
 abort:
+  if (win)
+    {
+      for (i = 0; i < window; i++)
+	free (win[i].pkt);
+      free (win);
+    }
   fclose (file);
   stopclock ();
   if (amount > 0)
@@ -1090,7 +1252,8 @@ abort:
 }
 
 /*
- * Receive a file.
+ * Receive a file.  The last block received in order is acknowledged
+ * after every window of blocks, and at once when one is missing.
  */
 void
 recvfile (int fd, char *name, char *mode)
@@ -1098,51 +1261,51 @@ recvfile (int fd, char *name, char *mode)
   register struct tftphdr *ap;
   struct tftphdr *dp, *w_init (void);
   register int n;
-  volatile int block, size, firsttrip;
+  volatile unsigned short block;
+  volatile int size, ack, bufsize;
   volatile unsigned long amount;
   struct sockaddr_storage from;
   socklen_t fromlen;
   FILE *file;
   volatile int convert;		/* true if converting crlf -> lf */
+  int window = 1;
 
   startclock ();
+
+  /* Make room for blocks of the size asked for, or of the default
+     size, should the server ignore the option.  */
+  segsize = blksize > SEGSIZE ? blksize : SEGSIZE;
   dp = w_init ();
+  bufsize = segsize + 4;
+  segsize = SEGSIZE;
+
   ap = (struct tftphdr *) ackbuf;
   file = fdopen (fd, "w");
   convert = !strcmp (mode, "netascii");
-  block = 1;
-  firsttrip = 1;
+  block = 0;
   amount = 0;
 
   signal (SIGALRM, timer);
+  size = makerequest (RRQ, name, ap, mode, 0);
+  ack = 1;
   do
     {
-      if (firsttrip)
-	{
-	  size = makerequest (RRQ, name, ap, mode);
-	  firsttrip = 0;
-	}
-      else
-	{
-	  ap->th_opcode = htons ((unsigned short) ACK);
-	  ap->th_block = htons ((unsigned short) (block));
-	  size = 4;
-	  block++;
-	}
-      timeout = 0;
-      setjmp (timeoutbuf);
-
-    send_ack:
-      if (trace)
-	tpacket ("sent", ap, size);
-      if (sendto (f, ackbuf, size, 0, (struct sockaddr *) &peeraddr,
-		  peerlen) != size)
+      if (ack)
 	{
-	  alarm (0);
-	  perror ("tftp: sendto");
-	  goto abort;
+	  timeout = 0;
+	  setjmp (timeoutbuf);
+	send_ack:
+	  if (trace)
+	    tpacket ("sent", ap, size);
+	  if (sendto (f, ackbuf, size, 0, (struct sockaddr *) &peeraddr,
+		      peerlen) != size)
+	    {
+	      alarm (0);
+	      perror ("tftp: sendto");
+	      goto abort;
+	    }
+	  write_behind (file, convert);
 	}
-      write_behind (file, convert);
 
       for (;;)
 	{
@@ -1150,22 +1313,31 @@ recvfile (int fd, char *name, char *mode)
 	  do
 	    {
 	      fromlen = sizeof (from);
-	      n = recvfrom (f, (char *) dp, PKTSIZE, 0,
+	      n = recvfrom (f, (char *) dp, bufsize, 0,
 			    (struct sockaddr *) &from, &fromlen);
 	    }
 	  while (n <= 0);
 
 	  alarm (0);
-	  if (n < 0)
-	    {
-	      perror ("tftp: recvfrom");
-	      goto abort;
-	    }
 	  set_port (&peeraddr, get_port (&from));
 	  if (trace)
 	    tpacket ("received", dp, n);
 	  /* should verify client address */
 	  dp->th_opcode = ntohs (dp->th_opcode);
+	  if (dp->th_opcode == OACK && block == 0)
+	    {
+	      if (!oack (dp, n, &window))
+		{
+		  nak (EOPTNEG);
+		  goto abort;
+		}
+	      /* The transfer starts with an ACK of block 0.  */
+	      ap->th_opcode = htons ((unsigned short) ACK);
+	      ap->th_block = htons ((unsigned short) 0);
+	      size = 4;
+	      timeout = 0;
+	      goto send_ack;
+	    }
 	  dp->th_block = ntohs (dp->th_block);
 	  if (dp->th_opcode == ERROR)
 	    {
@@ -1176,7 +1348,7 @@ recvfile (int fd, char *name, char *mode)
 	    {
 	      int j;
 
-	      if (dp->th_block == block)
+	      if (dp->th_block == (unsigned short) (block + 1))
 		break;		/* have next packet */
 
 	      /* On an error, try to synchronize
@@ -1186,20 +1358,29 @@ recvfile (int fd, char *name, char *mode)
 	      if (j && trace)
 		printf ("discarded %d packets\n", j);
 
-	      if (dp->th_block == (block - 1))
+	      if (dp->th_block == block || window > 1)
 		goto send_ack;	/* resend ack */
 	    }
 	}
+      block++;
+      timeout = 0;
+
+      /* From now on, the last block received is what is acknowledged.  */
+      ap->th_opcode = htons ((unsigned short) ACK);
+      ap->th_block = htons ((unsigned short) block);
+      size = 4;
+
       /*      size = write(fd, dp->th_data, n - 4); */
-      size = writeit (file, &dp, n - 4, convert);
-      if (size < 0)
+      n = writeit (file, &dp, n - 4, convert);
+      if (n < 0)
 	{
 	  nak (errno + 100);
 	  break;
 	}
-      amount += size;
+      amount += n;
+      ack = block % window == 0;
     }
-  while (size == SEGSIZE);
+  while (n == segsize);
 
 abort:				/* ok to ack, since user */
   ap->th_opcode = htons ((unsigned short) ACK);	/* has seen err msg */
@@ -1212,12 +1393,76 @@ abort:				/* ok to ack, since user */
     printstats ("Received", amount);
 }
 
+/* Check the options acknowledged in the OACK packet TP of length N,
+   which may only lessen what was asked for, and take them on.  The
+   negotiated window is stored in *WINDOW.  Returns 0 if they are not
+   acceptable.  */
+static int
+oack (struct tftphdr *tp, int n, int *window)
+{
+  char *cp, *end = (char *) tp + n, *name, *value;
+  long val;
+
+#if HAVE_STRUCT_TFTPHDR_TH_U
+  cp = (char *) tp + (tp->th_stuff - (char *) tp);
+#else
+  cp = (char *) &(tp->th_stuff);
+#endif
+
+  while (cp < end)
+    {
+      name = cp;
+      value = memchr (name, '\0', end - name);
+      if (value == NULL || ++value >= end)
+	return 0;
+      cp = memchr (value, '\0', end - value);
+      if (cp == NULL)
+	return 0;
+      cp++;
+
+      val = strtol (value, NULL, 10);
+      if (strcasecmp (name, "blksize") == 0)
+	{
+	  if (!blksize || val < MINBLKSIZE || val > blksize)
+	    return 0;
+	  segsize = val;
+	}
+      else if (strcasecmp (name, "windowsize") == 0)
+	{
+	  if (!windowsize || val < 1 || val > windowsize)
+	    return 0;
+	  *window = val;
+	}
+      else if (strcasecmp (name, "tsize") == 0)
+	{
+	  if (!tsize)
+	    return 0;
+	  if (verbose)
+	    printf ("Transfer size: %ld bytes\n", val);
+	}
+      else
+	return 0;
+    }
+  return 1;
+}
+
 static int
 makerequest (int request, const char *name, struct tftphdr *tp,
-	     const char *mode)
+	     const char *mode, off_t filesize)
 {
   register char *cp;
-  size_t arglen, len;
+  size_t arglen, len, optlen = 0;
+  char opts[64];
+
+  /* Options are pairs of a name and a value, each ending in NUL.  */
+  if (blksize)
+    optlen += sprintf (opts + optlen, "blksize%c%d", '\0', blksize) + 1;
+  if (windowsize)
+    optlen += sprintf (opts + optlen, "windowsize%c%d", '\0',
+		       windowsize) + 1;
+  if (tsize && filesize >= 0)
+    optlen += sprintf (opts + optlen, "tsize%c%lld", '\0',
+		       (long long) filesize) + 1;
 
   tp->th_opcode = htons ((unsigned short) request);
 #if HAVE_STRUCT_TFTPHDR_TH_U
@@ -1238,7 +1483,7 @@ makerequest (int request, const char *name, struct tftphdr *tp,
 #endif
 
   /* Available space for naming the target file.  */
-  len = PKTSIZE - sizeof (struct tftphdr) - sizeof ("netascii");
+  len = PKTSIZE - sizeof (struct tftphdr) - sizeof ("netascii") - optlen;
   arglen = strlen (name);
 
   strncpy (cp, name, len);
@@ -1251,6 +1496,8 @@ makerequest (int request, const char *name, struct tftphdr *tp,
   strcpy (cp, mode);
   cp += strlen (mode);
   *cp++ = '\0';
+  memcpy (cp, opts, optlen);
+  cp += optlen;
   return cp - (char *) tp;
 }
 
@@ -1268,6 +1515,7 @@ struct errmsg
     {EBADID, "Unknown transfer ID"},
     {EEXISTS, "File already exists"},
     {ENOUSER, "No such user"},
+    {EOPTNEG, "Option negotiation failed"},
     {-1, 0}
   };
 
@@ -1308,11 +1556,15 @@ nak (int error)
 static void
 tpacket (const char *s, struct tftphdr *tp, int n)
 {
-  static char *opcodes[] = { "#0", "RRQ", "WRQ", "DATA", "ACK", "ERROR" };
+  static char *opcodes[] = { "#0", "RRQ", "WRQ", "DATA", "ACK", "ERROR",
+    "OACK"
+  };
   register char *cp, *file;
+  char *end, *val;
+  const char *sep;
   unsigned short op = ntohs (tp->th_opcode);
 
-  if (op < RRQ || op > ERROR)
+  if (op < RRQ || op > OACK)
     printf ("%s opcode=%x ", s, op);
   else
     printf ("%s %s ", s, opcodes[op]);
@@ -1320,14 +1572,35 @@ tpacket (const char *s, struct tftphdr *tp, int n)
     {
     case RRQ:
     case WRQ:
-      n -= 2;
 #if HAVE_STRUCT_TFTPHDR_TH_U
       file = cp = tp->th_stuff;
 #else
       file = cp = (char *) &(tp->th_stuff);
 #endif
       cp = strchr (cp, '\0');
-      printf ("<file=%s, mode=%s>\n", file, cp + 1);
+      printf ("<file=%s, mode=%s", file, cp + 1);
+      cp = strchr (cp + 1, '\0') + 1;
+      sep = ", ";
+      goto options;
+
+    case OACK:
+#if HAVE_STRUCT_TFTPHDR_TH_U
+      cp = tp->th_stuff;
+#else
+      cp = (char *) &(tp->th_stuff);
+#endif
+      sep = "<";
+    options:
+      /* Pairs of option name and value.  */
+      end = (char *) tp + n;
+      while ((val = memchr (cp, '\0', end - cp)) && ++val < end
+	     && memchr (val, '\0', end - val))
+	{
+	  printf ("%s%s=%s", sep, cp, val);
+	  sep = ", ";
+	  cp = strchr (val, '\0') + 1;
+	}
+      printf (">\n");
       break;
 
     case DATA:
@@ -71,6 +71,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <netdb.h>
 #include <setjmp.h>
 #include <signal.h>
@@ -81,6 +82,16 @@
 #include <unistd.h>
 #include <grp.h>
 #include <pwd.h>
+#ifdef HAVE_EPOLL_CREATE1
+# include <sys/epoll.h>
+# include <sys/time.h>
+# include <time.h>
+# include <sys/resource.h>
+# include <sys/uio.h>
+#endif
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #include "tftpsubs.h"
 
@@ -113,9 +124,19 @@ static char *user;
 #endif
 static char buf[PKTSIZE];
 static char ackbuf[PKTSIZE];
+static char oackbuf[PKTSIZE];
+static int oacklen;		/* Options acknowledged, if not 0.  */
+static int windowsize = 1;	/* Blocks sent before awaiting an ACK.  */
 static struct sockaddr_storage from;
 static socklen_t fromlen;
 
+/* The largest window granted, to bound the memory held for blocks
+   that may need to be sent again, and the most data granted in one
+   window, so that it fits in the socket buffers of common systems
+   instead of being dropped.  */
+#define WINDOWSIZE_LIMIT	64
+#define WINDOWBYTES_LIMIT	(64 * 1024)
+
 void tftp (struct tftphdr *, int);
 
 /*
@@ -133,13 +154,25 @@ static struct dirlist
 } dirs[MAXDIRS + 1];
 static int suppress_naks;
 static int logging;
+static int single_process;	/* Serve all transfers in this process.  */
+static int idle_timeout = 60;	/* Seconds to wait for more, in it.  */
+static long cache_size = 128;	/* Megabytes of files kept, in it.  */
 
 static const char *errtomsg (int);
 static void nak (int);
 static const char *verifyhost (struct sockaddr_storage *, socklen_t);
+#ifdef HAVE_EPOLL_CREATE1
+static void engine (struct tftphdr *, int);
+#endif
 
 
 
+enum {
+  OPT_SINGLE_PROCESS = CHAR_MAX + 1,
+  OPT_IDLE_TIMEOUT,
+  OPT_CACHE_SIZE
+};
+
 static struct argp_option options[] = {
 #define GRP 0
   { "logging", 'l', NULL, 0,
@@ -158,13 +191,24 @@ static struct argp_option options[] = {
   { "user", 'u', "USR", 0,
     "set name of process owner, used with '-s' and "
     "defaults to 'nobody'", GRP+1},
+#undef GRP
+#define GRP 20
+  { NULL, 0, NULL, 0, "", GRP},
+  { "single-process", OPT_SINGLE_PROCESS, NULL, 0,
+    "serve all transfers in one process, instead of forking "
+    "for each request", GRP+1},
+  { "idle-timeout", OPT_IDLE_TIMEOUT, "SECS", 0,
+    "with '--single-process', exit after SECS seconds without "
+    "transfers, or never if 0; the default is 60", GRP+1},
+  { "cache-size", OPT_CACHE_SIZE, "MB", 0,
+    "with '--single-process', keep up to MB megabytes of the files "
+    "served in memory, or none if 0; the default is 128", GRP+1},
 #undef GRP
   { NULL, 0, NULL, 0, NULL, 0}
 };
 
 static error_t
-parse_opt (int key, char *arg,
-	   struct argp_state *state _GL_UNUSED_PARAMETER)
+parse_opt (int key, char *arg, struct argp_state *state)
 {
   switch (key)
     {
@@ -190,6 +234,35 @@ parse_opt (int key, char *arg,
       user = xstrdup (arg);
       break;
 
+    case OPT_SINGLE_PROCESS:
+      single_process = 1;
+      break;
+
+    case OPT_IDLE_TIMEOUT:
+      {
+	char *end;
+	long val = strtol (arg, &end, 10);
+
+	if (*arg == '\0' || *end != '\0' || val < 0 || val > INT_MAX / 1000)
+	  argp_error (state, "invalid number: %s", arg);
+	else
+	  idle_timeout = val;
+	break;
+      }
+
+    case OPT_CACHE_SIZE:
+      {
+	char *end;
+	long val = strtol (arg, &end, 10);
+
+	if (*arg == '\0' || *end != '\0' || val < 0
+	    || val > (long) ((size_t) -1 >> 21))
+	  argp_error (state, "invalid number: %s", arg);
+	else
+	  cache_size = val;
+	break;
+      }
+
     default:
       return ARGP_ERR_UNKNOWN;
     }
@@ -266,55 +339,61 @@ main (int argc, char *argv[])
    * instance of tftpd may be started up.  Worse, if tftpd
    * break before doing the above "recvfrom", inetd would
    * spawn endless instances, clogging the system.
+   *
+   * In single process mode, this process instead goes on to
+   * serve every request that comes in, until it has been idle
+   * for a while.  Meanwhile, inetd waits for it.
    */
-  {
-    int pid;
-    int i;
-    socklen_t j;
+  if (!single_process)
+    {
+      int pid;
+      int i;
+      socklen_t j;
 
-    for (i = 1; i < 20; i++)
-      {
-	pid = fork ();
-	if (pid < 0)
-	  {
-	    sleep (i);
-	    /*
-	     * flush out to most recently sent request.
-	     *
-	     * This may drop some request, but those
-	     * will be resent by the clients when
-	     * they timeout.  The positive effect of
-	     * this flush is to (try to) prevent more
-	     * than one tftpd being started up to service
-	     * a single request from a single client.
-	     */
-	    j = sizeof from;
-	    i = recvfrom (0, buf, sizeof (buf), 0,
-			  (struct sockaddr *) &from, &j);
-	    if (i > 0)
-	      {
-		n = i;
-		fromlen = j;
-	      }
-	  }
-	else
-	  {
-	    break;
-	  }
-      }
-    if (pid < 0)
-      {
-	syslog (LOG_ERR, "fork: %m\n");
-	exit (EXIT_FAILURE);
-      }
-    else if (pid != 0)
-      {
-	exit (EXIT_SUCCESS);
-      }
-  }
+      for (i = 1; i < 20; i++)
+	{
+	  pid = fork ();
+	  if (pid < 0)
+	    {
+	      sleep (i);
+	      /*
+	       * flush out to most recently sent request.
+	       *
+	       * This may drop some request, but those
+	       * will be resent by the clients when
+	       * they timeout.  The positive effect of
+	       * this flush is to (try to) prevent more
+	       * than one tftpd being started up to service
+	       * a single request from a single client.
+	       */
+	      j = sizeof from;
+	      i = recvfrom (0, buf, sizeof (buf), 0,
+			    (struct sockaddr *) &from, &j);
+	      if (i > 0)
+		{
+		  n = i;
+		  fromlen = j;
+		}
+	    }
+	  else
+	    {
+	      break;
+	    }
+	}
+      if (pid < 0)
+	{
+	  syslog (LOG_ERR, "fork: %m\n");
+	  exit (EXIT_FAILURE);
+	}
+      else if (pid != 0)
+	{
+	  exit (EXIT_SUCCESS);
+	}
+    }
 
   alarm (0);
-  close (0);
+  if (!single_process)
+    close (0);
   close (1);
 
   /* The peer's address 'from' is valid at this point.
@@ -409,11 +488,17 @@ main (int argc, char *argv[])
 
   tp = (struct tftphdr *) buf;
   tp->th_opcode = ntohs (tp->th_opcode);
+#ifdef HAVE_EPOLL_CREATE1
+  if (single_process)
+    engine (tp, n);
+#endif
   if (tp->th_opcode == RRQ || tp->th_opcode == WRQ)
     tftp (tp, n);
   exit (EXIT_FAILURE);
 }
 
+FILE *file;
+
 struct formats;
 int validate_access (char **, int);
 void send_file (struct formats *);
@@ -433,17 +518,86 @@ struct formats
     {0, NULL, NULL, NULL, 0}
   };
 
+/* Parse the options of RFC 2347 that follow the mode string at CP
+   in a request ending at END, and set up the acknowledgement of the
+   ones understood.  The size of the file to send is FILESIZE, if not
+   negative.  */
+static void
+parse_options (char *cp, char *end, int opcode, off_t filesize)
+{
+  struct tftphdr *op = (struct tftphdr *) oackbuf;
+  char *name, *value, *p;
+  long val, blksize = 0, window = 0;
+  off_t tsize = -1;
+
+  while (cp < end)
+    {
+      name = cp;
+      value = memchr (name, '\0', end - name);
+      if (value == NULL || ++value >= end)
+	break;
+      cp = memchr (value, '\0', end - value);
+      if (cp == NULL)
+	break;
+      cp++;
+
+      val = strtol (value, NULL, 10);
+      if (strcasecmp (name, "blksize") == 0 && val >= MINBLKSIZE)
+	blksize = val > MAXBLKSIZE ? MAXBLKSIZE : val;
+      else if (strcasecmp (name, "windowsize") == 0 && val >= 1)
+	window = val;
+      else if (strcasecmp (name, "tsize") == 0 && val >= 0)
+	/* The size of a file sent in netascii is not known.  */
+	tsize = opcode == RRQ ? filesize : val;
+    }
+
+  op->th_opcode = htons ((unsigned short) OACK);
+#if HAVE_STRUCT_TFTPHDR_TH_U
+  p = (char *) op + (op->th_stuff - (char *) op);
+#else
+  p = (char *) &(op->th_stuff);
+#endif
+
+  /* The longest acknowledgement fits easily in OACKBUF.  */
+  if (blksize)
+    {
+      segsize = blksize;
+      p += sprintf (p, "blksize%c%ld", '\0', blksize) + 1;
+    }
+  if (window)
+    {
+      if (window > WINDOWSIZE_LIMIT)
+	window = WINDOWSIZE_LIMIT;
+      if (window > WINDOWBYTES_LIMIT / segsize)
+	window = WINDOWBYTES_LIMIT / segsize;
+      if (window < 1)
+	window = 1;
+      windowsize = window;
+      p += sprintf (p, "windowsize%c%ld", '\0', window) + 1;
+    }
+  if (tsize >= 0)
+    p += sprintf (p, "tsize%c%lld", '\0', (long long) tsize) + 1;
+
+  if (p > (char *) op + 2)
+    oacklen = p - oackbuf;
+}
+
 /*
- * Handle initial connection protocol.
+ * Parse the request TP of SIZE bytes in BUF, and open its file.
+ * Returns the format of the transfer, the name of the file opened in
+ * *FILEP, and the options of the request in *OPTP.  Otherwise a NULL
+ * is returned, with the error that was sent, if any, in *ECODEP.
  */
-void
-tftp (struct tftphdr *tp, int size)
+static struct formats *
+open_request (struct tftphdr *tp, int size, char **filep, char **optp,
+	      int *ecodep)
 {
   register char *cp;
   int first = 1, ecode;
   register struct formats *pf;
   char *filename, *mode;
 
+  *ecodep = EBADOP;
 #if HAVE_STRUCT_TFTPHDR_TH_U
   filename = cp = tp->th_stuff;
 #else
@@ -459,7 +613,7 @@ again:
   if (*cp != '\0')
     {
       nak (EBADOP);
-      exit (EXIT_FAILURE);
+      return NULL;
     }
   if (first)
     {
@@ -476,7 +630,7 @@ again:
   if (pf->f_mode == 0)
     {
       nak (EBADOP);
-      exit (EXIT_FAILURE);
+      return NULL;
     }
   ecode = (*pf->f_validate) (&filename, tp->th_opcode);
   if (logging)
@@ -506,11 +660,47 @@ again:
        * Avoid storms of naks to a RRQ broadcast for a relative
        * bootfile pathname from a diskless Sun.
        */
+      *ecodep = 0;
       if (suppress_naks && *filename != '/' && ecode == ENOTFOUND)
-	exit (EXIT_SUCCESS);
+	return NULL;
       nak (ecode);
-      exit (EXIT_FAILURE);
+      *ecodep = ecode;
+      return NULL;
     }
+  *filep = filename;
+  *optp = cp + 1;
+  return pf;
+}
+
+/* Parse the options at OPTS of a request of SIZE bytes in BUF, for
+   the transfer in format PF.  */
+static void
+request_options (struct tftphdr *tp, int size, struct formats *pf,
+		 char *opts)
+{
+  struct stat st;
+  off_t filesize = -1;
+
+  if (tp->th_opcode == RRQ && !pf->f_convert
+      && fstat (fileno (file), &st) == 0)
+    filesize = st.st_size;
+  parse_options (opts, buf + size, tp->th_opcode, filesize);
+}
+
+/*
+ * Handle initial connection protocol.
+ */
+void
+tftp (struct tftphdr *tp, int size)
+{
+  register struct formats *pf;
+  char *filename, *opts;
+  int ecode;
+
+  pf = open_request (tp, size, &filename, &opts, &ecode);
+  if (pf == NULL)
+    exit (ecode ? EXIT_FAILURE : EXIT_SUCCESS);
+  request_options (tp, size, pf, opts);
   if (tp->th_opcode == WRQ)
     (*pf->f_recv) (pf);
   else
@@ -519,8 +709,6 @@ again:
 }
 
 
-FILE *file;
-
 /*
  * Validate file access.  Since we
  * have no uid or gid, for now require
@@ -645,43 +833,128 @@ timer (int sig _GL_UNUSED_PARAMETER)
 }
 
 /*
- * Send the requested file.
+ * Send the acknowledgement of options to a read request, and wait
+ * for the ACK of block 0 that starts the transfer.
+ */
+static int
+send_oack (void)
+{
+  register struct tftphdr *ap = (struct tftphdr *) ackbuf;
+  int n;
+
+  timeout = 0;
+  sigsetjmp (timeoutbuf, SIGALRM);
+  if (sendto (peer, oackbuf, oacklen, 0,
+	      (struct sockaddr *) &from, fromlen) != oacklen)
+    {
+      syslog (LOG_ERR, "tftpd: write: %m\n");
+      return -1;
+    }
+  for (;;)
+    {
+      alarm (rexmtval);
+      n = recv (peer, ackbuf, sizeof (ackbuf), 0);
+      alarm (0);
+      if (n < 0)
+	{
+	  syslog (LOG_ERR, "tftpd: read: %m\n");
+	  return -1;
+	}
+      ap->th_opcode = ntohs ((unsigned short) ap->th_opcode);
+      ap->th_block = ntohs ((unsigned short) ap->th_block);
+      if (ap->th_opcode == ERROR)
+	return -1;
+      if (ap->th_opcode == ACK && ap->th_block == 0)
+	return 0;
+    }
+}
+
+/*
+ * Send the requested file.  Up to WINDOWSIZE blocks are sent before
+ * an ACK is awaited.  An ACK tells the last block received in order,
+ * and the blocks after it are sent again when it comes in late or
+ * not at all.
  */
 void
 send_file (struct formats *pf)
 {
   struct tftphdr *dp, *r_init (void);
   register struct tftphdr *ap;	/* ack packet */
-  register int size, n;
-  volatile int block;
+  register int size, n, i;
+  struct window
+  {
+    char *pkt;
+    int len;
+  } *win = NULL;
+  volatile unsigned short base;	/* first block not acknowledged */
+  volatile int count;		/* blocks sent after it */
+  volatile int first;		/* index of BASE in WIN */
+  volatile int last;		/* the final block has been read */
+  int resend;
 
   signal (SIGALRM, timer);
+  if (oacklen && send_oack () < 0)
+    goto abort;
+
+  win = xmalloc (windowsize * sizeof (*win));
+  for (i = 0; i < windowsize; i++)
+    win[i].pkt = xmalloc (segsize + 4);
+
   dp = r_init ();
   ap = (struct tftphdr *) ackbuf;
-  block = 1;
+  base = 1;
+  count = first = last = 0;
   do
     {
-      size = readit (file, &dp, pf->f_convert);
-      if (size < 0)
+      /* Fill the window.  */
+      while (!last && count < windowsize)
 	{
-	  nak (errno + 100);
-	  goto abort;
-	}
-      dp->th_opcode = htons ((unsigned short) DATA);
-      dp->th_block = htons ((unsigned short) block);
-      timeout = 0;
-      sigsetjmp (timeoutbuf, SIGALRM);
+	  struct window *w = &win[(first + count) % windowsize];
 
-    send_data:
-      if (sendto (peer, (const char *) dp, size + 4, 0,
-		 (struct sockaddr *) &from, fromlen) != size + 4)
-	{
-	  syslog (LOG_ERR, "tftpd: write: %m\n");
-	  goto abort;
+	  size = readit (file, &dp, pf->f_convert);
+	  if (size < 0)
+	    {
+	      nak (errno + 100);
+	      goto abort;
+	    }
+	  dp->th_opcode = htons ((unsigned short) DATA);
+	  dp->th_block = htons ((unsigned short) (base + count));
+	  memcpy (w->pkt, dp, size + 4);
+	  w->len = size + 4;
+	  if (sendto (peer, w->pkt, w->len, 0,
+		      (struct sockaddr *) &from, fromlen) != w->len)
+	    {
+	      syslog (LOG_ERR, "tftpd: write: %m\n");
+	      goto abort;
+	    }
+	  if (size < segsize)
+	    last = 1;
+	  count++;
+	  read_ahead (file, pf->f_convert);
 	}
-      read_ahead (file, pf->f_convert);
+
+      timeout = 0;
+      resend = 0;
+      if (sigsetjmp (timeoutbuf, SIGALRM))
+	resend = 1;
       for (;;)
 	{
+	  if (resend)
+	    {
+	      for (i = 0; i < count; i++)
+		{
+		  struct window *w = &win[(first + i) % windowsize];
+
+		  if (sendto (peer, w->pkt, w->len, 0,
+			      (struct sockaddr *) &from, fromlen) != w->len)
+		    {
+		      syslog (LOG_ERR, "tftpd: write: %m\n");
+		      goto abort;
+		    }
+		}
+	      resend = 0;
+	    }
+
 	  alarm (rexmtval);	/* read the ack */
 	  n = recv (peer, ackbuf, sizeof (ackbuf), 0);
 	  alarm (0);
@@ -698,19 +971,30 @@ send_file (struct formats *pf)
 
 	  if (ap->th_opcode == ACK)
 	    {
-	      if ((unsigned short) ap->th_block == (unsigned short) block)
-		break;
+	      /* Number of blocks acknowledged.  */
+	      n = (unsigned short) (ap->th_block - base + 1);
+	      if (n >= 1 && n <= count)
+		{
+		  base += n;
+		  count -= n;
+		  first = (first + n) % windowsize;
+		  break;
+		}
 	      /* Re-synchronize with the other side */
 	      synchnet (peer);
-	      if ((unsigned short) ap->th_block == (unsigned short) (block - 1))
-		goto send_data;
+	      if ((unsigned short) ap->th_block == (unsigned short) (base - 1))
+		resend = 1;
 	    }
-
 	}
-      block++;
     }
-  while (size == SEGSIZE);
+  while (!last || count > 0);
 abort:
+  if (win)
+    {
+      for (i = 0; i < windowsize; i++)
+	free (win[i].pkt);
+      free (win);
+    }
   fclose (file);
 }
 
@@ -722,7 +1006,9 @@ justquit (int sig _GL_UNUSED_PARAMETER)
 
 
 /*
- * Receive a file.
+ * Receive a file.  The ACK of the last block received in order is
+ * sent after every WINDOWSIZE blocks, and at once when a block is
+ * missing.
  */
 void
 recvfile (struct formats *pf)
@@ -730,30 +1016,40 @@ recvfile (struct formats *pf)
   struct tftphdr *dp, *w_init (void);
   register struct tftphdr *ap;	/* ack buffer */
   register int n, size;
-  volatile int block;
+  volatile unsigned short block;
+  volatile int ack = 1;		/* ACK now, or wait for more blocks */
+  char *volatile pkt;		/* the ACK, or OACK, to send */
+  volatile int pktlen;
 
   signal (SIGALRM, timer);
   dp = w_init ();
   ap = (struct tftphdr *) ackbuf;
+  ap->th_opcode = htons ((unsigned short) ACK);
+  ap->th_block = htons ((unsigned short) 0);
   block = 0;
+
+  /* Options are acknowledged in place of block 0.  */
+  pkt = oacklen ? oackbuf : ackbuf;
+  pktlen = oacklen ? oacklen : 4;
   do
     {
-      timeout = 0;
-      ap->th_opcode = htons ((unsigned short) ACK);
-      ap->th_block = htons ((unsigned short) block);
-      block++;
-      sigsetjmp (timeoutbuf, SIGALRM);
-    send_ack:
-      if (sendto (peer, ackbuf, 4, 0, (struct sockaddr *) &from, fromlen) != 4)
+      if (ack)
 	{
-	  syslog (LOG_ERR, "tftpd: write: %m\n");
-	  goto abort;
+	  timeout = 0;
+	  sigsetjmp (timeoutbuf, SIGALRM);
+	send_ack:
+	  if (sendto (peer, pkt, pktlen, 0,
+		      (struct sockaddr *) &from, fromlen) != pktlen)
+	    {
+	      syslog (LOG_ERR, "tftpd: write: %m\n");
+	      goto abort;
+	    }
+	  write_behind (file, pf->f_convert);
 	}
-      write_behind (file, pf->f_convert);
       for (;;)
 	{
 	  alarm (rexmtval);
-	  n = recv (peer, (char *) dp, PKTSIZE, 0);
+	  n = recv (peer, (char *) dp, segsize + 4, 0);
 	  alarm (0);
 	  if (n < 0)
 	    {			/* really? */
@@ -766,16 +1062,24 @@ recvfile (struct formats *pf)
 	    goto abort;
 	  if (dp->th_opcode == DATA)
 	    {
-	      if (dp->th_block == block)
+	      if (dp->th_block == (unsigned short) (block + 1))
 		{
 		  break;	/* normal */
 		}
 	      /* Re-synchronize with the other side */
 	      synchnet (peer);
-	      if (dp->th_block == (block - 1))
+	      if (dp->th_block == block || windowsize > 1)
 		goto send_ack;	/* rexmit */
 	    }
 	}
+      block++;
+      timeout = 0;
+
+      /* From now on, the last block received is acknowledged.  */
+      ap->th_block = htons ((unsigned short) block);
+      pkt = ackbuf;
+      pktlen = 4;
+
       /*  size = write(file, dp->th_data, n - 4); */
       size = writeit (file, &dp, n - 4, pf->f_convert);
       if (size != (n - 4))
@@ -786,8 +1090,9 @@ recvfile (struct formats *pf)
 	    nak (ENOSPACE);
 	  goto abort;
 	}
+      ack = block % windowsize == 0;
     }
-  while (size == SEGSIZE);
+  while (size == segsize);
   write_behind (file, pf->f_convert);
   fclose (file);		/* close data file */
 
@@ -888,3 +1193,987 @@ verifyhost (struct sockaddr_storage *fromp, socklen_t frlen)
       return "0.0.0.0";
     }
 }
+
+#ifdef HAVE_EPOLL_CREATE1
+/*
+ * Single process mode (--single-process).  Every transfer is served
+ * by this process, from a socket of its own watched by epoll, instead
+ * of by a process of its own.  Blocks and acknowledgements are sent
+ * again on a timer wheel, after a timeout adapted to the round-trip
+ * time of each transfer as in RFC 6298, instead of after REXMTVAL
+ * seconds.  A transfer is given up after MAXTIMEOUT seconds without
+ * progress.  Files read are kept in a cache shared by the transfers.
+ */
+#define WHEEL_TICK	10	/* milliseconds per slot of the wheel */
+#define WHEEL_SLOTS	512	/* slots, a span of over five seconds */
+#define RTO_INITIAL	1000	/* milliseconds, before any sample */
+#define RTO_MIN		20	/* milliseconds */
+#define EVENT_MAX	64	/* ready sockets handled per wakeup */
+#define INPUT_BATCH	16	/* packets read per socket and wakeup */
+
+enum xfer_state
+{
+  XFER_OACK,			/* read: options sent, awaiting ACK 0 */
+  XFER_SEND,			/* read: sending blocks */
+  XFER_RECV,			/* write: receiving blocks */
+  XFER_DALLY			/* write: done, final ACK may be lost */
+};
+
+/* A block sent and not yet acknowledged.  */
+struct slot
+{
+  char *s_pkt;			/* DATA packet, or its header */
+  char *s_data;			/* its data, when sent from the cache */
+  int s_len;
+  long long s_sent;		/* time of the first transmission */
+  int s_resent;			/* transmitted more than once */
+};
+
+struct fcache;
+
+struct xfer
+{
+  int x_fd;			/* socket connected to the client */
+  enum xfer_state x_state;
+  FILE *x_file;
+  struct fcache *x_cache;	/* the file in memory, instead */
+  char *x_data;
+  size_t x_size;
+  size_t x_off;			/* of the next block to send */
+  int x_convert;
+  struct tftpconv x_conv;
+  int x_segsize;
+  int x_windowsize;
+
+  /* Reading: the window of blocks sent.  */
+  struct slot *x_win;
+  unsigned short x_base;	/* first block not acknowledged */
+  int x_count;			/* blocks sent after it */
+  int x_first;			/* index of X_BASE in X_WIN */
+  int x_last;			/* the final block has been read */
+
+  /* Writing: the last block received in order.  */
+  unsigned short x_block;
+  char x_ack[4];
+
+  /* The OACK, or else the ACK, sent last.  */
+  char *x_reply;
+  int x_replylen;
+  long long x_replied;		/* time sent, or 0 when sent again */
+  char *x_oack;
+
+  /* Retransmission timeout, in milliseconds.  */
+  int x_srtt;			/* smoothed round-trip time, or -1 */
+  int x_rttvar;
+  int x_rto;
+  long long x_progress;		/* time of the last progress */
+
+  long long x_expire;		/* time of the timer, or 0 */
+  struct xfer *x_next, *x_prev;	/* in its slot of the wheel */
+};
+
+static int epfd = -1;
+static int nxfers;		/* transfers in progress */
+static long long now;		/* milliseconds, at the last wakeup */
+static struct xfer *wheel[WHEEL_SLOTS];
+static long long wheel_tick;	/* last tick run */
+static char rbuf[MAXBLKSIZE + 4];	/* packet received */
+
+#ifdef HAVE_MMAP
+/*
+ * The cache of files.  A file read is kept in memory, keyed by its
+ * name, for as long as its inode, size and time of modification stay
+ * the same, and every transfer of it sends its blocks from there.
+ * Octet blocks are sent from a mapping of the file, and netascii
+ * blocks from a copy converted once.  Files no transfer is using are
+ * dropped, least recently used first, when more than CACHE_SIZE
+ * megabytes are kept.  Should a mapped file be shortened, the blocks
+ * beyond its end fail to be sent, instead of faulting this process.
+ */
+#define CACHE_BUCKETS	64
+
+struct fcache
+{
+  struct fcache *fc_next;	/* in its bucket */
+  char *fc_path;
+  dev_t fc_dev;
+  ino_t fc_ino;
+  time_t fc_mtime;
+  off_t fc_size;
+  char *fc_map;			/* the file, once mapped */
+  char *fc_ascii;		/* it in netascii, once converted */
+  size_t fc_asciilen;
+  int fc_refs;			/* transfers sending from it */
+  int fc_stale;			/* out of its bucket */
+  long long fc_used;		/* time of the last request */
+};
+
+static struct fcache *cache[CACHE_BUCKETS];
+static size_t cache_bytes;	/* mapped or converted */
+static unsigned long cache_files, cache_hits, cache_misses;
+static volatile sig_atomic_t stats_wanted;
+
+static unsigned
+cache_hash (const char *path)
+{
+  unsigned h = 0;
+
+  while (*path)
+    h = h * 31 + (unsigned char) *path++;
+  return h % CACHE_BUCKETS;
+}
+
+static void
+cache_free (struct fcache *fc)
+{
+  if (fc->fc_map)
+    {
+      munmap (fc->fc_map, fc->fc_size);
+      cache_bytes -= fc->fc_size;
+    }
+  if (fc->fc_ascii)
+    {
+      free (fc->fc_ascii);
+      cache_bytes -= fc->fc_asciilen;
+    }
+  free (fc->fc_path);
+  free (fc);
+  cache_files--;
+}
+
+/* Take FC out of the cache, to be freed once no transfer uses it.  */
+static void
+cache_drop (struct fcache *fc)
+{
+  struct fcache **fcp;
+
+  if (fc->fc_stale)
+    return;
+  for (fcp = &cache[cache_hash (fc->fc_path)]; *fcp != fc;
+       fcp = &(*fcp)->fc_next)
+    ;
+  *fcp = fc->fc_next;
+  fc->fc_stale = 1;
+  if (fc->fc_refs == 0)
+    cache_free (fc);
+}
+
+static void
+cache_release (struct fcache *fc)
+{
+  if (--fc->fc_refs == 0 && fc->fc_stale)
+    cache_free (fc);
+}
+
+/* Drop files not in use, least recently used first, until no more
+   than LIMIT bytes are kept.  */
+static void
+cache_trim (size_t limit)
+{
+  while (cache_bytes > limit)
+    {
+      struct fcache *fc, *lru = NULL;
+      int i;
+
+      for (i = 0; i < CACHE_BUCKETS; i++)
+	for (fc = cache[i]; fc; fc = fc->fc_next)
+	  if (fc->fc_refs == 0 && (!lru || fc->fc_used < lru->fc_used))
+	    lru = fc;
+      if (lru == NULL)
+	break;
+      cache_drop (lru);
+    }
+}
+
+/* Convert FILE, the file of FC, to netascii.  */
+static int
+cache_convert (struct fcache *fc, FILE *file)
+{
+  struct tftpconv conv;
+  size_t len = 0, room = fc->fc_size + fc->fc_size / 8 + SEGSIZE;
+  char *ascii;
+  int n;
+
+  conv.newline = 0;
+  conv.prevchar = -1;
+  ascii = xmalloc (room);
+  do
+    {
+      if (room - len < SEGSIZE)
+	{
+	  room *= 2;
+	  ascii = xrealloc (ascii, room);
+	}
+      n = readblock (file, ascii + len, SEGSIZE, 1, &conv);
+      if (n < 0 || ferror (file))
+	{
+	  free (ascii);
+	  return -1;
+	}
+      len += n;
+    }
+  while (n == SEGSIZE);
+
+  fc->fc_ascii = len ? xrealloc (ascii, len) : ascii;
+  fc->fc_asciilen = len;
+  cache_bytes += len;
+  return 0;
+}
+
+/* Find FILE, opened by the name PATH, in the cache, or add it.  Its
+   content, in netascii if CONVERT, is returned in *DATAP and *SIZEP.
+   Returns NULL if the file is not to be cached.  */
+static struct fcache *
+cache_get (const char *path, FILE *file, int convert,
+	   char **datap, size_t *sizep)
+{
+  struct fcache *fc;
+  struct stat st;
+  size_t limit = (size_t) cache_size << 20;
+  int hit = 1;
+
+  if (limit == 0 || fstat (fileno (file), &st) < 0 || !S_ISREG (st.st_mode)
+      || (unsigned long long) st.st_size > limit)
+    return NULL;
+
+  for (fc = cache[cache_hash (path)]; fc; fc = fc->fc_next)
+    if (strcmp (fc->fc_path, path) == 0)
+      break;
+  if (fc && (fc->fc_dev != st.st_dev || fc->fc_ino != st.st_ino
+	     || fc->fc_size != st.st_size || fc->fc_mtime != st.st_mtime))
+    {
+      cache_drop (fc);		/* replaced or changed */
+      fc = NULL;
+    }
+  if (fc == NULL)
+    {
+      unsigned h = cache_hash (path);
+
+      fc = xzalloc (sizeof (*fc));
+      fc->fc_path = xstrdup (path);
+      fc->fc_dev = st.st_dev;
+      fc->fc_ino = st.st_ino;
+      fc->fc_size = st.st_size;
+      fc->fc_mtime = st.st_mtime;
+      fc->fc_next = cache[h];
+      cache[h] = fc;
+      cache_files++;
+      hit = 0;
+    }
+
+  if (convert && !fc->fc_ascii)
+    {
+      hit = 0;
+      if (cache_convert (fc, file) < 0)
+	goto fail;
+    }
+  else if (!convert && !fc->fc_map && fc->fc_size > 0)
+    {
+      void *map = mmap (NULL, fc->fc_size, PROT_READ, MAP_SHARED,
+			fileno (file), 0);
+
+      hit = 0;
+      if (map == MAP_FAILED)
+	goto fail;
+      fc->fc_map = map;
+      cache_bytes += fc->fc_size;
+    }
+
+  if (hit)
+    cache_hits++;
+  else
+    cache_misses++;
+  fc->fc_refs++;
+  fc->fc_used = now;
+  *datap = convert ? fc->fc_ascii : fc->fc_map;
+  *sizep = convert ? fc->fc_asciilen : (size_t) fc->fc_size;
+  cache_trim (limit);
+  return fc;
+
+fail:
+  if (fc->fc_refs == 0 && !fc->fc_map && !fc->fc_ascii)
+    cache_drop (fc);
+  return NULL;
+}
+
+static void
+cache_stats (void)
+{
+  syslog (LOG_INFO, "file cache: %lu hits, %lu misses, "
+	  "%lu files, %lu bytes in memory",
+	  cache_hits, cache_misses, cache_files,
+	  (unsigned long) cache_bytes);
+}
+
+static void
+want_stats (int sig _GL_UNUSED_PARAMETER)
+{
+  stats_wanted = 1;
+}
+#endif /* HAVE_MMAP */
+
+/* Milliseconds on a clock that is never set back, for the timers,
+   the round-trip times and the idle timeout.  */
+static long long
+now_ms (void)
+{
+#if defined HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+#else
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+#endif
+}
+
+static void
+timer_clear (struct xfer *x)
+{
+  if (!x->x_expire)
+    return;
+  if (x->x_prev)
+    x->x_prev->x_next = x->x_next;
+  else
+    wheel[(x->x_expire / WHEEL_TICK) % WHEEL_SLOTS] = x->x_next;
+  if (x->x_next)
+    x->x_next->x_prev = x->x_prev;
+  x->x_expire = 0;
+}
+
+/* Let the timer of X expire in MS milliseconds.  */
+static void
+timer_set (struct xfer *x, int ms)
+{
+  struct xfer **slot;
+
+  timer_clear (x);
+  x->x_expire = now + ms;
+  slot = &wheel[(x->x_expire / WHEEL_TICK) % WHEEL_SLOTS];
+  x->x_prev = NULL;
+  x->x_next = *slot;
+  if (*slot)
+    (*slot)->x_prev = x;
+  *slot = x;
+}
+
+/* Account for a round-trip time of the packet sent at SENT.  */
+static void
+rtt_sample (struct xfer *x, long long sent)
+{
+  int r = now - sent, max = rexmtval * 1000;
+
+  if (x->x_srtt < 0)
+    {
+      x->x_srtt = r;
+      x->x_rttvar = r / 2;
+    }
+  else
+    {
+      x->x_rttvar = (3 * x->x_rttvar + abs (x->x_srtt - r)) / 4;
+      x->x_srtt = (7 * x->x_srtt + r) / 8;
+    }
+  x->x_rto = x->x_srtt + (4 * x->x_rttvar > WHEEL_TICK
+			  ? 4 * x->x_rttvar : WHEEL_TICK);
+  if (x->x_rto < RTO_MIN)
+    x->x_rto = RTO_MIN;
+  if (max > 0 && x->x_rto > max)
+    x->x_rto = max;
+}
+
+static void
+xfer_end (struct xfer *x)
+{
+  int i;
+
+  timer_clear (x);
+  close (x->x_fd);
+  if (x->x_file)
+    fclose (x->x_file);
+#ifdef HAVE_MMAP
+  if (x->x_cache)
+    cache_release (x->x_cache);
+#endif
+  if (x->x_win)
+    {
+      for (i = 0; i < x->x_windowsize; i++)
+	free (x->x_win[i].s_pkt);
+      free (x->x_win);
+    }
+  free (x->x_oack);
+  free (x);
+  nxfers--;
+}
+
+/* Send the error ERROR to the client of X.  */
+static void
+xfer_nak (struct xfer *x, int error)
+{
+  peer = x->x_fd;
+  fromlen = sizeof (from);
+  getpeername (x->x_fd, (struct sockaddr *) &from, &fromlen);
+  nak (error);
+}
+
+/* Send the block in S of X.  Returns -1 if the transfer has ended,
+   as when the data of a cached file is gone.  */
+static int
+xfer_send (struct xfer *x, struct slot *s)
+{
+  struct iovec iov[2];
+  struct msghdr msg;
+
+  if (!x->x_cache)
+    {
+      send (x->x_fd, s->s_pkt, s->s_len, 0);
+      return 0;
+    }
+
+  /* The header, followed by the data in the cache.  */
+  iov[0].iov_base = s->s_pkt;
+  iov[0].iov_len = 4;
+  iov[1].iov_base = s->s_data;
+  iov[1].iov_len = s->s_len - 4;
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  if (sendmsg (x->x_fd, &msg, 0) < 0 && errno == EFAULT)
+    {
+#ifdef HAVE_MMAP
+      cache_drop (x->x_cache);
+#endif
+      xfer_nak (x, EIO + 100);
+      xfer_end (x);
+      return -1;
+    }
+  return 0;
+}
+
+/* Send the OACK or ACK of X.  */
+static void
+xfer_reply (struct xfer *x)
+{
+  send (x->x_fd, x->x_reply, x->x_replylen, 0);
+  x->x_replied = now;
+}
+
+/* Send the blocks of X that fit in its window.  Returns -1 if the
+   transfer has ended.  */
+static int
+xfer_fill (struct xfer *x)
+{
+  int sent = 0;
+
+  while (!x->x_last && x->x_count < x->x_windowsize)
+    {
+      struct slot *s = &x->x_win[(x->x_first + x->x_count)
+				 % x->x_windowsize];
+      struct tftphdr *dp = (struct tftphdr *) s->s_pkt;
+      int size;
+
+      if (x->x_cache)
+	{
+	  size = x->x_size - x->x_off < (size_t) x->x_segsize
+	    ? (int) (x->x_size - x->x_off) : x->x_segsize;
+	  s->s_data = x->x_data + x->x_off;
+	  x->x_off += size;
+	}
+      else
+	size = readblock (x->x_file, dp->th_data, x->x_segsize,
+			  x->x_convert, &x->x_conv);
+      if (size < 0)
+	{
+	  xfer_nak (x, errno + 100);
+	  xfer_end (x);
+	  return -1;
+	}
+      dp->th_opcode = htons ((unsigned short) DATA);
+      dp->th_block = htons ((unsigned short) (x->x_base + x->x_count));
+      s->s_len = size + 4;
+      s->s_sent = now;
+      s->s_resent = 0;
+      if (xfer_send (x, s) < 0)
+	return -1;
+      if (size < x->x_segsize)
+	x->x_last = 1;
+      x->x_count++;
+      sent++;
+    }
+
+  if (sent)
+    timer_set (x, x->x_rto);
+  return 0;
+}
+
+/* Send the window of X again.  Returns -1 if the transfer has
+   ended.  */
+static int
+xfer_resend (struct xfer *x)
+{
+  int i;
+
+  for (i = 0; i < x->x_count; i++)
+    {
+      struct slot *s = &x->x_win[(x->x_first + i) % x->x_windowsize];
+
+      if (xfer_send (x, s) < 0)
+	return -1;
+      s->s_resent = 1;
+    }
+  return 0;
+}
+
+/* Discard what is queued on the socket of X.  */
+static void
+xfer_drain (struct xfer *x)
+{
+  while (recv (x->x_fd, rbuf, sizeof (rbuf), 0) >= 0)
+    ;
+}
+
+static void
+xfer_timeout (struct xfer *x)
+{
+  int max = rexmtval * 1000;
+
+  if (x->x_state == XFER_DALLY
+      || now - x->x_progress >= maxtimeout * 1000LL)
+    {
+      xfer_end (x);
+      return;
+    }
+
+  /* Back off, and send again what was not acknowledged.  */
+  x->x_rto *= 2;
+  if (max > 0 && x->x_rto > max)
+    x->x_rto = max;
+  if (x->x_state == XFER_SEND)
+    {
+      if (xfer_resend (x) < 0)
+	return;
+    }
+  else
+    {
+      xfer_reply (x);
+      x->x_replied = 0;
+    }
+  timer_set (x, x->x_rto);
+}
+
+/* Handle the packet of N bytes in RBUF, received by X.  Returns -1
+   if no more is to be read for X now, as when the transfer has ended
+   or its socket was drained.  */
+static int
+xfer_packet (struct xfer *x, int n)
+{
+  struct tftphdr *tp = (struct tftphdr *) rbuf;
+  unsigned short block;
+
+  if (n < 4)
+    return 0;
+  block = ntohs (tp->th_block);
+  switch (ntohs (tp->th_opcode))
+    {
+    case ERROR:
+      xfer_end (x);
+      return -1;
+
+    case ACK:
+      if (x->x_state == XFER_OACK)
+	{
+	  if (block != 0)
+	    return 0;
+	  if (x->x_replied)
+	    rtt_sample (x, x->x_replied);
+	  x->x_state = XFER_SEND;
+	  x->x_progress = now;
+	  return xfer_fill (x);
+	}
+      if (x->x_state == XFER_SEND)
+	{
+	  /* Number of blocks acknowledged.  */
+	  int k = (unsigned short) (block - x->x_base + 1);
+
+	  if (k >= 1 && k <= x->x_count)
+	    {
+	      struct slot *s = &x->x_win[(x->x_first + k - 1)
+					 % x->x_windowsize];
+
+	      if (!s->s_resent)
+		rtt_sample (x, s->s_sent);
+	      x->x_base += k;
+	      x->x_count -= k;
+	      x->x_first = (x->x_first + k) % x->x_windowsize;
+	      x->x_progress = now;
+	      if (x->x_last && x->x_count == 0)
+		{
+		  xfer_end (x);
+		  return -1;
+		}
+	      timer_set (x, x->x_rto);
+	      return xfer_fill (x);
+	    }
+	  if (block == (unsigned short) (x->x_base - 1))
+	    {
+	      /* Re-synchronize with the other side.  */
+	      xfer_drain (x);
+	      if (xfer_resend (x) == 0)
+		timer_set (x, x->x_rto);
+	      return -1;
+	    }
+	}
+      return 0;
+
+    case DATA:
+      if (x->x_state == XFER_DALLY)
+	{
+	  if (block == x->x_block)
+	    xfer_reply (x);	/* the final ACK was lost */
+	  return 0;
+	}
+      if (x->x_state != XFER_RECV)
+	return 0;
+      if (block == (unsigned short) (x->x_block + 1))
+	{
+	  int size = n - 4, written;
+
+	  if (x->x_replied)
+	    rtt_sample (x, x->x_replied);
+	  x->x_replied = 0;
+	  written = writeblock (x->x_file, tp->th_data, size,
+				x->x_convert, &x->x_conv);
+	  if (written != size)
+	    {
+	      xfer_nak (x, written < 0 ? errno + 100 : ENOSPACE);
+	      xfer_end (x);
+	      return -1;
+	    }
+	  x->x_block = block;
+	  x->x_progress = now;
+
+	  /* From now on, the last block received is acknowledged.  */
+	  tp = (struct tftphdr *) x->x_ack;
+	  tp->th_opcode = htons ((unsigned short) ACK);
+	  tp->th_block = htons (block);
+	  x->x_reply = x->x_ack;
+	  x->x_replylen = 4;
+	  if (size < x->x_segsize)
+	    {
+	      /* Data is on disk before the final ACK.  */
+	      if (fclose (x->x_file) != 0)
+		{
+		  x->x_file = NULL;
+		  xfer_nak (x, errno + 100);
+		  xfer_end (x);
+		  return -1;
+		}
+	      x->x_file = NULL;
+	      xfer_reply (x);
+	      x->x_state = XFER_DALLY;
+	      timer_set (x, rexmtval * 1000);
+	    }
+	  else if (block % x->x_windowsize == 0)
+	    {
+	      xfer_reply (x);
+	      timer_set (x, x->x_rto);
+	    }
+	  else
+	    timer_set (x, x->x_rto);
+	  return 0;
+	}
+      if (block == x->x_block || x->x_windowsize > 1)
+	{
+	  /* Re-synchronize with the other side.  */
+	  xfer_drain (x);
+	  xfer_reply (x);
+	  x->x_replied = 0;
+	  timer_set (x, x->x_rto);
+	  return -1;
+	}
+      return 0;
+    }
+  return 0;
+}
+
+/* Read what the client of X sent.  */
+static void
+xfer_input (struct xfer *x)
+{
+  int i, n;
+
+  for (i = 0; i < INPUT_BATCH; i++)
+    {
+      n = recv (x->x_fd, rbuf, sizeof (rbuf), 0);
+      if (n < 0)
+	{
+	  /* The client is gone when its port is unreachable.  */
+	  if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+	    xfer_end (x);
+	  return;
+	}
+      if (xfer_packet (x, n) < 0)
+	return;
+    }
+}
+
+/* Start the transfer asked for by the request TP of SIZE bytes in
+   BUF, from FROM.  */
+static void
+xfer_start (struct tftphdr *tp, int size)
+{
+  struct sockaddr_storage sin;
+  struct epoll_event ev;
+  struct formats *pf;
+  struct xfer *x;
+  char *filename, *opts;
+  int fd, on = 1, ecode, i;
+
+  fd = socket (from.ss_family, SOCK_DGRAM, 0);
+  if (fd < 0)
+    {
+      syslog (LOG_ERR, "socket: %m\n");
+      return;
+    }
+  memset (&sin, 0, sizeof (sin));
+  sin.ss_family = from.ss_family;
+#if HAVE_STRUCT_SOCKADDR_STORAGE_SS_LEN
+  sin.ss_len = from.ss_len;
+#endif
+  if (bind (fd, (struct sockaddr *) &sin, fromlen) < 0
+      || connect (fd, (struct sockaddr *) &from, fromlen) < 0
+      || ioctl (fd, FIONBIO, &on) < 0)
+    {
+      syslog (LOG_ERR, "tftpd: socket: %m\n");
+      close (fd);
+      return;
+    }
+  fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+  peer = fd;
+  file = NULL;
+  pf = open_request (tp, size, &filename, &opts, &ecode);
+  if (pf == NULL)
+    {
+      if (file)
+	fclose (file);
+      close (fd);
+      return;
+    }
+
+  /* The options of this request alone.  */
+  segsize = SEGSIZE;
+  windowsize = 1;
+  oacklen = 0;
+  request_options (tp, size, pf, opts);
+
+  x = xzalloc (sizeof (*x));
+  x->x_fd = fd;
+  x->x_file = file;
+  file = NULL;
+  x->x_convert = pf->f_convert;
+  x->x_conv.prevchar = -1;
+  x->x_segsize = segsize;
+  x->x_windowsize = windowsize;
+  x->x_srtt = -1;
+  x->x_rto = RTO_INITIAL;
+  x->x_progress = now;
+  nxfers++;
+#ifdef HAVE_MMAP
+  if (tp->th_opcode == RRQ)
+    {
+      x->x_cache = cache_get (filename, x->x_file, x->x_convert,
+			      &x->x_data, &x->x_size);
+      if (x->x_cache)
+	{
+	  fclose (x->x_file);
+	  x->x_file = NULL;
+	}
+    }
+#endif
+
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = x;
+  if (epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+      syslog (LOG_ERR, "epoll_ctl: %m");
+      xfer_end (x);
+      return;
+    }
+
+  if (oacklen)
+    {
+      x->x_oack = xmalloc (oacklen);
+      memcpy (x->x_oack, oackbuf, oacklen);
+    }
+
+  if (tp->th_opcode == RRQ)
+    {
+      x->x_win = xcalloc (x->x_windowsize, sizeof (*x->x_win));
+      for (i = 0; i < x->x_windowsize; i++)
+	x->x_win[i].s_pkt = xmalloc (x->x_cache ? 4 : x->x_segsize + 4);
+      x->x_base = 1;
+      if (!x->x_oack)
+	{
+	  x->x_state = XFER_SEND;
+	  xfer_fill (x);
+	  return;
+	}
+      x->x_state = XFER_OACK;
+    }
+  else
+    {
+      /* Options are acknowledged in place of block 0.  */
+      tp = (struct tftphdr *) x->x_ack;
+      tp->th_opcode = htons ((unsigned short) ACK);
+      tp->th_block = htons ((unsigned short) 0);
+      x->x_state = XFER_RECV;
+    }
+
+  x->x_reply = x->x_oack ? x->x_oack : x->x_ack;
+  x->x_replylen = x->x_oack ? oacklen : 4;
+  xfer_reply (x);
+  timer_set (x, x->x_rto);
+}
+
+/* Read the requests queued on the socket of the service.  */
+static void
+requests (void)
+{
+  struct tftphdr *tp = (struct tftphdr *) buf;
+  int i, n;
+
+  for (i = 0; i < INPUT_BATCH; i++)
+    {
+      fromlen = sizeof (from);
+      n = recvfrom (0, buf, sizeof (buf), 0,
+		    (struct sockaddr *) &from, &fromlen);
+      if (n < 0)
+	return;
+      if (n < 4)
+	continue;
+      tp->th_opcode = ntohs (tp->th_opcode);
+      if (tp->th_opcode == RRQ || tp->th_opcode == WRQ)
+	xfer_start (tp, n);
+    }
+}
+
+/* Run the timers that have expired by now.  */
+static void
+timer_run (void)
+{
+  long long tick, end = now / WHEEL_TICK;
+
+  /* Every slot is visited once at most.  */
+  if (end - wheel_tick > WHEEL_SLOTS)
+    wheel_tick = end - WHEEL_SLOTS;
+
+  for (tick = wheel_tick + 1; tick <= end; tick++)
+    {
+      struct xfer *x, *next;
+
+      for (x = wheel[tick % WHEEL_SLOTS]; x; x = next)
+	{
+	  next = x->x_next;
+	  if (x->x_expire <= now)
+	    {
+	      timer_clear (x);
+	      xfer_timeout (x);
+	    }
+	}
+    }
+  wheel_tick = end;
+}
+
+/*
+ * Serve the request TP of SIZE bytes in BUF, and every one that
+ * follows on the socket of the service, until no transfer has been
+ * in progress for IDLE_TIMEOUT seconds.
+ */
+static void
+engine (struct tftphdr *tp, int size)
+{
+  struct epoll_event ev, events[EVENT_MAX];
+  struct rlimit rl;
+  long long idle;
+  int i, n, wait;
+
+  epfd = epoll_create1 (EPOLL_CLOEXEC);
+  if (epfd < 0)
+    {
+      syslog (LOG_ERR, "epoll_create1: %m");
+      return;
+    }
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (epoll_ctl (epfd, EPOLL_CTL_ADD, 0, &ev) < 0)
+    {
+      syslog (LOG_ERR, "epoll_ctl: %m");
+      return;
+    }
+
+  /* Each transfer holds a socket and a file.  */
+  if (getrlimit (RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+      rl.rlim_cur = rl.rlim_max;
+      setrlimit (RLIMIT_NOFILE, &rl);
+    }
+  signal (SIGPIPE, SIG_IGN);
+#ifdef HAVE_MMAP
+  signal (SIGUSR1, want_stats);
+#endif
+
+  idle = now = now_ms ();
+  wheel_tick = now / WHEEL_TICK;
+  if (tp->th_opcode == RRQ || tp->th_opcode == WRQ)
+    xfer_start (tp, size);
+
+  for (;;)
+    {
+      if (nxfers)
+	{
+	  idle = now;
+	  wait = WHEEL_TICK;
+	}
+      else if (idle_timeout)
+	{
+	  wait = idle + idle_timeout * 1000LL - now;
+	  if (wait <= 0)
+	    {
+#ifdef HAVE_MMAP
+	      if (logging)
+		cache_stats ();
+#endif
+	      exit (EXIT_SUCCESS);
+	    }
+	}
+      else
+	wait = -1;
+
+      n = epoll_wait (epfd, events, EVENT_MAX, wait);
+      if (n < 0 && errno != EINTR)
+	{
+	  syslog (LOG_ERR, "epoll_wait: %m");
+	  exit (EXIT_FAILURE);
+	}
+      now = now_ms ();
+#ifdef HAVE_MMAP
+      if (stats_wanted)
+	{
+	  stats_wanted = 0;
+	  cache_stats ();
+	}
+#endif
+      for (i = 0; i < n; i++)
+	if (events[i].data.ptr)
+	  xfer_input (events[i].data.ptr);
+	else
+	  requests ();
+      timer_run ();
+    }
+}
+#endif /* HAVE_EPOLL_CREATE1 */
@@ -83,10 +83,13 @@ typedef struct trace
 void trace_init (trace_t * t, const struct sockaddr_in to,
 		 const enum trace_type type);
 void trace_ip_opts (struct sockaddr_in *to);
+void trace_set_ttl (trace_t * t, int ttl);
 void trace_inc_ttl (trace_t * t);
 void trace_inc_port (trace_t * t);
 void trace_port (trace_t * t, const unsigned short port);
 int trace_read (trace_t * t, int * type, int * code);
+int trace_read_probe (trace_t * t, int nprobes, int * type, int * code,
+		      bool * arrived, struct in_addr * probed);
 int trace_write (trace_t * t);
 int trace_udp_sock (trace_t * t);
 int trace_icmp_sock (trace_t * t);
@@ -96,12 +99,93 @@ int trace_icmp_sock (trace_t * t);
 void do_try (trace_t * trace, const int hop,
 	     const int max_hops, const int max_tries);
 
+/* A probe sent in parallel mode.  */
+struct probe
+{
+  int state;			/* PROBE_NEW, PROBE_SENT, or PROBE_DONE */
+  struct timeval tsent;
+  struct in_addr from;
+  double triptime;		/* milliseconds, or -1 without reply */
+  int type, code;		/* of the reply */
+};
+
+#define PROBE_NEW	0
+#define PROBE_SENT	1
+#define PROBE_DONE	2
+
+#define PROBE_BURST	16	/* Probes sent between reads.  */
+
+int do_parallel (trace_t * trace);
+
+/* A hop of a route traced in batch mode.  */
+struct hop
+{
+  struct in_addr addr;		/* the first to reply, if any */
+  double rtt;			/* fastest reply in ms, or -1 */
+  int type, code;		/* of the first reply */
+  bool known;			/* taken from a route traced before */
+};
+
+/* A destination of batch mode.  */
+struct target
+{
+  char *name;			/* as given */
+  struct in_addr addr;
+  struct hop *hops;		/* from hop OPT_TTL on */
+  int hop;			/* the one being probed */
+  int last;			/* last hop of the route */
+  int tosend, pending;		/* probes of HOP to send, and awaited */
+  int silent;			/* hops without reply in a row */
+  bool backward;		/* probing towards the local host */
+  bool done;
+};
+
+/* A probe of batch mode in flight.  */
+struct slot
+{
+  struct target *target;	/* NULL once answered or timed out */
+  int hop;
+  struct timeval tsent;
+};
+
+/* A hop known to lie on a route traced before.  */
+struct known
+{
+  struct known *next;		/* in its bucket */
+  struct in_addr addr;
+  int hop;
+  struct target *route;
+};
+
+#define BATCH_WINDOW	64	/* Default probes in flight.  */
+#define BATCH_SLOTS	4096	/* Probes told apart.  */
+#define BATCH_GAP	5	/* Silent hops ending a route.  */
+#define BATCH_SPLIT	6	/* Default hop to probe forward from.  */
+#define KNOWN_BUCKETS	4096
+
+void add_target (const char *name);
+void read_targets (const char *file);
+int do_batch (trace_t * trace);
+
+/* A name looked up by get_hostname.  */
+struct ptr
+{
+  struct ptr *next;		/* in its bucket */
+  struct in_addr addr;
+  char *name;
+};
+
+#define PTR_BUCKETS	1024
+
 char *get_hostname (struct in_addr *addr);
 
 int stop = 0;
 int pid;
 int seqno;	/* Most recent sequence number.  */
 static char *hostname = NULL;
+static struct target *targets;	/* of batch mode */
+static size_t ntargets;
+static struct ptr *ptrs[PTR_BUCKETS];
 char addrstr[INET6_ADDRSTRLEN];
 struct sockaddr_in dest;
 
@@ -123,6 +207,9 @@ int opt_resolve_hostnames = 0;
 int opt_tos = -1;	/* Triggers with non-negative values.  */
 int opt_ttl = TRACE_TTL;
 int opt_wait = TIME_INTERVAL;
+static int opt_parallel = -1;	/* Probes in flight, 0 for all.  */
+static char *opt_hosts_file = NULL;
+static int opt_split_hop = BATCH_SPLIT;
 #ifdef IP_OPTIONS
 char *opt_gateways = NULL;
 #endif
@@ -136,7 +223,10 @@ const char *program_authors[] = {
 
 /* Define keys for long options that do not have short counterparts. */
 enum {
-  OPT_RESOLVE = 256
+  OPT_RESOLVE = 256,
+  OPT_PARALLEL,
+  OPT_HOSTS_FILE,
+  OPT_SPLIT_HOP
 };
 
 static struct argp_option argp_options[] = {
@@ -147,11 +237,19 @@ static struct argp_option argp_options[] = {
   {"gateways", 'g', "GATES", 0, "list of gateways for loose source routing",
    GRP+1},
 #endif
+  {"hosts-file", OPT_HOSTS_FILE, "FILE", 0, "trace the routes to the hosts "
+   "listed in FILE as well, or in standard input if FILE is -, and print "
+   "one line for each", GRP+1},
   {"icmp", 'I', NULL, 0, "use ICMP ECHO as probe", GRP+1},
   {"max-hop", 'm', "NUM", 0, "set maximal hop count (default: 64)", GRP+1},
+  {"parallel", OPT_PARALLEL, "NUM", OPTION_ARG_OPTIONAL, "send the probes "
+   "for all hops at once, or NUM at a time", GRP+1},
   {"port", 'p', "PORT", 0, "use destination PORT port (default: 33434)",
    GRP+1},
   {"resolve-hostnames", OPT_RESOLVE, NULL, 0, "resolve hostnames", GRP+1},
+  {"split-hop", OPT_SPLIT_HOP, "NUM", 0, "with --hosts-file, probe forward "
+   "from hop NUM, and back from it until the route joins one traced "
+   "before (default: 6)", GRP+1},
   {"tos", 't', "NUM", 0, "set type of service (TOS) to NUM", GRP+1},
   {"tries", 'q', "NUM", 0, "send NUM probe packets per hop (default: 3)",
    GRP+1},
@@ -247,13 +345,34 @@ parse_opt (int key, char *arg, struct argp_state *state)
       opt_resolve_hostnames = 1;
       break;
 
+    case OPT_PARALLEL:
+      opt_parallel = 0;
+      if (arg)
+	{
+	  opt_parallel = strtol (arg, &p, 0);
+	  if (*p || opt_parallel <= 0)
+	    error (EXIT_FAILURE, 0, "invalid number of probes `%s'", arg);
+	}
+      break;
+
+    case OPT_HOSTS_FILE:
+      opt_hosts_file = arg;
+      break;
+
+    case OPT_SPLIT_HOP:
+      opt_split_hop = strtol (arg, &p, 0);
+      if (*p || opt_split_hop <= 0 || opt_split_hop > 255)
+	error (EXIT_FAILURE, 0, "impossible distance `%s'", arg);
+      break;
+
     case ARGP_KEY_ARG:
       host_is_given = true;
       hostname = xstrdup(arg);
+      add_target (arg);
       break;
 
     case ARGP_KEY_SUCCESS:
-      if (!host_is_given)
+      if (!host_is_given && !opt_hosts_file)
         argp_error (state, "missing host operand");
       break;
 
@@ -287,6 +406,22 @@ main (int argc, char **argv)
   iu_argp_init ("traceroute", program_authors);
   argp_parse (&argp, argc, argv, 0, NULL, NULL);
 
+  if (opt_hosts_file)
+    {
+#ifdef IP_OPTIONS
+      if (opt_gateways)
+	error (EXIT_FAILURE, 0, "--gateways and --hosts-file incompatible "
+	       "options");
+#endif
+      read_targets (opt_hosts_file);
+
+      memset (&dest, 0, sizeof (dest));
+      dest.sin_family = AF_INET;
+      dest.sin_port = htons (opt_port);
+      trace_init (&trace, dest, opt_type);
+      exit (do_batch (&trace));
+    }
+
   if ((hostname == NULL) || (*hostname == '\0'))
     error (EXIT_FAILURE, 0, "unknown host");
 
@@ -333,6 +468,9 @@ main (int argc, char **argv)
 
   trace_init (&trace, dest, opt_type);
 
+  if (opt_parallel >= 0)
+    exit (do_parallel (&trace));
+
   hop = 1;
   seqno = -1;	/* One less than first usable packet number 0.  */
 
@@ -452,15 +590,643 @@ do_try (trace_t * trace, const int hop,
   printf ("\n");
 }
 
+/* Milliseconds from EARLIER to LATER.  */
+static double
+tv_ms (struct timeval *later, struct timeval *earlier)
+{
+  return (later->tv_sec - earlier->tv_sec) * 1000.0
+    + (later->tv_usec - earlier->tv_usec) / 1000.0;
+}
+
+/* Print the line of HOP, whose probes are every NHOPS in PROBES.  */
+static void
+print_hop (int hop, struct probe *probes, int nhops)
+{
+  int tries;
+  uint32_t prev_addr = 0;
+
+  printf (" %2d  ", hop);
+  for (tries = 0; tries < opt_max_tries; tries++)
+    {
+      struct probe *pr = &probes[tries * nhops + hop - 1];
+
+      if (pr->triptime < 0)
+	{
+	  printf (" * ");
+	  continue;
+	}
+
+      if (tries == 0 || prev_addr != pr->from.s_addr)
+	{
+	  printf (" %s ", inet_ntoa (pr->from));
+	  if (opt_resolve_hostnames)
+	    printf ("(%s) ", get_hostname (&pr->from));
+	}
+      printf (" %.3fms ", pr->triptime);
+
+      /* Additional messages.  */
+      if (pr->type == ICMP_DEST_UNREACH
+	  && (opt_type == TRACE_ICMP || pr->code != ICMP_PORT_UNREACH))
+	printf ("!%c ", unreach_sign[pr->code & 0x0f]);
+
+      prev_addr = pr->from.s_addr;
+    }
+  printf ("\n");
+  fflush (stdout);
+}
+
+/*
+ * Send the probes of all hops without waiting for replies, at most
+ * OPT_PARALLEL at a time unless it is zero.  Every probe is told
+ * from the others by its destination port for UDP, or its sequence
+ * number for ICMP, and all go out for the first try before any for
+ * the second, as routers often limit the rate at which they reply.
+ * No more probes are sent beyond the hop at which the destination
+ * answers.  Each hop is printed once all its probes have been
+ * answered or have timed out, and those before it printed.
+ * Returns the exit status.
+ */
+int
+do_parallel (trace_t * trace)
+{
+  struct probe *probes;
+  int nhops, nprobes, reached, next = 0, inflight = 0, printed = 0;
+  int fd = trace_icmp_sock (trace);
+  bool arrived = false;
+  int k;
+
+  nhops = opt_max_hops;
+  if (opt_ttl + nhops - 1 > 255)
+    nhops = 256 - opt_ttl;
+  nprobes = nhops * opt_max_tries;
+  if (opt_type == TRACE_UDP && opt_port + nprobes > 65536)
+    error (EXIT_FAILURE, 0, "not enough ports above %d for %d probes",
+	   opt_port, nprobes);
+
+  probes = xcalloc (nprobes, sizeof (*probes));
+  for (k = 0; k < nprobes; k++)
+    probes[k].triptime = -1;
+  reached = nhops;
+
+  while (printed < reached)
+    {
+      fd_set readset;
+      struct timeval now, time, *timeout = NULL;
+      double first = -1;
+      int ret, type, code, burst = 0;
+      struct in_addr probed;
+      bool last;
+
+      /* Time out the probes sent too long ago, and wait for the
+         first of the others to.  */
+      gettimeofday (&now, NULL);
+      for (k = 0; k < next; k++)
+	{
+	  struct probe *pr = &probes[k];
+	  double left;
+
+	  if (pr->state != PROBE_SENT)
+	    continue;
+	  left = opt_wait * 1000.0 - tv_ms (&now, &pr->tsent);
+	  if (left <= 0)
+	    {
+	      pr->state = PROBE_DONE;
+	      inflight--;
+	    }
+	  else if (first < 0 || left < first)
+	    first = left;
+	}
+
+      /* Send what the window allows, a burst at a time to read the
+         replies in between.  */
+      while (next < nprobes && burst < PROBE_BURST
+	     && (opt_parallel == 0 || inflight < opt_parallel))
+	{
+	  struct probe *pr = &probes[next];
+
+	  if (next % nhops < reached)
+	    {
+	      trace_set_ttl (trace, opt_ttl + next % nhops);
+	      if (opt_type == TRACE_UDP)
+		trace->to.sin_port = htons (opt_port + next);
+	      else
+		seqno = next - 1;	/* Incremented by trace_write.  */
+	      trace_write (trace);
+	      pr->tsent = trace->tsent;
+	      pr->state = PROBE_SENT;
+	      inflight++;
+	      burst++;
+	    }
+	  else
+	    pr->state = PROBE_DONE;
+	  next++;
+	}
+      if (burst > 0 && first < 0)
+	first = opt_wait * 1000.0;
+
+      /* Print the hops that are complete.  */
+      while (printed < reached)
+	{
+	  int tries;
+
+	  for (tries = 0; tries < opt_max_tries; tries++)
+	    if (probes[tries * nhops + printed].state != PROBE_DONE)
+	      break;
+	  if (tries < opt_max_tries)
+	    break;
+	  print_hop (++printed, probes, nhops);
+	}
+      if (printed >= reached)
+	break;
+
+      if (burst == PROBE_BURST)
+	{
+	  /* Only look for replies before sending on.  */
+	  time.tv_sec = time.tv_usec = 0;
+	  timeout = &time;
+	}
+      else if (first >= 0)
+	{
+	  /* Rounded up, not to wake up early.  */
+	  long usec = first * 1000 + 1;
+
+	  time.tv_sec = usec / 1000000;
+	  time.tv_usec = usec % 1000000;
+	  timeout = &time;
+	}
+
+      FD_ZERO (&readset);
+      FD_SET (fd, &readset);
+      ret = select (fd + 1, &readset, NULL, NULL, timeout);
+      if (ret < 0)
+	{
+	  if (errno != EINTR)
+	    error (EXIT_FAILURE, errno, "select failed");
+	  continue;
+	}
+      if (ret == 0)
+	continue;
+
+      /* Take all the replies waiting.  */
+      while ((k = trace_read_probe (trace, next, &type, &code, &last,
+				    &probed)) != -2)
+	{
+	  struct probe *pr;
+
+	  if (k < 0 || probes[k].state != PROBE_SENT)
+	    continue;
+
+	  pr = &probes[k];
+	  gettimeofday (&now, NULL);
+	  pr->triptime = tv_ms (&now, &pr->tsent);
+	  pr->from = trace->from.sin_addr;
+	  pr->type = type;
+	  pr->code = code;
+	  pr->state = PROBE_DONE;
+	  inflight--;
+
+	  /* There are no hops beyond the one that answered last.  */
+	  if (last && k % nhops < reached)
+	    {
+	      reached = k % nhops + 1;
+	      arrived = true;
+	    }
+	}
+    }
+
+  free (probes);
+  return arrived ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void
+add_target (const char *name)
+{
+  if (ntargets % 64 == 0)
+    targets = xrealloc (targets, (ntargets + 64) * sizeof (*targets));
+  memset (&targets[ntargets], 0, sizeof (*targets));
+  targets[ntargets++].name = xstrdup (name);
+}
+
+/* Add the hosts named in FILE, or on the standard input if FILE is
+   "-".  A line may name several hosts, and a `#' starts a comment.  */
+void
+read_targets (const char *file)
+{
+  FILE *fp = stdin;
+  char *line = NULL, *name;
+  size_t size = 0;
+
+  if (strcmp (file, "-") != 0)
+    {
+      fp = fopen (file, "r");
+      if (fp == NULL)
+	error (EXIT_FAILURE, errno, "%s", file);
+    }
+
+  while (getline (&line, &size, fp) > 0)
+    for (name = strtok (line, " \t\r\n"); name && *name != '#';
+	 name = strtok (NULL, " \t\r\n"))
+      add_target (name);
+
+  free (line);
+  if (fp != stdin)
+    fclose (fp);
+}
+
+static unsigned
+addr_hash (struct in_addr addr, int hop)
+{
+  unsigned h = ntohl (addr.s_addr) * 31 + hop;
+
+  return h ^ (h >> 16);
+}
+
+static struct known *known[KNOWN_BUCKETS];
+
+/* The route traced before through ADDR at HOP, or NULL.  */
+static struct target *
+known_route (struct in_addr addr, int hop)
+{
+  struct known *k;
+
+  for (k = known[addr_hash (addr, hop) % KNOWN_BUCKETS]; k; k = k->next)
+    if (k->addr.s_addr == addr.s_addr && k->hop == hop)
+      return k->route;
+  return NULL;
+}
+
+/* Remember the hops of the route to T.  */
+static void
+known_add (struct target *t)
+{
+  int hop;
+
+  for (hop = opt_ttl; hop <= t->last; hop++)
+    {
+      struct hop *h = &t->hops[hop - opt_ttl];
+      struct known *k;
+      unsigned i;
+
+      if (h->addr.s_addr == INADDR_ANY || known_route (h->addr, hop))
+	continue;
+      i = addr_hash (h->addr, hop) % KNOWN_BUCKETS;
+      k = xmalloc (sizeof (*k));
+      k->addr = h->addr;
+      k->hop = hop;
+      k->route = t;
+      k->next = known[i];
+      known[i] = k;
+    }
+}
+
+/* Print the route to T on one line: the host as given, its address,
+   `reached', `!' and the sign of the reason it cannot be, or `-', the
+   last hop, and then every hop from OPT_TTL on.  Returns true if the
+   destination was reached.  */
+static bool
+print_route (struct target *t)
+{
+  struct hop *h = t->last >= opt_ttl ? &t->hops[t->last - opt_ttl] : NULL;
+  int hop;
+
+  bool reached = h && h->addr.s_addr == t->addr.s_addr;
+
+  printf ("%s %s", t->name, inet_ntoa (t->addr));
+  if (reached)
+    printf (" reached");
+  else if (h && h->addr.s_addr != INADDR_ANY
+	   && h->type == ICMP_DEST_UNREACH)
+    printf (" !%c", unreach_sign[h->code & 0x0f]);
+  else
+    printf (" -");
+  printf (" %d", t->last);
+
+  for (hop = opt_ttl; hop <= t->last; hop++)
+    {
+      h = &t->hops[hop - opt_ttl];
+      if (h->addr.s_addr == INADDR_ANY)
+	{
+	  printf (" *");
+	  continue;
+	}
+      printf (" %s", inet_ntoa (h->addr));
+      if (opt_resolve_hostnames)
+	printf ("(%s)", get_hostname (&h->addr));
+      if (h->known)
+	printf (":=");
+      else
+	printf (":%.3f", h->rtt);
+    }
+  printf ("\n");
+  return reached;
+}
+
+/* Probe the hop of T that comes after the one just done, or end the
+   route.  Forward from SPLIT, the route ends at the destination, at an
+   unreachable reply, or after BATCH_GAP silent hops.  Back from SPLIT,
+   probing ends when the route joins one traced before, whose hops are
+   taken for the nearer ones.  */
+static void
+batch_next (struct target *t, int split, int max_hop)
+{
+  struct hop *h = &t->hops[t->hop - opt_ttl];
+  bool replied = h->addr.s_addr != INADDR_ANY;
+  bool arrived = replied && (h->type == ICMP_DEST_UNREACH
+			     || h->addr.s_addr == t->addr.s_addr);
+
+  if (!t->backward)
+    {
+      t->silent = replied ? 0 : t->silent + 1;
+      if (!arrived && t->silent < BATCH_GAP && t->hop < max_hop)
+	{
+	  t->hop++;
+	  t->tosend = opt_max_tries;
+	  return;
+	}
+      t->last = arrived ? t->hop : t->hop - t->silent;
+      t->backward = true;
+      t->hop = split;
+    }
+  else if (arrived)
+    /* The destination is nearer than thought.  */
+    t->last = t->hop;
+  else if (replied)
+    {
+      struct target *route = known_route (h->addr, t->hop);
+
+      if (route)
+	{
+	  int hop;
+
+	  for (hop = opt_ttl; hop < t->hop; hop++)
+	    {
+	      t->hops[hop - opt_ttl] = route->hops[hop - opt_ttl];
+	      t->hops[hop - opt_ttl].known = true;
+	    }
+	  t->done = true;
+	  return;
+	}
+    }
+
+  if (t->hop > opt_ttl)
+    {
+      t->hop--;
+      t->tosend = opt_max_tries;
+    }
+  else
+    t->done = true;
+}
+
+/*
+ * Trace the routes to all TARGETS at once from the two sockets of
+ * TRACE, with at most OPT_PARALLEL probes in flight, or BATCH_WINDOW.
+ * Each probe takes the next slot of a ring of them, and is told by it
+ * as it is by its index in do_parallel, and by its destination.  The
+ * hops of a route are probed one after the other, see batch_next, and
+ * many routes at once, started in the order of TARGETS.  The routes are
+ * printed in that order as they are traced, or all at the end with
+ * OPT_RESOLVE_HOSTNAMES, not to hold up the probes during the lookups.
+ * Returns the exit status.
+ */
+int
+do_batch (trace_t * trace)
+{
+  struct slot *slots;
+  struct target **active;
+  struct addrinfo hints, *res;
+  unsigned long head = 0, tail = 0;
+  size_t next = 0, printed = 0, i, n;
+  int nslots = BATCH_SLOTS, window, nactive = 0, inflight = 0, rr = 0;
+  int split, max_hop, status = EXIT_SUCCESS;
+  int fd = trace_icmp_sock (trace);
+
+  /* Hosts that cannot be found are left out.  */
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_INET;
+  for (i = n = 0; i < ntargets; i++)
+    {
+      if (getaddrinfo (targets[i].name, NULL, &hints, &res))
+	{
+	  error (0, 0, "unknown host %s", targets[i].name);
+	  free (targets[i].name);
+	  status = EXIT_FAILURE;
+	  continue;
+	}
+      targets[i].addr = ((struct sockaddr_in *) res->ai_addr)->sin_addr;
+      freeaddrinfo (res);
+      targets[n++] = targets[i];
+    }
+  ntargets = n;
+  if (ntargets == 0)
+    error (EXIT_FAILURE, 0, "no host to trace");
+
+  max_hop = opt_ttl + opt_max_hops - 1;
+  if (max_hop > 255)
+    max_hop = 255;
+  split = opt_split_hop;
+  if (split < opt_ttl)
+    split = opt_ttl;
+  if (split > max_hop)
+    split = max_hop;
+
+  if (opt_type == TRACE_UDP && opt_port + nslots > 65536)
+    nslots = 65536 - opt_port;
+  if (nslots <= 0)
+    error (EXIT_FAILURE, 0, "no port above %d for the probes", opt_port);
+  window = opt_parallel > 0 ? opt_parallel : BATCH_WINDOW;
+  if (window > nslots)
+    window = nslots;
+
+  slots = xcalloc (nslots, sizeof (*slots));
+  active = xcalloc (window, sizeof (*active));
+
+  printf ("traceroute to %zu hosts, %d hops max\n", ntargets, opt_max_hops);
+  printf ("# host address result hops route\n");
+  fflush (stdout);
+
+  while (next < ntargets || nactive > 0)
+    {
+      fd_set readset;
+      struct timeval now, time;
+      struct in_addr probed;
+      int ret, type, code, k, burst = 0;
+      bool arrived;
+
+      /* Time out the probes sent too long ago, the oldest first.  */
+      gettimeofday (&now, NULL);
+      for (; tail != head; tail++)
+	{
+	  struct slot *s = &slots[tail % nslots];
+
+	  if (s->target == NULL)
+	    continue;
+	  if (tv_ms (&now, &s->tsent) < opt_wait * 1000.0)
+	    break;
+	  s->target->pending--;
+	  s->target = NULL;
+	  inflight--;
+	}
+
+      /* Move on the routes whose hop is done, and start new ones in
+         place of those traced.  */
+      for (k = 0; k < nactive; k++)
+	{
+	  struct target *t = active[k];
+
+	  if (t->tosend == 0 && t->pending == 0)
+	    batch_next (t, split, max_hop);
+	  if (t->done)
+	    {
+	      known_add (t);
+	      active[k--] = active[--nactive];
+	    }
+	}
+      while (nactive < window && next < ntargets)
+	{
+	  struct target *t = &targets[next++];
+	  int hop;
+
+	  t->hops = xcalloc (max_hop - opt_ttl + 1, sizeof (*t->hops));
+	  for (hop = opt_ttl; hop <= max_hop; hop++)
+	    t->hops[hop - opt_ttl].rtt = -1;
+	  t->hop = split;
+	  t->tosend = opt_max_tries;
+	  active[nactive++] = t;
+	}
+
+      while (!opt_resolve_hostnames && printed < next
+	     && targets[printed].done)
+	if (!print_route (&targets[printed++]))
+	  status = EXIT_FAILURE;
+      fflush (stdout);
+
+      if (nactive == 0)
+	continue;
+
+      /* Send what the window allows, a burst at a time to read the
+         replies in between, taking turns among the routes.  */
+      for (k = 0; k < nactive && burst < PROBE_BURST; k++)
+	{
+	  struct target *t = active[(rr + k) % nactive];
+
+	  while (t->tosend > 0 && inflight < window
+		 && head - tail < (unsigned long) nslots
+		 && burst < PROBE_BURST)
+	    {
+	      struct slot *s = &slots[head % nslots];
+
+	      trace->to.sin_addr = t->addr;
+	      trace_set_ttl (trace, t->hop);
+	      if (opt_type == TRACE_UDP)
+		trace->to.sin_port = htons (opt_port + head % nslots);
+	      else
+		seqno = head % nslots - 1;	/* Incremented by trace_write.  */
+	      trace_write (trace);
+	      s->target = t;
+	      s->hop = t->hop;
+	      s->tsent = trace->tsent;
+	      head++;
+	      inflight++;
+	      burst++;
+	      t->tosend--;
+	      t->pending++;
+	    }
+	}
+      rr = (rr + 1) % nactive;
+
+      if (burst == PROBE_BURST || tail == head)
+	/* Only look for replies before going on.  */
+	time.tv_sec = time.tv_usec = 0;
+      else
+	{
+	  /* Until the oldest probe times out, rounded up.  */
+	  double left = opt_wait * 1000.0
+	    - tv_ms (&now, &slots[tail % nslots].tsent);
+	  long usec = left > 0 ? left * 1000 + 1 : 0;
+
+	  time.tv_sec = usec / 1000000;
+	  time.tv_usec = usec % 1000000;
+	}
+
+      FD_ZERO (&readset);
+      FD_SET (fd, &readset);
+      ret = select (fd + 1, &readset, NULL, NULL, &time);
+      if (ret < 0)
+	{
+	  if (errno != EINTR)
+	    error (EXIT_FAILURE, errno, "select failed");
+	  continue;
+	}
+      if (ret == 0)
+	continue;
+
+      /* Take all the replies waiting.  */
+      while ((k = trace_read_probe (trace, nslots, &type, &code, &arrived,
+				    &probed)) != -2)
+	{
+	  struct slot *s;
+	  struct hop *h;
+	  double rtt;
+
+	  if (k < 0)
+	    continue;
+	  s = &slots[k];
+	  if (s->target == NULL || s->target->addr.s_addr != probed.s_addr)
+	    continue;
+
+	  gettimeofday (&now, NULL);
+	  rtt = tv_ms (&now, &s->tsent);
+	  h = &s->target->hops[s->hop - opt_ttl];
+	  if (h->addr.s_addr == INADDR_ANY)
+	    {
+	      h->addr = trace->from.sin_addr;
+	      h->type = type;
+	      h->code = code;
+	      h->rtt = rtt;
+	    }
+	  else if (rtt < h->rtt)
+	    h->rtt = rtt;
+	  s->target->pending--;
+	  s->target = NULL;
+	  inflight--;
+	}
+    }
+
+  while (printed < ntargets)
+    if (!print_route (&targets[printed++]))
+      status = EXIT_FAILURE;
+
+  for (i = 0; i < ntargets; i++)
+    {
+      free (targets[i].name);
+      free (targets[i].hops);
+    }
+  free (targets);
+  free (slots);
+  free (active);
+  return status;
+}
+
+/* The name of ADDR, or ADDR itself without one.  Every address is
+   looked up once.  */
 char *
 get_hostname (struct in_addr *addr)
 {
-  struct hostent *info =
-	gethostbyaddr ((char *) addr, sizeof (*addr), AF_INET);
-  if (info != NULL)
-    return info->h_name;
-
-  return inet_ntoa (*addr);
+  struct ptr **bucket = &ptrs[addr_hash (*addr, 0) % PTR_BUCKETS];
+  struct ptr *p;
+  struct hostent *info;
+
+  for (p = *bucket; p; p = p->next)
+    if (p->addr.s_addr == addr->s_addr)
+      return p->name;
+
+  info = gethostbyaddr ((char *) addr, sizeof (*addr), AF_INET);
+  p = xmalloc (sizeof (*p));
+  p->addr = *addr;
+  p->name = xstrdup (info ? info->h_name : inet_ntoa (*addr));
+  p->next = *bucket;
+  *bucket = p;
+  return p->name;
 }
 
 void
@@ -651,6 +1417,90 @@ trace_read (trace_t * t, int * type, int * code)
   return rc;
 }
 
+/* Read a reply to one of the first NPROBES probes of do_parallel or
+ * do_batch, passing its type and code, whether it tells that the probe
+ * went as far as it can in ARRIVED, and the destination of the probe in
+ * PROBED.  Returns the index of the probe, -1 if the packet is not for
+ * us, or -2 if there is none to read.
+ */
+int
+trace_read_probe (trace_t * t, int nprobes, int * type, int * code,
+		  bool * arrived, struct in_addr * probed)
+{
+  int len, k;
+  unsigned char data[CAPTURE_LEN];
+  struct ip *ip;
+  icmphdr_t *ic;
+  socklen_t siz;
+
+  assert (t);
+
+  siz = sizeof (t->from);
+
+  len = recvfrom (t->icmpfd, (char *) data, sizeof (data), MSG_DONTWAIT,
+		  (struct sockaddr *) &t->from, &siz);
+  if (len < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+	return -2;
+      error (EXIT_FAILURE, errno, "recvfrom");
+    }
+
+  if (icmp_generic_decode (data, len, &ip, &ic) < 0)
+    return -1;
+
+  /* Pass type and code of incoming packet.  */
+  *type = ic->icmp_type;
+  *code = ic->icmp_code;
+
+  if (ic->icmp_type == ICMP_ECHOREPLY)
+    {
+      if (t->type != TRACE_ICMP || ntohs (ic->icmp_id) != pid)
+	return -1;
+      k = ntohs (ic->icmp_seq);
+      *probed = ip->ip_src;
+    }
+  else if (ic->icmp_type == ICMP_TIME_EXCEEDED
+	   || ic->icmp_type == ICMP_DEST_UNREACH)
+    {
+      struct ip *old_ip = &ic->icmp_ip;
+      unsigned char *old = (unsigned char *) old_ip + (old_ip->ip_hl << 2);
+
+      /* The probe is told by the first eight bytes of its payload.  */
+      if (old + 8 > data + len)
+	return -1;
+      *probed = old_ip->ip_dst;
+
+      if (t->type == TRACE_UDP)
+	{
+	  unsigned short port;
+
+	  if (old_ip->ip_p != IPPROTO_UDP)
+	    return -1;
+	  memcpy (&port, old + sizeof (in_port_t), sizeof (port));
+	  k = ntohs (port) - opt_port;
+	}
+      else
+	{
+	  icmphdr_t *old_icmp = (icmphdr_t *) old;
+
+	  if (old_ip->ip_p != IPPROTO_ICMP || ntohs (old_icmp->icmp_id) != pid)
+	    return -1;
+	  k = ntohs (old_icmp->icmp_seq);
+	}
+    }
+  else
+    return -1;
+
+  if (k < 0 || k >= nprobes)
+    return -1;
+
+  *arrived = (ic->icmp_type == ICMP_DEST_UNREACH
+	      || (t->type == TRACE_ICMP
+		  && ip->ip_src.s_addr == dest.sin_addr.s_addr));
+  return k;
+}
+
 int
 trace_write (trace_t * t)
 {
@@ -731,7 +1581,7 @@ trace_icmp_sock (trace_t * t)
 }
 
 void
-trace_inc_ttl (trace_t * t)
+trace_set_ttl (trace_t * t, int ttl)
 {
   int fd;
   const int *ttlp;
@@ -739,12 +1589,20 @@ trace_inc_ttl (trace_t * t)
   assert (t);
 
   ttlp = &t->ttl;
-  t->ttl++;
+  t->ttl = ttl;
   fd = (t->type == TRACE_UDP ? t->udpfd : t->icmpfd);
   if (setsockopt (fd, IPPROTO_IP, IP_TTL, ttlp, sizeof (*ttlp)) < 0)
     error (EXIT_FAILURE, errno, "setsockopt");
 }
 
+void
+trace_inc_ttl (trace_t * t)
+{
+  assert (t);
+
+  trace_set_ttl (t, t->ttl + 1);
+}
+
 void
 trace_inc_port (trace_t * t)
 {
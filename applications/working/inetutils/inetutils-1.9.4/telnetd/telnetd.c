@@ -701,22 +701,7 @@ telnetd_run (void)
 	  pty_get_char (0);	/* Discard the TIOCPKT preamble.  */
 	}
 
-      while (pty_input_level () > 0)
-	{
-	  if (net_buffer_is_full ())
-	    break;
-	  c = pty_get_char (0);
-	  if (c == IAC)
-	    net_output_byte (c);
-	  net_output_byte (c);
-	  if (c == '\r' && my_state_is_wont (TELOPT_BINARY))
-	    {
-	      if (pty_input_level () > 0 && pty_get_char (1) == '\n')
-		net_output_byte (pty_get_char (0));
-	      else
-		net_output_byte (0);
-	    }
-	}
+      net_output_pty (!my_state_is_wont (TELOPT_BINARY));
 
       if (FD_ISSET (net, &obits) && net_output_level () > 0)
 	netflush ();
@@ -381,5 +381,6 @@ extern int pty_read (void);
 extern int pty_output_level (void);
 extern int pty_get_char (int peek);
 extern int pty_input_putback (const char *str, size_t len);
+extern void net_output_pty (int binary);
 
 extern int terminaltypeok (char *s);
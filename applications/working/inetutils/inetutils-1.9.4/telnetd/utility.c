@@ -49,7 +49,8 @@
 # include <stropts.h>
 #endif
 
-static char netobuf[BUFSIZ + NETSLOP], *nfrontp, *nbackp;
+static char *netobuf, *nfrontp, *nbackp;	/* grown as needed */
+static size_t netosize;		/* of NETOBUF, less NETSLOP */
 static char *neturg;		/* one past last byte of urgent data */
 #ifdef  ENCRYPTION
 static char *nclearto;
@@ -172,6 +173,8 @@ void
 io_setup (void)
 {
   pfrontp = pbackp = ptyobuf;
+  netosize = BUFSIZ;
+  netobuf = xmalloc (netosize + NETSLOP);
   nfrontp = nbackp = netobuf;
 #ifdef  ENCRYPTION
   nclearto = 0;
@@ -188,6 +191,32 @@ set_neturg (void)
 
 /* net-buffers */
 
+/* Make room for LEN more bytes in the network buffer, growing it.  */
+static void
+net_output_grow (size_t len)
+{
+  ptrdiff_t front = nfrontp - netobuf, back = nbackp - netobuf;
+  ptrdiff_t urg = neturg ? neturg - netobuf : 0;
+#ifdef	ENCRYPTION
+  ptrdiff_t clear = nclearto ? nclearto - netobuf : 0;
+#endif
+
+  if (netosize - front >= len)
+    return;
+  while (netosize - front < len)
+    netosize *= 2;
+  netobuf = xrealloc (netobuf, netosize + NETSLOP);
+
+  nfrontp = netobuf + front;
+  nbackp = netobuf + back;
+  if (neturg)
+    neturg = netobuf + urg;
+#ifdef	ENCRYPTION
+  if (nclearto)
+    nclearto = netobuf + clear;
+#endif
+}
+
 void
 net_output_byte (int c)
 {
@@ -201,12 +230,12 @@ net_output_data (const char *format, ...)
   size_t remaining, ret;
 
   va_start (args, format);
-  remaining = BUFSIZ - (nfrontp - netobuf);
+  remaining = netosize - (nfrontp - netobuf);
   /* try a netflush() if the room is too low */
   if (strlen (format) > remaining || BUFSIZ / 4 > remaining)
     {
       netflush ();
-      remaining = BUFSIZ - (nfrontp - netobuf);
+      remaining = netosize - (nfrontp - netobuf);
     }
   ret = vsnprintf (nfrontp, remaining, format, args);
   nfrontp += ((ret < remaining - 1) ? ret : remaining - 1);
@@ -219,14 +248,12 @@ net_output_datalen (const void *buf, size_t l)
 {
   size_t remaining;
 
-  remaining = BUFSIZ - (nfrontp - netobuf);
+  remaining = netosize - (nfrontp - netobuf);
   if (remaining < l)
     {
       netflush ();
-      remaining = BUFSIZ - (nfrontp - netobuf);
+      net_output_grow (l);
     }
-  if (remaining < l)
-    return -1;
   memmove (nfrontp, buf, l);
   nfrontp += l;
   return (int) l;
@@ -247,7 +274,7 @@ net_output_level (void)
 int
 net_buffer_is_full (void)
 {
-  return (&netobuf[BUFSIZ] - nfrontp) < 2;
+  return (&netobuf[netosize] - nfrontp) < 2;
 }
 
 int
@@ -361,6 +388,57 @@ pty_get_char (int peek)
   return 0;
 }
 
+/* Pass all the data read from the pty to the network, doubling every
+   IAC, and unless BINARY, following every CR that does not come with
+   its LF by a NUL.  The runs of bytes in between are copied whole.  */
+void
+net_output_pty (int binary)
+{
+  char *end = ptyip + pcc, *iac, *cr = NULL;
+
+  if (pcc <= 0)
+    return;
+
+  /* At worst every byte is doubled.  */
+  net_output_grow (2 * pcc);
+
+  iac = memchr (ptyip, IAC, pcc);
+  if (!binary)
+    cr = memchr (ptyip, '\r', pcc);
+
+  while (ptyip < end)
+    {
+      char *stop = end;
+
+      if (iac && iac < stop)
+	stop = iac;
+      if (cr && cr < stop)
+	stop = cr;
+
+      memcpy (nfrontp, ptyip, stop - ptyip);
+      nfrontp += stop - ptyip;
+      ptyip = stop;
+      if (ptyip == end)
+	break;
+
+      *nfrontp++ = *ptyip++;
+      if (stop == iac)
+	{
+	  *nfrontp++ = (char) IAC;
+	  iac = memchr (ptyip, IAC, end - ptyip);
+	}
+      else
+	{
+	  if (ptyip < end && *ptyip == '\n')
+	    *nfrontp++ = *ptyip++;
+	  else
+	    *nfrontp++ = '\0';
+	  cr = memchr (ptyip, '\r', end - ptyip);
+	}
+    }
+  pcc = 0;
+}
+
 int
 pty_input_putback (const char *str, size_t len)
 {
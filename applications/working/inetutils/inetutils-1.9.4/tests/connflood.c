@@ -0,0 +1,248 @@
+/* connflood - hold many concurrent sessions with a stream service.
+  Copyright (C) 2016 Free Software Foundation, Inc.
+
+  This file is part of GNU Inetutils.
+
+  GNU Inetutils is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or (at
+  your option) any later version.
+
+  GNU Inetutils is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see `http://www.gnu.org/licenses/'. */
+
+/* Connflood opens many connections to an echo, discard or chargen
+ * service on the local host, exchanges some data on each of them
+ * while all are open, and reports the time taken.  When the process
+ * id of inetd is given, its resident memory and the number of its
+ * child processes are read from /proc while the connections are
+ * open, as well as the processor time it used.  This is a load test,
+ * mostly run by hand:
+ *
+ *   inetd [--inline-builtins] -d CONF &
+ *   connflood [-n count] [-m echo|discard|chargen|eof|close] [-p pid]
+ *             [-t secs] port
+ *
+ * With `-m eof', each connection is read until the server closes it,
+ * which suits a server that writes a line and exits.  The processor
+ * time of inetd per connection then measures the cost of starting a
+ * server.  With `-m close', the data sent to an echo service is
+ * followed by a shutdown, and all of it must come back before the
+ * server closes the connection.  The option `-t' ends the run with
+ * SIGALRM after that many seconds, so that a test script fails rather
+ * than hangs on a connection that is never closed.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <progname.h>
+#include "procstat.h"
+
+#define DATALEN 64
+
+/* Number of processes whose parent is PID, and their resident
+   memory in kB in *KB.  */
+static int
+children (const char *pid, long *kb)
+{
+  char path[sizeof "/proc//stat" + 255], buf[1024], *p;
+  struct dirent *ent;
+  int ppid, n = 0;
+  long k;
+  DIR *dir;
+  FILE *fp;
+
+  *kb = 0;
+  dir = opendir ("/proc");
+  if (dir == NULL)
+    return -1;
+  while ((ent = readdir (dir)))
+    {
+      snprintf (path, sizeof (path), "/proc/%s/stat", ent->d_name);
+      fp = fopen (path, "r");
+      if (fp == NULL)
+	continue;
+      p = fgets (buf, sizeof (buf), fp);
+      fclose (fp);
+      if (p)
+	p = strrchr (buf, ')');
+      if (p && sscanf (p + 2, "%*c %d", &ppid) == 1 && ppid == atoi (pid))
+	{
+	  n++;
+	  k = rss (ent->d_name);
+	  if (k > 0)
+	    *kb += k;
+	}
+    }
+  closedir (dir);
+  return n;
+}
+
+/* Exchange some data on FD according to MODE.  */
+static int
+exchange (int fd, const char *mode)
+{
+  char buf[DATALEN];
+  ssize_t n;
+  size_t got = 0;
+
+  if (strcmp (mode, "eof") == 0)
+    {
+      while ((n = read (fd, buf, sizeof (buf))) > 0)
+	got += n;
+      return n < 0 || got == 0 ? -1 : 0;
+    }
+
+  if (strcmp (mode, "close") == 0)
+    {
+      memset (buf, 'x', sizeof (buf));
+      if (write (fd, buf, sizeof (buf)) != sizeof (buf)
+	  || shutdown (fd, SHUT_WR) < 0)
+	return -1;
+      while ((n = read (fd, buf, sizeof (buf))) > 0)
+	got += n;
+      return n < 0 || got != sizeof (buf) ? -1 : 0;
+    }
+
+  memset (buf, 'x', sizeof (buf));
+  if (strcmp (mode, "chargen") != 0
+      && write (fd, buf, sizeof (buf)) != sizeof (buf))
+    return -1;
+  if (strcmp (mode, "discard") == 0)
+    return 0;
+
+  while (got < sizeof (buf))
+    {
+      n = read (fd, buf, sizeof (buf) - got);
+      if (n <= 0)
+	return -1;
+      got += n;
+    }
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int opt, i, count = 1000, *fds, failed = 0, nchild, timeout = 0;
+  char *pid = NULL, *mode = "echo";
+  struct sockaddr_in sin;
+  struct rlimit rl;
+  double t0, t1, t2, cpu0 = 0, cpu1;
+  long kb, childkb;
+
+  set_program_name (argv[0]);
+
+  while ((opt = getopt (argc, argv, "m:n:p:t:")) != -1)
+    switch (opt)
+      {
+      case 'm':
+	mode = optarg;
+	break;
+
+      case 'n':
+	count = atoi (optarg);
+	break;
+
+      case 'p':
+	pid = optarg;
+	break;
+
+      case 't':
+	timeout = atoi (optarg);
+	break;
+
+      default:
+	fprintf (stderr, "Usage: %s [-m mode] [-n count] [-p pid] [-t secs] "
+		 "port\n",
+		 argv[0]);
+	exit (EXIT_FAILURE);
+      }
+
+  if (argc < optind + 1 || count < 1)
+    return EXIT_FAILURE;
+
+  /* Make room for the descriptors.  */
+  if (getrlimit (RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+      rl.rlim_cur = rl.rlim_max;
+      setrlimit (RLIMIT_NOFILE, &rl);
+    }
+
+  fds = calloc (count, sizeof (*fds));
+  if (fds == NULL)
+    return EXIT_FAILURE;
+
+  memset (&sin, 0, sizeof (sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons (atoi (argv[optind]));
+  sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+  if (pid && (cpu0 = cputime (pid)) < 0)
+    {
+      fprintf (stderr, "%s: no such process %s\n", argv[0], pid);
+      return EXIT_FAILURE;
+    }
+
+  if (timeout > 0)
+    alarm (timeout);
+
+  t0 = walltime ();
+  for (i = 0; i < count; i++)
+    {
+      fds[i] = socket (AF_INET, SOCK_STREAM, 0);
+      if (fds[i] < 0
+	  || connect (fds[i], (struct sockaddr *) &sin, sizeof (sin)) < 0)
+	{
+	  perror ("connect");
+	  failed = count - i;
+	  count = i;
+	  break;
+	}
+    }
+  t1 = walltime ();
+
+  for (i = 0; i < count; i++)
+    if (exchange (fds[i], mode) < 0)
+      failed++;
+  t2 = walltime ();
+
+  printf ("%d connections opened in %.3f s, %s on all in %.3f s, "
+	  "%d failed\n", count, t1 - t0, mode, t2 - t1, failed);
+
+  if (pid)
+    {
+      kb = rss (pid);
+      nchild = children (pid, &childkb);
+      printf ("inetd resident: %ld kB, %d children resident: %ld kB\n",
+	      kb, nchild, childkb);
+      cpu1 = cputime (pid);
+      if (cpu1 > cpu0)
+	printf ("inetd used %.2f s of processor time: "
+		"%.0f connections/s per core\n",
+		cpu1 - cpu0, count / (cpu1 - cpu0));
+      else
+	printf ("inetd used too little processor time to measure\n");
+    }
+
+  for (i = 0; i < count; i++)
+    close (fds[i]);
+  free (fds);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,274 @@
+/* ftpbench - measure the transfer rate of an FTP server.
+  Copyright (C) 2016 Free Software Foundation, Inc.
+
+  This file is part of GNU Inetutils.
+
+  GNU Inetutils is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or (at
+  your option) any later version.
+
+  GNU Inetutils is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see `http://www.gnu.org/licenses/'. */
+
+/* Ftpbench logs in anonymously to an FTP server on the local host,
+ * retrieves a file, or stores one, a number of times over passive
+ * data connections, and reports the rate achieved.  The processor
+ * time of the server is the one of its process at the end of the
+ * control connection, which is read from /proc as long as the session
+ * lasts.  This is a benchmark, not a test, and is run by hand:
+ *
+ *   inetd -d CONF &
+ *   ftpbench [-a] [-n count] [-s size] port file
+ *
+ * With `-a', the transfers use TYPE A, otherwise TYPE I.  With `-s',
+ * SIZE bytes of text lines are stored into FILE instead.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <progname.h>
+#include "procstat.h"
+
+static FILE *ctrl;
+static struct sockaddr_in sin;
+
+/* Process id of the server at the other end of the control
+   connection, found as the owner of its socket in /proc, or -1.  */
+static int
+server_pid (void)
+{
+  struct sockaddr_in me;
+  socklen_t len = sizeof (me);
+  char buf[256], path[sizeof "/proc//fd/0" + 255], link[64];
+  unsigned long inode = 0;
+  unsigned int lport, rport;
+  struct dirent *ent;
+  DIR *dir;
+  FILE *fp;
+
+  if (getsockname (fileno (ctrl), (struct sockaddr *) &me, &len) < 0)
+    return -1;
+
+  /* The server's socket has our port as remote port.  */
+  fp = fopen ("/proc/net/tcp", "r");
+  if (fp == NULL)
+    return -1;
+  while (fgets (buf, sizeof (buf), fp))
+    if (sscanf (buf, "%*d: %*x:%x %*x:%x %*x %*x:%*x %*x:%*x %*x %*d %*d %lu",
+		&lport, &rport, &inode) == 3
+	&& rport == ntohs (me.sin_port) && lport == ntohs (sin.sin_port))
+      break;
+    else
+      inode = 0;
+  fclose (fp);
+  if (inode == 0)
+    return -1;
+
+  /* Look at descriptor 0, which is the socket for a server of inetd.  */
+  snprintf (link, sizeof (link), "socket:[%lu]", inode);
+  dir = opendir ("/proc");
+  if (dir == NULL)
+    return -1;
+  while ((ent = readdir (dir)))
+    {
+      ssize_t n;
+
+      snprintf (path, sizeof (path), "/proc/%s/fd/0", ent->d_name);
+      n = readlink (path, buf, sizeof (buf) - 1);
+      if (n < 0)
+	continue;
+      buf[n] = '\0';
+      if (strcmp (buf, link) == 0)
+	{
+	  closedir (dir);
+	  return atoi (ent->d_name);
+	}
+    }
+  closedir (dir);
+  return -1;
+}
+
+/* Read a reply, which may span several lines, and return its code.  */
+static int
+reply (char *line, size_t size)
+{
+  int code;
+
+  do
+    if (fgets (line, size, ctrl) == NULL)
+      return -1;
+  while (!(line[0] >= '1' && line[0] <= '5' && line[3] == ' '));
+  code = atoi (line);
+  return code;
+}
+
+static int
+command (const char *cmd, char *line, size_t size)
+{
+  fprintf (ctrl, "%s\r\n", cmd);
+  fflush (ctrl);
+  return reply (line, size);
+}
+
+/* Open a passive data connection.  */
+static int
+passive (void)
+{
+  char line[256], *p;
+  unsigned int h[4], port[2];
+  struct sockaddr_in data;
+  int fd;
+
+  if (command ("PASV", line, sizeof (line)) != 227
+      || (p = strchr (line, '(')) == NULL
+      || sscanf (p, "(%u,%u,%u,%u,%u,%u)", &h[0], &h[1], &h[2], &h[3],
+		 &port[0], &port[1]) != 6)
+    return -1;
+
+  data = sin;
+  data.sin_port = htons (port[0] * 256 + port[1]);
+  fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (fd >= 0 && connect (fd, (struct sockaddr *) &data, sizeof (data)) < 0)
+    {
+      close (fd);
+      return -1;
+    }
+  return fd;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int opt, i, fd, count = 10, pid, ascii = 0;
+  long size = 0;
+  char line[256], cmd[256], buf[65536], spid[16];
+  double t0, t1, cpu0 = -1, cpu1 = -1, bytes = 0;
+  ssize_t n;
+
+  set_program_name (argv[0]);
+
+  while ((opt = getopt (argc, argv, "an:s:")) != -1)
+    switch (opt)
+      {
+      case 'a':
+	ascii = 1;
+	break;
+
+      case 'n':
+	count = atoi (optarg);
+	break;
+
+      case 's':
+	size = atol (optarg);
+	break;
+
+      default:
+	fprintf (stderr, "Usage: %s [-a] [-n count] [-s size] port file\n",
+		 argv[0]);
+	exit (EXIT_FAILURE);
+      }
+
+  if (argc < optind + 2 || count < 1)
+    return EXIT_FAILURE;
+
+  memset (&sin, 0, sizeof (sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons (atoi (argv[optind]));
+  sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+  fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (fd < 0 || connect (fd, (struct sockaddr *) &sin, sizeof (sin)) < 0)
+    {
+      perror ("connect");
+      return EXIT_FAILURE;
+    }
+  ctrl = fdopen (fd, "r+");
+  if (reply (line, sizeof (line)) != 220
+      || command ("USER anonymous", line, sizeof (line)) != 331
+      || command ("PASS ftpbench@", line, sizeof (line)) != 230
+      || command (ascii ? "TYPE A" : "TYPE I", line, sizeof (line)) != 200)
+    {
+      fprintf (stderr, "%s: login failed: %s", argv[0], line);
+      return EXIT_FAILURE;
+    }
+
+  /* Text lines of 63 characters each, to store.  */
+  for (i = 0; i < (int) sizeof (buf); i++)
+    buf[i] = i % 64 == 63 ? '\n' : 'a' + i % 26;
+
+  pid = server_pid ();
+  snprintf (spid, sizeof (spid), "%d", pid);
+  if (pid > 0)
+    cpu0 = cputime (spid);
+
+  t0 = walltime ();
+  for (i = 0; i < count; i++)
+    {
+      fd = passive ();
+      if (fd < 0)
+	{
+	  fprintf (stderr, "%s: no data connection\n", argv[0]);
+	  return EXIT_FAILURE;
+	}
+      snprintf (cmd, sizeof (cmd), "%s %s", size ? "STOR" : "RETR",
+		argv[optind + 1]);
+      if (command (cmd, line, sizeof (line)) != 150)
+	{
+	  fprintf (stderr, "%s: %s", argv[0], line);
+	  return EXIT_FAILURE;
+	}
+      if (size)
+	{
+	  long left;
+
+	  for (left = size; left > 0; left -= n)
+	    {
+	      n = write (fd, buf, left < (long) sizeof (buf)
+			 ? left : (long) sizeof (buf));
+	      if (n <= 0)
+		break;
+	      bytes += n;
+	    }
+	}
+      else
+	while ((n = read (fd, buf, sizeof (buf))) > 0)
+	  bytes += n;
+      close (fd);
+      if (reply (line, sizeof (line)) != 226)
+	{
+	  fprintf (stderr, "%s: %s", argv[0], line);
+	  return EXIT_FAILURE;
+	}
+    }
+  t1 = walltime ();
+  if (pid > 0)
+    cpu1 = cputime (spid);
+
+  printf ("%d transfers of %.0f bytes in %.3f s: %.1f MB/s\n",
+	  count, bytes / count, t1 - t0, bytes / (t1 - t0) / 1e6);
+  if (cpu0 >= 0 && cpu1 > cpu0)
+    printf ("ftpd used %.2f s of processor time: %.1f MB/s per core\n",
+	    cpu1 - cpu0, bytes / (cpu1 - cpu0) / 1e6);
+  else
+    printf ("ftpd used too little processor time to measure\n");
+
+  command ("QUIT", line, sizeof (line));
+  fclose (ctrl);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,200 @@
+#!/bin/sh
+
+# Copyright (C) 2016 Free Software Foundation, Inc.
+#
+# This file is part of GNU Inetutils.
+#
+# GNU Inetutils is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or (at
+# your option) any later version.
+#
+# GNU Inetutils is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see `http://www.gnu.org/licenses/'.
+
+# Test of transfers in ASCII mode.  A text file holding carriage
+# returns at the start, in the middle and at the end of its lines,
+# some of them at the last byte of a block of 4096 bytes, is stored
+# with STOR and retrieved with RETR, both in TYPE A.  The stored and
+# the retrieved file must be identical to the original.
+#
+# The anonymous account is used, as in ftp-localhost.sh, so the test
+# needs a user `ftp' with a directory that it may write into.
+#
+# Prerequisites:
+#
+#  * Shell: SVR4 Bourne shell, or newer.
+#
+#  * awk(1), cmp(1), id(1), kill(1), mktemp(1), netstat(8).
+
+. ./tools.sh
+
+FTP=${FTP:-../ftp/ftp$EXEEXT}
+FTPD=${FTPD:-../ftpd/ftpd$EXEEXT}
+INETD=${INETD:-../src/inetd$EXEEXT}
+TARGET=${TARGET:-127.0.0.1}
+
+# Portability fix for SVR4
+PWD="${PWD:-`pwd`}"
+
+USER=`func_id_user`
+FTPUSER=${FTPUSER:-ftp}
+
+if test -z "${VERBOSE+set}"; then
+    silence=:
+fi
+
+for prog in $FTP $FTPD $INETD; do
+    if test ! -x $prog; then
+	echo "Missing executable '$prog'.  Skipping test." >&2
+	exit 77
+    fi
+done
+
+$need_mktemp || exit_no_mktemp
+$need_netstat || exit_no_netstat
+
+if test -n "$VERBOSE"; then
+    set -x
+    $FTPD --version | $SED '1q'
+fi
+
+if test `func_id_uid` != 0; then
+    echo "ftpd needs to run as root" >&2
+    exit 77
+fi
+
+if id "$FTPUSER" > /dev/null 2>&1; then
+    :
+else
+    echo "anonymous ftpd needs a '$FTPUSER' user" >&2
+    exit 77
+fi
+
+FTPHOME="`eval echo ~"$FTPUSER"`"
+if test ! -d "$FTPHOME"; then
+    echo "The user '$FTPUSER' must have a home directory." >&2
+    exit 77
+fi
+
+# Find a directory that the anonymous user owns and may write into.
+#
+for DLDIR in /pub /download /downloads /dl /tmp / none; do
+    test $DLDIR = none && break
+    test -d $FTPHOME$DLDIR || continue
+    set -- `ls -ld $FTPHOME$DLDIR`
+    test "$3" = $FTPUSER || continue
+    test `expr $1 : 'drwx'` -eq 4 && break
+done
+
+if test $DLDIR = none; then
+    echo "There is no writable directory for '$FTPUSER'.  Skipping." >&2
+    exit 77
+fi
+test x"$DLDIR" = x"/" && DLDIR=
+
+TMPDIR=`$MKTEMP -d $PWD/tmp.XXXXXXXXXX` ||
+    {
+	echo 'Failed at creating test directory.  Aborting.' >&2
+	exit 1
+    }
+
+TEXT=text.`expr "$TMPDIR" : "$PWD/tmp\.\(.*\)"`
+GOT=got.$TEXT
+PUTME=putme.$TEXT
+
+posttesting () {
+    test -n "$TMPDIR" && test -f "$TMPDIR/inetd.pid" \
+	&& test -r "$TMPDIR/inetd.pid" \
+	&& { kill "`cat $TMPDIR/inetd.pid`" \
+	     || kill -9 "`cat $TMPDIR/inetd.pid`"; }
+    test -n "$TMPDIR" && test -d "$TMPDIR" && rm -rf "$TMPDIR"
+    test -f "$FTPHOME$DLDIR/$PUTME" && rm -f "$FTPHOME$DLDIR/$PUTME"
+}
+
+trap posttesting 0 1 2 3 15
+
+for PORT in 4711 4713 4717 4725 4741 4773 none; do
+    test $PORT = none && break
+    $NETSTAT -na | $GREP "^tcp.*[.:]$PORT .*LISTEN" >/dev/null 2>&1 ||
+	break
+done
+if test "$PORT" = 'none'; then
+    echo 'Our port allocation failed.  Skipping test.' >&2
+    exit 77
+fi
+
+cat <<EOT > "$TMPDIR/inetd.conf"
+$PORT stream tcp4 nowait $USER $PWD/$FTPD ftpd -A -l
+EOT
+
+cat <<EOT > "$TMPDIR/.netrc"
+machine $TARGET login $FTPUSER password foobar
+EOT
+chmod 600 "$TMPDIR/.netrc"
+
+# The first line puts a carriage return at offset 4095, with the line
+# feed after it at 4096.  The second puts a bare one at offset 8191.
+# More follow at all kinds of offsets.
+awk 'BEGIN {
+    s = ""
+    for (i = 0; i < 4094; i++)
+	s = s "x"
+    print s "x\r"
+    print s "\ry"
+    for (i = 1; i <= 3000; i++) {
+	s = ""
+	for (j = 0; j < i % 97; j++)
+	    s = s "x"
+	if (i % 3 == 0)
+	    s = s "\r"
+	if (i % 5 == 0)
+	    s = "\r" s
+	if (i % 7 == 0)
+	    s = s "\r\ry"
+	print s
+    }
+}' > "$TMPDIR/$TEXT"
+
+$INETD --pidfile="$TMPDIR/inetd.pid" "$TMPDIR/inetd.conf" ||
+    {
+	echo 'Not able to start Inetd.  Skipping test.' >&2
+	exit 1
+    }
+
+sleep 2
+
+errno=0
+
+cat <<STOP |
+`test -n "$DLDIR" && echo "cd $DLDIR"`
+lcd $TMPDIR
+ascii
+put $TEXT $PUTME
+get $PUTME $GOT
+STOP
+NETRC=$TMPDIR/.netrc \
+  $FTP "$TARGET" $PORT -4 -v -p -t >$TMPDIR/ftp.stdout 2>&1
+
+test -z "$VERBOSE" || cat "$TMPDIR/ftp.stdout"
+
+if cmp -s "$TMPDIR/$TEXT" "$FTPHOME$DLDIR/$PUTME"; then
+    $silence echo 'STOR in ASCII mode succeeded.'
+else
+    echo 'STOR in ASCII mode changed the text.' >&2
+    errno=1
+fi
+
+if cmp -s "$TMPDIR/$TEXT" "$TMPDIR/$GOT"; then
+    $silence echo 'RETR in ASCII mode succeeded.'
+else
+    echo 'RETR in ASCII mode changed the text.' >&2
+    errno=1
+fi
+
+exit $errno
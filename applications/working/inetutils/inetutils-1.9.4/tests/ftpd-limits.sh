@@ -0,0 +1,163 @@
+#!/bin/sh
+
+# Copyright (C) 2016 Free Software Foundation, Inc.
+#
+# This file is part of GNU Inetutils.
+#
+# GNU Inetutils is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or (at
+# your option) any later version.
+#
+# GNU Inetutils is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see `http://www.gnu.org/licenses/'.
+
+# Test of the connection limits of ftpd in daemon mode.  With
+# --max-per-ip=1, a second client from the same address must be
+# turned away with reply 421 while the first session lasts, and
+# be served again once it has ended.
+#
+# Prerequisites:
+#
+#  * Shell: SVR4 Bourne shell, or newer.
+#
+#  * id(1), kill(1), mktemp(1), netstat(8).
+#
+#  * Privileges to bind the FTP port, 21/tcp.
+
+. ./tools.sh
+
+if test -z "${VERBOSE+set}"; then
+    silence=:
+fi
+
+# Portability fix for SVR4
+PWD="${PWD:-`pwd`}"
+
+# Prerequisites
+#
+$need_id || exit_no_id
+$need_mktemp || exit_no_mktemp
+$need_netstat || exit_no_netstat
+
+if test `func_id_uid` != 0; then
+    echo 'This test needs privileges to bind port 21/tcp.  Skipping.' >&2
+    exit 77
+fi
+
+# The daemon always listens at the FTP port.
+if $NETSTAT -na | $GREP "^tcp.*[.:]21 .*LISTEN" >/dev/null 2>&1; then
+    echo 'Port 21/tcp is already in use.  Skipping test.' >&2
+    exit 77
+fi
+
+# Execution control.  Initialise early!
+#
+do_cleandir=false
+
+# Select numerical target address, only IPv4.
+TARGET=${TARGET:-127.0.0.1}
+
+# Executable under test and helper functionality.
+#
+FTPD=${FTPD:-../ftpd/ftpd$EXEEXT}
+TCPGET=${TCPGET:-$PWD/tcpget$EXEEXT}
+
+if [ ! -x $FTPD ]; then
+    echo "Missing executable '$FTPD'.  Skipping test." >&2
+    exit 77
+fi
+
+if test ! -x $TCPGET; then
+    echo >&2 "No executable '$TCPGET' present.  Skipping test."
+    exit 77
+fi
+
+if test -n "$VERBOSE"; then
+    set -x
+    $FTPD --version | $SED '1q'
+fi
+
+# For file creation below IU_TESTDIR.
+umask 0077
+
+# Keep any external assignment of testing directory.
+# Otherwise a randomisation is included.
+#
+: ${IU_TESTDIR:=$PWD/iu_ftpd.XXXXXX}
+
+if [ ! -d "$IU_TESTDIR" ]; then
+    do_cleandir=true
+    IU_TESTDIR="`$MKTEMP -d "$IU_TESTDIR" 2>/dev/null`" ||
+	{
+	    echo 'Failed at creating test directory.  Aborting.' >&2
+	    exit 77
+	}
+elif expr X"$IU_TESTDIR" : X"\.\{1,2\}/\{0,1\}$" >/dev/null; then
+    # Eliminating directories: . ./ .. ../
+    echo 'Dangerous input for test directory.  Aborting.' >&2
+    exit 77
+fi
+
+PID="$IU_TESTDIR"/ftpd.pid
+FIRST="$IU_TESTDIR"/first
+SECOND="$IU_TESTDIR"/second
+THIRD="$IU_TESTDIR"/third
+
+# Erase the temporary directory.
+#
+clean_testdir () {
+    if test -f "$PID" && kill -0 "`cat "$PID"`" >/dev/null 2>&1; then
+	kill "`cat "$PID"`" || kill -9 "`cat "$PID"`"
+    fi
+    if test -z "${NOCLEAN+no}" && $do_cleandir; then
+	rm -r -f "$IU_TESTDIR"
+    fi
+}
+
+# Did the client saved in FILE get the reply CODE?
+check_reply () {
+    $GREP "^$2 " "$1" >/dev/null 2>&1 || {
+	echo >&2 "*** The `basename "$1"` client did not get reply $2. ***"
+	test -z "$VERBOSE" || cat "$1" >&2
+	errno=1
+    }
+}
+
+errno=0
+
+$FTPD --daemon --max-per-ip=1 --pidfile="$PID"
+
+# Allow for the service to settle.
+sleep 2
+
+if test ! -f "$PID"; then
+    echo >&2 "Ftpd never started: missing the PID-file."
+    errno=1
+else
+    # A session lasts until its client gives up, by SIGALRM,
+    # which the subshells keep quiet about.
+    ($TCPGET -t 3 $TARGET 21 > "$FIRST" || :) 2>/dev/null &
+    sleep 1
+    ($TCPGET -t 2 $TARGET 21 > "$SECOND" || :) 2>/dev/null
+    wait
+
+    # Allow for the first session to be reaped.
+    sleep 1
+    ($TCPGET -t 1 $TARGET 21 > "$THIRD" || :) 2>/dev/null
+
+    check_reply "$FIRST" 220
+    check_reply "$SECOND" 421
+    check_reply "$THIRD" 220
+fi
+
+test $errno -ne 0 || $silence echo 'Successful testing.'
+
+clean_testdir
+
+exit $errno
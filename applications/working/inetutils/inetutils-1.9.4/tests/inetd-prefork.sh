@@ -0,0 +1,159 @@
+#!/bin/sh
+
+# Copyright (C) 2016 Free Software Foundation, Inc.
+#
+# This file is part of GNU Inetutils.
+#
+# GNU Inetutils is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or (at
+# your option) any later version.
+#
+# GNU Inetutils is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see `http://www.gnu.org/licenses/'.
+
+# Test of the worker pools of inetd.  The builtin echo service
+# is served by one pre-forked worker and no spare, so that further
+# workers are started while connections wait for them.  Batches of
+# connections are sent data and shut down, and every one must be
+# echoed and then closed by its worker.  A descriptor of another
+# connection held by a new worker would leave the client waiting
+# for end of file.
+#
+# Prerequisites:
+#
+#  * Shell: SVR4 Bourne shell, or newer.
+#
+#  * id(1), kill(1), mktemp(1), netstat(8).
+#
+#  * Privileges to bind the echo port, 7/tcp.
+
+. ./tools.sh
+
+if test -z "${VERBOSE+set}"; then
+    silence=:
+fi
+
+# Portability fix for SVR4
+PWD="${PWD:-`pwd`}"
+USER=${USER:-`func_id_user`}
+
+# Prerequisites
+#
+$need_id || exit_no_id
+$need_mktemp || exit_no_mktemp
+$need_netstat || exit_no_netstat
+
+if test `func_id_uid` != 0; then
+    echo 'This test needs privileges to bind port 7/tcp.  Skipping.' >&2
+    exit 77
+fi
+
+# The echo service must be free for inetd.
+if $NETSTAT -na | $GREP "^tcp.*[.:]7 .*LISTEN" >/dev/null 2>&1; then
+    echo 'Port 7/tcp is already in use.  Skipping test.' >&2
+    exit 77
+fi
+
+# Execution control.  Initialise early!
+#
+do_cleandir=false
+
+# Select numerical target address, only IPv4.
+TARGET=${TARGET:-127.0.0.1}
+
+# Executable under test and helper functionality.
+#
+INETD=${INETD:-../src/inetd$EXEEXT}
+CONNFLOOD=${CONNFLOOD:-$PWD/connflood$EXEEXT}
+
+if [ ! -x $INETD ]; then
+    echo "Missing executable '$INETD'.  Skipping test." >&2
+    exit 77
+fi
+
+if test ! -x $CONNFLOOD; then
+    echo >&2 "No executable '$CONNFLOOD' present.  Skipping test."
+    exit 77
+fi
+
+if test -n "$VERBOSE"; then
+    set -x
+    $INETD --version | $SED '1q'
+fi
+
+# For file creation below IU_TESTDIR.
+umask 0077
+
+# Keep any external assignment of testing directory.
+# Otherwise a randomisation is included.
+#
+: ${IU_TESTDIR:=$PWD/iu_inetd.XXXXXX}
+
+if [ ! -d "$IU_TESTDIR" ]; then
+    do_cleandir=true
+    IU_TESTDIR="`$MKTEMP -d "$IU_TESTDIR" 2>/dev/null`" ||
+	{
+	    echo 'Failed at creating test directory.  Aborting.' >&2
+	    exit 77
+	}
+elif expr X"$IU_TESTDIR" : X"\.\{1,2\}/\{0,1\}$" >/dev/null; then
+    # Eliminating directories: . ./ .. ../
+    echo 'Dangerous input for test directory.  Aborting.' >&2
+    exit 77
+fi
+
+CONF="$IU_TESTDIR"/inetd.conf
+PID="$IU_TESTDIR"/inetd.pid
+
+# Erase the temporary directory.
+#
+clean_testdir () {
+    if test -f "$PID" && kill -0 "`cat "$PID"`" >/dev/null 2>&1; then
+	kill "`cat "$PID"`" || kill -9 "`cat "$PID"`"
+    fi
+    if test -z "${NOCLEAN+no}" && $do_cleandir; then
+	rm -r -f "$IU_TESTDIR"
+    fi
+}
+
+echo "$TARGET:echo stream tcp4 nowait,prefork=1,minspare=0 $USER internal" \
+    > "$CONF" || {
+	echo 'No write access in test directory.  Aborting.' >&2
+	clean_testdir
+	exit 1
+    }
+
+errno=0
+
+$INETD -p"$PID" "$CONF"
+
+# Allow for the service to settle.
+sleep 2
+
+if test ! -f "$PID"; then
+    echo >&2 "Inetd never started: missing the PID-file."
+    errno=1
+else
+    # The connections of a round are opened before any is served,
+    # so that inetd accepts several of them at once.
+    for nn in 1 2 3 4 5; do
+	$CONNFLOOD -m close -n 20 -t 10 7 >/dev/null || errno=1
+
+	test $errno -eq 0 ||
+	    { echo >&2 "*** Round $nn of connections was not closed. ***"
+	      break; }
+    done
+    $silence echo "Passed `expr $nn - $errno` rounds of connections."
+fi
+
+test $errno -ne 0 || $silence echo 'Successful testing.'
+
+clean_testdir
+
+exit $errno
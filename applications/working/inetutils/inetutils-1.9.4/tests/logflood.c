@@ -0,0 +1,155 @@
+/* logflood - measure the message rate of a syslog daemon.
+  Copyright (C) 2016 Free Software Foundation, Inc.
+
+  This file is part of GNU Inetutils.
+
+  GNU Inetutils is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or (at
+  your option) any later version.
+
+  GNU Inetutils is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see `http://www.gnu.org/licenses/'. */
+
+/* Logflood sends a stream of messages to the datagram socket of a
+ * running syslogd, as fast as the socket accepts them, and reports
+ * the rate achieved.  When the process id of the daemon is given,
+ * the processor time it consumed is read from /proc, so that the
+ * rate can also be stated per second of processor time, i.e., per
+ * core.  This is a benchmark, not a test, and is run by hand:
+ *
+ *   syslogd -n -f CONF -p /tmp/log -P /tmp/pid &
+ *   logflood [-n count] [-s size] [-r repeat] [-p pid] /tmp/log
+ *
+ * The option `-s' sets the length of the message text, and `-r'
+ * sends each distinct text that many times in a row, to exercise
+ * the suppression of repeated lines.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <progname.h>
+#include "procstat.h"
+
+int
+main (int argc, char *argv[])
+{
+  int fd, opt;
+  long i, count = 100000;
+  int size = 60, repeat = 1;
+  char *pid = NULL;
+  char msg[2048];
+  struct sockaddr_un sun;
+  double cpu0 = 0, cpu1, last, t0, t1;
+  size_t hdr;
+
+  set_program_name (argv[0]);
+
+  while ((opt = getopt (argc, argv, "n:p:r:s:")) != -1)
+    switch (opt)
+      {
+      case 'n':
+	count = atol (optarg);
+	break;
+
+      case 'p':
+	pid = optarg;
+	break;
+
+      case 'r':
+	repeat = atoi (optarg);
+	if (repeat < 1)
+	  repeat = 1;
+	break;
+
+      case 's':
+	size = atoi (optarg);
+	if (size < 16 || size > 1024)
+	  size = 60;
+	break;
+
+      default:
+	fprintf (stderr, "Usage: %s [-n count] [-p pid] [-r repeat] "
+		 "[-s size] socket\n", argv[0]);
+	exit (EXIT_FAILURE);
+      }
+
+  if (argc < optind + 1 || count < 1)
+    return EXIT_FAILURE;
+
+  memset (&sun, 0, sizeof (sun));
+  sun.sun_family = AF_UNIX;
+  strncpy (sun.sun_path, argv[optind], sizeof (sun.sun_path) - 1);
+
+  fd = socket (AF_UNIX, SOCK_DGRAM, 0);
+  if (fd < 0 || connect (fd, (struct sockaddr *) &sun, sizeof (sun)) < 0)
+    {
+      perror (argv[optind]);
+      return EXIT_FAILURE;
+    }
+
+  hdr = snprintf (msg, sizeof (msg), "<13>logflood[%d]: ", (int) getpid ());
+  memset (msg + hdr, 'x', size);
+
+  if (pid && (cpu0 = cputime (pid)) < 0)
+    {
+      fprintf (stderr, "%s: no such process %s\n", argv[0], pid);
+      return EXIT_FAILURE;
+    }
+
+  t0 = walltime ();
+  for (i = 0; i < count; i++)
+    {
+      /* A leading serial number makes distinct texts.  */
+      int n = snprintf (msg + hdr, sizeof (msg) - hdr, "%09ld",
+			i / repeat);
+
+      msg[hdr + n] = 'x';
+      while (send (fd, msg, hdr + size, 0) < 0)
+	if (errno != ENOBUFS && errno != EAGAIN && errno != EINTR)
+	  {
+	    perror ("send");
+	    return EXIT_FAILURE;
+	  }
+    }
+  t1 = walltime ();
+
+  printf ("%ld messages in %.3f s: %.0f messages/s\n",
+	  count, t1 - t0, count / (t1 - t0));
+
+  if (pid)
+    {
+      /* Let the daemon finish with what is still queued.  */
+      cpu1 = cputime (pid);
+      do
+	{
+	  last = cpu1;
+	  usleep (200000);
+	  cpu1 = cputime (pid);
+	}
+      while (cpu1 > last);
+
+      if (cpu1 > cpu0)
+	printf ("syslogd used %.2f s of processor time: "
+		"%.0f messages/s per core\n",
+		cpu1 - cpu0, count / (cpu1 - cpu0));
+      else
+	printf ("syslogd used too little processor time to measure\n");
+    }
+
+  close (fd);
+  return EXIT_SUCCESS;
+}
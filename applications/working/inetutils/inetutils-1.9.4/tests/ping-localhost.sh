@@ -53,6 +53,39 @@ errno2=0
 $PING -n -c 1 $TARGET || errno=$?
 test $errno -eq 0 || echo "Failed at pinging $TARGET." >&2
 
+# The summary gives percentiles of the round-trip times.
+if test $errno -eq 0; then
+    $PING -n -q -c 3 -i 1 $TARGET > ping.out.$$ || errno=$?
+    test $errno -eq 0 &&
+	grep "^round-trip p50/p90/p99/p99.9 = " ping.out.$$ > /dev/null ||
+	{ errno=1; echo "Failed at timing replies from $TARGET." >&2; }
+    test -z "$VERBOSE" || cat ping.out.$$
+    rm -f ping.out.$$
+fi
+
+# A thousand packets a second, none of which should be lost.
+if test $errno -eq 0; then
+    $PING -n -q -c 1000 -i 0.001 $TARGET > ping.out.$$ || errno=$?
+    test $errno -eq 0 &&
+	grep "^1000 packets transmitted, 1000 packets received" \
+	    ping.out.$$ > /dev/null ||
+	{ errno=1; echo "Failed at pinging $TARGET fast." >&2; }
+    test -z "$VERBOSE" || cat ping.out.$$
+    rm -f ping.out.$$
+fi
+
+# All hosts at once, some of them from standard input, with one line
+# of statistics for each host.
+if test $errno -eq 0; then
+    echo "$TARGET # comment" |
+    $PING -n -q -c 2 --hosts-file=- $TARGET > ping.out.$$ || errno=$?
+    test $errno -eq 0 &&
+	test `grep -c "^$TARGET $TARGET 2 2 0 0 " ping.out.$$` -eq 2 ||
+	{ errno=1; echo "Failed at pinging $TARGET twice at once." >&2; }
+    test -z "$VERBOSE" || cat ping.out.$$
+    rm -f ping.out.$$
+fi
+
 # Host might not have been built with IPv6 support.
 test "$TEST_IPV6" != "no" && test -x $PING6 &&
     { $PING6 -n -c 1 $TARGET6 || errno2=$?; }
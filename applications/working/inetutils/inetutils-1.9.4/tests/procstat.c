@@ -0,0 +1,85 @@
+/* procstat - times and sizes of processes, for the load helpers.
+  Copyright (C) 2016 Free Software Foundation, Inc.
+
+  This file is part of GNU Inetutils.
+
+  GNU Inetutils is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or (at
+  your option) any later version.
+
+  GNU Inetutils is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see `http://www.gnu.org/licenses/'. */
+
+/* Shared by logflood, connflood, ftpbench and tftpflood.  The figures
+ * of other processes are read from /proc, so they are only available
+ * on systems with a Linux style /proc.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/time.h>
+#include "procstat.h"
+
+/* Elapsed time in seconds, from an arbitrary start.  */
+double
+walltime (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Processor time in seconds used by process PID, or -1.  */
+double
+cputime (const char *pid)
+{
+  char path[64], buf[1024], *p;
+  unsigned long utime, stime;
+  FILE *fp;
+
+  snprintf (path, sizeof (path), "/proc/%s/stat", pid);
+  fp = fopen (path, "r");
+  if (fp == NULL)
+    return -1;
+  p = fgets (buf, sizeof (buf), fp);
+  fclose (fp);
+
+  /* Skip the command name, which may contain blanks.  */
+  if (p)
+    p = strrchr (buf, ')');
+  if (p == NULL
+      || sscanf (p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+		 &utime, &stime) != 2)
+    return -1;
+
+  return (double) (utime + stime) / sysconf (_SC_CLK_TCK);
+}
+
+/* Resident memory of process PID in kB, or -1.  */
+long
+rss (const char *pid)
+{
+  char path[sizeof "/proc//status" + 255], buf[256];
+  long kb = -1;
+  FILE *fp;
+
+  snprintf (path, sizeof (path), "/proc/%s/status", pid);
+  fp = fopen (path, "r");
+  if (fp == NULL)
+    return -1;
+  while (fgets (buf, sizeof (buf), fp))
+    if (sscanf (buf, "VmRSS: %ld", &kb) == 1)
+      break;
+  fclose (fp);
+  return kb;
+}
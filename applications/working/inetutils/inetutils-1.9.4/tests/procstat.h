@@ -0,0 +1,26 @@
+/* procstat - times and sizes of processes, for the load helpers.
+  Copyright (C) 2016 Free Software Foundation, Inc.
+
+  This file is part of GNU Inetutils.
+
+  GNU Inetutils is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or (at
+  your option) any later version.
+
+  GNU Inetutils is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see `http://www.gnu.org/licenses/'. */
+
+#ifndef _PROCSTAT_H
+# define _PROCSTAT_H 1
+
+extern double walltime (void);
+extern double cputime (const char *pid);
+extern long rss (const char *pid);
+
+#endif				/* _PROCSTAT_H */
@@ -0,0 +1,233 @@
+#!/bin/sh
+
+# Copyright (C) 2016 Free Software Foundation, Inc.
+#
+# This file is part of GNU Inetutils.
+#
+# GNU Inetutils is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or (at
+# your option) any later version.
+#
+# GNU Inetutils is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see `http://www.gnu.org/licenses/'.
+
+# Test of message forwarding by syslogd.  One daemon, listening at
+# 127.0.0.1, forwards all messages to a second one at 127.0.0.2,
+# over UDP, and to the same address over TCP.  The TCP listener,
+# inetd running `cat', is started only after the first messages,
+# which must wait in the queue until the stream is reconnected.
+#
+# Prerequisites:
+#
+#  * Shell: SVR4 Bourne shell, or newer.
+#
+#  * id(1), kill(1), mktemp(1), netstat(8), uname(1).
+#
+#  * Privileges to bind the syslog port, 514/udp and 514/tcp,
+#    and a loopback interface answering at 127.0.0.2.
+
+. ./tools.sh
+
+if test -z "${VERBOSE+set}"; then
+    silence=:
+fi
+
+# Portability fix for SVR4
+PWD="${PWD:-`pwd`}"
+
+$need_id || exit_no_id
+$need_mktemp || exit_no_mktemp
+$need_netstat || exit_no_netstat
+
+if test `func_id_uid` != 0; then
+    echo 'This test needs privileges to bind port 514.  Skipping.' >&2
+    exit 77
+fi
+
+# Only Linux answers at all of 127.0.0.0/8 without configuration.
+if test "`uname -s`" != "Linux"; then
+    echo 'This test needs the address 127.0.0.2.  Skipping.' >&2
+    exit 77
+fi
+
+if $NETSTAT -na | $GREP "^[tu][cd]p.*[.:]514 " >/dev/null 2>&1; then
+    echo 'Port 514 is already in use.  Skipping test.' >&2
+    exit 77
+fi
+
+# Execution control.  Initialise early!
+#
+do_cleandir=false
+
+# The executables under test.
+#
+SYSLOGD=${SYSLOGD:-../src/syslogd$EXEEXT}
+LOGGER=${LOGGER:-../src/logger$EXEEXT}
+INETD=${INETD:-../src/inetd$EXEEXT}
+
+for prog in $SYSLOGD $LOGGER $INETD; do
+    if test ! -x $prog; then
+	echo "Missing executable '$prog'.  Skipping test." >&2
+	exit 77
+    fi
+done
+
+if test -n "$VERBOSE"; then
+    set -x
+    $SYSLOGD --version | $SED '1q'
+fi
+
+# For file creation below IU_TESTDIR.
+umask 0077
+
+# Keep any external assignment of testing directory.
+# Otherwise a randomisation is included.
+#
+: ${IU_TESTDIR:=$PWD/iu_syslog.XXXXXX}
+
+if [ ! -d "$IU_TESTDIR" ]; then
+    do_cleandir=true
+    IU_TESTDIR="`$MKTEMP -d "$IU_TESTDIR" 2>/dev/null`" ||
+	{
+	    echo 'Failed at creating test directory.  Aborting.' >&2
+	    exit 77
+	}
+elif expr X"$IU_TESTDIR" : X'\.\{1,2\}/\{0,1\}$' >/dev/null; then
+    # Eliminating directories: . ./ .. ../
+    echo 'Dangerous input for test directory.  Aborting.' >&2
+    exit 77
+fi
+
+# The forwarding daemon, the receiving daemon, and inetd.
+#
+CONF="$IU_TESTDIR"/forward.conf
+PID="$IU_TESTDIR"/forward.pid
+SOCKET="$IU_TESTDIR"/log
+RCONF="$IU_TESTDIR"/receive.conf
+RPID="$IU_TESTDIR"/receive.pid
+OUT="$IU_TESTDIR"/messages
+ICONF="$IU_TESTDIR"/inetd.conf
+IPID="$IU_TESTDIR"/inetd.pid
+SERVER="$IU_TESTDIR"/server
+OUT_TCP="$IU_TESTDIR"/stream
+
+# Erase the testing directory.
+#
+clean_testdir () {
+    for pidfile in "$PID" "$RPID" "$IPID"; do
+	if test -f "$pidfile" && kill -0 "`cat "$pidfile"`" >/dev/null 2>&1
+	then
+	    kill "`cat "$pidfile"`" || kill -9 "`cat "$pidfile"`"
+	fi
+    done
+    if test -z "${NOCLEAN+no}" && $do_cleandir; then
+	rm -r -f "$IU_TESTDIR"
+    fi
+}
+
+# Clean artifacts as execution stops.
+#
+trap clean_testdir EXIT HUP INT QUIT TERM
+
+TAG="syslogd-forward"
+
+cat > "$CONF" <<-EOT
+	*.*	@127.0.0.2
+	*.*	@@127.0.0.2
+EOT
+
+cat > "$RCONF" <<-EOT
+	*.*	$OUT
+EOT
+
+cat > "$SERVER" <<-EOT
+	#!/bin/sh
+	exec cat >> "$OUT_TCP"
+EOT
+chmod 0700 "$SERVER"
+
+echo "127.0.0.2:514 stream tcp4 nowait root $SERVER server" > "$ICONF"
+
+# Send the messages FIRST to LAST.  They end with a full stop, for the
+# records of the TCP stream follow each other without a newline.
+#
+send_messages () {
+    nn=$1
+    while test $nn -le $2; do
+	$LOGGER -h "$SOCKET" -p user.info -t "$TAG" "Message $nn."
+	nn=`expr $nn + 1`
+    done
+}
+
+# Count the messages FIRST to LAST in FILE.
+#
+count_messages () {
+    nn=$1 found=0
+    while test $nn -le $2; do
+	$GREP "$TAG: Message $nn\." "$3" >/dev/null 2>&1 &&
+	    found=`expr $found + 1`
+	nn=`expr $nn + 1`
+    done
+    echo $found
+}
+
+errno=0
+
+$SYSLOGD --rcfile="$RCONF" --pidfile="$RPID" --no-unixaf --no-klog \
+    --inet --bind=127.0.0.2
+$SYSLOGD --rcfile="$CONF" --pidfile="$PID" --socket="$SOCKET" --no-klog \
+    --inet --bind=127.0.0.1
+
+# Allow for the daemons to settle.
+sleep 1
+
+if test ! -r "$PID" || test ! -r "$RPID"; then
+    echo "The service daemons never started.  Failing." >&2
+    exit 1
+fi
+
+send_messages 1 40
+
+# Only now can the stream be connected.
+$INETD -p"$IPID" "$ICONF"
+sleep 1
+send_messages 41 50
+
+# The stream is retried after one, two and four seconds.
+nn=0
+while test $nn -lt 10 &&
+	! $GREP "$TAG: Message 50\." "$OUT_TCP" >/dev/null 2>&1; do
+    sleep 1
+    nn=`expr $nn + 1`
+done
+
+found=`count_messages 1 50 "$OUT"`
+$silence echo "Received $found of 50 messages over UDP."
+if test $found -ne 50; then
+    echo "Forwarding over UDP lost `expr 50 - $found` of 50 messages." >&2
+    errno=1
+fi
+
+found=`count_messages 1 50 "$OUT_TCP"`
+$silence echo "Received $found of 50 messages over TCP."
+if test $found -ne 50; then
+    echo "Forwarding over TCP lost `expr 50 - $found` of 50 messages." >&2
+    errno=1
+fi
+
+# Every record is preceded by its length.
+if test -r "$OUT_TCP" &&
+	! $GREP "^[1-9][0-9]* <[0-9]*>" "$OUT_TCP" >/dev/null 2>&1; then
+    echo "The TCP stream lacks octet counting." >&2
+    errno=1
+fi
+
+test $errno -ne 0 || $silence echo 'Successful testing.'
+
+exit $errno
@@ -0,0 +1,179 @@
+#!/bin/sh
+
+# Copyright (C) 2016 Free Software Foundation, Inc.
+#
+# This file is part of GNU Inetutils.
+#
+# GNU Inetutils is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or (at
+# your option) any later version.
+#
+# GNU Inetutils is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see `http://www.gnu.org/licenses/'.
+
+# Test of the output threads of syslogd.  With --pipeline, messages
+# are written to two files and a named pipe by threads of their own.
+# The daemon is sent a hangup signal in the middle, which restarts
+# the threads, and is stopped at the end.  Every message must have
+# been written by each of them before it exits.
+#
+# Prerequisites:
+#
+#  * Shell: SVR4 Bourne shell, or newer.
+#
+#  * kill(1), mkfifo(1), mktemp(1).
+
+. ./tools.sh
+
+if test -z "${VERBOSE+set}"; then
+    silence=:
+fi
+
+# Portability fix for SVR4
+PWD="${PWD:-`pwd`}"
+
+$need_mktemp || exit_no_mktemp
+
+# Execution control.  Initialise early!
+#
+do_cleandir=false
+
+# The executables under test.
+#
+SYSLOGD=${SYSLOGD:-../src/syslogd$EXEEXT}
+LOGFLOOD=${LOGFLOOD:-$PWD/logflood$EXEEXT}
+
+for prog in $SYSLOGD $LOGFLOOD; do
+    if test ! -x $prog; then
+	echo "Missing executable '$prog'.  Skipping test." >&2
+	exit 77
+    fi
+done
+
+# Output threads are only built with POSIX threads.
+if $SYSLOGD --help | $GREP -e '--pipeline' >/dev/null 2>&1; then :; else
+    echo "Syslogd lacks the option '--pipeline'.  Skipping test." >&2
+    exit 77
+fi
+
+if test -n "$VERBOSE"; then
+    set -x
+    $SYSLOGD --version | $SED '1q'
+fi
+
+# For file creation below IU_TESTDIR.
+umask 0077
+
+# Keep any external assignment of testing directory.
+# Otherwise a randomisation is included.
+#
+: ${IU_TESTDIR:=$PWD/iu_syslog.XXXXXX}
+
+if [ ! -d "$IU_TESTDIR" ]; then
+    do_cleandir=true
+    IU_TESTDIR="`$MKTEMP -d "$IU_TESTDIR" 2>/dev/null`" ||
+	{
+	    echo 'Failed at creating test directory.  Aborting.' >&2
+	    exit 77
+	}
+elif expr X"$IU_TESTDIR" : X'\.\{1,2\}/\{0,1\}$' >/dev/null; then
+    # Eliminating directories: . ./ .. ../
+    echo 'Dangerous input for test directory.  Aborting.' >&2
+    exit 77
+fi
+
+# The SYSLOG daemon uses three outputs.
+#
+CONF="$IU_TESTDIR"/syslog.conf
+PID="$IU_TESTDIR"/syslogd.pid
+SOCKET="$IU_TESTDIR"/log
+OUT="$IU_TESTDIR"/messages
+OUT_USER="$IU_TESTDIR"/user
+FIFO="$IU_TESTDIR"/fifo
+OUT_PIPE="$IU_TESTDIR"/pipe
+
+# The path of the socket must fit a sockaddr_un.
+if test `expr X"$SOCKET" : X".*"` -gt 104; then
+    echo 'The test directory has too long a path.  Skipping test.' >&2
+    rm -r -f "$IU_TESTDIR"
+    exit 77
+fi
+
+# Erase the testing directory.
+#
+clean_testdir () {
+    if test -f "$PID" && kill -0 "`cat "$PID"`" >/dev/null 2>&1; then
+	kill "`cat "$PID"`" || kill -9 "`cat "$PID"`"
+    fi
+    if test -z "${NOCLEAN+no}" && $do_cleandir; then
+	rm -r -f "$IU_TESTDIR"
+    fi
+}
+
+# Clean artifacts as execution stops.
+#
+trap clean_testdir EXIT HUP INT QUIT TERM
+
+mkfifo "$FIFO" || {
+    echo 'Failed at creating a named pipe.  Skipping test.' >&2
+    exit 77
+}
+
+cat > "$CONF" <<-EOT
+	*.*	$OUT
+	user.*	-$OUT_USER
+	*.*	|$FIFO
+EOT
+
+# The reader of the pipe lasts until descriptor 4 is closed as well,
+# so that it survives the reopening of the pipe by syslogd.
+cat "$FIFO" > "$OUT_PIPE" &
+exec 4> "$FIFO"
+
+errno=0
+
+# No line may be dropped from a full queue.
+$SYSLOGD --rcfile="$CONF" --pidfile="$PID" --socket="$SOCKET" --no-klog \
+    --pipeline --queue-policy=block --queue-size=4096
+
+# Allow for the daemon to settle.
+sleep 1
+
+if test ! -r "$PID"; then
+    echo "The service daemon never started.  Failing." >&2
+    exit 1
+fi
+
+$LOGFLOOD -n 5000 "$SOCKET" >/dev/null || errno=1
+kill -HUP "`cat "$PID"`"
+sleep 1
+$LOGFLOOD -n 5000 "$SOCKET" >/dev/null || errno=1
+
+# Wait for the daemon to exit.
+kill "`cat "$PID"`"
+nn=0
+while test $nn -lt 10 && kill -0 "`cat "$PID"`" >/dev/null 2>&1; do
+    sleep 1
+    nn=`expr $nn + 1`
+done
+exec 4>&-
+wait
+
+for file in "$OUT" "$OUT_USER" "$OUT_PIPE"; do
+    found=`$GREP -c 'logflood\[' "$file"`
+    $silence echo "Found $found of 10000 messages in `basename "$file"`."
+    if test "$found" -ne 10000; then
+	echo "Lost `expr 10000 - $found` of 10000 messages to $file." >&2
+	errno=1
+    fi
+done
+
+test $errno -ne 0 || $silence echo 'Successful testing.'
+
+exit $errno
@@ -0,0 +1,144 @@
+#!/bin/sh
+
+# Copyright (C) 2016 Free Software Foundation, Inc.
+#
+# This file is part of GNU Inetutils.
+#
+# GNU Inetutils is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or (at
+# your option) any later version.
+#
+# GNU Inetutils is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see `http://www.gnu.org/licenses/'.
+
+# Test of the escapes in the output of telnetd.  A program run by
+# telnetd in place of login writes a file full of IAC and CR bytes,
+# over 100 kB of it, to a pty set to raw mode.  Telnetd doubles each
+# IAC and follows each CR by NUL unless an LF comes along, and it does
+# so for one read of the pty at a time.  Once the escapes are undone
+# by telnetget, the data must equal the file.
+#
+# Prerequisites:
+#
+#  * Shell: SVR4 Bourne shell, or newer.
+#
+#  * awk(1), cmp(1), kill(1), mktemp(1), netstat(8), stty(1).
+
+. ./tools.sh
+
+TELNETD=${TELNETD:-../telnetd/telnetd$EXEEXT}
+INETD=${INETD:-../src/inetd$EXEEXT}
+TELNETGET=${TELNETGET:-$PWD/telnetget$EXEEXT}
+TARGET=${TARGET:-127.0.0.1}
+
+# Portability fix for SVR4
+PWD="${PWD:-`pwd`}"
+USER=${USER:-`func_id_user`}
+
+if test -z "${VERBOSE+set}"; then
+    silence=:
+fi
+
+for prog in $TELNETD $INETD $TELNETGET; do
+    if test ! -x $prog; then
+	echo "Missing executable '$prog'.  Skipping test." >&2
+	exit 77
+    fi
+done
+
+$need_mktemp || exit_no_mktemp
+$need_netstat || exit_no_netstat
+
+if test -n "$VERBOSE"; then
+    set -x
+    $TELNETD --version | $SED '1q'
+fi
+
+TMPDIR=`$MKTEMP -d $PWD/tmp.XXXXXXXXXX` ||
+    {
+	echo 'Failed at creating test directory.  Aborting.' >&2
+	exit 1
+    }
+
+posttesting () {
+    test -n "$TMPDIR" && test -f "$TMPDIR/inetd.pid" \
+	&& test -r "$TMPDIR/inetd.pid" \
+	&& { kill "`cat $TMPDIR/inetd.pid`" \
+	     || kill -9 "`cat $TMPDIR/inetd.pid`"; }
+    test -n "$TMPDIR" && test -d "$TMPDIR" && rm -rf "$TMPDIR"
+}
+
+trap posttesting 0 1 2 3 15
+
+for PORT in 4711 4713 4717 4725 4741 4773 none; do
+    test $PORT = none && break
+    $NETSTAT -na | $GREP "^tcp.*[.:]$PORT .*LISTEN" >/dev/null 2>&1 ||
+	break
+done
+if test "$PORT" = 'none'; then
+    echo 'Our port allocation failed.  Skipping test.' >&2
+    exit 77
+fi
+
+# Lines of all lengths, with IAC and CR at their start, in their
+# middle and at their end, and with runs of either.
+LC_ALL=C awk 'BEGIN {
+    for (i = 1; i <= 2000; i++) {
+	s = ""
+	for (j = 0; j < i % 101; j++)
+	    s = s "x"
+	if (i % 2 == 0)
+	    s = s "\377"
+	if (i % 3 == 0)
+	    s = s "\r"
+	if (i % 5 == 0)
+	    s = "\377\r" s
+	if (i % 7 == 0)
+	    s = s "\377\377\r\r"
+	if (i % 11 == 0)
+	    s = "\r" s "\377"
+	print s
+    }
+}' > "$TMPDIR/text"
+
+# The modes of the pty are changed by telnetd as the options are
+# refused, so the program waits for the negotiation to end.
+cat <<EOT > "$TMPDIR/server"
+#!/bin/sh
+sleep 2
+stty raw -echo
+cat "$TMPDIR/text"
+sleep 1
+EOT
+chmod 0700 "$TMPDIR/server"
+
+cat <<EOT > "$TMPDIR/inetd.conf"
+$PORT stream tcp4 nowait $USER $PWD/$TELNETD telnetd -h -E $TMPDIR/server
+EOT
+
+$INETD --pidfile="$TMPDIR/inetd.pid" "$TMPDIR/inetd.conf" ||
+    {
+	echo 'Not able to start Inetd.  Skipping test.' >&2
+	exit 1
+    }
+
+sleep 2
+
+errno=0
+
+$TELNETGET -t 20 $TARGET $PORT > "$TMPDIR/got" || errno=1
+
+if test $errno -eq 0 && cmp -s "$TMPDIR/text" "$TMPDIR/got"; then
+    $silence echo 'Successful testing.'
+else
+    echo 'The output of telnetd was not escaped correctly.' >&2
+    errno=1
+fi
+
+exit $errno
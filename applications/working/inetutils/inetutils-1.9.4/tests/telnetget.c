@@ -0,0 +1,189 @@
+/*
+  Copyright (C) 2016 Free Software Foundation, Inc.
+
+  This file is part of GNU Inetutils.
+
+  GNU Inetutils is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or (at
+  your option) any later version.
+
+  GNU Inetutils is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see `http://www.gnu.org/licenses/'. */
+
+/* Telnetget receives whatever a telnet server sends until it closes
+ * the connection, and writes the data to standard output without the
+ * escapes of the protocol: a doubled IAC becomes one, and the NUL
+ * following a CR is dropped.  Every option the server offers or asks
+ * for is refused, so the session stays in NVT ASCII mode, and
+ * subnegotiations are skipped.  Nothing is ever sent but the refusals.
+ * An alarm timer ends the wait after five seconds by default, or the
+ * time set with a command line switch.
+ *
+ * Invocation:
+ *
+ *   telnetget [-t secs] host tcp-port
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/telnet.h>
+#include <netdb.h>
+#include <progname.h>
+
+enum
+{
+  TS_DATA,			/* plain data */
+  TS_CR,			/* after a CR */
+  TS_IAC,			/* after an IAC */
+  TS_OPT,			/* after IAC and a command */
+  TS_SB,			/* in a subnegotiation */
+  TS_SE				/* after an IAC in a subnegotiation */
+};
+
+int
+main (int argc, char *argv[])
+{
+  int fd, opt, rc, state = TS_DATA, cmd = 0;
+  int timeout = 5;
+  unsigned char buffer[4096], out[sizeof (buffer)];
+  struct addrinfo hints, *ai, *res;
+  ssize_t n, i;
+  size_t len;
+
+  set_program_name (argv[0]);
+
+  while ((opt = getopt (argc, argv, "t:")) != -1)
+    {
+      int t;
+
+      switch (opt)
+	{
+	case 't':
+	  t = atoi (optarg);
+	  if (t > 0 && t <= 3600)
+	    timeout = t;
+	  break;
+
+	default:
+	  fprintf (stderr, "Usage: %s [-t secs] host port\n", argv[0]);
+	  exit (EXIT_FAILURE);
+	}
+    }
+
+  if (argc < optind + 2)
+    return EXIT_FAILURE;
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  rc = getaddrinfo (argv[optind], argv[optind + 1], &hints, &res);
+  if (rc)
+    {
+      fprintf (stderr, "%s: %s\n", argv[0], gai_strerror (rc));
+      return EXIT_FAILURE;
+    }
+
+  for (ai = res; ai; ai = ai->ai_next)
+    {
+      fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd < 0)
+	continue;
+
+      if (connect (fd, ai->ai_addr, ai->ai_addrlen) >= 0)
+	break;
+
+      close (fd);
+    }
+
+  freeaddrinfo (res);
+
+  if (ai == NULL)
+    return EXIT_FAILURE;
+
+  alarm (timeout);
+
+  while ((n = recv (fd, buffer, sizeof (buffer), 0)) > 0)
+    {
+      for (i = 0, len = 0; i < n; i++)
+	{
+	  int c = buffer[i];
+
+	  switch (state)
+	    {
+	    case TS_CR:
+	      state = TS_DATA;
+	      if (c == '\0')
+		break;
+	      /* FALLTHROUGH */
+
+	    case TS_DATA:
+	      if (c == IAC)
+		state = TS_IAC;
+	      else
+		{
+		  out[len++] = c;
+		  if (c == '\r')
+		    state = TS_CR;
+		}
+	      break;
+
+	    case TS_IAC:
+	      state = TS_DATA;
+	      if (c == IAC)
+		out[len++] = c;
+	      else if (c == SB)
+		state = TS_SB;
+	      else if (c == WILL || c == WONT || c == DO || c == DONT)
+		{
+		  cmd = c;
+		  state = TS_OPT;
+		}
+	      break;
+
+	    case TS_OPT:
+	      state = TS_DATA;
+	      if (cmd == WILL || cmd == DO)
+		{
+		  unsigned char reply[3];
+
+		  reply[0] = IAC;
+		  reply[1] = (cmd == WILL) ? DONT : WONT;
+		  reply[2] = c;
+		  if (write (fd, reply, sizeof (reply)) != sizeof (reply))
+		    return EXIT_FAILURE;
+		}
+	      break;
+
+	    case TS_SB:
+	      if (c == IAC)
+		state = TS_SE;
+	      break;
+
+	    case TS_SE:
+	      state = (c == SE) ? TS_DATA : TS_SB;
+	      break;
+	    }
+	}
+
+      if (len > 0 && write (STDOUT_FILENO, out, len) != (ssize_t) len)
+	return EXIT_FAILURE;
+    }
+
+  close (fd);
+
+  return n < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
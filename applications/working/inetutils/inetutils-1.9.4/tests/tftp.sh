@@ -208,12 +208,12 @@ fi
 # identical in daemon-mode and in debug-mode.
 write_conf () {
     cat > "$INETD_CONF" <<-EOF
-	$PORT dgram ${PROTO}4 wait $USER $TFTPD   tftpd -l $TMPDIR/tftp-test
+	$PORT dgram ${PROTO}4 wait $USER $TFTPD   tftpd $TFTPD_OPTS -l $TMPDIR/tftp-test
 	EOF
 
     test "$TEST_IPV6" = "no" ||
 	cat >> "$INETD_CONF" <<-EOF
-	$PORT dgram ${PROTO}6 wait $USER $TFTPD   tftpd -l $TMPDIR/tftp-test
+	$PORT dgram ${PROTO}6 wait $USER $TFTPD   tftpd $TFTPD_OPTS -l $TMPDIR/tftp-test
 	EOF
 }
 
@@ -370,6 +370,37 @@ get $name" | \
    done
 done
 
+# Ask for a larger block size, a window of blocks, and the
+# transfer size, i.e., the options of RFC 2348, 7440, and 2349.
+#
+for addr in $ADDRESSES; do
+    $silence echo "trying options with address '$addr'..." >&2
+
+    for name in $FILELIST; do
+	test -n "$name" || continue
+	EFFORTS=`expr $EFFORTS + 1`
+	rm -f "$name"
+	test "$name" = $ASCIIFILE && type=ascii || type=binary
+	echo "$type
+blksize 1428
+windowsize 8
+tsize
+get $name" | \
+	eval "$TFTP" ${VERBOSE:+-v} "$addr" $PORT $bucket
+
+	cmp "$TMPDIR/tftp-test/$name" "$name" 2>/dev/null
+	result=$?
+
+	if [ "$result" -ne 0 ]; then
+	    test -z "$VERBOSE" || echo "Failed options for $addr/$name." >&2
+	    RESULT=$result
+	else
+	    SUCCESSES=`expr $SUCCESSES + 1`
+	    test -z "$VERBOSE" || echo "Successful options for $addr/$name." >&2
+	fi
+   done
+done
+
 # Test the ability of inetd to reload configuration:
 #
 # Assign a new port in the configuration file. Send SIGHUP
@@ -414,6 +445,48 @@ get $name" | \
 	    test -z "$VERBOSE" || echo >&2 "Success at new port for $addr/$name."
 	fi
     done
+
+    # Serve concurrent requests from a single process, which
+    # exits soon after, so as not to interfere with what follows.
+    #
+    $silence echo >&2 'Testing single process mode.'
+    TFTPD_OPTS='--single-process --idle-timeout=1'
+    write_conf ||
+	{
+	    echo >&2 'Could not rewrite configuration file for Inetd.  Failing.'
+	    exit 1
+	}
+    TFTPD_OPTS=
+
+    kill -HUP $inetd_pid
+    for addr in $ADDRESSES; do
+	pids=
+	for name in $FILELIST; do
+	    test -n "$name" || continue
+	    rm -f "$name"
+	    test "$name" = $ASCIIFILE && type=ascii || type=binary
+	    echo "$type
+get $name" | \
+	    eval "$TFTP" ${VERBOSE:+-v} "$addr" $PORT $bucket &
+	    pids="$pids $!"
+	done
+	wait $pids
+
+	for name in $FILELIST; do
+	    test -n "$name" || continue
+	    EFFORTS=`expr $EFFORTS + 1`
+	    cmp "$TMPDIR/tftp-test/$name" "$name" 2>/dev/null
+	    result=$?
+	    if test $result -ne 0; then
+		test -z "$VERBOSE" || echo >&2 "Failed single process for $addr/$name."
+		RESULT=$result
+	    else
+		SUCCESSES=`expr $SUCCESSES + 1`
+		test -z "$VERBOSE" || echo >&2 "Success with single process for $addr/$name."
+	    fi
+	done
+    done
+    sleep 2
 else
     $silence echo >&2 'Informational: Inhibiting config reload test.'
 fi
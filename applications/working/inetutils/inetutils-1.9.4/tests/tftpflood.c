@@ -0,0 +1,363 @@
+/* tftpflood - run many concurrent transfers with a TFTP server.
+  Copyright (C) 2016 Free Software Foundation, Inc.
+
+  This file is part of GNU Inetutils.
+
+  GNU Inetutils is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or (at
+  your option) any later version.
+
+  GNU Inetutils is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see `http://www.gnu.org/licenses/'. */
+
+/* Tftpflood reads a file from a TFTP server over many transfers at
+ * once, all from this one process, and reports the time taken and
+ * the aggregate throughput.  Each of COUNT transfers is started again
+ * when it completes, until every one has run ROUNDS times.  When the
+ * process id of the server is given, the processor time it used is
+ * read from /proc.  This is a load test, not a test, and is run by
+ * hand:
+ *
+ *   inetd -d CONF &	(with `tftpd --single-process' in CONF)
+ *   tftpflood [-n count] [-r rounds] [-b blksize] [-w windowsize]
+ *             [-p pid] host port file
+ *
+ * A transfer that makes no progress for a second sends its last
+ * packet again, and fails after ten such tries.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/tftp.h>
+#include <netdb.h>
+#include <progname.h>
+#include "procstat.h"
+
+#ifndef OACK
+# define OACK	06
+#endif
+
+#define PKTMAX	(65464 + 4)
+#define TRIES	10
+#define RETRY	1.0		/* seconds without progress */
+
+struct xfer
+{
+  int fd;
+  int started;			/* a server port has answered */
+  struct sockaddr_storage peer;
+  socklen_t peerlen;
+  unsigned short block;		/* last block received in order */
+  int blksize, window;
+  int tries;
+  int done;			/* rounds completed */
+  double last;			/* time of the last progress */
+};
+
+static struct sockaddr_storage server;
+static socklen_t serverlen;
+static char request[512];
+static int reqlen, blksize, window;
+static unsigned long long bytes;
+static int failed, rounds = 1;
+
+/* Start transfer X, from a new socket.  */
+static int
+start (struct xfer *x)
+{
+  x->fd = socket (server.ss_family, SOCK_DGRAM, 0);
+  if (x->fd < 0)
+    {
+      perror ("socket");
+      return -1;
+    }
+  x->started = 0;
+  x->block = 0;
+  x->blksize = 512;
+  x->window = 1;
+  x->tries = 0;
+  x->last = walltime ();
+  sendto (x->fd, request, reqlen, 0, (struct sockaddr *) &server, serverlen);
+  return 0;
+}
+
+static void
+ack (struct xfer *x)
+{
+  unsigned char pkt[4];
+
+  pkt[0] = 0;
+  pkt[1] = ACK;
+  pkt[2] = x->block >> 8;
+  pkt[3] = x->block & 0xff;
+  sendto (x->fd, pkt, 4, 0, (struct sockaddr *) &x->peer, x->peerlen);
+}
+
+/* End transfer X, and start it again for another round, if any.  */
+static void
+finish (struct xfer *x, int ok)
+{
+  close (x->fd);
+  x->fd = -1;
+  if (!ok)
+    failed++;
+  if (++x->done < rounds)
+    start (x);
+}
+
+/* Take the options of the OACK of N bytes in BUF.  */
+static void
+options (struct xfer *x, char *buf, int n)
+{
+  char *cp = buf + 2, *end = buf + n, *value;
+
+  while (cp < end)
+    {
+      value = memchr (cp, '\0', end - cp);
+      if (value == NULL || ++value >= end || !memchr (value, '\0', end - value))
+	break;
+      if (strcasecmp (cp, "blksize") == 0)
+	x->blksize = atoi (value);
+      else if (strcasecmp (cp, "windowsize") == 0)
+	x->window = atoi (value);
+      cp = value + strlen (value) + 1;
+    }
+}
+
+static void
+input (struct xfer *x)
+{
+  static char buf[PKTMAX];
+  struct sockaddr_storage from;
+  socklen_t fromlen = sizeof (from);
+  unsigned short block;
+  int n;
+
+  n = recvfrom (x->fd, buf, sizeof (buf), MSG_DONTWAIT,
+		(struct sockaddr *) &from, &fromlen);
+  if (n < 4)
+    return;
+  if (!x->started)
+    {
+      x->peer = from;
+      x->peerlen = fromlen;
+      x->started = 1;
+    }
+
+  block = ((unsigned char) buf[2] << 8) | (unsigned char) buf[3];
+  switch (buf[1])
+    {
+    case OACK:
+      if (x->block == 0)
+	{
+	  options (x, buf, n);
+	  x->last = walltime ();
+	  ack (x);
+	}
+      break;
+
+    case DATA:
+      if (block != (unsigned short) (x->block + 1))
+	{
+	  ack (x);		/* a block was lost */
+	  break;
+	}
+      x->block = block;
+      x->tries = 0;
+      x->last = walltime ();
+      bytes += n - 4;
+      if (n - 4 < x->blksize)
+	{
+	  ack (x);
+	  finish (x, 1);
+	}
+      else if (block % x->window == 0)
+	ack (x);
+      break;
+
+    case ERROR:
+      fprintf (stderr, "error %d: %.*s\n", block, n - 4, buf + 4);
+      finish (x, 0);
+      break;
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  int opt, i, n, count = 100, active;
+  char *pid = NULL, *p;
+  struct addrinfo hints, *ai;
+  struct xfer *xs;
+  struct pollfd *pfds;
+  struct rlimit rl;
+  double t0, t1, cpu0 = 0, cpu1, now, sampled = 0;
+  long k, kb = -1;
+
+  set_program_name (argv[0]);
+
+  while ((opt = getopt (argc, argv, "b:n:p:r:w:")) != -1)
+    switch (opt)
+      {
+      case 'b':
+	blksize = atoi (optarg);
+	break;
+
+      case 'n':
+	count = atoi (optarg);
+	break;
+
+      case 'p':
+	pid = optarg;
+	break;
+
+      case 'r':
+	rounds = atoi (optarg);
+	break;
+
+      case 'w':
+	window = atoi (optarg);
+	break;
+
+      default:
+	fprintf (stderr, "Usage: %s [-b blksize] [-n count] [-p pid] "
+		 "[-r rounds] [-w windowsize] host port file\n", argv[0]);
+	exit (EXIT_FAILURE);
+      }
+
+  if (argc < optind + 3 || count < 1 || rounds < 1)
+    return EXIT_FAILURE;
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_socktype = SOCK_DGRAM;
+  if (getaddrinfo (argv[optind], argv[optind + 1], &hints, &ai) != 0)
+    {
+      fprintf (stderr, "%s: unknown host %s\n", argv[0], argv[optind]);
+      return EXIT_FAILURE;
+    }
+  memcpy (&server, ai->ai_addr, ai->ai_addrlen);
+  serverlen = ai->ai_addrlen;
+  freeaddrinfo (ai);
+
+  /* The read request, with the options asked for.  */
+  p = request;
+  *p++ = 0;
+  *p++ = RRQ;
+  p += sprintf (p, "%.400s", argv[optind + 2]) + 1;
+  p += sprintf (p, "octet") + 1;
+  if (blksize)
+    p += sprintf (p, "blksize%c%d", '\0', blksize) + 1;
+  if (window)
+    p += sprintf (p, "windowsize%c%d", '\0', window) + 1;
+  reqlen = p - request;
+
+  /* Make room for the descriptors.  */
+  if (getrlimit (RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+      rl.rlim_cur = rl.rlim_max;
+      setrlimit (RLIMIT_NOFILE, &rl);
+    }
+
+  xs = calloc (count, sizeof (*xs));
+  pfds = calloc (count, sizeof (*pfds));
+  if (xs == NULL || pfds == NULL)
+    return EXIT_FAILURE;
+
+  if (pid && (cpu0 = cputime (pid)) < 0)
+    {
+      fprintf (stderr, "%s: no such process %s\n", argv[0], pid);
+      return EXIT_FAILURE;
+    }
+
+  t0 = walltime ();
+  for (i = 0; i < count; i++)
+    if (start (&xs[i]) < 0)
+      return EXIT_FAILURE;
+
+  do
+    {
+      for (i = 0; i < count; i++)
+	{
+	  pfds[i].fd = xs[i].fd;
+	  pfds[i].events = POLLIN;
+	}
+      n = poll (pfds, count, 100);
+      if (n < 0 && errno != EINTR)
+	{
+	  perror ("poll");
+	  return EXIT_FAILURE;
+	}
+      now = walltime ();
+      if (pid && now - sampled > 0.5)
+	{
+	  k = rss (pid);
+	  if (k > kb)
+	    kb = k;
+	  sampled = now;
+	}
+
+      active = 0;
+      for (i = 0; i < count; i++)
+	{
+	  struct xfer *x = &xs[i];
+
+	  if (x->fd >= 0 && (pfds[i].revents & (POLLIN | POLLERR)))
+	    input (x);
+	  if (x->fd < 0)
+	    continue;
+	  if (now - x->last > RETRY)
+	    {
+	      if (++x->tries > TRIES)
+		{
+		  finish (x, 0);
+		  continue;
+		}
+	      x->last = now;
+	      if (x->started)
+		ack (x);
+	      else
+		sendto (x->fd, request, reqlen, 0,
+			(struct sockaddr *) &server, serverlen);
+	    }
+	  active++;
+	}
+    }
+  while (active);
+  t1 = walltime ();
+
+  printf ("%d transfers, %d at a time, in %.3f s: %.1f MB/s, %d failed\n",
+	  count * rounds, count, t1 - t0, bytes / (t1 - t0) / 1e6, failed);
+
+  if (pid)
+    {
+      cpu1 = cputime (pid);
+      printf ("server resident: %ld kB at most\n", kb);
+      if (cpu1 > cpu0)
+	printf ("server used %.2f s of processor time: "
+		"%.1f MB/s per core\n", cpu1 - cpu0,
+		bytes / (cpu1 - cpu0) / 1e6);
+      else
+	printf ("server used too little processor time to measure\n");
+    }
+
+  free (xs);
+  free (pfds);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -53,6 +53,26 @@ test $errno -eq 0 || echo "Failed at UDP tracing." >&2
 $TRACEROUTE --type=icmp $TARGET || errno2=$?
 test $errno2 -eq 0 || echo "Failed at ICMP tracing." >&2
 
+# All hops at once.  The target is the first hop.
+for type in udp icmp; do
+    $TRACEROUTE --type=$type --parallel $TARGET > traceroute.out.$$ &&
+	grep "^  1   $TARGET  .*ms  .*ms  .*ms" traceroute.out.$$ > /dev/null ||
+	{ errno=1; echo "Failed at parallel $type tracing." >&2; }
+    test -z "$VERBOSE" || cat traceroute.out.$$
+    rm -f traceroute.out.$$
+done
+
+# Many routes at once, some from standard input, one line for each.
+for type in udp icmp; do
+    echo "$TARGET # comment" |
+    $TRACEROUTE --type=$type --hosts-file=- $TARGET > traceroute.out.$$ &&
+	test `grep -c "^$TARGET $TARGET reached 1 $TARGET:" \
+		traceroute.out.$$` -eq 2 ||
+	{ errno=1; echo "Failed at batch $type tracing." >&2; }
+    test -z "$VERBOSE" || cat traceroute.out.$$
+    rm -f traceroute.out.$$
+done
+
 test $errno -eq 0 || exit $errno
 
 exit $errno2